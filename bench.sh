@@ -0,0 +1,17 @@
+#!/bin/bash
+# Ancient Warriors Game - Benchmark Script
+# Usage: ./bench.sh [--bench-json FILE] [--bench-baseline FILE] [--bench-threshold PCT]
+# Example: ./bench.sh --bench-json baseline.json            (record a baseline)
+#          ./bench.sh --bench-baseline baseline.json        (compare against it)
+
+cd "$(dirname "$0")"
+
+# Always rebuild, optimized and without the profiler's phase timers
+echo "Building benchmark binary..."
+if [ "$(uname)" = "Darwin" ]; then
+    g++ -std=c++17 -O2 -DNDEBUG src/P1600_1977.cpp -o src/P1600_1977_bench -framework OpenGL -framework GLUT -framework AudioToolbox -Wno-deprecated || exit 1
+else
+    g++ -std=c++17 -O2 -DNDEBUG -pthread src/P1600_1977.cpp -o src/P1600_1977_bench -lglut -lGLU -lGL -lEGL || exit 1
+fi
+
+./src/P1600_1977_bench --bench "$@"
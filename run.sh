@@ -6,7 +6,7 @@ cd "$(dirname "$0")"
 # Build if not already built
 if [ ! -f "src/P1600_1977" ]; then
     echo "Building game..."
-    g++ -std=c++17 src/P1600_1977.cpp -o src/P1600_1977 -framework OpenGL -framework GLUT -Wno-deprecated
+    g++ -std=c++17 src/P1600_1977.cpp -o src/P1600_1977 -framework OpenGL -framework GLUT -framework AudioToolbox -Wno-deprecated
 fi
 
 # Run the game
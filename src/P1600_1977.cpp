@@ -9,40 +9,149 @@
  * Mouse: Click+Drag for free camera rotation
  * Animations (after collecting all items): Z, X, C, V
  * B: Toggle debug visualization
+ * P: Toggle the frame profiler overlay (frame times, p50/p99, draw calls)
+ * T: Export the profiled frames to frame_trace.json (Chrome trace format)
+ * M: Toggle mesh cache (compare against GLU/GLUT tessellation)
+ * I: Toggle instanced collectible rendering
+ * L: Toggle shader / fixed-function lighting
+ * F: Toggle frustum culling and level of detail
  * R: Restart game
+ * Q: Rewind one second
  * ESC: Exit
+ *
+ * COMMAND LINE:
+ * --headless [ticks]: Run the simulation on autopilot without a window and
+ *                     report throughput in ticks/sec, with the rivals and
+ *                     without them
+ * --bench-pickup:     Time collectible pickup checks at 12 to 100k collectibles
+ * --stress-collectibles N: Add N collectibles across the built-in arena and print
+ *                     frame times every few seconds
+ * --fixed-function:   Use fixed-function lighting instead of the shaders
+ * --uncapped:         Render as fast as possible (simulation stays at 60 Hz)
+ * --vsync:            Render once per display refresh
+ * --log-level L:      Only log messages at level L (debug, info, warn, error)
+ *                     or above
+ * --log-categories A,B: Only log these categories (GAME, PLAYER, RENDER, ...)
+ * --log-binary:       Write game_debug.bin in a compact binary format instead
+ *                     of the text log
+ * --decode-log FILE:  Print a binary log as text
+ * --bench-logger:     Time log calls on the game thread
+ * --audio-null:       Mix sounds without a sound device
+ * --audio-wav FILE:   Record the mixed sound to a WAV file instead of playing it
+ * --bench-audio:      Measure mixer latency and cost on the null backend
+ * --bench-entities:   Compare the component tables with the old per-entity
+ *                     structs at 1k to 1M entities
+ * --bench:            Time the simulation and drawing hot paths (drawing in an
+ *                     offscreen software GL context)
+ * --bench-json FILE:  Also write the --bench results to FILE
+ * --bench-baseline FILE: Compare with an earlier --bench-json file; exits with
+ *                     2 if a median is slower than --bench-threshold PCT
+ *                     (default 10) allows
+ * --simd PATH:        Force the proximity kernel path (scalar, sse2, avx2, neon)
+ * --verify-simd:      Check every proximity path against the scalar one and
+ *                     time them
+ * --jobs N:           Run parallel work on N threads including the main one
+ *                     (default: one per core)
+ * --bench-jobs [N]:   Time animation, extraction and culling of a 1M-entity
+ *                     level on 1 to N threads and check the output matches
+ * --level FILE:       Play a text (.level) or compiled level instead of the
+ *                     built-in arena
+ * --compile-level IN OUT: Compile a text level to the binary format
+ * --validate-level FILE: Report collectibles that are too close together or
+ *                     on missing platforms
+ * --bench-level:      Time compiling, loading and validating levels of 12 to
+ *                     1M collectibles
+ * --stream-budget MB: Memory for resident world chunks (default 64)
+ * --bench-stream:     Walk across a 2000 x 2000 world and report chunk loads,
+ *                     evictions and load latency
+ * --bench-snapshot:   Time restarting by initGame against capturing and
+ *                     restoring a state snapshot at 1k to 1M collectibles
+ * --bench-collision:  Move up to 10k boxes among up to 100k static ones through
+ *                     the broadphase and against a brute-force sweep
+ * --record FILE:      Record the seed and every input event to FILE (also with
+ *                     --headless, recording the autopilot)
+ * --replay FILE:      Play a recording back in the window in real time
+ * --replay-headless FILE: Play a recording back at full speed without a
+ *                     window, report step times and check the final state
+ * --npcs N:           Rival warriors competing for the collectibles (default 4)
+ * --bench-crowd [N]:  Steer 1k to 50k rivals on 1 to N threads and check the
+ *                     state matches
+ * --bench-nav:        Time A* paths and flow field updates on navigation grids
+ *                     of 128 x 128 to 1024 x 1024 cells
  */
 
 // macOS uses different include paths
 #ifdef __APPLE__
 #define GL_SILENCE_DEPRECATION
 #include <GLUT/glut.h>
+#include <OpenGL/OpenGL.h>
 #include <OpenGL/gl.h>
 #include <OpenGL/glu.h>
+#include <OpenGL/glext.h>
+#include <AudioToolbox/AudioToolbox.h>
 #else
+#define GL_GLEXT_PROTOTYPES
 #include <GL/glut.h>
 #include <GL/gl.h>
 #include <GL/glu.h>
+#include <GL/glx.h>
+#include <EGL/egl.h>
 #endif
 
 #include <cmath>
 #include <string>
 #include <vector>
+#include <deque>
 #include <cstdlib>
 #include <ctime>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <cstring>
+#include <chrono>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+#include <strings.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <climits>
+#include <iterator>
+#include <random>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 // ==================== CONSTANTS ====================
 const int WINDOW_WIDTH = 1200;
 const int WINDOW_HEIGHT = 800;
 const float GROUND_SIZE = 50.0f;
 const float WALL_HEIGHT = 10.0f;
-const float PLAYER_SPEED = 0.3f;
+const float PLAYER_SPEED = 0.3f; // per simulation step
+const float PLAYER_HALF_WIDTH = 0.4f;
+const float PLAYER_HEIGHT = 2.0f;
+const float PLAYER_FOOT_OFFSET = 0.5f; // playerPos above the feet
+const float STEP_HEIGHT = 1.1f;        // the player climbs onto anything this low
 const int GAME_TIME = 120; // seconds
 const float COLLECTION_RADIUS = 2.0f; // Increased for easier collection
+const int SIM_HZ = 60;                     // Fixed simulation rate
+const double SIM_STEP_MS = 1000.0 / SIM_HZ;
+const double MAX_FRAME_MS = 250.0;         // Longer frames are clamped (e.g. after a breakpoint)
 
 // ==================== STRUCTURES ====================
 struct Vector3 {
@@ -55,33 +164,164 @@ struct Color {
     Color(float r = 1, float g = 1, float b = 1) : r(r), g(g), b(b) {}
 };
 
-struct Collectible {
-    Vector3 position;
-    bool collected;
-    int platform;
-    Collectible(Vector3 pos, int plat) : position(pos), collected(false), platform(plat) {}
+// Level entities live in component tables with one array per field, so each
+// system only pulls the fields it works on through the cache. An entity is
+// its index in the tables of its kind.
+
+// A column that never changes after the level is built. It either owns its
+// elements or reads them in place from a loaded level file (see LevelFile);
+// adding to a borrowed column copies it first.
+template <typename T>
+class Column {
+private:
+    std::vector<T> owned;
+    const T* borrowed;
+    size_t borrowedCount;
+    
+    void own() {
+        if (!borrowed) return;
+        owned.assign(borrowed, borrowed + borrowedCount);
+        borrowed = NULL;
+        borrowedCount = 0;
+    }
+    
+public:
+    Column() : borrowed(NULL), borrowedCount(0) {}
+    
+    void borrow(const T* data, size_t n) {
+        owned.clear();
+        borrowed = data;
+        borrowedCount = n;
+    }
+    bool isBorrowed() const { return borrowed != NULL; }
+    
+    size_t size() const { return borrowed ? borrowedCount : owned.size(); }
+    bool empty() const { return size() == 0; }
+    const T* data() const { return borrowed ? borrowed : owned.data(); }
+    const T& operator[](size_t i) const { return data()[i]; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size(); }
+    
+    void push_back(const T& v) { own(); owned.push_back(v); }
+    void reserve(size_t n) { own(); owned.reserve(n); }
+    void clear() {
+        owned.clear();
+        borrowed = NULL;
+        borrowedCount = 0;
+    }
 };
 
-struct Platform {
-    Vector3 position;
-    Vector3 size;
-    Color color;
-    bool allCollected;
-    bool animationActive;
-    float animationValue;
-    int animationType;
-    Platform(Vector3 pos, Vector3 sz, Color col, int anim) 
-        : position(pos), size(sz), color(col), allCollected(false), 
-          animationActive(false), animationValue(0), animationType(anim) {}
+// Transform component
+struct Transforms {
+    Column<float> x, y, z;
+    
+    Vector3 position(int i) const { return Vector3(x[i], y[i], z[i]); }
+    void add(const Vector3& p) { x.push_back(p.x); y.push_back(p.y); z.push_back(p.z); }
+    void clear() { x.clear(); y.clear(); z.clear(); }
+    void reserve(size_t n) { x.reserve(n); y.reserve(n); z.reserve(n); }
+};
+
+struct CollectibleTable {
+    Transforms transform;
+    // Pickup state
+    std::vector<uint8_t> collected;
+    Column<int> platform;  // owning platform, -1 for none
+    
+    int count() const { return (int)collected.size(); }
+    
+    int add(const Vector3& pos, int owner) {
+        transform.add(pos);
+        collected.push_back(0);
+        platform.push_back(owner);
+        return count() - 1;
+    }
+    
+    void clear() {
+        transform.clear();
+        collected.clear();
+        platform.clear();
+    }
+    
+    // Sizes the pickup state to the static columns, all uncollected
+    void resetState() { collected.assign(transform.x.size(), 0); }
+    
+    void reserve(size_t n) {
+        transform.reserve(n);
+        collected.reserve(n);
+        platform.reserve(n);
+    }
+};
+
+// What stands on a platform. Each object has its own animation.
+enum PlatformObject { OBJECT_NONE = -1, OBJECT_LANTERN, OBJECT_PAGODA, OBJECT_STATUE, OBJECT_WEAPON_RACK };
+
+struct PlatformTable {
+    Transforms transform;
+    // Animation state
+    std::vector<uint8_t> animationActive;
+    Column<int> animationType;  // the PlatformObject on top, which picks the animation
+    std::vector<float> animationValue;
+    std::vector<float> prevAnimationValue;   // value before the last simulation step
+    std::vector<float> renderAnimationValue; // interpolated value used by the draw functions
+    // Pickup state
+    std::vector<uint8_t> allCollected;
+    // Render data
+    Column<Vector3> size;
+    Column<Color> color;
+    
+    int count() const { return (int)animationType.size(); }
+    
+    int add(const Vector3& pos, const Vector3& sz, const Color& col, int anim) {
+        transform.add(pos);
+        animationActive.push_back(0);
+        animationType.push_back(anim);
+        animationValue.push_back(0);
+        prevAnimationValue.push_back(0);
+        renderAnimationValue.push_back(0);
+        allCollected.push_back(0);
+        size.push_back(sz);
+        color.push_back(col);
+        return count() - 1;
+    }
+    
+    void clear() {
+        transform.clear();
+        animationActive.clear();
+        animationType.clear();
+        animationValue.clear();
+        prevAnimationValue.clear();
+        renderAnimationValue.clear();
+        allCollected.clear();
+        size.clear();
+        color.clear();
+    }
+    
+    // Sizes the animation and pickup state to the static columns, all idle
+    void resetState() {
+        size_t n = animationType.size();
+        animationActive.assign(n, 0);
+        animationValue.assign(n, 0);
+        prevAnimationValue.assign(n, 0);
+        renderAnimationValue.assign(n, 0);
+        allCollected.assign(n, 0);
+    }
 };
 
 // ==================== GLOBAL VARIABLES ====================
 enum GameState { PLAYING, WIN, GAME_OVER };
 GameState gameState = PLAYING;
 int gameTimeRemaining = GAME_TIME;
-int lastTime = 0;
+int timerTicks = 0; // simulation steps since the timer last ticked down
+
+// Frame loop: the simulation thread runs fixed SIM_STEP_MS steps on the wall
+// clock; rendering interpolates by how far the clock is past the last step.
+enum FramePacing { PACING_TIMER, PACING_UNCAPPED, PACING_VSYNC };
+FramePacing framePacing = PACING_TIMER;
+float renderAlpha = 1.0f;
 
 Vector3 playerPos(0, 0.5, 0);
+Vector3 prevPlayerPos(0, 0.5, 0);
+Vector3 renderPlayerPos(0, 0.5, 0);
 float playerRotation = 0.0f;
 
 Vector3 cameraPos(0, 15, 25);
@@ -92,1107 +332,10284 @@ int mouseX = 0, mouseY = 0;
 bool mouseDown = false;
 int cameraMode = 0;
 
-std::vector<Platform> platforms;
-std::vector<Collectible> collectibles;
+PlatformTable platforms;
+CollectibleTable collectibles;
+float worldHalfSize = GROUND_SIZE; // of the current level
 float globalRotation = 0.0f;
+float prevGlobalRotation = 0.0f;
+float renderGlobalRotation = 0.0f;
 
 bool keys[256] = {false};
 bool specialKeys[256] = {false};
 bool debugMode = false;
+bool headlessMode = false; // No window, no GL, no sounds (see runHeadless)
+int stressCollectibleCount = 0; // Extra collectibles for --stress-collectibles
+uint32_t gameSeed = (uint32_t)time(NULL); // srand() seed of the run, recorded by --record
 
 // ==================== LOGGING SYSTEM ====================
+// log() only checks the filters and copies the format string pointer and the
+// raw arguments into a fixed-size record in the calling thread's ring buffer.
+// A background thread formats the records and does all file and console I/O.
+enum LogLevel { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR };
+
+enum LogCategory {
+    LOG_GAME, LOG_INIT, LOG_COLLECTIBLE, LOG_OVERLAP, LOG_COLLECT, LOG_PLAYER,
+    LOG_SUCCESS, LOG_PLATFORM, LOG_VECTOR, LOG_RENDER, LOG_SHADER, LOG_DEBUG_MODE,
+    LOG_BENCH, LOG_AUDIO, LOG_CATEGORY_COUNT
+};
+
+const char* const LOG_CATEGORY_NAMES[LOG_CATEGORY_COUNT] = {
+    "GAME", "INIT", "COLLECTIBLE", "OVERLAP", "COLLECT", "PLAYER",
+    "SUCCESS", "PLATFORM", "VECTOR", "RENDER", "SHADER", "DEBUG",
+    "BENCH", "AUDIO"
+};
+
+const char* const LOG_LEVEL_NAMES[] = { "debug", "info", "warn", "error" };
+
+struct LogRecord {
+    enum ArgType : uint8_t { ARG_INT, ARG_DOUBLE, ARG_TEXT };
+    static const int MAX_ARGS = 6;
+    static const int TEXT_BYTES = 128;
+    
+    uint64_t time;      // ns since the logger was created
+    const char* format; // must outlive the logger: a string literal
+    uint8_t level, category, argCount, textUsed;
+    uint8_t types[MAX_ARGS];
+    union { int64_t i; double d; uint32_t text; } args[MAX_ARGS];
+    char text[TEXT_BYTES]; // string arguments, nul-terminated, truncated to fit
+    
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value>::type add(T v) {
+        if (argCount == MAX_ARGS) return;
+        types[argCount] = ARG_INT;
+        args[argCount++].i = (int64_t)v;
+    }
+    template <typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type add(T v) {
+        if (argCount == MAX_ARGS) return;
+        types[argCount] = ARG_DOUBLE;
+        args[argCount++].d = (double)v;
+    }
+    void add(const char* s) {
+        if (argCount == MAX_ARGS) return;
+        types[argCount] = ARG_TEXT;
+        args[argCount++].text = textUsed;
+        while (*s && textUsed < TEXT_BYTES - 1) text[textUsed++] = *s++;
+        if (textUsed < TEXT_BYTES) text[textUsed++] = '\0';
+    }
+    void add(const std::string& s) { add(s.c_str()); }
+    
+    void pack() {}
+    template <typename T, typename... Rest>
+    void pack(const T& first, const Rest&... rest) {
+        add(first);
+        pack(rest...);
+    }
+    
+    // printf-style expansion; each conversion takes the next argument
+    // whatever its length modifier, so "%d" works for size_t too
+    std::string expand() const {
+        std::string out;
+        char spec[32], piece[256];
+        int next = 0;
+        for (const char* p = format; *p; p++) {
+            if (*p != '%') { out += *p; continue; }
+            if (p[1] == '%') { out += '%'; p++; continue; }
+            
+            int n = 0;
+            spec[n++] = *p++;
+            while (*p && strchr("-+ #0123456789.", *p) && n < 24) spec[n++] = *p++;
+            while (*p && strchr("hlLqjzt", *p)) p++;
+            if (!*p) break;
+            char conversion = *p;
+            
+            if (next >= argCount) { out += "<?>"; continue; }
+            int a = next++;
+            bool wantsFloat = strchr("fFeEgGaA", conversion) != NULL;
+            if (conversion == 's' || types[a] == ARG_TEXT) {
+                spec[n++] = 's'; spec[n] = '\0';
+                snprintf(piece, sizeof(piece), spec,
+                         types[a] == ARG_TEXT ? text + args[a].text : "<?>");
+            } else if (wantsFloat) {
+                spec[n++] = conversion; spec[n] = '\0';
+                snprintf(piece, sizeof(piece), spec,
+                         types[a] == ARG_DOUBLE ? args[a].d : (double)args[a].i);
+            } else {
+                spec[n++] = 'l'; spec[n++] = 'l';
+                spec[n++] = strchr("diouxXc", conversion) ? conversion : 'd'; spec[n] = '\0';
+                snprintf(piece, sizeof(piece), spec,
+                         types[a] == ARG_INT ? (long long)args[a].i : (long long)args[a].d);
+            }
+            out += piece;
+        }
+        return out;
+    }
+};
+
+// Lock-free single-producer single-consumer queue with a power-of-two
+// capacity. The producer claims a slot, fills it and publishes it; the
+// consumer reads the published slots in place and releases them.
+template <typename T, uint32_t CAPACITY>
+class SpscRing {
+private:
+    T slots[CAPACITY];
+    std::atomic<uint32_t> head; // next slot the producer writes
+    std::atomic<uint32_t> tail; // next slot the consumer reads
+    
+public:
+    std::atomic<uint64_t> dropped; // pushes lost because the ring was full
+    
+    SpscRing() : head(0), tail(0), dropped(0) {}
+    
+    // Producer side: a free slot, or NULL when full
+    T* claim() {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == CAPACITY) return NULL;
+        return &slots[h & (CAPACITY - 1)];
+    }
+    void publish() { head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+    
+    bool push(const T& item) {
+        T* slot = claim();
+        if (!slot) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        *slot = item;
+        publish();
+        return true;
+    }
+    
+    // Consumer side
+    uint32_t readable(uint32_t& first) const {
+        first = tail.load(std::memory_order_relaxed);
+        return head.load(std::memory_order_acquire) - first;
+    }
+    const T& at(uint32_t index) const { return slots[index & (CAPACITY - 1)]; }
+    void release(uint32_t count) { tail.store(tail.load(std::memory_order_relaxed) + count, std::memory_order_release); }
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+};
+
+typedef SpscRing<LogRecord, 4096> LogRing; // one per logging thread
+
 class GameLogger {
 private:
+    uint32_t id;
+    std::string path;
     std::ofstream logFile;
     bool enabled;
+    bool binary;
+    bool echo;           // also print to the console
+    int minLevel;
+    uint32_t categories; // bit per LogCategory
     int frameCounter;
     
-public:
-    GameLogger() : enabled(true), frameCounter(0) {
-        logFile.open("game_debug.log", std::ios::out | std::ios::trunc);
-        if (logFile.is_open()) {
+    std::chrono::steady_clock::time_point startTime;
+    std::mutex ringsMutex; // only taken when a thread logs for the first time
+    std::vector<std::unique_ptr<LogRing>> rings;
+    std::thread writer;
+    std::atomic<bool> running;
+    std::atomic<bool> started;
+    std::mutex startMutex;
+    
+    // Binary output: format strings are written once and then referred to by id
+    std::unordered_map<const char*, uint16_t> formatIds;
+    
+    static uint32_t nextId() {
+        static std::atomic<uint32_t> counter(0);
+        return counter++;
+    }
+    
+    LogRing* ringForThisThread() {
+        // One ring per thread and logger; the id lets bench loggers coexist
+        thread_local std::vector<std::pair<uint32_t, LogRing*>> mine;
+        for (const auto& entry : mine) {
+            if (entry.first == id) return entry.second;
+        }
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.push_back(std::unique_ptr<LogRing>(new LogRing()));
+        mine.push_back(std::make_pair(id, rings.back().get()));
+        return rings.back().get();
+    }
+    
+    void start() {
+        std::lock_guard<std::mutex> lock(startMutex);
+        if (started.load()) return;
+        logFile.open(path.c_str(), binary ? std::ios::out | std::ios::trunc | std::ios::binary
+                                          : std::ios::out | std::ios::trunc);
+        if (binary) {
+            logFile.write("GLOG", 4);
+            uint32_t version = 1;
+            logFile.write((const char*)&version, sizeof(version));
+        } else if (logFile.is_open()) {
             logFile << "=== GAME DEBUG LOG ===" << std::endl;
             logFile << "Timestamp: " << time(NULL) << std::endl;
             logFile << "======================" << std::endl << std::endl;
         }
+        running = true;
+        writer = std::thread(&GameLogger::writerLoop, this);
+        started = true;
+    }
+    
+    void writeBinary(const LogRecord& r) {
+        auto found = formatIds.find(r.format);
+        uint16_t id;
+        if (found == formatIds.end()) {
+            // Format definition: 0xFF, id, length, bytes
+            id = (uint16_t)formatIds.size();
+            formatIds[r.format] = id;
+            uint16_t length = (uint16_t)strlen(r.format);
+            logFile.put((char)0xFF);
+            logFile.write((const char*)&id, 2);
+            logFile.write((const char*)&length, 2);
+            logFile.write(r.format, length);
+        } else {
+            id = found->second;
+        }
+        // Record: level, category, format id, time, argument count, then
+        // each argument as a type byte and 8 bytes or a nul-terminated string
+        logFile.put((char)r.level);
+        logFile.put((char)r.category);
+        logFile.write((const char*)&id, 2);
+        logFile.write((const char*)&r.time, 8);
+        logFile.put((char)r.argCount);
+        for (int a = 0; a < r.argCount; a++) {
+            logFile.put((char)r.types[a]);
+            if (r.types[a] == LogRecord::ARG_TEXT) {
+                const char* s = r.text + r.args[a].text;
+                logFile.write(s, strlen(s) + 1);
+            } else {
+                logFile.write((const char*)&r.args[a], 8);
+            }
+        }
+    }
+    
+    void writeRecord(const LogRecord& r) {
+        if (!binary || echo) {
+            std::string line = std::string("[") + LOG_CATEGORY_NAMES[r.category] + "] " + r.expand();
+            if (!binary && logFile.is_open()) logFile << line << '\n';
+            if (echo) std::cout << line << '\n';
+        }
+        if (binary && logFile.is_open()) writeBinary(r);
+    }
+    
+    // Moves everything queued so far to the outputs, in time order across threads
+    bool drain() {
+        std::vector<LogRing*> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (const auto& ring : rings) snapshot.push_back(ring.get());
+        }
+        std::vector<std::pair<uint32_t, uint32_t>> spans; // first, count per ring
+        size_t total = 0;
+        for (LogRing* ring : snapshot) {
+            uint32_t first;
+            uint32_t count = ring->readable(first);
+            spans.push_back(std::make_pair(first, count));
+            total += count;
+        }
+        if (total == 0) return false;
+        
+        std::vector<const LogRecord*> batch;
+        batch.reserve(total);
+        for (size_t i = 0; i < snapshot.size(); i++) {
+            for (uint32_t k = 0; k < spans[i].second; k++) batch.push_back(&snapshot[i]->at(spans[i].first + k));
+        }
+        if (snapshot.size() > 1) {
+            std::stable_sort(batch.begin(), batch.end(),
+                             [](const LogRecord* a, const LogRecord* b) { return a->time < b->time; });
+        }
+        for (const LogRecord* r : batch) writeRecord(*r);
+        logFile.flush();
+        if (echo) std::cout.flush();
+        for (size_t i = 0; i < snapshot.size(); i++) snapshot[i]->release(spans[i].second);
+        return true;
+    }
+    
+    void writerLoop() {
+        while (running.load(std::memory_order_acquire)) {
+            if (!drain()) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        drain();
     }
     
+public:
+    GameLogger(const std::string& path = "game_debug.log")
+        : id(nextId()), path(path), enabled(true), binary(false), echo(true), minLevel(LOG_DEBUG),
+          categories(~0u), frameCounter(0), startTime(std::chrono::steady_clock::now()),
+          running(false), started(false) {}
+    
     ~GameLogger() {
+        if (started.load()) {
+            running = false;
+            writer.join();
+        }
         if (logFile.is_open()) {
+            uint64_t lost = dropped();
+            if (lost > 0 && !binary) logFile << "[LOG] " << lost << " records dropped (ring full)" << std::endl;
             logFile.close();
         }
     }
     
-    void log(const std::string& category, const std::string& message) {
-        if (!enabled || !logFile.is_open()) return;
+    // Checked before any formatting or argument copying
+    bool wants(LogLevel level, LogCategory category) const {
+        return enabled && level >= minLevel && (categories >> category & 1u);
+    }
+    
+    template <typename... Args>
+    void log(LogLevel level, LogCategory category, const char* format, const Args&... args) {
+        if (!wants(level, category)) return;
+        if (!started.load(std::memory_order_acquire)) start();
         
-        logFile << "[" << category << "] " << message << std::endl;
-        logFile.flush();
-        std::cout << "[" << category << "] " << message << std::endl;
+        LogRing* ring = ringForThisThread();
+        LogRecord* r = ring->claim();
+        if (!r) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        r->time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - startTime).count();
+        r->format = format;
+        r->level = (uint8_t)level;
+        r->category = (uint8_t)category;
+        r->argCount = 0;
+        r->textUsed = 0;
+        r->pack(args...);
+        ring->publish();
     }
     
-    void logVector(const std::string& label, const Vector3& v) {
-        std::stringstream ss;
-        ss << label << " (" << std::fixed << std::setprecision(2) 
-           << v.x << ", " << v.y << ", " << v.z << ")";
-        log("VECTOR", ss.str());
+    // Blocks until everything logged so far has been written
+    void flush() {
+        if (!started.load()) return;
+        std::vector<LogRing*> snapshot;
+        {
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            for (const auto& ring : rings) snapshot.push_back(ring.get());
+        }
+        for (LogRing* ring : snapshot) {
+            while (!ring->empty()) std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
     }
     
-    void logCollectiblePositions(const std::vector<Collectible>& collectibles) {
-        log("INIT", "=== Collectible Positions ===");
-        for (size_t i = 0; i < collectibles.size(); i++) {
-            std::stringstream ss;
-            ss << "Collectible " << i << " [P" << collectibles[i].platform << "] at ("
-               << std::fixed << std::setprecision(2)
-               << collectibles[i].position.x << ", "
-               << collectibles[i].position.y << ", "
-               << collectibles[i].position.z << ")";
-            log("COLLECTIBLE", ss.str());
-        }
-        
-        // Check for overlaps
-        for (size_t i = 0; i < collectibles.size(); i++) {
-            for (size_t j = i + 1; j < collectibles.size(); j++) {
-                if (collectibles[i].platform == collectibles[j].platform) {
-                    float dx = collectibles[i].position.x - collectibles[j].position.x;
-                    float dy = collectibles[i].position.y - collectibles[j].position.y;
-                    float dz = collectibles[i].position.z - collectibles[j].position.z;
-                    float dist = sqrt(dx*dx + dy*dy + dz*dz);
-                    if (dist < 1.0f) {
-                        std::stringstream ss;
-                        ss << "WARNING: Collectibles " << i << " and " << j 
-                           << " are too close! Distance: " << std::fixed << std::setprecision(2) << dist;
-                        log("OVERLAP", ss.str());
-                    }
-                }
-            }
+    uint64_t dropped() {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        uint64_t total = 0;
+        for (const auto& ring : rings) total += ring->dropped.load();
+        return total;
+    }
+    
+    void logVector(const char* label, const Vector3& v) {
+        log(LOG_DEBUG, LOG_VECTOR, "%s (%.2f, %.2f, %.2f)", label, v.x, v.y, v.z);
+    }
+    
+    void logCollectiblePositions(const CollectibleTable& collectibles) {
+        if (!wants(LOG_INFO, LOG_COLLECTIBLE)) return;
+        log(LOG_INFO, LOG_INIT, "=== Collectible Positions ===");
+        const Transforms& t = collectibles.transform;
+        for (int i = 0; i < collectibles.count(); i++) {
+            log(LOG_INFO, LOG_COLLECTIBLE, "Collectible %d [P%d] at (%.2f, %.2f, %.2f)",
+                i, collectibles.platform[i], t.x[i], t.y[i], t.z[i]);
         }
     }
     
     void logCollectionAttempt(int index, float dist) {
-        std::stringstream ss;
-        ss << "Attempt to collect #" << index << " at distance " 
-           << std::fixed << std::setprecision(2) << dist;
-        log("COLLECT", ss.str());
+        log(LOG_DEBUG, LOG_COLLECT, "Attempt to collect #%d at distance %.2f", index, dist);
     }
     
     void logPlayerMovement(const Vector3& pos) {
         if (frameCounter++ % 60 == 0) { // Log every second
-            std::stringstream ss;
-            ss << "Player at (" << std::fixed << std::setprecision(2)
-               << pos.x << ", " << pos.y << ", " << pos.z << ")";
-            log("PLAYER", ss.str());
+            log(LOG_DEBUG, LOG_PLAYER, "Player at (%.2f, %.2f, %.2f)", pos.x, pos.y, pos.z);
         }
     }
     
     void setEnabled(bool enable) { enabled = enable; }
+    const std::string& outputPath() const { return path; }
+    void setLevel(LogLevel level) { minLevel = level; }
+    void setCategories(uint32_t mask) { categories = mask; }
+    void setConsoleEcho(bool on) { echo = on; }
+    
+    // Takes effect if set before the first message
+    void setBinary(bool on) {
+        binary = on;
+        if (on && path == "game_debug.log") path = "game_debug.bin";
+    }
+    
+    static bool parseLevel(const std::string& name, LogLevel& level) {
+        for (int i = 0; i <= LOG_ERROR; i++) {
+            if (name == LOG_LEVEL_NAMES[i]) { level = (LogLevel)i; return true; }
+        }
+        return false;
+    }
+    
+    // Comma-separated category names -> bit mask; 0 if none matched
+    static uint32_t parseCategories(const std::string& list) {
+        uint32_t mask = 0;
+        std::stringstream ss(list);
+        std::string name;
+        while (std::getline(ss, name, ',')) {
+            for (int c = 0; c < LOG_CATEGORY_COUNT; c++) {
+                if (strcasecmp(name.c_str(), LOG_CATEGORY_NAMES[c]) == 0) mask |= 1u << c;
+            }
+        }
+        return mask;
+    }
 };
 
 // Global logger instance
 GameLogger gameLogger;
 
-// ==================== UTILITY FUNCTIONS ====================
-float distance(Vector3 a, Vector3 b) {
-    return sqrt(pow(a.x - b.x, 2) + pow(a.y - b.y, 2) + pow(a.z - b.z, 2));
-}
-
-// ==================== DRAWING PRIMITIVES ====================
-void drawCube(float size, Color color) {
-    glColor3f(color.r, color.g, color.b);
-    glutSolidCube(size);
+// Prints a log written with --log-binary as text
+int decodeBinaryLog(const char* path) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    char magic[4];
+    uint32_t version = 0;
+    if (!in.read(magic, 4) || memcmp(magic, "GLOG", 4) != 0 ||
+        !in.read((char*)&version, sizeof(version)) || version != 1) {
+        std::cerr << path << ": not a binary game log" << std::endl;
+        return 1;
+    }
+    
+    std::vector<std::string> formats;
+    int c;
+    while ((c = in.get()) != EOF) {
+        if (c == 0xFF) {
+            uint16_t id, length;
+            in.read((char*)&id, 2);
+            in.read((char*)&length, 2);
+            std::string format(length, '\0');
+            in.read(&format[0], length);
+            if (formats.size() <= id) formats.resize(id + 1);
+            formats[id] = format;
+            continue;
+        }
+        
+        LogRecord r;
+        uint16_t id;
+        r.level = (uint8_t)c;
+        r.category = (uint8_t)in.get();
+        in.read((char*)&id, 2);
+        in.read((char*)&r.time, 8);
+        int count = in.get();
+        r.argCount = 0;
+        r.textUsed = 0;
+        for (int a = 0; a < count && in; a++) {
+            int type = in.get();
+            if (type == LogRecord::ARG_TEXT) {
+                std::string s;
+                std::getline(in, s, '\0');
+                r.add(s);
+            } else {
+                char raw[8];
+                in.read(raw, 8);
+                if (type == LogRecord::ARG_DOUBLE) { double d; memcpy(&d, raw, 8); r.add(d); }
+                else { int64_t i; memcpy(&i, raw, 8); r.add(i); }
+            }
+        }
+        if (!in || id >= formats.size() || r.category >= LOG_CATEGORY_COUNT) {
+            std::cerr << path << ": truncated or corrupt record" << std::endl;
+            return 1;
+        }
+        r.format = formats[id].c_str();
+        std::cout << std::fixed << std::setprecision(3) << r.time / 1e6 << " ms "
+                  << LOG_LEVEL_NAMES[r.level < 4 ? r.level : 0]
+                  << " [" << LOG_CATEGORY_NAMES[r.category] << "] " << r.expand() << '\n';
+    }
+    return 0;
 }
 
-void drawSphere(float radius, Color color) {
-    glColor3f(color.r, color.g, color.b);
-    glutSolidSphere(radius, 20, 20);
+// ==================== UTILITY FUNCTIONS ====================
+float distance(Vector3 a, Vector3 b) {
+    float dx = a.x - b.x, dy = a.y - b.y, dz = a.z - b.z;
+    return sqrtf(dx*dx + dy*dy + dz*dz);
 }
 
-void drawCylinder(float radius, float height, Color color) {
-    glColor3f(color.r, color.g, color.b);
-    GLUquadric* quad = gluNewQuadric();
-    glPushMatrix();
-    glRotatef(-90, 1, 0, 0);
-    gluCylinder(quad, radius, radius, height, 20, 20);
-    glPopMatrix();
-    gluDeleteQuadric(quad);
+Vector3 lerp(Vector3 a, Vector3 b, float t) {
+    return Vector3(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t, a.z + (b.z - a.z) * t);
 }
 
-void drawCone(float radius, float height, Color color) {
-    glColor3f(color.r, color.g, color.b);
-    GLUquadric* quad = gluNewQuadric();
-    glPushMatrix();
-    glRotatef(-90, 1, 0, 0);
-    gluCylinder(quad, radius, 0, height, 20, 20);
-    glPopMatrix();
-    gluDeleteQuadric(quad);
+// Interpolates a value that wraps from 360 back to 0 going forward
+float lerpWrapped(float from, float to, float t) {
+    if (to < from) to += 360.0f;
+    return from + (to - from) * t;
 }
 
-void drawTorus(float innerRadius, float outerRadius, Color color) {
-    glColor3f(color.r, color.g, color.b);
-    glutSolidTorus(innerRadius, outerRadius, 16, 16);
+double nowMs() {
+    using namespace std::chrono;
+    return duration<double, std::milli>(steady_clock::now().time_since_epoch()).count();
 }
 
-// ==================== DEBUG DRAWING ====================
-void drawDebugSphere(Vector3 pos, float radius, Color color) {
-    glPushMatrix();
-    glDisable(GL_LIGHTING);
-    glColor3f(color.r, color.g, color.b);
-    glTranslatef(pos.x, pos.y, pos.z);
-    glutWireSphere(radius, 12, 12);
-    glEnable(GL_LIGHTING);
-    glPopMatrix();
-}
+// FNV-1a, for checksums that compare runs
+const uint64_t FNV_OFFSET = 14695981039346656037ULL;
 
-void drawDebugLine(Vector3 from, Vector3 to, Color color) {
-    glDisable(GL_LIGHTING);
-    glColor3f(color.r, color.g, color.b);
-    glLineWidth(2.0f);
-    glBegin(GL_LINES);
-    glVertex3f(from.x, from.y, from.z);
-    glVertex3f(to.x, to.y, to.z);
-    glEnd();
-    glLineWidth(1.0f);
-    glEnable(GL_LIGHTING);
+uint64_t fnv1a(const void* data, size_t size, uint64_t hash = FNV_OFFSET) {
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
 }
 
-// ==================== GAME OBJECTS ====================
+// ==================== PROFILER ====================
+// Scoped timers for the hot path. They compile to nothing when NDEBUG is
+// defined (or ENABLE_PROFILER is set to 0); frame times are always recorded.
+#ifndef ENABLE_PROFILER
+#ifdef NDEBUG
+#define ENABLE_PROFILER 0
+#else
+#define ENABLE_PROFILER 1
+#endif
+#endif
 
-// Ground (1 primitive)
-void drawGround() {
-    glPushMatrix();
-    glColor3f(0.2f, 0.3f, 0.2f);
-    glBegin(GL_QUADS);
-    glVertex3f(-GROUND_SIZE, 0, -GROUND_SIZE);
-    glVertex3f(GROUND_SIZE, 0, -GROUND_SIZE);
-    glVertex3f(GROUND_SIZE, 0, GROUND_SIZE);
-    glVertex3f(-GROUND_SIZE, 0, GROUND_SIZE);
-    glEnd();
+// Phase timings of the last HISTORY frames. A frame is closed by endFrame()
+// after the buffer swap, so it covers the update that led up to it as well
+// as the drawing. Main thread only.
+class FrameProfiler {
+public:
+    static const int HISTORY = 241;     // one slot is the frame in progress
+    static const int MAX_PHASES = 48;
+    static const int MAX_EVENTS = 1024; // traced scopes per frame
+    static const int MAX_PHASE_EVENTS = 64;  // per phase, so one busy phase can't crowd out the rest
     
-    glColor3f(0.3f, 0.4f, 0.3f);
-    glBegin(GL_LINES);
-    for (float i = -GROUND_SIZE; i <= GROUND_SIZE; i += 5) {
-        glVertex3f(i, 0.01f, -GROUND_SIZE);
-        glVertex3f(i, 0.01f, GROUND_SIZE);
-        glVertex3f(-GROUND_SIZE, 0.01f, i);
-        glVertex3f(GROUND_SIZE, 0.01f, i);
-    }
-    glEnd();
-    glPopMatrix();
-}
-
-// Walls (3 primitives - 1 each)
-void drawWalls() {
-    // Front wall
-    glPushMatrix();
-    glTranslatef(0, WALL_HEIGHT/2, -GROUND_SIZE);
-    glScalef(GROUND_SIZE * 2, WALL_HEIGHT, 0.5f);
-    drawCube(1, Color(0.8f, 0.2f, 0.2f));
-    glPopMatrix();
+    struct Event {
+        uint16_t phase;
+        uint16_t depth;
+        float startUs;      // from the start of the frame
+        float durationUs;
+    };
     
-    // Left wall
-    glPushMatrix();
-    glTranslatef(-GROUND_SIZE, WALL_HEIGHT/2, 0);
-    glScalef(0.5f, WALL_HEIGHT, GROUND_SIZE * 2);
-    drawCube(1, Color(0.8f, 0.2f, 0.2f));
-    glPopMatrix();
+    struct Frame {
+        double startMs;     // since the profiler was created
+        float durationMs;
+        int drawCalls;
+        int eventCount;
+        int droppedEvents;  // timed but left out of the trace
+        float phaseMs[MAX_PHASES];
+        uint16_t phaseEvents[MAX_PHASES];
+        
+        void clear(double start) {
+            startMs = start;
+            durationMs = 0;
+            drawCalls = eventCount = droppedEvents = 0;
+            memset(phaseMs, 0, sizeof(phaseMs));
+            memset(phaseEvents, 0, sizeof(phaseEvents));
+        }
+    };
     
-    // Right wall
-    glPushMatrix();
-    glTranslatef(GROUND_SIZE, WALL_HEIGHT/2, 0);
-    glScalef(0.5f, WALL_HEIGHT, GROUND_SIZE * 2);
-    drawCube(1, Color(0.8f, 0.2f, 0.2f));
-    glPopMatrix();
-}
-
-// Player Character (8 primitives)
-void drawPlayer() {
-    glPushMatrix();
-    glTranslatef(playerPos.x, playerPos.y, playerPos.z);
-    glRotatef(playerRotation, 0, 1, 0);
+    bool enabled;   // scopes record nothing until this is set
     
-    // Legs (2 cylinders)
-    glPushMatrix();
-    glTranslatef(-0.2f, -0.3f, 0);
-    drawCylinder(0.15f, 0.6f, Color(0.1f, 0.1f, 0.1f));
-    glPopMatrix();
+private:
+    std::vector<Frame> frames;
+    std::vector<Event> events;  // MAX_EVENTS per frame slot
+    const char* phaseNames[MAX_PHASES];
+    int phaseCount;
+    int depth;
+    int current;                // slot being recorded
+    int completed;
+    double origin;
     
-    glPushMatrix();
-    glTranslatef(0.2f, -0.3f, 0);
-    drawCylinder(0.15f, 0.6f, Color(0.1f, 0.1f, 0.1f));
-    glPopMatrix();
+    int slot(int age) const { return (current - 1 - age + 2 * HISTORY) % HISTORY; }
     
-    // Torso (cube)
-    glPushMatrix();
-    glTranslatef(0, 0.4f, 0);
-    glScalef(0.8f, 1.0f, 0.5f);
-    drawCube(1, Color(0.8f, 0.0f, 0.0f));
-    glPopMatrix();
+public:
+    FrameProfiler() : enabled(false), phaseCount(0), depth(0), current(0), completed(0) {
+        frames.resize(HISTORY);
+        events.resize((size_t)HISTORY * MAX_EVENTS);
+        origin = nowMs();
+        frames[0].clear(0);
+    }
     
-    // Arms (2 cylinders)
-    glPushMatrix();
-    glTranslatef(-0.5f, 0.4f, 0);
-    glRotatef(90, 0, 0, 1);
-    drawCylinder(0.1f, 0.4f, Color(0.8f, 0.0f, 0.0f));
-    glPopMatrix();
+    // Returns -1 once the phase table is full; such scopes are ignored
+    int registerPhase(const char* name) {
+        for (int i = 0; i < phaseCount; i++) {
+            if (strcmp(phaseNames[i], name) == 0) return i;
+        }
+        if (phaseCount == MAX_PHASES) return -1;
+        phaseNames[phaseCount] = name;
+        return phaseCount++;
+    }
     
-    glPushMatrix();
-    glTranslatef(0.5f, 0.4f, 0);
-    glRotatef(-90, 0, 0, 1);
-    drawCylinder(0.1f, 0.4f, Color(0.8f, 0.0f, 0.0f));
-    glPopMatrix();
+    double now() const { return nowMs() - origin; }
+    int enter() { return depth++; }
     
-    // Head (sphere)
-    glPushMatrix();
-    glTranslatef(0, 1.1f, 0);
-    drawSphere(0.3f, Color(0.9f, 0.8f, 0.7f));
+    void leave(int phase, int eventDepth, double startMs) {
+        depth--;
+        double endMs = now();
+        Frame& frame = frames[current];
+        frame.phaseMs[phase] += (float)(endMs - startMs);
+        if (frame.eventCount < MAX_EVENTS && frame.phaseEvents[phase] < MAX_PHASE_EVENTS) {
+            frame.phaseEvents[phase]++;
+            Event& e = events[(size_t)current * MAX_EVENTS + frame.eventCount++];
+            e.phase = (uint16_t)phase;
+            e.depth = (uint16_t)eventDepth;
+            e.startUs = (float)((startMs - frame.startMs) * 1000.0);
+            e.durationUs = (float)((endMs - startMs) * 1000.0);
+        } else {
+            frame.droppedEvents++;
+        }
+    }
+    
+    void endFrame(int drawCalls) {
+        double t = now();
+        Frame& frame = frames[current];
+        frame.durationMs = (float)(t - frame.startMs);
+        frame.drawCalls = drawCalls;
+        current = (current + 1) % HISTORY;
+        if (completed < HISTORY - 1) completed++;
+        frames[current].clear(t);
+    }
+    
+    // Finished frames, age 0 being the most recent
+    int frameCount() const { return completed; }
+    const Frame& frame(int age) const { return frames[slot(age)]; }
+    const Event* frameEvents(int age) const { return &events[(size_t)slot(age) * MAX_EVENTS]; }
+    int phases() const { return phaseCount; }
+    const char* phaseName(int phase) const { return phaseNames[phase]; }
+    
+    // Frame time at fraction p (0..1) of the recorded frames
+    float percentile(float p) const {
+        if (completed == 0) return 0;
+        static std::vector<float> times;
+        times.clear();
+        for (int i = 0; i < completed; i++) times.push_back(frame(i).durationMs);
+        size_t k = std::min((size_t)(p * completed), times.size() - 1);
+        std::nth_element(times.begin(), times.begin() + k, times.end());
+        return times[k];
+    }
+    
+    float averagePhaseMs(int phase) const {
+        if (completed == 0) return 0;
+        double total = 0;
+        for (int i = 0; i < completed; i++) total += frame(i).phaseMs[phase];
+        return (float)(total / completed);
+    }
+    
+    // Writes the recorded frames in the Chrome trace event format, for
+    // chrome://tracing or ui.perfetto.dev
+    bool exportChromeTrace(const char* path) const {
+        FILE* f = fopen(path, "w");
+        if (!f) return false;
+        fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        fprintf(f, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}}");
+        for (int age = completed - 1; age >= 0; age--) {
+            const Frame& fr = frame(age);
+            double base = fr.startMs * 1000.0;
+            fprintf(f, ",\n{\"name\":\"frame\",\"cat\":\"frame\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                       "\"pid\":1,\"tid\":1,\"args\":{\"draw calls\":%d,\"untraced scopes\":%d}}",
+                    base, fr.durationMs * 1000.0, fr.drawCalls, fr.droppedEvents);
+            fprintf(f, ",\n{\"name\":\"draw calls\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"draws\":%d}}",
+                    base, fr.drawCalls);
+            const Event* ev = frameEvents(age);
+            for (int i = 0; i < fr.eventCount; i++) {
+                fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+                        phaseNames[ev[i].phase], base + ev[i].startUs, (double)ev[i].durationUs);
+            }
+        }
+        fprintf(f, "\n]}\n");
+        return fclose(f) == 0;
+    }
+};
+
+FrameProfiler profiler;
+
+// Cleared on threads whose scopes should not be recorded (the profiler
+// belongs to the render thread)
+thread_local bool profileThisThread = true;
+
+class ProfileScope {
+private:
+    int phase, depth;
+    double start;
+    
+public:
+    explicit ProfileScope(int phase) : phase(phase), depth(0), start(0) {
+        if (!profiler.enabled || phase < 0 || !profileThisThread) { this->phase = -1; return; }
+        depth = profiler.enter();
+        start = profiler.now();
+    }
+    ~ProfileScope() {
+        if (phase >= 0) profiler.leave(phase, depth, start);
+    }
+};
+
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+#if ENABLE_PROFILER
+// Times the rest of the enclosing block as the phase called name (a literal)
+#define PROFILE_SCOPE(name) \
+    static const int PROFILE_CONCAT(profilePhase, __LINE__) = profiler.registerPhase(name); \
+    ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(PROFILE_CONCAT(profilePhase, __LINE__))
+#else
+#define PROFILE_SCOPE(name) do {} while (0)
+#endif
+
+// ==================== JOB SYSTEM ====================
+// A fixed pool of worker threads, each with its own queue. A thread takes the
+// newest job from its own queue and, when that is empty, steals the oldest
+// job from another one. Jobs are created by client threads (the render thread
+// and the simulation thread), each with its own queue and per-frame arena for
+// the jobs and the callables they run, so scheduling does not touch the heap;
+// endFrame() recycles the caller's arena once its jobs have finished. A thread
+// waiting on a job runs queued jobs meanwhile, so with no workers everything
+// still completes on the caller.
+//
+// Jobs must not change state that another job running at the same time reads;
+// parallel loops write disjoint ranges and merge results in range order, which
+// keeps the output the same for any number of workers.
+
+// Bump allocator for job data. Allocation is lock-free until the buffer is
+// full, after which blocks come from the heap until the next reset().
+class FrameArena {
+private:
+    std::vector<unsigned char> buffer;
+    std::atomic<size_t> used;
+    std::mutex overflowMutex;
+    std::vector<void*> overflow;
+    size_t peak;
+    
+public:
+    explicit FrameArena(size_t capacity) : buffer(capacity), used(0), peak(0) {}
+    ~FrameArena() { reset(); }
+    
+    void* allocate(size_t size, size_t align) {
+        size_t offset = used.fetch_add(size + align - 1, std::memory_order_relaxed);
+        if (offset + size + align - 1 <= buffer.size()) {
+            uintptr_t p = (uintptr_t)(buffer.data() + offset);
+            return (void*)((p + align - 1) & ~(uintptr_t)(align - 1));
+        }
+        std::lock_guard<std::mutex> lock(overflowMutex);
+        overflow.push_back(::operator new(size));
+        return overflow.back();
+    }
+    
+    // Arena objects are never destroyed, so only trivially destructible types
+    template <typename T>
+    T* create(const T& value) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned arena object");
+        return new (allocate(sizeof(T), alignof(T))) T(value);
+    }
+    
+    // Only while nothing allocated from the arena is still in use
+    void reset() {
+        peak = std::max(peak, used.load(std::memory_order_relaxed));
+        used.store(0, std::memory_order_relaxed);
+        for (void* p : overflow) ::operator delete(p);
+        overflow.clear();
+    }
+    
+    size_t capacity() const { return buffer.size(); }
+    size_t peakBytes() const { return peak; }
+};
+
+struct Job {
+    static const int MAX_CONTINUATIONS = 4;
+    
+    void (*run)(Job*);
+    void* data;                     // arena copy of the callable
+    int begin, end;                 // range of a parallel-for chunk
+    Job* parent;                    // does not finish before this job does
+    std::atomic<int> unfinished;    // this job plus its unfinished children
+    std::atomic<int> blockers;      // unfinished dependencies, plus one until submitted
+    Job* continuations[MAX_CONTINUATIONS];
+    int continuationCount;
+};
+
+// One thread's queue. The owner pushes and pops at the back, thieves take
+// from the front, so a steal gets the oldest (and usually largest) job.
+class WorkQueue {
+private:
+    std::mutex mutex;
+    std::vector<Job*> ring;     // power-of-two capacity
+    size_t head, tail;
+    
+public:
+    WorkQueue() : ring(1024), head(0), tail(0) {}
+    
+    void push(Job* job) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tail - head == ring.size()) {
+            std::vector<Job*> grown(ring.size() * 2);
+            for (size_t i = head; i < tail; i++) grown[i & (grown.size() - 1)] = ring[i & (ring.size() - 1)];
+            ring.swap(grown);
+        }
+        ring[tail++ & (ring.size() - 1)] = job;
+    }
+    
+    Job* pop() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tail == head ? NULL : ring[--tail & (ring.size() - 1)];
+    }
+    
+    Job* steal() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return tail == head ? NULL : ring[head++ & (ring.size() - 1)];
+    }
+};
+
+// Queue of the calling thread: the client number for client threads (0 for
+// the main thread), JobSystem::CLIENTS and up for the workers
+thread_local int jobQueueIndex = 0;
+
+class JobSystem {
+public:
+    enum Client { RENDER_CLIENT, SIMULATION_CLIENT, CLIENTS };
+    
+private:
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::atomic<int> queued;
+    std::atomic<int> sleeping;
+    std::atomic<bool> quit;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::unique_ptr<FrameArena> arenas[CLIENTS];
+    std::atomic<long> executed, stolen;
+    
+    template <typename F>
+    static void invoke(Job* job) { (*(F*)job->data)(); }
+    
+    template <typename F>
+    static void invokeRange(Job* job) { (*(F*)job->data)(job->begin, job->end); }
+    
+    // Body of a parallel-for job: queues its chunks as children
+    template <typename F>
+    struct ParallelFor {
+        JobSystem* system;
+        FrameArena* arena;  // the creator's, wherever the chunks get spawned
+        F* fn;
+        int count, grain;
+    };
+    
+    template <typename F>
+    static void spawnChunks(Job* job) {
+        const ParallelFor<F>& loop = *(const ParallelFor<F>*)job->data;
+        if (loop.count <= loop.grain) {
+            if (loop.count > 0) (*loop.fn)(0, loop.count);
+            return;
+        }
+        for (int begin = 0; begin < loop.count; begin += loop.grain) {
+            Job* chunk = loop.system->allocate(*loop.arena, invokeRange<F>, loop.fn);
+            chunk->begin = begin;
+            chunk->end = std::min(begin + loop.grain, loop.count);
+            chunk->parent = job;
+            job->unfinished.fetch_add(1, std::memory_order_relaxed);
+            loop.system->push(chunk);
+        }
+    }
+    
+    // Jobs are only created on client threads
+    FrameArena& clientArena() { return *arenas[std::min(jobQueueIndex, (int)CLIENTS - 1)]; }
+    
+    Job* allocate(FrameArena& arena, void (*run)(Job*), void* data) {
+        Job* job = (Job*)arena.allocate(sizeof(Job), alignof(Job));
+        job->run = run;
+        job->data = data;
+        job->begin = job->end = 0;
+        job->parent = NULL;
+        new (&job->unfinished) std::atomic<int>(1);
+        new (&job->blockers) std::atomic<int>(1);
+        job->continuationCount = 0;
+        return job;
+    }
+    
+    void push(Job* job) {
+        queues[jobQueueIndex]->push(job);
+        queued.fetch_add(1);
+        if (sleeping.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_one();
+        }
+    }
+    
+    Job* take() {
+        int self = jobQueueIndex;
+        Job* job = queues[self]->pop();
+        for (size_t k = 1; !job && k < queues.size(); k++) {
+            job = queues[(self + k) % queues.size()]->steal();
+            if (job) stolen.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (job) queued.fetch_sub(1);
+        return job;
+    }
+    
+    void finish(Job* job) {
+        // Read before the count drops: a waiter may recycle the job right after
+        Job* parent = job->parent;
+        int continuationCount = job->continuationCount;
+        Job* continuations[Job::MAX_CONTINUATIONS];
+        for (int i = 0; i < continuationCount; i++) continuations[i] = job->continuations[i];
+        if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        for (int i = 0; i < continuationCount; i++) {
+            if (continuations[i]->blockers.fetch_sub(1, std::memory_order_acq_rel) == 1) push(continuations[i]);
+        }
+        if (parent) finish(parent);
+    }
+    
+    void execute(Job* job) {
+        job->run(job);
+        executed.fetch_add(1, std::memory_order_relaxed);
+        finish(job);
+    }
+    
+    void workerLoop(int index) {
+        jobQueueIndex = index;
+        while (!quit.load()) {
+            Job* job = take();
+            if (job) {
+                execute(job);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleeping.fetch_add(1);
+            wake.wait(lock, [this] { return queued.load() > 0 || quit.load(); });
+            sleeping.fetch_sub(1);
+        }
+    }
+    
+public:
+    JobSystem() : queued(0), sleeping(0), quit(false), executed(0), stolen(0) {
+        for (int i = 0; i < CLIENTS; i++) {
+            queues.emplace_back(new WorkQueue());
+            arenas[i].reset(new FrameArena(1 << 20));
+        }
+    }
+    ~JobSystem() { stop(); }
+    
+    // Replaces the pool with `workers` threads besides the clients. Only
+    // while no jobs are queued.
+    void start(int workers) {
+        stop();
+        quit = false;
+        queues.resize(CLIENTS);
+        for (int i = 0; i < workers; i++) queues.emplace_back(new WorkQueue());
+        for (int i = 0; i < workers; i++) threads.emplace_back(&JobSystem::workerLoop, this, CLIENTS + i);
+    }
+    
+    // Makes the calling thread the given client (threads start as RENDER_CLIENT)
+    void attach(Client client) { jobQueueIndex = client; }
+    
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : threads) t.join();
+        threads.clear();
+    }
+    
+    int workerCount() const { return (int)threads.size(); }
+    long jobsExecuted() const { return executed.load(); }
+    long jobsStolen() const { return stolen.load(); }
+    const FrameArena& frameArena(Client client) const { return *arenas[client]; }
+    
+    // A job that calls fn(). It runs once submitted and its dependencies are done.
+    template <typename F>
+    Job* create(const F& fn) {
+        FrameArena& arena = clientArena();
+        return allocate(arena, invoke<F>, arena.create(fn));
+    }
+    
+    // A job that calls fn(begin, end) over [0, count) in chunks of `grain`.
+    // Chunk bounds depend only on count and grain, not on the worker count.
+    template <typename F>
+    Job* parallelFor(int count, int grain, const F& fn) {
+        FrameArena& arena = clientArena();
+        ParallelFor<F> loop = { this, &arena, arena.create(fn), count, std::max(grain, 1) };
+        return allocate(arena, spawnChunks<F>, arena.create(loop));
+    }
+    
+    // `job` starts only after `on` has finished. Both must not be submitted yet.
+    void depend(Job* job, Job* on) {
+        if (on->continuationCount == Job::MAX_CONTINUATIONS) {
+            std::cerr << "Job has too many dependents" << std::endl;
+            abort();
+        }
+        on->continuations[on->continuationCount++] = job;
+        job->blockers.fetch_add(1, std::memory_order_relaxed);
+    }
+    
+    void submit(Job* job) {
+        if (job->blockers.fetch_sub(1, std::memory_order_acq_rel) == 1) push(job);
+    }
+    
+    // Runs queued jobs until `job` (and everything it spawned) has finished
+    void wait(Job* job) {
+        while (job->unfinished.load(std::memory_order_acquire) > 0) {
+            Job* next = take();
+            if (next) execute(next);
+            else std::this_thread::yield();
+        }
+    }
+    
+    void run(Job* job) {
+        submit(job);
+        wait(job);
+    }
+    
+    // Call once per frame (or simulation step) when none of the calling
+    // client's jobs is in flight
+    void endFrame() { clientArena().reset(); }
+};
+
+JobSystem jobs;
+
+// ==================== AUDIO ====================
+// Samples are decoded once at startup and mixed on a dedicated thread (the
+// AudioQueue callback thread on macOS). The game thread only pushes small
+// commands onto a lock-free queue, so a pickup never waits on the mixer.
+enum SoundId { SOUND_PICKUP, SOUND_WIN, SOUND_TIME_UP, SOUND_MUSIC, SOUND_COUNT };
+
+// Looked up in order: a WAV next to the game, the macOS system sound, and
+// a synthesised tone so there is always something to mix
+struct SoundSource {
+    const char* wavFile;
+    const char* systemSound;
+    float toneHz, toneSeconds;
+};
+
+const SoundSource SOUND_SOURCES[SOUND_COUNT] = {
+    { "sounds/pickup.wav",  "/System/Library/Sounds/Pop.aiff",   880.0f, 0.12f },
+    { "sounds/win.wav",     "/System/Library/Sounds/Glass.aiff", 660.0f, 0.60f },
+    { "sounds/time_up.wav", "/System/Library/Sounds/Basso.aiff", 110.0f, 0.50f },
+    { "sounds/music.wav",   "/System/Library/Sounds/Funk.aiff",  220.0f, 0.30f },
+};
+
+const int AUDIO_RATE = 44100;
+const int AUDIO_CHANNELS = 2;
+const int AUDIO_BLOCK_FRAMES = 256; // 5.8 ms per mixed block
+
+// Decoded PCM at AUDIO_RATE, one or two interleaved channels
+struct Sample {
+    std::vector<float> data;
+    int channels;
+    int frames;
+    Sample() : channels(1), frames(0) {}
+};
+
+// Reads 8/16/24/32-bit integer or 32-bit float PCM into floats
+static void decodePCM(const unsigned char* p, size_t count, int bits, bool bigEndian, bool isFloat,
+                      std::vector<float>& out) {
+    int bytes = bits / 8;
+    out.resize(count);
+    for (size_t i = 0; i < count; i++, p += bytes) {
+        uint32_t raw = 0;
+        for (int b = 0; b < bytes; b++) {
+            raw |= (uint32_t)p[bigEndian ? b : bytes - 1 - b] << (8 * (bytes - 1 - b));
+        }
+        if (isFloat) {
+            float f;
+            memcpy(&f, &raw, 4);
+            out[i] = f;
+        } else if (bits == 8) {
+            out[i] = ((int)raw - 128) / 128.0f; // WAV 8-bit is unsigned
+        } else {
+            int32_t v = (int32_t)(raw << (32 - bits)); // sign-extend via the top bits
+            out[i] = v / 2147483648.0f;
+        }
+    }
+}
+
+static uint32_t readLE(const unsigned char* p, int n) {
+    uint32_t v = 0;
+    for (int i = n - 1; i >= 0; i--) v = v << 8 | p[i];
+    return v;
+}
+
+static uint32_t readBE(const unsigned char* p, int n) {
+    uint32_t v = 0;
+    for (int i = 0; i < n; i++) v = v << 8 | p[i];
+    return v;
+}
+
+// The 80-bit IEEE extended float AIFF stores its sample rate in
+static double readExtended(const unsigned char* p) {
+    int exponent = ((p[0] & 0x7F) << 8 | p[1]) - 16383;
+    double mantissa = 0;
+    for (int i = 0; i < 8; i++) mantissa = mantissa * 256 + p[2 + i];
+    double value = ldexp(mantissa, exponent - 63);
+    return p[0] & 0x80 ? -value : value;
+}
+
+// Linear resampling to AUDIO_RATE
+static void resample(Sample& s, double rate) {
+    if (s.frames == 0 || fabs(rate - AUDIO_RATE) < 1) return;
+    int frames = (int)(s.frames * AUDIO_RATE / rate);
+    std::vector<float> out(frames * s.channels);
+    for (int f = 0; f < frames; f++) {
+        double pos = f * rate / AUDIO_RATE;
+        int i = (int)pos;
+        float t = (float)(pos - i);
+        int j = std::min(i + 1, s.frames - 1);
+        for (int c = 0; c < s.channels; c++) {
+            out[f * s.channels + c] = s.data[i * s.channels + c] * (1 - t) + s.data[j * s.channels + c] * t;
+        }
+    }
+    s.data.swap(out);
+    s.frames = frames;
+}
+
+bool loadWAV(const std::vector<unsigned char>& file, Sample& s) {
+    if (file.size() < 12 || memcmp(&file[0], "RIFF", 4) != 0 || memcmp(&file[8], "WAVE", 4) != 0) return false;
+    int format = 0, bits = 0;
+    double rate = 0;
+    for (size_t at = 12; at + 8 <= file.size();) {
+        const unsigned char* chunk = &file[at];
+        size_t size = readLE(chunk + 4, 4);
+        if (at + 8 + size > file.size()) size = file.size() - at - 8;
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            format = readLE(chunk + 8, 2);
+            s.channels = readLE(chunk + 10, 2);
+            rate = readLE(chunk + 12, 4);
+            bits = readLE(chunk + 22, 2);
+            if (format == 0xFFFE && size >= 40) format = readLE(chunk + 32, 2); // WAVE_FORMAT_EXTENSIBLE
+        } else if (memcmp(chunk, "data", 4) == 0 && bits > 0) {
+            bool isFloat = format == 3;
+            if ((format != 1 && !isFloat) || bits % 8 || bits > 32 || s.channels < 1 || s.channels > 2) return false;
+            if (!(rate >= 1)) return false; // resample() divides by it
+            size_t count = size / (bits / 8);
+            decodePCM(chunk + 8, count, bits, false, isFloat, s.data);
+            s.frames = (int)(count / s.channels);
+            resample(s, rate);
+            return true;
+        }
+        at += 8 + size + (size & 1);
+    }
+    return false;
+}
+
+bool loadAIFF(const std::vector<unsigned char>& file, Sample& s) {
+    if (file.size() < 12 || memcmp(&file[0], "FORM", 4) != 0) return false;
+    bool aifc = memcmp(&file[8], "AIFC", 4) == 0;
+    if (!aifc && memcmp(&file[8], "AIFF", 4) != 0) return false;
+    int bits = 0;
+    double rate = 0;
+    bool littleEndian = false, isFloat = false;
+    for (size_t at = 12; at + 8 <= file.size();) {
+        const unsigned char* chunk = &file[at];
+        size_t size = readBE(chunk + 4, 4);
+        if (at + 8 + size > file.size()) size = file.size() - at - 8;
+        if (memcmp(chunk, "COMM", 4) == 0 && size >= 18) {
+            s.channels = readBE(chunk + 8, 2);
+            bits = readBE(chunk + 14, 2);
+            rate = readExtended(chunk + 16);
+            if (aifc && size >= 22) {
+                const unsigned char* type = chunk + 26;
+                littleEndian = memcmp(type, "sowt", 4) == 0;
+                isFloat = memcmp(type, "fl32", 4) == 0;
+                if (!littleEndian && !isFloat && memcmp(type, "NONE", 4) != 0) return false;
+            }
+        } else if (memcmp(chunk, "SSND", 4) == 0 && bits > 0 && size >= 8) {
+            if (bits % 8 || bits > 32 || s.channels < 1 || s.channels > 2) return false;
+            if (!(rate >= 1)) return false; // resample() divides by it
+            size_t offset = readBE(chunk + 8, 4);
+            if (offset > size - 8) return false;
+            size_t count = (size - 8 - offset) / (bits / 8);
+            decodePCM(chunk + 16 + offset, count, bits, !littleEndian, isFloat, s.data);
+            // AIFF 8-bit is signed, unlike WAV
+            if (bits == 8) {
+                for (size_t i = 0; i < count; i++) s.data[i] = (int8_t)chunk[16 + offset + i] / 128.0f;
+            }
+            s.frames = (int)(count / s.channels);
+            resample(s, rate);
+            return true;
+        }
+        at += 8 + size + (size & 1);
+    }
+    return false;
+}
+
+bool loadSample(const char* path, Sample& s) {
+    std::ifstream in(path, std::ios::in | std::ios::binary);
+    if (!in) return false;
+    std::vector<unsigned char> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return loadWAV(file, s) || loadAIFF(file, s);
+}
+
+// A decaying sine, used when no sound file is found
+void synthesizeTone(Sample& s, float hz, float seconds) {
+    s.channels = 1;
+    s.frames = (int)(seconds * AUDIO_RATE);
+    s.data.resize(s.frames);
+    for (int i = 0; i < s.frames; i++) {
+        float t = (float)i / AUDIO_RATE;
+        float envelope = std::min(1.0f, t * 200.0f) * exp(-4.0f * t / seconds);
+        s.data[i] = 0.4f * envelope * sin(2.0f * M_PI * hz * t);
+    }
+}
+
+struct AudioCommand {
+    enum Type : uint8_t { PLAY, STOP_ALL };
+    Type type;
+    uint8_t sound;
+    bool loop;
+    float gain;
+    double issuedMs; // for the latency statistics
+};
+
+// Where mixed blocks go. Push backends are fed by the mixer thread; a pull
+// backend (AudioQueue) calls AudioMixer::render() from its own thread.
+class AudioBackend {
+public:
+    virtual ~AudioBackend() {}
+    virtual const char* name() const = 0;
+    virtual bool open() = 0;
+    virtual bool pulls() const { return false; }
+    virtual void write(const float* block, int frames) { (void)block; (void)frames; }
+    virtual void close() {}
+    virtual int bufferedFrames() const = 0; // output latency after a block is mixed
+};
+
+// Discards the audio at the real-time rate, so the mixer and its latency
+// can be exercised without a sound device
+class NullAudioBackend : public AudioBackend {
+public:
+    const char* name() const { return "null"; }
+    bool open() { return true; }
+    int bufferedFrames() const { return AUDIO_BLOCK_FRAMES; }
+};
+
+// Records the mix into a 16-bit WAV file
+class WavFileAudioBackend : public AudioBackend {
+private:
+    std::string path;
+    std::ofstream out;
+    uint32_t frames;
+    std::vector<int16_t> pcm;
+    
+    void header() {
+        uint32_t dataBytes = frames * AUDIO_CHANNELS * 2, riffBytes = 36 + dataBytes;
+        unsigned char h[44];
+        memcpy(h, "RIFF", 4);
+        memcpy(h + 4, &riffBytes, 4);
+        memcpy(h + 8, "WAVEfmt ", 8);
+        uint32_t fmtSize = 16, rate = AUDIO_RATE, byteRate = AUDIO_RATE * AUDIO_CHANNELS * 2;
+        uint16_t format = 1, channels = AUDIO_CHANNELS, blockAlign = AUDIO_CHANNELS * 2, bits = 16;
+        memcpy(h + 16, &fmtSize, 4);
+        memcpy(h + 20, &format, 2);
+        memcpy(h + 22, &channels, 2);
+        memcpy(h + 24, &rate, 4);
+        memcpy(h + 28, &byteRate, 4);
+        memcpy(h + 32, &blockAlign, 2);
+        memcpy(h + 34, &bits, 2);
+        memcpy(h + 36, "data", 4);
+        memcpy(h + 40, &dataBytes, 4);
+        out.seekp(0);
+        out.write((const char*)h, sizeof(h));
+        out.seekp(0, std::ios::end);
+    }
+    
+public:
+    WavFileAudioBackend(const std::string& path) : path(path), frames(0) {}
+    const char* name() const { return "wav file"; }
+    int bufferedFrames() const { return AUDIO_BLOCK_FRAMES; }
+    
+    bool open() {
+        out.open(path.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!out) return false;
+        header();
+        return true;
+    }
+    void write(const float* block, int count) {
+        pcm.resize(count * AUDIO_CHANNELS);
+        for (size_t i = 0; i < pcm.size(); i++) pcm[i] = (int16_t)(block[i] * 32767.0f);
+        out.write((const char*)&pcm[0], pcm.size() * sizeof(int16_t));
+        frames += count;
+    }
+    void close() {
+        if (!out.is_open()) return;
+        header();
+        out.close();
+    }
+};
+
+#ifdef __APPLE__
+// Core Audio output queue; its callback thread is the mixer thread
+class AudioQueueBackend : public AudioBackend {
+private:
+    static const int BUFFERS = 3;
+    AudioQueueRef queue;
+    AudioQueueBufferRef buffers[BUFFERS];
+    
+    static void callback(void* user, AudioQueueRef q, AudioQueueBufferRef buffer);
+    
+public:
+    AudioQueueBackend() : queue(NULL) {}
+    const char* name() const { return "AudioQueue"; }
+    bool pulls() const { return true; }
+    int bufferedFrames() const { return AUDIO_BLOCK_FRAMES * BUFFERS; }
+    bool open();
+    void close() {
+        if (!queue) return;
+        AudioQueueStop(queue, true);
+        AudioQueueDispose(queue, true);
+        queue = NULL;
+    }
+};
+#endif
+
+class AudioMixer {
+private:
+    static const int MAX_VOICES = 32;
+    
+    struct Voice {
+        int sound;
+        int position; // next frame
+        bool loop;
+        float gain;
+        bool active;
+    };
+    
+    Sample samples[SOUND_COUNT];
+    Voice voices[MAX_VOICES];
+    SpscRing<AudioCommand, 256> commands;
+    AudioBackend* backend;
+    std::thread thread;
+    std::atomic<bool> running;
+    std::vector<float> block;
+    
+    // Written by the mixer thread only, read by stats() from any thread.
+    // With one writer a relaxed load and store is enough to add.
+    struct Counters {
+        std::atomic<long> blocks, commands, underruns;
+        std::atomic<double> latencySumMs, latencyMaxMs, mixMs;
+        std::atomic<int> voices; // active after the last block
+    } counters;
+    
+    template <typename T, typename U>
+    static void add(std::atomic<T>& counter, U value) {
+        counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+    
+    void apply(const AudioCommand& c) {
+        if (c.type == AudioCommand::STOP_ALL) {
+            for (Voice& v : voices) v.active = false;
+        } else {
+            // A free voice, or else the one that has played longest
+            Voice* target = NULL;
+            for (Voice& v : voices) {
+                if (!v.active) { target = &v; break; }
+                if (!v.loop && (!target || v.position > target->position)) target = &v;
+            }
+            if (!target) return;
+            target->sound = c.sound;
+            target->position = 0;
+            target->loop = c.loop;
+            target->gain = c.gain;
+            target->active = true;
+        }
+        double latency = nowMs() - c.issuedMs;
+        add(counters.latencySumMs, latency);
+        if (latency > counters.latencyMaxMs.load(std::memory_order_relaxed)) {
+            counters.latencyMaxMs.store(latency, std::memory_order_relaxed);
+        }
+        add(counters.commands, 1);
+    }
+    
+    void mixerLoop() {
+        raiseThreadPriority();
+        const double blockMs = 1000.0 * AUDIO_BLOCK_FRAMES / AUDIO_RATE;
+        double deadline = nowMs();
+        while (running.load(std::memory_order_acquire)) {
+            render(&block[0], AUDIO_BLOCK_FRAMES);
+            backend->write(&block[0], AUDIO_BLOCK_FRAMES);
+            // Paced like a device draining its buffer at the sample rate
+            deadline += blockMs;
+            double now = nowMs();
+            if (now > deadline + blockMs) {
+                add(counters.underruns, 1);
+                deadline = now;
+            } else if (deadline > now) {
+                std::this_thread::sleep_for(std::chrono::microseconds((long)((deadline - now) * 1000.0)));
+            }
+        }
+    }
+    
+    static void raiseThreadPriority() {
+        // Needs privileges on Linux; without them the thread just runs normally
+        sched_param param;
+        param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+        pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    }
+    
+public:
+    // A copy of the mixer thread's counters, for reports
+    struct Stats {
+        long blocks, commands, underruns;
+        double latencySumMs, latencyMaxMs; // command push -> voice started
+        double mixMs;                      // time spent mixing
+        Stats() : blocks(0), commands(0), underruns(0), latencySumMs(0), latencyMaxMs(0), mixMs(0) {}
+    };
+    
+    AudioMixer() : backend(NULL), running(false) {
+        for (Voice& v : voices) v.active = false;
+        resetCounters();
+    }
+    ~AudioMixer() { shutdown(); }
+    
+    void loadSamples() {
+        for (int i = 0; i < SOUND_COUNT; i++) {
+            const SoundSource& src = SOUND_SOURCES[i];
+            Sample& s = samples[i];
+            if (loadSample(src.wavFile, s) || loadSample(src.systemSound, s)) continue;
+            synthesizeTone(s, src.toneHz, src.toneSeconds);
+        }
+    }
+    
+    // Takes ownership of the backend; false if it could not be opened
+    bool start(AudioBackend* output) {
+        shutdown();
+        backend = output;
+        resetCounters();
+        block.assign(AUDIO_BLOCK_FRAMES * AUDIO_CHANNELS, 0.0f);
+        if (!backend->open()) {
+            gameLogger.log(LOG_WARN, LOG_AUDIO, "Could not open the %s audio output", backend->name());
+            delete backend;
+            backend = NULL;
+            return false;
+        }
+        running = true;
+        if (!backend->pulls()) thread = std::thread(&AudioMixer::mixerLoop, this);
+        gameLogger.log(LOG_INFO, LOG_AUDIO, "Audio output: %s, %d Hz, %d-frame blocks",
+                       backend->name(), AUDIO_RATE, AUDIO_BLOCK_FRAMES);
+        return true;
+    }
+    
+    void shutdown() {
+        if (!backend) return;
+        running = false;
+        if (thread.joinable()) thread.join();
+        backend->close();
+        delete backend;
+        backend = NULL;
+    }
+    
+    void resetCounters() {
+        counters.blocks = counters.commands = counters.underruns = 0;
+        counters.latencySumMs = counters.latencyMaxMs = counters.mixMs = 0;
+        counters.voices = 0;
+    }
+    
+    bool active() const { return backend != NULL; }
+    int outputLatencyFrames() const { return backend ? backend->bufferedFrames() : 0; }
+    
+    // Game thread: never blocks; a full queue drops the command
+    void play(SoundId sound, bool loop = false, float gain = 1.0f) {
+        if (!backend) return;
+        AudioCommand c = { AudioCommand::PLAY, (uint8_t)sound, loop, gain, nowMs() };
+        commands.push(c);
+    }
+    void stopAll() {
+        if (!backend) return;
+        AudioCommand c = { AudioCommand::STOP_ALL, 0, false, 0.0f, nowMs() };
+        commands.push(c);
+    }
+    
+    // Mixer thread: applies pending commands and mixes one interleaved block
+    void render(float* out, int frames) {
+        double t0 = nowMs();
+        uint32_t first;
+        uint32_t count = commands.readable(first);
+        for (uint32_t i = 0; i < count; i++) apply(commands.at(first + i));
+        commands.release(count);
+        
+        std::fill(out, out + frames * AUDIO_CHANNELS, 0.0f);
+        for (Voice& v : voices) {
+            if (!v.active) continue;
+            const Sample& s = samples[v.sound];
+            if (s.frames == 0) { v.active = false; continue; }
+            for (int f = 0; f < frames; f++) {
+                if (v.position >= s.frames) {
+                    if (!v.loop) { v.active = false; break; }
+                    v.position = 0;
+                }
+                const float* in = &s.data[v.position * s.channels];
+                out[f * 2] += in[0] * v.gain;
+                out[f * 2 + 1] += in[s.channels - 1] * v.gain;
+                v.position++;
+            }
+        }
+        for (int i = 0; i < frames * AUDIO_CHANNELS; i++) {
+            out[i] = std::max(-1.0f, std::min(1.0f, out[i]));
+        }
+        int active = 0;
+        for (const Voice& v : voices) active += v.active;
+        counters.voices.store(active, std::memory_order_relaxed);
+        add(counters.blocks, 1);
+        add(counters.mixMs, nowMs() - t0);
+    }
+    
+    Stats stats() const {
+        Stats s;
+        s.blocks = counters.blocks.load(std::memory_order_relaxed);
+        s.commands = counters.commands.load(std::memory_order_relaxed);
+        s.underruns = counters.underruns.load(std::memory_order_relaxed);
+        s.latencySumMs = counters.latencySumMs.load(std::memory_order_relaxed);
+        s.latencyMaxMs = counters.latencyMaxMs.load(std::memory_order_relaxed);
+        s.mixMs = counters.mixMs.load(std::memory_order_relaxed);
+        return s;
+    }
+    int activeVoices() const { return counters.voices.load(std::memory_order_relaxed); }
+    uint64_t droppedCommands() const { return commands.dropped.load(); }
+};
+
+AudioMixer audio;
+
+// The platform's sound output unless a null or WAV file sink is asked for
+AudioBackend* createAudioBackend(bool null, const std::string& wavPath) {
+    if (!wavPath.empty()) return new WavFileAudioBackend(wavPath);
+#ifdef __APPLE__
+    if (!null) return new AudioQueueBackend();
+#endif
+    (void)null;
+    return new NullAudioBackend();
+}
+
+#ifdef __APPLE__
+void AudioQueueBackend::callback(void* user, AudioQueueRef q, AudioQueueBufferRef buffer) {
+    (void)user;
+    audio.render((float*)buffer->mAudioData, AUDIO_BLOCK_FRAMES);
+    buffer->mAudioDataByteSize = AUDIO_BLOCK_FRAMES * AUDIO_CHANNELS * sizeof(float);
+    AudioQueueEnqueueBuffer(q, buffer, 0, NULL);
+}
+
+bool AudioQueueBackend::open() {
+    AudioStreamBasicDescription format;
+    memset(&format, 0, sizeof(format));
+    format.mSampleRate = AUDIO_RATE;
+    format.mFormatID = kAudioFormatLinearPCM;
+    format.mFormatFlags = kLinearPCMFormatFlagIsFloat | kLinearPCMFormatFlagIsPacked;
+    format.mBitsPerChannel = 32;
+    format.mChannelsPerFrame = AUDIO_CHANNELS;
+    format.mFramesPerPacket = 1;
+    format.mBytesPerFrame = AUDIO_CHANNELS * sizeof(float);
+    format.mBytesPerPacket = format.mBytesPerFrame;
+    // No run loop: Core Audio calls back on its own real-time thread
+    if (AudioQueueNewOutput(&format, callback, NULL, NULL, NULL, 0, &queue) != noErr) return false;
+    for (int i = 0; i < BUFFERS; i++) {
+        if (AudioQueueAllocateBuffer(queue, AUDIO_BLOCK_FRAMES * format.mBytesPerFrame, &buffers[i]) != noErr) {
+            close();
+            return false;
+        }
+        callback(NULL, queue, buffers[i]); // prime with silence
+    }
+    if (AudioQueueStart(queue, NULL) != noErr) {
+        close();
+        return false;
+    }
+    return true;
+}
+#endif
+
+// ==================== PROXIMITY KERNEL ====================
+// Tests a batch of positions, one array per coordinate, against one or more
+// query spheres and returns a hit bitmask per query. The vector paths do the
+// same float operations in the same order as the scalar one and never fuse
+// a multiply into an add, so every path sets exactly the same bits
+// (--verify-simd checks this).
+struct ProximityQuery {
+    float x, y, z;
+    float radius2;  // squared radius; a hit is strictly inside
+    
+    ProximityQuery() : x(0), y(0), z(0), radius2(0) {}
+    ProximityQuery(const Vector3& center, float radius)
+        : x(center.x), y(center.y), z(center.z), radius2(radius * radius) {}
+};
+
+// masks holds queryCount rows of maskWords(count) words; bit i of row q is
+// set when position i lies within query q
+typedef void (*ProximityFn)(const float* x, const float* y, const float* z, int count,
+                            const ProximityQuery* queries, int queryCount, uint64_t* masks);
+
+inline int proximityMaskWords(int count) { return (count + 63) / 64; }
+
+// Written as separate statements so no compiler contracts them into an FMA
+inline bool proximityHit(float x, float y, float z, const ProximityQuery& q) {
+    float dx = x - q.x;
+    float dy = y - q.y;
+    float dz = z - q.z;
+    float dx2 = dx * dx;
+    float dy2 = dy * dy;
+    float dz2 = dz * dz;
+    float sum = dx2 + dy2;
+    sum = sum + dz2;
+    return sum < q.radius2;
+}
+
+// Positions from `first` on, one at a time, for the scalar path and the tails
+inline void proximityTail(const float* x, const float* y, const float* z, int first, int count,
+                          const ProximityQuery* queries, int queryCount, uint64_t* masks) {
+    int words = proximityMaskWords(count);
+    for (int q = 0; q < queryCount; q++) {
+        uint64_t* mask = masks + (size_t)q * words;
+        for (int i = first; i < count; i++) {
+            mask[i >> 6] |= (uint64_t)proximityHit(x[i], y[i], z[i], queries[q]) << (i & 63);
+        }
+    }
+}
+
+void proximityScalar(const float* x, const float* y, const float* z, int count,
+                     const ProximityQuery* queries, int queryCount, uint64_t* masks) {
+    memset(masks, 0, (size_t)queryCount * proximityMaskWords(count) * sizeof(uint64_t));
+    proximityTail(x, y, z, 0, count, queries, queryCount, masks);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+void proximitySSE2(const float* x, const float* y, const float* z, int count,
+                   const ProximityQuery* queries, int queryCount, uint64_t* masks) {
+    int words = proximityMaskWords(count);
+    memset(masks, 0, (size_t)queryCount * words * sizeof(uint64_t));
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i);
+        __m128 py = _mm_loadu_ps(y + i);
+        __m128 pz = _mm_loadu_ps(z + i);
+        for (int q = 0; q < queryCount; q++) {
+            const ProximityQuery& query = queries[q];
+            __m128 dx = _mm_sub_ps(px, _mm_set1_ps(query.x));
+            __m128 dy = _mm_sub_ps(py, _mm_set1_ps(query.y));
+            __m128 dz = _mm_sub_ps(pz, _mm_set1_ps(query.z));
+            __m128 sum = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            int bits = _mm_movemask_ps(_mm_cmplt_ps(sum, _mm_set1_ps(query.radius2)));
+            masks[(size_t)q * words + (i >> 6)] |= (uint64_t)bits << (i & 63);
+        }
+    }
+    proximityTail(x, y, z, i, count, queries, queryCount, masks);
+}
+
+__attribute__((target("avx2")))
+void proximityAVX2(const float* x, const float* y, const float* z, int count,
+                   const ProximityQuery* queries, int queryCount, uint64_t* masks) {
+    int words = proximityMaskWords(count);
+    memset(masks, 0, (size_t)queryCount * words * sizeof(uint64_t));
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i);
+        __m256 py = _mm256_loadu_ps(y + i);
+        __m256 pz = _mm256_loadu_ps(z + i);
+        for (int q = 0; q < queryCount; q++) {
+            const ProximityQuery& query = queries[q];
+            __m256 dx = _mm256_sub_ps(px, _mm256_set1_ps(query.x));
+            __m256 dy = _mm256_sub_ps(py, _mm256_set1_ps(query.y));
+            __m256 dz = _mm256_sub_ps(pz, _mm256_set1_ps(query.z));
+            __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                       _mm256_mul_ps(dz, dz));
+            int bits = _mm256_movemask_ps(_mm256_cmp_ps(sum, _mm256_set1_ps(query.radius2), _CMP_LT_OQ));
+            masks[(size_t)q * words + (i >> 6)] |= (uint64_t)bits << (i & 63);
+        }
+    }
+    proximityTail(x, y, z, i, count, queries, queryCount, masks);
+}
+#endif
+
+#if defined(__ARM_NEON) && defined(__aarch64__)
+void proximityNEON(const float* x, const float* y, const float* z, int count,
+                   const ProximityQuery* queries, int queryCount, uint64_t* masks) {
+    int words = proximityMaskWords(count);
+    memset(masks, 0, (size_t)queryCount * words * sizeof(uint64_t));
+    const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+    uint32x4_t lanes = vld1q_u32(laneBits);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t px = vld1q_f32(x + i);
+        float32x4_t py = vld1q_f32(y + i);
+        float32x4_t pz = vld1q_f32(z + i);
+        for (int q = 0; q < queryCount; q++) {
+            const ProximityQuery& query = queries[q];
+            float32x4_t dx = vsubq_f32(px, vdupq_n_f32(query.x));
+            float32x4_t dy = vsubq_f32(py, vdupq_n_f32(query.y));
+            float32x4_t dz = vsubq_f32(pz, vdupq_n_f32(query.z));
+            // vmulq/vaddq rather than vfmaq, to round like the scalar path
+            float32x4_t sum = vaddq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)), vmulq_f32(dz, dz));
+            uint32_t bits = vaddvq_u32(vandq_u32(vcltq_f32(sum, vdupq_n_f32(query.radius2)), lanes));
+            masks[(size_t)q * words + (i >> 6)] |= (uint64_t)bits << (i & 63);
+        }
+    }
+    proximityTail(x, y, z, i, count, queries, queryCount, masks);
+}
+#endif
+
+// Picks the widest path the CPU runs at startup; use() can force another
+// one for comparisons
+class ProximityKernel {
+public:
+    enum Level { SCALAR, SSE2, AVX2, NEON, LEVEL_COUNT };
+    
+private:
+    Level current;
+    ProximityFn fn;
+    
+public:
+    ProximityKernel() : current(SCALAR), fn(proximityScalar) {
+        for (int level = LEVEL_COUNT - 1; level > SCALAR; level--) {
+            if (use((Level)level)) break;
+        }
+    }
+    
+    static const char* name(Level level) {
+        static const char* names[LEVEL_COUNT] = { "scalar", "sse2", "avx2", "neon" };
+        return names[level];
+    }
+    
+    static ProximityFn function(Level level) {
+        switch (level) {
+#if defined(__x86_64__) || defined(__i386__)
+            case SSE2: return __builtin_cpu_supports("sse2") ? proximitySSE2 : NULL;
+            case AVX2: return __builtin_cpu_supports("avx2") ? proximityAVX2 : NULL;
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+            case NEON: return proximityNEON;
+#endif
+            case SCALAR: return proximityScalar;
+            default: return NULL;
+        }
+    }
+    
+    bool use(Level level) {
+        ProximityFn f = function(level);
+        if (!f) return false;
+        current = level;
+        fn = f;
+        return true;
+    }
+    
+    Level level() const { return current; }
+    
+    // Batches shorter than a vector skip the indirect call; all paths set the
+    // same bits, so this only saves time
+    void test(const float* x, const float* y, const float* z, int count,
+              const ProximityQuery* queries, int queryCount, uint64_t* masks) const {
+        if (count < 8) {
+            int words = proximityMaskWords(count);
+            for (int w = 0; w < queryCount * words; w++) masks[w] = 0;
+            proximityTail(x, y, z, 0, count, queries, queryCount, masks);
+        } else {
+            fn(x, y, z, count, queries, queryCount, masks);
+        }
+    }
+};
+
+ProximityKernel proximity;
+
+// ==================== SPATIAL INDEX ====================
+// Uniform grid over the XZ plane holding the uncollected collectibles. Queries
+// only visit the cells overlapping the search area, so their cost depends on
+// local density rather than on how many collectibles the level has.
+class CollectibleGrid {
+private:
+    struct Entry {
+        int index;
+        float x, y, z;
+    };
+    
+    float cellSize;
+    int minCellX, maxCellX, minCellZ, maxCellZ;
+    size_t count;
+    std::unordered_map<long long, std::vector<Entry>> cells;
+    mutable std::vector<std::pair<float, int>> hits; // scratch space for queries
+    
+    int cellOf(float v) const { return (int)floor(v / cellSize); }
+    
+    static long long key(int cx, int cz) {
+        return ((long long)cx << 32) ^ (long long)(unsigned int)cz;
+    }
+    
+    // Appends the entries of one cell that lie within sqrt(r2) of center
+    void collect(int cx, int cz, const Vector3& center, float r2,
+                 std::vector<std::pair<float, int>>& out) const {
+        auto it = cells.find(key(cx, cz));
+        if (it == cells.end()) return;
+        for (const Entry& e : it->second) {
+            float dx = e.x - center.x;
+            float dy = e.y - center.y;
+            float dz = e.z - center.z;
+            float d2 = dx*dx + dy*dy + dz*dz;
+            if (d2 < r2) out.push_back(std::make_pair(d2, e.index));
+        }
+    }
+    
+public:
+    CollectibleGrid() : cellSize(1), minCellX(0), maxCellX(-1), minCellZ(0), maxCellZ(-1), count(0) {}
+    
+    void clear(float cell) {
+        cellSize = cell;
+        cells.clear();
+        count = 0;
+        minCellX = minCellZ = 0;
+        maxCellX = maxCellZ = -1;
+    }
+    
+    void build(const CollectibleTable& items, float cell) {
+        clear(cell);
+        for (int i = 0; i < items.count(); i++) {
+            if (!items.collected[i]) insert(i, items.transform.position(i));
+        }
+    }
+    
+    void insert(int index, const Vector3& pos) {
+        int cx = cellOf(pos.x), cz = cellOf(pos.z);
+        if (count == 0) {
+            minCellX = maxCellX = cx;
+            minCellZ = maxCellZ = cz;
+        } else {
+            minCellX = std::min(minCellX, cx); maxCellX = std::max(maxCellX, cx);
+            minCellZ = std::min(minCellZ, cz); maxCellZ = std::max(maxCellZ, cz);
+        }
+        Entry e = { index, pos.x, pos.y, pos.z };
+        cells[key(cx, cz)].push_back(e);
+        count++;
+    }
+    
+    bool remove(int index, const Vector3& pos) {
+        auto it = cells.find(key(cellOf(pos.x), cellOf(pos.z)));
+        if (it == cells.end()) return false;
+        std::vector<Entry>& bucket = it->second;
+        for (size_t i = 0; i < bucket.size(); i++) {
+            if (bucket[i].index == index) {
+                bucket[i] = bucket.back();
+                bucket.pop_back();
+                if (bucket.empty()) cells.erase(it);
+                count--;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // Indices of all entries strictly within radius of center, in index order
+    void queryRadius(const Vector3& center, float radius, std::vector<int>& out) const {
+        out.clear();
+        if (count == 0) return;
+        hits.clear();
+        float r2 = radius * radius;
+        int x0 = cellOf(center.x - radius), x1 = cellOf(center.x + radius);
+        int z0 = cellOf(center.z - radius), z1 = cellOf(center.z + radius);
+        for (int cx = x0; cx <= x1; cx++) {
+            for (int cz = z0; cz <= z1; cz++) {
+                collect(cx, cz, center, r2, hits);
+            }
+        }
+        for (const auto& h : hits) out.push_back(h.second);
+        std::sort(out.begin(), out.end());
+    }
+    
+    // Up to k nearest entries, closest first. Searches outward ring by ring and
+    // stops once no unvisited cell can hold anything closer than the k-th hit.
+    void nearest(const Vector3& center, int k, std::vector<int>& out) const {
+        nearest(center, k, out, hits);
+    }
+    
+    // The same with the caller's scratch space, so jobs can search at the same
+    // time while nothing changes the grid
+    void nearest(const Vector3& center, int k, std::vector<int>& out, std::vector<std::pair<float, int>>& scratch) const {
+        out.clear();
+        if (count == 0 || k <= 0) return;
+        const float inf = 1e30f;
+        scratch.clear();
+        int ccx = cellOf(center.x), ccz = cellOf(center.z);
+        int maxRing = std::max(std::max(std::abs(ccx - minCellX), std::abs(maxCellX - ccx)),
+                               std::max(std::abs(ccz - minCellZ), std::abs(maxCellZ - ccz)));
+        // How far center is from the edges of its own cell; ring r + 1 is at
+        // least r cells further out
+        float edge = std::min(std::min(center.x - ccx * cellSize, (ccx + 1) * cellSize - center.x),
+                              std::min(center.z - ccz * cellSize, (ccz + 1) * cellSize - center.z));
+        edge = std::max(edge, 0.0f);
+        for (int ring = 0; ring <= maxRing; ring++) {
+            for (int cx = ccx - ring; cx <= ccx + ring; cx++) {
+                bool edgeColumn = (cx == ccx - ring || cx == ccx + ring);
+                for (int cz = ccz - ring; cz <= ccz + ring; cz += edgeColumn ? 1 : 2 * ring) {
+                    collect(cx, cz, center, inf, scratch);
+                    if (ring == 0) break;
+                }
+            }
+            if ((int)scratch.size() >= k) {
+                std::nth_element(scratch.begin(), scratch.begin() + (k - 1), scratch.end());
+                float reach = ring * cellSize + edge; // closest any cell of the next ring can be
+                if (scratch[k - 1].first <= reach * reach) break;
+            }
+        }
+        size_t keep = std::min(scratch.size(), (size_t)k);
+        std::partial_sort(scratch.begin(), scratch.begin() + keep, scratch.end());
+        for (size_t i = 0; i < keep; i++) out.push_back(scratch[i].second);
+    }
+    
+    size_t size() const { return count; }
+};
+
+const float GRID_CELL_SIZE = COLLECTION_RADIUS * 2.0f;
+CollectibleGrid collectibleGrid;
+
+// ==================== COLLISION ====================
+// Solid boxes: the arena walls, the platforms and the objects on them, and
+// dynamic boxes that move every step (the player). All of them live in one
+// dynamic AABB tree. The static boxes are built into it once per level;
+// dynamic ones keep a fattened box in the tree, so most moves leave the tree
+// alone. A move is swept against the boxes the tree returns and slides along
+// whatever it hits first, so no step is long enough to pass through a wall.
+struct AABB {
+    Vector3 min, max;
+    
+    AABB() {}
+    AABB(const Vector3& lo, const Vector3& hi) : min(lo), max(hi) {}
+    
+    // Boxes that only touch don't overlap, so a box resting against a wall can slide along it
+    bool overlaps(const AABB& o) const {
+        return min.x < o.max.x && o.min.x < max.x && min.y < o.max.y && o.min.y < max.y &&
+               min.z < o.max.z && o.min.z < max.z;
+    }
+    bool touches(const AABB& o) const {
+        return min.x <= o.max.x && o.min.x <= max.x && min.y <= o.max.y && o.min.y <= max.y &&
+               min.z <= o.max.z && o.min.z <= max.z;
+    }
+    bool contains(const AABB& o) const {
+        return min.x <= o.min.x && min.y <= o.min.y && min.z <= o.min.z &&
+               o.max.x <= max.x && o.max.y <= max.y && o.max.z <= max.z;
+    }
+    AABB merged(const AABB& o) const {
+        return AABB(Vector3(std::min(min.x, o.min.x), std::min(min.y, o.min.y), std::min(min.z, o.min.z)),
+                    Vector3(std::max(max.x, o.max.x), std::max(max.y, o.max.y), std::max(max.z, o.max.z)));
+    }
+    AABB expanded(float margin) const {
+        return AABB(Vector3(min.x - margin, min.y - margin, min.z - margin),
+                    Vector3(max.x + margin, max.y + margin, max.z + margin));
+    }
+    AABB moved(const Vector3& d) const {
+        return AABB(Vector3(min.x + d.x, min.y + d.y, min.z + d.z), Vector3(max.x + d.x, max.y + d.y, max.z + d.z));
+    }
+    // Half the surface area, which the tree keeps small on every path
+    float cost() const {
+        float dx = max.x - min.x, dy = max.y - min.y, dz = max.z - min.z;
+        return dx * dy + dy * dz + dz * dx;
+    }
+};
+
+inline float axisOf(const Vector3& v, int axis) { return axis == 0 ? v.x : axis == 1 ? v.y : v.z; }
+
+// Binary tree of boxes; every inner node's box holds both of its children.
+// build() makes a balanced tree over a fixed set in one pass; insert() picks
+// the cheapest place for one more box and rotates the path back to balance,
+// the way Box2D's dynamic tree does.
+class AABBTree {
+public:
+    static const int NONE = -1;
+
+private:
+    struct Node {
+        AABB box;
+        int parent;        // next free node while unused
+        int left, right;   // NONE in a leaf
+        int height;        // 0 for a leaf
+        int item;          // the leaf's collider
+        bool leaf() const { return left == NONE; }
+    };
+    
+    std::vector<Node> nodes;
+    int root;
+    int freeList;
+    int leaves;
+    
+    int allocate() {
+        if (freeList == NONE) {
+            nodes.push_back(Node());
+            freeList = (int)nodes.size() - 1;
+            nodes[freeList].parent = NONE;
+        }
+        int n = freeList;
+        freeList = nodes[n].parent;
+        nodes[n].parent = nodes[n].left = nodes[n].right = NONE;
+        nodes[n].height = 0;
+        nodes[n].item = NONE;
+        return n;
+    }
+    
+    void release(int n) {
+        nodes[n].parent = freeList;
+        nodes[n].height = -1;
+        freeList = n;
+    }
+    
+    void replaceChild(int parent, int from, int to) {
+        if (parent == NONE) root = to;
+        else if (nodes[parent].left == from) nodes[parent].left = to;
+        else nodes[parent].right = to;
+    }
+    
+    void fit(int n) {
+        Node& node = nodes[n];
+        node.box = nodes[node.left].box.merged(nodes[node.right].box);
+        node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+    }
+    
+    // Lifts the child `up` of n into n's place when one side is two levels
+    // taller: n keeps its other child and takes up's shorter child
+    int balance(int n) {
+        if (nodes[n].leaf() || nodes[n].height < 2) return n;
+        int left = nodes[n].left, right = nodes[n].right;
+        int diff = nodes[right].height - nodes[left].height;
+        if (diff >= -1 && diff <= 1) return n;
+        int up = diff > 1 ? right : left;
+        int f = nodes[up].left, g = nodes[up].right;
+        int tall = nodes[f].height > nodes[g].height ? f : g;
+        int small = tall == f ? g : f;
+        
+        nodes[up].parent = nodes[n].parent;
+        replaceChild(nodes[n].parent, n, up);
+        nodes[n].parent = up;
+        nodes[up].left = n;
+        nodes[up].right = tall;
+        if (nodes[n].left == up) nodes[n].left = small;
+        else nodes[n].right = small;
+        nodes[small].parent = n;
+        fit(n);
+        fit(up);
+        return up;
+    }
+    
+    // Rebalances and refits from n up to the root
+    void refit(int n) {
+        while (n != NONE) {
+            n = balance(n);
+            fit(n);
+            n = nodes[n].parent;
+        }
+    }
+    
+    void insertLeaf(int leaf) {
+        leaves++;
+        if (root == NONE) {
+            root = leaf;
+            nodes[leaf].parent = NONE;
+            return;
+        }
+        // Walk down while splitting off lower is cheaper than pairing here
+        AABB box = nodes[leaf].box;
+        int n = root;
+        while (!nodes[n].leaf()) {
+            float area = nodes[n].box.cost();
+            float combined = nodes[n].box.merged(box).cost();
+            float here = 2 * combined;
+            float inherited = 2 * (combined - area);
+            float costs[2];
+            int children[2] = { nodes[n].left, nodes[n].right };
+            for (int c = 0; c < 2; c++) {
+                const AABB& child = nodes[children[c]].box;
+                float grown = child.merged(box).cost();
+                costs[c] = (nodes[children[c]].leaf() ? grown : grown - child.cost()) + inherited;
+            }
+            if (here < costs[0] && here < costs[1]) break;
+            n = costs[0] < costs[1] ? children[0] : children[1];
+        }
+        
+        int sibling = n;
+        int oldParent = nodes[sibling].parent;
+        int parent = allocate();
+        nodes[parent].parent = oldParent;
+        nodes[parent].left = sibling;
+        nodes[parent].right = leaf;
+        replaceChild(oldParent, sibling, parent);
+        nodes[sibling].parent = parent;
+        nodes[leaf].parent = parent;
+        refit(parent);
+    }
+    
+    void removeLeaf(int leaf) {
+        leaves--;
+        if (leaf == root) {
+            root = NONE;
+            return;
+        }
+        int parent = nodes[leaf].parent;
+        int grandparent = nodes[parent].parent;
+        int sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+        replaceChild(grandparent, parent, sibling);
+        nodes[sibling].parent = grandparent;
+        release(parent);
+        refit(grandparent);
+    }
+    
+    // Top-down build over leaf ids [begin, end): median split along the
+    // longest axis of their centers
+    int buildRange(std::vector<int>& ids, int begin, int end) {
+        if (end - begin == 1) return ids[begin];
+        Vector3 lo(1e30f, 1e30f, 1e30f), hi(-1e30f, -1e30f, -1e30f);
+        for (int i = begin; i < end; i++) {
+            const AABB& b = nodes[ids[i]].box;
+            Vector3 c((b.min.x + b.max.x) * 0.5f, (b.min.y + b.max.y) * 0.5f, (b.min.z + b.max.z) * 0.5f);
+            lo = Vector3(std::min(lo.x, c.x), std::min(lo.y, c.y), std::min(lo.z, c.z));
+            hi = Vector3(std::max(hi.x, c.x), std::max(hi.y, c.y), std::max(hi.z, c.z));
+        }
+        int axis = 0;
+        if (hi.y - lo.y > axisOf(hi, axis) - axisOf(lo, axis)) axis = 1;
+        if (hi.z - lo.z > axisOf(hi, axis) - axisOf(lo, axis)) axis = 2;
+        int mid = begin + (end - begin) / 2;
+        std::nth_element(ids.begin() + begin, ids.begin() + mid, ids.begin() + end, [&](int a, int b) {
+            return axisOf(nodes[a].box.min, axis) + axisOf(nodes[a].box.max, axis) <
+                   axisOf(nodes[b].box.min, axis) + axisOf(nodes[b].box.max, axis);
+        });
+        int left = buildRange(ids, begin, mid);
+        int right = buildRange(ids, mid, end);
+        int n = allocate();
+        nodes[n].left = left;
+        nodes[n].right = right;
+        nodes[left].parent = nodes[right].parent = n;
+        fit(n);
+        return n;
+    }
+
+public:
+    AABBTree() : root(NONE), freeList(NONE), leaves(0) {}
+    
+    void clear() {
+        nodes.clear();
+        root = freeList = NONE;
+        leaves = 0;
+    }
+    
+    // Replaces the tree with one over boxes; box i becomes leaf i holding item i
+    void build(const std::vector<AABB>& boxes) {
+        clear();
+        nodes.reserve(boxes.size() * 2);
+        std::vector<int> ids(boxes.size());
+        for (size_t i = 0; i < boxes.size(); i++) {
+            ids[i] = allocate();
+            nodes[ids[i]].box = boxes[i];
+            nodes[ids[i]].item = (int)i;
+        }
+        leaves = (int)boxes.size();
+        if (!ids.empty()) {
+            root = buildRange(ids, 0, (int)ids.size());
+            nodes[root].parent = NONE;
+        }
+    }
+    
+    int insert(const AABB& box, int item) {
+        int leaf = allocate();
+        nodes[leaf].box = box;
+        nodes[leaf].item = item;
+        insertLeaf(leaf);
+        return leaf;
+    }
+    
+    void remove(int leaf) {
+        removeLeaf(leaf);
+        release(leaf);
+    }
+    
+    // Gives the leaf a new box unless its current one already holds `box`.
+    // Returns true when it had to move in the tree.
+    bool move(int leaf, const AABB& box, float margin) {
+        if (nodes[leaf].box.contains(box)) return false;
+        removeLeaf(leaf);
+        nodes[leaf].box = box.expanded(margin);
+        insertLeaf(leaf);
+        return true;
+    }
+    
+    const AABB& box(int leaf) const { return nodes[leaf].box; }
+    
+    // Calls visit(item) for every leaf whose box touches `box`; returns the
+    // number of nodes looked at
+    template <typename Visit>
+    int query(const AABB& box, Visit visit) const {
+        if (root == NONE) return 0;
+        // Holds at most one pending node per level, plus one
+        int fixed[64];
+        std::vector<int> deep;
+        int* stack = fixed;
+        if (height() >= 63) {
+            deep.resize(height() + 2);
+            stack = deep.data();
+        }
+        int top = 0, visited = 0;
+        stack[top++] = root;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            visited++;
+            if (!node.box.touches(box)) continue;
+            if (node.leaf()) {
+                visit(node.item);
+            } else {
+                stack[top++] = node.left;
+                stack[top++] = node.right;
+            }
+        }
+        return visited;
+    }
+    
+    int size() const { return leaves; }
+    int height() const { return root == NONE ? 0 : nodes[root].height; }
+};
+
+enum ColliderKind { COLLIDER_WALL, COLLIDER_PLATFORM, COLLIDER_PROP, COLLIDER_DYNAMIC };
+
+struct Collider {
+    AABB box;
+    ColliderKind kind;
+    int owner;   // platform of a platform or prop, otherwise -1
+    int proxy;   // leaf in the tree
+    std::vector<int> nearby;  // dynamic only: every collider whose box may touch its fattened box
+    
+    Collider() : kind(COLLIDER_WALL), owner(-1), proxy(AABBTree::NONE) {}
+    Collider(const AABB& b, ColliderKind k, int o) : box(b), kind(k), owner(o), proxy(AABBTree::NONE) {}
+};
+
+// Running totals; the profiler overlay and the exit statistics divide them by steps
+struct CollisionStats {
+    long steps;
+    long queries;        // tree queries
+    long cached;         // queries answered from a dynamic collider's pair list instead
+    long nodesVisited;
+    long pairsTested;    // box-against-box sweeps and overlap tests
+    long contacts;       // sweeps that hit something
+    long reinserts;      // dynamic boxes that left their fattened box
+    
+    CollisionStats() : steps(0), queries(0), cached(0), nodesVisited(0), pairsTested(0), contacts(0), reinserts(0) {}
+    
+    void add(const CollisionStats& o) {
+        steps += o.steps;
+        queries += o.queries;
+        cached += o.cached;
+        nodesVisited += o.nodesVisited;
+        pairsTested += o.pairsTested;
+        contacts += o.contacts;
+        reinserts += o.reinserts;
+    }
+};
+
+const float COLLISION_MARGIN = 2.0f;   // dynamic boxes move this far before the tree is touched
+const float COLLISION_SKIN = 0.001f;   // gap left between a moving box and what it hits
+const int MAX_SLIDES = 3;               // hits resolved per move
+const float GROUND_LEVEL = 0.0f;
+
+// Earliest time in [0, 1] at which `box`, moving by d, touches `other`, and
+// the axis it hits along. False if it never does in this move, or if the two
+// overlap already, so a box that got stuck inside another can move out.
+bool sweepBox(const AABB& box, const Vector3& d, const AABB& other, float& t, int& axis) {
+    float enter = -1e30f, exit = 1e30f;
+    for (int a = 0; a < 3; a++) {
+        float v = axisOf(d, a);
+        float lo = axisOf(box.min, a), hi = axisOf(box.max, a);
+        float otherLo = axisOf(other.min, a), otherHi = axisOf(other.max, a);
+        if (v == 0) {
+            if (hi <= otherLo || lo >= otherHi) return false;
+            continue;
+        }
+        float t0 = ((v > 0 ? otherLo - hi : otherHi - lo)) / v;
+        float t1 = ((v > 0 ? otherHi - lo : otherLo - hi)) / v;
+        if (t0 > enter) {
+            enter = t0;
+            axis = a;
+        }
+        exit = std::min(exit, t1);
+    }
+    if (enter < 0 || enter > 1 || enter >= exit) return false;
+    t = enter;
+    return true;
+}
+
+class CollisionWorld {
+private:
+    AABBTree tree;
+    std::vector<Collider> colliders;   // the static ones first, in build() order
+    std::vector<int> candidates;
+    int staticCount;
+    
+    void gather(const AABB& area, int ignore) {
+        candidates.clear();
+        stats.queries++;
+        stats.nodesVisited += tree.query(area, [&](int c) {
+            if (c != ignore) candidates.push_back(c);
+        });
+    }
+    
+    // Candidates for an area around dynamic collider id: its pair list while
+    // the area stays inside its fattened box, otherwise a tree query
+    const std::vector<int>& candidatesNear(const AABB& area, int id) {
+        if (id >= 0 && colliders[id].kind == COLLIDER_DYNAMIC && tree.box(colliders[id].proxy).contains(area)) {
+            stats.cached++;
+            return colliders[id].nearby;
+        }
+        gather(area, id);
+        return candidates;
+    }
+    
+    // Pairs a dynamic collider with everything its new fattened box touches.
+    // Fattened boxes only change here, so any two that touch are on each
+    // other's lists; entries for boxes that moved apart go once the list's
+    // owner moves in the tree itself.
+    void pairUp(int id) {
+        gather(tree.box(colliders[id].proxy), id);
+        colliders[id].nearby = candidates;
+        for (int c : candidates) {
+            std::vector<int>& theirs = colliders[c].nearby;
+            if (colliders[c].kind == COLLIDER_DYNAMIC && std::find(theirs.begin(), theirs.end(), id) == theirs.end()) {
+                theirs.push_back(id);
+            }
+        }
+    }
+
+public:
+    CollisionStats stats;
+    
+    CollisionWorld() : staticCount(0) {}
+    
+    // Replaces every collider with the static ones given
+    void build(const std::vector<Collider>& statics) {
+        colliders = statics;
+        staticCount = (int)statics.size();
+        std::vector<AABB> boxes(statics.size());
+        for (size_t i = 0; i < statics.size(); i++) boxes[i] = statics[i].box;
+        tree.build(boxes);
+        for (int i = 0; i < staticCount; i++) colliders[i].proxy = i;
+    }
+    
+    int addDynamic(const AABB& box) {
+        Collider c(box, COLLIDER_DYNAMIC, -1);
+        c.proxy = tree.insert(box.expanded(COLLISION_MARGIN), (int)colliders.size());
+        colliders.push_back(c);
+        pairUp((int)colliders.size() - 1);
+        return (int)colliders.size() - 1;
+    }
+    
+    // Puts a dynamic collider somewhere without sweeping it there
+    void place(int id, const AABB& box) {
+        colliders[id].box = box;
+        if (tree.move(colliders[id].proxy, box, COLLISION_MARGIN)) {
+            stats.reinserts++;
+            pairUp(id);
+        }
+    }
+    
+    // Colliders other than `ignore` that overlap box
+    void overlapping(const AABB& box, int ignore, std::vector<int>& out) {
+        const std::vector<int>& near = candidatesNear(box, ignore);
+        out.clear();
+        for (int c : near) {
+            stats.pairsTested++;
+            if (colliders[c].box.overlaps(box)) out.push_back(c);
+        }
+    }
+    
+    // Sweeps box by delta and returns where it ends up. It slides along what
+    // it hits and climbs onto anything whose top is at most stepHeight above
+    // its bottom; afterwards it stands on the highest such box under it, or
+    // on the ground. near(area) returns the colliders that may touch area.
+    template <typename Near>
+    AABB sweep(AABB box, Vector3 delta, float stepHeight, Near near, CollisionStats& counts) const {
+        const AABB start = box;
+        for (int slide = 0; slide < MAX_SLIDES && (delta.x != 0 || delta.y != 0 || delta.z != 0); slide++) {
+            float first = 1;
+            int axis = -1;
+            for (int c : near(box.merged(box.moved(delta)))) {
+                const AABB& other = colliders[c].box;
+                counts.pairsTested++;
+                if (other.max.y <= box.min.y + stepHeight) continue; // stepped onto below
+                float t;
+                int a;
+                if (sweepBox(box, delta, other, t, a) && t < first) {
+                    first = t;
+                    axis = a;
+                }
+            }
+            if (axis < 0) {
+                box = box.moved(delta);
+                break;
+            }
+            // Stop just short of the hit and keep the rest of the move along the surface
+            counts.contacts++;
+            float travel = std::max(0.0f, first - COLLISION_SKIN / fabsf(axisOf(delta, axis)));
+            box = box.moved(Vector3(delta.x * travel, delta.y * travel, delta.z * travel));
+            float rest = 1 - first;
+            delta = Vector3(axis == 0 ? 0 : delta.x * rest, axis == 1 ? 0 : delta.y * rest,
+                            axis == 2 ? 0 : delta.z * rest);
+        }
+        
+        if (stepHeight > 0) {
+            AABB column(Vector3(box.min.x, GROUND_LEVEL, box.min.z),
+                        Vector3(box.max.x, box.min.y + stepHeight, box.max.z));
+            float support = GROUND_LEVEL;
+            for (int c : near(column)) {
+                const AABB& other = colliders[c].box;
+                counts.pairsTested++;
+                if (other.overlaps(column) && other.max.y <= column.max.y) support = std::max(support, other.max.y);
+            }
+            bool climbed = support > box.min.y;
+            box = box.moved(Vector3(0, support - box.min.y, 0));
+            
+            // Climbing may have put it into something overhead; then it stays put
+            if (climbed) {
+                for (int c : near(box)) {
+                    counts.pairsTested++;
+                    if (colliders[c].box.overlaps(box) && !colliders[c].box.overlaps(start)) {
+                        box = start;
+                        break;
+                    }
+                }
+            }
+        }
+        return box;
+    }
+    
+    // Sweeps dynamic collider id by delta (see sweep()) and returns how far it got
+    Vector3 move(int id, Vector3 delta, float stepHeight) {
+        const AABB start = colliders[id].box;
+        AABB box = sweep(start, delta, stepHeight, [this, id](const AABB& area) -> const std::vector<int>& {
+            return candidatesNear(area, id);
+        }, stats);
+        place(id, box);
+        return Vector3(box.min.x - start.min.x, box.min.y - start.min.y, box.min.z - start.min.z);
+    }
+    
+    // The static colliders whose boxes touch area. Only reads the tree, so
+    // jobs may call it together while no dynamic collider moves.
+    void staticNear(const AABB& area, std::vector<int>& out, CollisionStats& counts) const {
+        out.clear();
+        counts.queries++;
+        counts.nodesVisited += tree.query(area, [&](int c) {
+            if (c < staticCount) out.push_back(c);
+        });
+    }
+    
+    // sweep() of a box that is not in the world against the colliders in
+    // near, which must hold everything the move can reach and the ground
+    // under it. Safe to call from jobs like staticNear().
+    AABB sweepAmong(const AABB& box, const Vector3& delta, float stepHeight, const std::vector<int>& near,
+                    CollisionStats& counts) const {
+        return sweep(box, delta, stepHeight, [&near](const AABB&) -> const std::vector<int>& { return near; }, counts);
+    }
+    
+    const Collider& collider(int id) const { return colliders[id]; }
+    int count() const { return (int)colliders.size(); }
+    int staticColliders() const { return staticCount; }
+    int treeHeight() const { return tree.height(); }
+};
+
+// Bounds of the objects on platforms around the platform's position, large
+// enough for every frame of their animations (see drawLantern() and the
+// others). The lantern's chain is too thin to bump into.
+const AABB PROP_BOUNDS[] = {
+    AABB(Vector3(-0.6f, 2.75f, -0.6f), Vector3(0.6f, 6.05f, 0.6f)),   // lantern, bobbing
+    AABB(Vector3(-1.3f, 1.8f, -1.3f), Vector3(1.3f, 5.8f, 1.3f)),     // pagoda, scaled and tilted
+    AABB(Vector3(-1.3f, 1.15f, -1.3f), Vector3(1.3f, 6.1f, 1.3f)),    // statue, orbiting
+    AABB(Vector3(-1.0f, 1.9f, -0.6f), Vector3(1.0f, 5.3f, 0.6f)),     // weapon rack
+};
+
+CollisionWorld collision;
+int playerCollider = -1;
+
+// The player's feet are PLAYER_FOOT_OFFSET below playerPos
+AABB playerBox(const Vector3& pos) {
+    float feet = pos.y - PLAYER_FOOT_OFFSET;
+    return AABB(Vector3(pos.x - PLAYER_HALF_WIDTH, feet, pos.z - PLAYER_HALF_WIDTH),
+                Vector3(pos.x + PLAYER_HALF_WIDTH, feet + PLAYER_HEIGHT, pos.z + PLAYER_HALF_WIDTH));
+}
+
+// Walls, platforms and props for a level, plus the player
+void buildColliders(const PlatformTable& table, float half) {
+    std::vector<Collider> statics;
+    statics.reserve(4 + table.count() * 2);
+    // The walls as drawWalls() draws them
+    const float t = 0.25f;
+    statics.push_back(Collider(AABB(Vector3(-half, 0, -half - t), Vector3(half, WALL_HEIGHT, -half + t)), COLLIDER_WALL, -1));
+    statics.push_back(Collider(AABB(Vector3(-half, 0, half - t), Vector3(half, WALL_HEIGHT, half + t)), COLLIDER_WALL, -1));
+    statics.push_back(Collider(AABB(Vector3(-half - t, 0, -half), Vector3(-half + t, WALL_HEIGHT, half)), COLLIDER_WALL, -1));
+    statics.push_back(Collider(AABB(Vector3(half - t, 0, -half), Vector3(half + t, WALL_HEIGHT, half)), COLLIDER_WALL, -1));
+    for (int p = 0; p < table.count(); p++) {
+        Vector3 pos = table.transform.position(p);
+        Vector3 extent(table.size[p].x * 0.5f, table.size[p].y * 0.5f, table.size[p].z * 0.5f);
+        statics.push_back(Collider(AABB(Vector3(pos.x - extent.x, pos.y - extent.y, pos.z - extent.z),
+                                        Vector3(pos.x + extent.x, pos.y + extent.y, pos.z + extent.z)),
+                                   COLLIDER_PLATFORM, p));
+        int object = table.animationType[p];
+        if (object >= 0 && object < (int)(sizeof(PROP_BOUNDS) / sizeof(PROP_BOUNDS[0]))) {
+            statics.push_back(Collider(PROP_BOUNDS[object].moved(pos), COLLIDER_PROP, p));
+        }
+    }
+    collision.build(statics);
+    playerCollider = collision.addDynamic(playerBox(Vector3(0, PLAYER_FOOT_OFFSET, 0)));
+}
+
+// One line of totals and per-step averages, after the caller's label
+void printCollisionStats(const CollisionStats& stats, int colliders) {
+    double perStep = 1.0 / std::max(1L, stats.steps);
+    std::cout << colliders << " colliders, per step " << std::fixed << std::setprecision(2)
+              << stats.pairsTested * perStep << " pairs tested, " << stats.queries * perStep << " tree queries ("
+              << std::setprecision(1) << stats.nodesVisited / (double)std::max(1L, stats.queries)
+              << " nodes each) and " << std::setprecision(2) << stats.cached * perStep << " from pair lists; "
+              << stats.contacts << " contacts, " << stats.reinserts << " reinserts" << std::endl;
+}
+
+// ==================== NAVIGATION ====================
+// Where a warrior can walk, as a grid of square cells over the level. Cells
+// under walls and props (anything too tall to step onto that the body would
+// hit) are blocked; cells on platforms are open but cost more to cross than
+// the ground, so paths go round platforms unless climbing one saves a lot.
+// Moves go to the 8 neighbours, diagonally only when both cells beside the
+// move are open, so no path cuts a corner.
+//
+// Step costs are integers (5 per unit of the two cells' costs straight, 7
+// diagonally), so a distance is the same whichever order it was found in.
+const float NAV_CELL_SIZE = 1.0f;
+const int NAV_MAX_SIDE = 1024;          // larger levels get coarser cells
+const int NAV_CLIMB_COST = 2;           // per platform cell, against 1 on the ground
+const int NAV_MAX_STEP = 7 * 2 * NAV_CLIMB_COST;
+const int NAV_UNREACHED = INT_MAX;
+const int NAV_PATH_CACHE = 4096;        // cached paths, by start and goal cell
+const int NAV_PATH_WAYS = 8;            // a path may go in any of 8 places, the oldest is replaced
+const int NAV_MAX_EXPANSIONS = 8192;    // A* gives up past this many cells (a millisecond or two)
+const long NAV_FIELD_STEP_CELLS = 16384; // flow field cells refilled per simulation step (a millisecond or two)
+
+class NavGrid {
+public:
+    float cellSize, originX, originZ;
+    int width, height;
+    std::vector<uint8_t> cost;   // per cell, 0 where blocked
+    
+    NavGrid() : cellSize(NAV_CELL_SIZE), originX(0), originZ(0), width(0), height(0) {}
+    
+    // The square of half size `half` around the origin, from the static colliders of world
+    void build(float half, const CollisionWorld& world) {
+        cellSize = std::max(NAV_CELL_SIZE, 2 * half / NAV_MAX_SIDE);
+        width = height = std::max(1, (int)ceilf(2 * half / cellSize));
+        originX = originZ = -half;
+        cost.assign((size_t)width * height, 1);
+        // Platforms first, so the props on them still block
+        for (int pass = 0; pass < 2; pass++) {
+            for (int c = 0; c < world.staticColliders(); c++) {
+                const AABB& box = world.collider(c).box;
+                bool climbable = box.max.y <= GROUND_LEVEL + STEP_HEIGHT;
+                if (climbable != (pass == 0) || box.min.y >= GROUND_LEVEL + STEP_HEIGHT + PLAYER_HEIGHT) continue;
+                if (climbable) {
+                    // Cells whose middle is on top
+                    int x0 = std::max(0, (int)ceilf((box.min.x - originX) / cellSize - 0.5f));
+                    int x1 = std::min(width - 1, (int)floorf((box.max.x - originX) / cellSize - 0.5f));
+                    int z0 = std::max(0, (int)ceilf((box.min.z - originZ) / cellSize - 0.5f));
+                    int z1 = std::min(height - 1, (int)floorf((box.max.z - originZ) / cellSize - 0.5f));
+                    for (int z = z0; z <= z1; z++) {
+                        for (int x = x0; x <= x1; x++) cost[z * width + x] = NAV_CLIMB_COST;
+                    }
+                } else {
+                    // Every cell where a body could touch it
+                    AABB reach = box.expanded(PLAYER_HALF_WIDTH);
+                    int x0 = std::max(0, (int)floorf((reach.min.x - originX) / cellSize));
+                    int x1 = std::min(width - 1, (int)floorf((reach.max.x - originX) / cellSize));
+                    int z0 = std::max(0, (int)floorf((reach.min.z - originZ) / cellSize));
+                    int z1 = std::min(height - 1, (int)floorf((reach.max.z - originZ) / cellSize));
+                    for (int z = z0; z <= z1; z++) {
+                        for (int x = x0; x <= x1; x++) cost[z * width + x] = 0;
+                    }
+                }
+            }
+        }
+    }
+    
+    int cells() const { return width * height; }
+    bool open(int cell) const { return cost[cell] != 0; }
+    
+    // The cell under a point, clamped to the grid
+    int cellAt(float x, float z) const {
+        int cx = std::max(0, std::min(width - 1, (int)floorf((x - originX) / cellSize)));
+        int cz = std::max(0, std::min(height - 1, (int)floorf((z - originZ) / cellSize)));
+        return cz * width + cx;
+    }
+    Vector3 center(int cell) const {
+        return Vector3(originX + (cell % width + 0.5f) * cellSize, GROUND_LEVEL, originZ + (cell / width + 0.5f) * cellSize);
+    }
+    
+    // Calls fn(neighbour, step cost) for every move out of cell, whether or
+    // not the neighbour itself is open; a blocked cell costs like the ground
+    template <typename Fn>
+    void forMoves(int cell, Fn fn) const {
+        const uint8_t* c = cost.data();
+        int cz = cell / width, cx = cell - cz * width;
+        int here = std::max<int>(c[cell], 1);
+        bool left = cx > 0, right = cx < width - 1, back = cz > 0, front = cz < height - 1;
+        if (right) fn(cell + 1, 5 * (here + std::max<int>(c[cell + 1], 1)));
+        if (left) fn(cell - 1, 5 * (here + std::max<int>(c[cell - 1], 1)));
+        if (front) fn(cell + width, 5 * (here + std::max<int>(c[cell + width], 1)));
+        if (back) fn(cell - width, 5 * (here + std::max<int>(c[cell - width], 1)));
+        // Diagonals only past two open cells
+        bool openRight = right && c[cell + 1], openLeft = left && c[cell - 1];
+        bool openFront = front && c[cell + width], openBack = back && c[cell - width];
+        if (openRight && openFront) fn(cell + width + 1, 7 * (here + std::max<int>(c[cell + width + 1], 1)));
+        if (openLeft && openFront) fn(cell + width - 1, 7 * (here + std::max<int>(c[cell + width - 1], 1)));
+        if (openRight && openBack) fn(cell - width + 1, 7 * (here + std::max<int>(c[cell - width + 1], 1)));
+        if (openLeft && openBack) fn(cell - width - 1, 7 * (here + std::max<int>(c[cell - width - 1], 1)));
+    }
+    
+    // Lower bound of the cost between two cells
+    int estimate(int a, int b) const {
+        int dx = std::abs(a % width - b % width), dz = std::abs(a / width - b / width);
+        return 10 * std::max(dx, dz) + 4 * std::min(dx, dz);
+    }
+};
+
+// Running totals, like CollisionStats
+struct NavStats {
+    long queries;       // A* paths asked for
+    long cached;        // of which answered from the cache
+    long expanded;      // cells A* expanded
+    long capped;        // of which given up after NAV_MAX_EXPANSIONS
+    long updates;       // flow field changes (a batch of pickups or restores)
+    long cellsUpdated;
+    double updateMs;
+    double worstMs;     // longest flow field update() in a step
+    
+    NavStats() : queries(0), cached(0), expanded(0), capped(0), updates(0), cellsUpdated(0), updateMs(0), worstMs(0) {}
+};
+
+// A* over a NavGrid. A path is the cells where it turns, so each leg is
+// straight or diagonal; the most recently used ones are kept by start and
+// goal cell until reset() says the grid changed. A search that expands more
+// than NAV_MAX_EXPANSIONS cells is given up as if there were no path, so no
+// query stalls a step; the caller falls back on the flow field.
+class PathFinder {
+private:
+    struct CachedPath {
+        uint64_t key;
+        unsigned version;   // 0 while empty
+        long used;
+        bool found;
+        std::vector<int> turns;
+        
+        CachedPath() : key(0), version(0), used(0), found(false) {}
+    };
+    
+    const NavGrid& grid;
+    std::vector<int> cost, parent;
+    std::vector<unsigned> visited;   // the search a cell's entries are from
+    unsigned search;
+    std::vector<std::pair<int, int>> open;   // min-heap of (estimated total, cell)
+    std::vector<int> trail;
+    std::vector<CachedPath> cache;
+    unsigned version;
+    long uses;
+    
+    long age(const CachedPath& p) const { return p.version == version ? p.used : -1; }
+    
+    bool run(int start, int goal, std::vector<int>& turns) {
+        if (++search == 0) {
+            std::fill(visited.begin(), visited.end(), 0u);
+            search = 1;
+        }
+        open.clear();
+        cost[start] = 0;
+        parent[start] = -1;
+        visited[start] = search;
+        open.push_back(std::make_pair(grid.estimate(start, goal), start));
+        bool found = false;
+        int expansions = 0;
+        while (!open.empty()) {
+            std::pop_heap(open.begin(), open.end(), std::greater<std::pair<int, int>>());
+            std::pair<int, int> top = open.back();
+            open.pop_back();
+            int c = top.second;
+            if (c == goal) {
+                found = true;
+                break;
+            }
+            if (top.first > cost[c] + grid.estimate(c, goal)) continue; // reached more cheaply since
+            if (++expansions > NAV_MAX_EXPANSIONS) {
+                stats.capped++;
+                break;
+            }
+            stats.expanded++;
+            grid.forMoves(c, [&](int n, int step) {
+                if (!grid.open(n) && n != goal) return;
+                int g = cost[c] + step;
+                if (visited[n] == search && g >= cost[n]) return;
+                visited[n] = search;
+                cost[n] = g;
+                parent[n] = c;
+                open.push_back(std::make_pair(g + grid.estimate(n, goal), n));
+                std::push_heap(open.begin(), open.end(), std::greater<std::pair<int, int>>());
+            });
+        }
+        turns.clear();
+        if (!found) return false;
+        
+        trail.clear();
+        for (int c = goal; c >= 0; c = parent[c]) trail.push_back(c);
+        std::reverse(trail.begin(), trail.end());
+        // Keeps the last cell of every straight run
+        for (size_t k = 1; k < trail.size(); k++) {
+            if (k + 1 < trail.size() && trail[k] - trail[k - 1] == trail[k + 1] - trail[k]) continue;
+            turns.push_back(trail[k]);
+        }
+        return true;
+    }
+
+public:
+    NavStats stats;
+    
+    PathFinder(const NavGrid& g) : grid(g), search(0), version(1), uses(0) {}
+    
+    // After the grid was built: drops every cached path
+    void reset() {
+        cost.assign(grid.cells(), 0);
+        parent.assign(grid.cells(), -1);
+        visited.assign(grid.cells(), 0);
+        search = 0;
+        cache.assign(NAV_PATH_CACHE, CachedPath());
+        version++;
+    }
+    
+    // Waypoints from `from` to `to`: the middles of the cells where the path
+    // turns, then `to` itself. False, with no waypoints, if there is no path.
+    bool findPath(const Vector3& from, const Vector3& to, std::vector<Vector3>& path) {
+        path.clear();
+        if (grid.cells() == 0) return false;
+        int start = grid.cellAt(from.x, from.z), goal = grid.cellAt(to.x, to.z);
+        stats.queries++;
+        uint64_t key = (uint64_t)start << 32 | (uint32_t)goal;
+        uint64_t h = (key ^ (key >> 33)) * 0xFF51AFD7ED558CCDULL;
+        h = (h ^ (h >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+        CachedPath* set = &cache[(h ^ (h >> 33)) % (NAV_PATH_CACHE / NAV_PATH_WAYS) * NAV_PATH_WAYS];
+        CachedPath* slot = set; // the path, or else the way used longest ago
+        for (int w = 0; w < NAV_PATH_WAYS; w++) {
+            if (set[w].version == version && set[w].key == key) {
+                slot = &set[w];
+                break;
+            }
+            if (age(set[w]) < age(*slot)) slot = &set[w];
+        }
+        if (slot->version == version && slot->key == key) {
+            stats.cached++;
+        } else {
+            slot->key = key;
+            slot->version = version;
+            slot->found = start == goal || run(start, goal, slot->turns);
+            if (start == goal) slot->turns.clear();
+        }
+        slot->used = ++uses;
+        if (!slot->found) return false;
+        for (size_t k = 0; k + 1 < slot->turns.size(); k++) path.push_back(grid.center(slot->turns[k]));
+        path.push_back(to);
+        return true;
+    }
+};
+
+// For every cell, the walking distance to the nearest of a set of sources
+// (collectibles) and which one that is, nearest meaning the lowest distance
+// and then the lowest index. Each agent looks up its cell and moves to the
+// neighbour closer to the source, so one field serves every agent heading
+// for any of the sources. Removing a source only recomputes the cells that
+// led to it; adding one only spreads out from it while it is closer.
+// Distances are integers and ties go to the lower index, so a field updated
+// this way is the same as one built from scratch.
+//
+// Removals are applied by update(), a bounded number of cells per step, so
+// a pickup never stalls the step that made it. Until one is done the cells
+// that led to it are REFILLING or still name the removed source.
+class FlowField {
+private:
+    const NavGrid& grid;
+    struct Label {
+        int distance, source;   // NAV_UNREACHED and -1 where no source reaches (or REFILLING)
+    };
+    std::vector<Label> labels;           // per cell
+    std::vector<int> itemCell;           // per collectible
+    std::vector<uint8_t> active;         // per collectible: a source now
+    int activeCount;
+    std::vector<int> byCell;             // every collectible, by cell and index
+    std::vector<std::pair<int, int>> seeds;     // (distance, cell) offered before spread()
+    std::vector<int> buckets[NAV_MAX_STEP + 1]; // cells to spread from, by distance modulo the count
+    std::vector<int> region;
+    struct Border {
+        int distance, source, cell;
+        Border(int d, int s, int c) : distance(d), source(s), cell(c) {}
+    };
+    std::vector<Border> border;
+    
+    // The removal in progress: the region is cleared from region[clearNext]
+    // on, then refilled by spread(), which goes on from spreadDistance
+    enum Phase { IDLE, CLEARING, SPREADING };
+    Phase phase;
+    std::vector<int> pending;            // removed since, waiting for their turn
+    size_t clearNext, nextSeed;
+    long waiting;
+    int spreadDistance;
+    
+    bool better(int d, int s, int cell) const {
+        return d < labels[cell].distance || (d == labels[cell].distance && s < labels[cell].source);
+    }
+    void offer(int d, int s, int cell) {
+        if (!better(d, s, cell)) return;
+        labels[cell].distance = d;
+        labels[cell].source = s;
+        seeds.push_back(std::make_pair(d, cell));
+    }
+    void unlabel(int cell) {
+        labels[cell].source = REFILLING;
+        labels[cell].distance = NAV_UNREACHED;
+    }
+    // Labelled with a source that has been removed
+    bool stale(int cell) const { return labels[cell].source >= 0 && !active[labels[cell].source]; }
+    
+    // Dijkstra from the seeds with a bucket per distance: no step is longer
+    // than NAV_MAX_STEP, so every cell waiting is in the next NAV_MAX_STEP + 1
+    // buckets. A cell is spread from once its distance comes up, by then with
+    // its final source. Only open cells are entered. Stops at the first
+    // distance done once budget cells were spread from, and goes on from
+    // there on the next call; true when finished.
+    void startSpread() {
+        std::sort(seeds.begin(), seeds.end());
+        nextSeed = 0;
+        waiting = 0;
+    }
+    bool spread(long& budget) {
+        const int B = NAV_MAX_STEP + 1;
+        while (waiting > 0 || nextSeed < seeds.size()) {
+            if (budget <= 0) return false;
+            if (waiting == 0) spreadDistance = seeds[nextSeed].first; // skip ahead to the next seed
+            int d = spreadDistance;
+            for (; nextSeed < seeds.size() && seeds[nextSeed].first == d; nextSeed++) {
+                buckets[d % B].push_back(seeds[nextSeed].second);
+                waiting++;
+            }
+            std::vector<int>& bucket = buckets[d % B];
+            for (int c : bucket) {
+                if (labels[c].distance != d) continue; // reached more cheaply since
+                stats.cellsUpdated++;
+                budget--;
+                int s = labels[c].source;
+                grid.forMoves(c, [&](int n, int step) {
+                    if (!grid.open(n) || !better(d + step, s, n)) return;
+                    labels[n].distance = d + step;
+                    labels[n].source = s;
+                    buckets[(d + step) % B].push_back(n);
+                    waiting++;
+                });
+            }
+            waiting -= bucket.size();
+            bucket.clear();
+            spreadDistance++;
+        }
+        seeds.clear();
+        return true;
+    }
+    void spreadAll() {
+        long unlimited = LONG_MAX;
+        startSpread();
+        spread(unlimited);
+    }
+    
+    // The region of the pending removals is found by its stale labels, so
+    // removals made since that touch it are cleared along with it. The cells
+    // around it seed it as they are now, unless their source went too.
+    void beginRemoval() {
+        region.clear();
+        border.clear();
+        for (int item : pending) {
+            int first = itemCell[item];
+            if (!stale(first)) continue; // another one in its cell won the tie, or it was cleared already
+            unlabel(first);
+            region.push_back(first);
+        }
+        pending.clear();
+        clearNext = 0;
+        phase = CLEARING;
+    }
+    bool clearRegion(long& budget) {
+        for (; clearNext < region.size(); clearNext++) {
+            if (budget-- <= 0) return false;
+            int c = region[clearNext];
+            bool open = grid.open(c);
+            grid.forMoves(c, [&](int n, int step) {
+                if (stale(n)) {
+                    unlabel(n);
+                    region.push_back(n);
+                } else if (labels[n].source >= 0 && open) {
+                    border.push_back(Border(labels[n].distance + step, labels[n].source, c));
+                }
+            });
+        }
+        for (const Border& b : border) {
+            if (active[b.source]) offer(b.distance, b.source, b.cell);
+        }
+        for (int c : region) sourcesIn(c, [&](int item) { offer(0, item, c); });
+        startSpread();
+        phase = SPREADING;
+        return true;
+    }
+    
+    // Drops a removal in progress, for a new build or an empty field
+    void cancel() {
+        for (std::vector<int>& bucket : buckets) bucket.clear();
+        seeds.clear();
+        pending.clear();
+        phase = IDLE;
+    }
+    
+    
+    // The active sources standing in cell
+    template <typename Fn>
+    void sourcesIn(int cell, Fn fn) const {
+        auto first = std::lower_bound(byCell.begin(), byCell.end(), cell,
+                                      [this](int item, int c) { return itemCell[item] < c; });
+        for (auto it = first; it != byCell.end() && itemCell[*it] == cell; ++it) {
+            if (active[*it]) fn(*it);
+        }
+    }
+
+public:
+    static const int REFILLING = -2;     // the source of a cell a removal has yet to refill
+    NavStats stats;
+    
+    FlowField(const NavGrid& g) : grid(g), activeCount(0), phase(IDLE), clearNext(0), nextSeed(0), waiting(0),
+                                  spreadDistance(0) {}
+    
+    // Leaves no field; updates are ignored until the next build()
+    void clear() {
+        cancel();
+        labels.clear();
+        activeCount = 0;
+    }
+    
+    // Every uncollected collectible of items becomes a source
+    void build(const CollectibleTable& items) {
+        cancel();
+        Label none = { NAV_UNREACHED, -1 };
+        labels.assign(grid.cells(), none);
+        itemCell.resize(items.count());
+        active.resize(items.count());
+        byCell.resize(items.count());
+        activeCount = 0;
+        for (int i = 0; i < items.count(); i++) {
+            itemCell[i] = grid.cellAt(items.transform.x[i], items.transform.z[i]);
+            active[i] = !items.collected[i];
+            activeCount += active[i];
+            byCell[i] = i;
+        }
+        std::stable_sort(byCell.begin(), byCell.end(), [this](int a, int b) { return itemCell[a] < itemCell[b]; });
+        for (int i = 0; i < items.count(); i++) {
+            if (active[i]) offer(0, i, itemCell[i]);
+        }
+        spreadAll();
+    }
+    
+    // Sources no longer; update() recomputes the cells that led to them.
+    // Taking the last one empties the field at once.
+    void remove(const std::vector<int>& items) {
+        if (!ready()) return;
+        for (int item : items) {
+            if (!active[item]) continue;
+            activeCount--;
+            active[item] = 0;
+            pending.push_back(item);
+        }
+        if (activeCount == 0) {
+            double start = nowMs();
+            cancel();
+            Label none = { NAV_UNREACHED, -1 };
+            labels.assign(grid.cells(), none);
+            stats.updates++;
+            stats.updateMs += nowMs() - start;
+        }
+    }
+    void remove(int item) {
+        static std::vector<int> one(1);
+        one[0] = item;
+        remove(one);
+    }
+    
+    // Once per simulation step: carries on with the removals, spreading from
+    // about `cells` cells at most
+    void update(long cells) {
+        if (!ready() || current()) return;
+        double start = nowMs();
+        long budget = cells;
+        while (budget > 0) {
+            if (phase == IDLE) {
+                if (pending.empty()) break;
+                beginRemoval();
+            }
+            if (phase == CLEARING && !clearRegion(budget)) break;
+            if (!spread(budget)) break;
+            // What no source reached is out of reach
+            for (int c : region) {
+                if (labels[c].source == REFILLING) labels[c].source = -1;
+            }
+            phase = IDLE;
+            stats.updates++;
+        }
+        double ms = nowMs() - start;
+        stats.updateMs += ms;
+        stats.worstMs = std::max(stats.worstMs, ms);
+    }
+    // Every removal applied, however long it takes
+    void finish() { update(LONG_MAX); }
+    
+    // Sources again, after a restore put them back. Applies the removals
+    // still waiting first.
+    void add(const std::vector<int>& items) {
+        if (!ready()) return;
+        finish();
+        double start = nowMs();
+        for (int item : items) {
+            activeCount += !active[item];
+            active[item] = 1;
+            offer(0, item, itemCell[item]);
+        }
+        spreadAll();
+        stats.updates++;
+        stats.updateMs += nowMs() - start;
+    }
+    
+    // No removal waiting or half done, so every label is final
+    bool current() const { return phase == IDLE && pending.empty(); }
+    int sourceAt(int cell) const { return labels[cell].source; }
+    int distanceAt(int cell) const { return labels[cell].distance; }
+    bool ready() const { return (int)labels.size() == grid.cells() && grid.cells() > 0; }
+    
+    // The neighbour to move to from cell on the way to its source, -1 in the
+    // source's own cell or where no source is reachable
+    int next(int cell) const {
+        if (labels[cell].source < 0 || labels[cell].distance == 0) return -1;
+        int best = -1, bestDistance = NAV_UNREACHED;
+        grid.forMoves(cell, [&](int n, int step) {
+            if (labels[n].source < 0 || (!grid.open(n) && labels[n].distance != 0)) return;
+            if (labels[n].distance + step < bestDistance) {
+                bestDistance = labels[n].distance + step;
+                best = n;
+            }
+        });
+        return best;
+    }
+};
+
+NavGrid navGrid;
+PathFinder pathFinder(navGrid);
+FlowField collectibleField(navGrid);   // towards every uncollected collectible
+
+// After the colliders and collectibles of a level are in place. The flow
+// field is only kept up to date while there are rivals to follow it.
+void buildNavigation(float half, bool field) {
+    navGrid.build(half, collision);
+    pathFinder.reset();
+    if (field) collectibleField.build(collectibles);
+    else collectibleField.clear();
+}
+
+// One line of totals and averages, after the caller's label
+void printNavStats(const NavStats& paths, const NavStats& field) {
+    std::cout << navGrid.width << " x " << navGrid.height << " cells of " << std::fixed << std::setprecision(2)
+              << navGrid.cellSize << "; " << paths.queries << " paths (" << std::setprecision(1)
+              << 100.0 * paths.cached / std::max(1L, paths.queries) << "% cached, "
+              << paths.expanded / (double)std::max(1L, paths.queries - paths.cached) << " cells expanded each, "
+              << paths.capped << " given up), " << field.updates << " field updates ("
+              << field.cellsUpdated / (double)std::max(1L, field.updates) << " cells, " << std::setprecision(3)
+              << field.updateMs / std::max(1L, field.updates) << " ms each, worst step " << field.worstMs << " ms)"
+              << std::endl;
+}
+
+// ==================== LEVEL FORMAT ====================
+// Levels are written as text (see levels/arena.level) and compiled to a
+// binary file: a header followed by one 64-byte aligned array per static
+// table column. Binary levels are memory-mapped and the tables read those
+// arrays in place, so loading costs about the same for 12 collectibles as
+// for a million. Text levels are compiled in memory and used the same way.
+// The world is split into square chunks, and the file lists the platforms
+// and collectibles of each one so they can be streamed (see WorldStreamer).
+//
+// Text format, one statement per line ('#' starts a comment):
+//   world HALF_SIZE        the ground spans [-HALF_SIZE, HALF_SIZE] (default 50)
+//   chunk SIZE             side of a streaming chunk (default 50)
+//   platform X Y Z  WIDTH HEIGHT DEPTH  R G B  OBJECT
+//       OBJECT is lantern, pagoda, statue, weapon-rack or none
+//   ring COUNT [ANGLE]     COUNT collectibles evenly around the last platform,
+//                          the first at ANGLE degrees
+//   collectible X Y Z [none]   one collectible on the last platform, or on none
+//   lattice COUNT          COUNT collectibles on no platform, on a square
+//                          lattice across the arena
+// `world` and `chunk` go before anything that is placed in the world.
+
+const char LEVEL_MAGIC[8] = { 'P', '1', '6', 'L', 'E', 'V', 'E', 'L' };
+const uint32_t LEVEL_VERSION = 2;
+const uint32_t LEVEL_BYTE_ORDER = 0x01020304; // reads back differently on the other endianness
+const size_t LEVEL_ALIGN = 64;
+
+enum LevelSectionId {
+    SECTION_PLATFORM_X, SECTION_PLATFORM_Y, SECTION_PLATFORM_Z,
+    SECTION_PLATFORM_SIZE, SECTION_PLATFORM_COLOR, SECTION_PLATFORM_OBJECT,
+    SECTION_COLLECTIBLE_X, SECTION_COLLECTIBLE_Y, SECTION_COLLECTIBLE_Z, SECTION_COLLECTIBLE_PLATFORM,
+    // Per chunk, row by row: where its entries start in the index list after
+    // it (one more entry than there are chunks), then the indices themselves
+    SECTION_CHUNK_PLATFORM_START, SECTION_CHUNK_PLATFORMS,
+    SECTION_CHUNK_COLLECTIBLE_START, SECTION_CHUNK_COLLECTIBLES,
+    LEVEL_SECTIONS
+};
+
+const size_t LEVEL_ELEMENT_SIZE[LEVEL_SECTIONS] = {
+    sizeof(float), sizeof(float), sizeof(float), sizeof(Vector3), sizeof(Color), sizeof(int32_t),
+    sizeof(float), sizeof(float), sizeof(float), sizeof(int32_t),
+    sizeof(uint32_t), sizeof(int32_t), sizeof(uint32_t), sizeof(int32_t)
+};
+
+const float DEFAULT_CHUNK_SIZE = 50.0f;
+
+// World settings from the `world` and `chunk` statements
+struct LevelInfo {
+    float worldHalfSize;
+    float chunkSize;
+    LevelInfo() : worldHalfSize(GROUND_SIZE), chunkSize(DEFAULT_CHUNK_SIZE) {}
+    
+    int chunksPerSide() const { return std::max(1, (int)ceil(2 * worldHalfSize / chunkSize)); }
+    
+    // The chunk holding a point; points outside the world go to the nearest edge chunk
+    int chunkAt(float x, float z) const {
+        int side = chunksPerSide();
+        int cx = std::min(std::max((int)floor((x + worldHalfSize) / chunkSize), 0), side - 1);
+        int cz = std::min(std::max((int)floor((z + worldHalfSize) / chunkSize), 0), side - 1);
+        return cz * side + cx;
+    }
+};
+
+struct LevelSection {
+    uint64_t offset; // from the start of the file, a multiple of LEVEL_ALIGN
+    uint64_t bytes;
+};
+
+struct LevelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    uint32_t platformCount;
+    uint32_t collectibleCount;
+    float worldHalfSize;
+    float chunkSize;
+    uint32_t chunksPerSide;
+    uint32_t reserved;
+    LevelSection sections[LEVEL_SECTIONS];
+};
+
+static_assert(sizeof(LevelHeader) == 48 + LEVEL_SECTIONS * sizeof(LevelSection), "level header has padding");
+
+// Number of elements in section s
+uint64_t levelSectionCount(const LevelHeader& h, int s) {
+    uint64_t chunks = (uint64_t)h.chunksPerSide * h.chunksPerSide;
+    switch (s) {
+        case SECTION_CHUNK_PLATFORM_START:
+        case SECTION_CHUNK_COLLECTIBLE_START: return chunks + 1;
+        case SECTION_CHUNK_PLATFORMS: return h.platformCount;
+        case SECTION_CHUNK_COLLECTIBLES: return h.collectibleCount;
+        default: return s < SECTION_COLLECTIBLE_X ? h.platformCount : h.collectibleCount;
+    }
+}
+static_assert(sizeof(Vector3) == 3 * sizeof(float) && std::is_trivially_copyable<Vector3>::value,
+              "Vector3 is stored as three floats");
+static_assert(sizeof(Color) == 3 * sizeof(float) && std::is_trivially_copyable<Color>::value,
+              "Color is stored as three floats");
+static_assert(sizeof(int) == sizeof(int32_t), "object and owner columns are stored as int32");
+
+// Storage unit of an in-memory level, so every section stays aligned
+struct alignas(LEVEL_ALIGN) LevelBlock {
+    unsigned char bytes[LEVEL_ALIGN];
+};
+
+const char* const OBJECT_NAMES[] = { "lantern", "pagoda", "statue", "weapon-rack" };
+const int OBJECT_TYPES = sizeof(OBJECT_NAMES) / sizeof(OBJECT_NAMES[0]);
+
+// Collectibles on a square lattice across the arena floor, on no platform
+void addLatticeCollectibles(CollectibleTable& items, int count, float worldHalfSize) {
+    int side = (int)ceil(sqrt((float)count));
+    float extent = worldHalfSize - 2.0f;
+    float spacing = 2.0f * extent / std::max(side - 1, 1);
+    for (int i = 0; i < count; i++) {
+        float x = -extent + (i % side) * spacing;
+        float z = -extent + (i / side) * spacing;
+        items.add(Vector3(x, 2.25f, z), -1);
+    }
+}
+
+// Collectibles evenly spaced on a circle over platform p, inside its edges
+void addRingCollectibles(const PlatformTable& platformList, int p, int count, float angleDegrees,
+                         CollectibleTable& items) {
+    Vector3 position = platformList.transform.position(p);
+    const Vector3& size = platformList.size[p];
+    float platformRadius = (size.x / 2.0f) * 0.7f; // Stay within platform
+    float collectY = position.y + size.y * 0.5f * 0.5f + 1.5f; // Higher above platform
+    float angleOffset = M_PI / 180.0 * angleDegrees;
+    for (int j = 0; j < count; j++) {
+        float angle = (2.0f * M_PI * j / count) + angleOffset;
+        Vector3 pos(position.x + cos(angle) * platformRadius, collectY, position.z + sin(angle) * platformRadius);
+        items.add(pos, p);
+    }
+}
+
+// Parses a text level into the tables. On failure `error` names the line.
+bool parseLevel(const std::string& text, const std::string& name,
+                PlatformTable& platformList, CollectibleTable& items, LevelInfo& info, std::string& error) {
+    platformList.clear();
+    items.clear();
+    info = LevelInfo();
+    std::istringstream lines(text);
+    std::string line;
+    for (int number = 1; std::getline(lines, line); number++) {
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) line.erase(comment);
+        std::istringstream in(line);
+        std::string word, extra;
+        if (!(in >> word)) continue;
+        
+        bool ok = true;
+        if (word == "world" || word == "chunk") {
+            float value = 0;
+            ok = (bool)(in >> value) && value > 0;
+            if (ok && (platformList.count() > 0 || items.count() > 0)) {
+                error = name + ":" + std::to_string(number) + ": " + word + " after the first platform or collectible";
+                return false;
+            }
+            if (ok) (word == "world" ? info.worldHalfSize : info.chunkSize) = value;
+        } else if (word == "platform") {
+            Vector3 pos, size;
+            Color color;
+            std::string object;
+            ok = (bool)(in >> pos.x >> pos.y >> pos.z >> size.x >> size.y >> size.z
+                           >> color.r >> color.g >> color.b >> object);
+            int type = OBJECT_NONE;
+            for (int t = 0; t < OBJECT_TYPES; t++) {
+                if (object == OBJECT_NAMES[t]) type = t;
+            }
+            if (ok && type == OBJECT_NONE && object != "none") {
+                error = name + ":" + std::to_string(number) + ": unknown object '" + object + "'";
+                return false;
+            }
+            if (ok) platformList.add(pos, size, color, type);
+        } else if (word == "ring") {
+            int count = 0;
+            float angle = 0;
+            ok = (bool)(in >> count) && count > 0;
+            if (ok && !(in >> angle)) {
+                in.clear();
+                angle = 0;
+            }
+            if (ok && platformList.count() == 0) {
+                error = name + ":" + std::to_string(number) + ": ring before any platform";
+                return false;
+            }
+            if (ok) addRingCollectibles(platformList, platformList.count() - 1, count, angle, items);
+        } else if (word == "collectible") {
+            Vector3 pos;
+            std::string owner;
+            ok = (bool)(in >> pos.x >> pos.y >> pos.z);
+            if (ok && in >> owner && owner != "none") ok = false;
+            if (ok) items.add(pos, owner == "none" ? -1 : platformList.count() - 1);
+        } else if (word == "lattice") {
+            int count = 0;
+            ok = (bool)(in >> count) && count > 0;
+            if (ok) addLatticeCollectibles(items, count, info.worldHalfSize);
+        } else {
+            error = name + ":" + std::to_string(number) + ": unknown statement '" + word + "'";
+            return false;
+        }
+        if (!ok || in >> extra) {
+            error = name + ":" + std::to_string(number) + ": malformed " + word;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Groups entity indices by chunk: start[c] is where chunk c's indices begin
+// in `indices`, and start[chunks] is the total
+void bucketByChunk(const LevelInfo& info, const Transforms& t, std::vector<uint32_t>& start, std::vector<int>& indices) {
+    int chunks = info.chunksPerSide() * info.chunksPerSide();
+    int n = (int)t.x.size();
+    std::vector<int> chunkOf(n);
+    start.assign(chunks + 1, 0);
+    for (int i = 0; i < n; i++) {
+        chunkOf[i] = info.chunkAt(t.x[i], t.z[i]);
+        start[chunkOf[i] + 1]++;
+    }
+    for (int c = 0; c < chunks; c++) start[c + 1] += start[c];
+    std::vector<uint32_t> next(start.begin(), start.end() - 1);
+    indices.resize(n);
+    for (int i = 0; i < n; i++) indices[next[chunkOf[i]]++] = i;
+}
+
+// Writes the tables' static columns as a binary level
+void compileLevel(const PlatformTable& platformList, const CollectibleTable& items, const LevelInfo& info,
+                  std::vector<LevelBlock>& out) {
+    std::vector<uint32_t> platformStart, collectibleStart;
+    std::vector<int> platformIndices, collectibleIndices;
+    bucketByChunk(info, platformList.transform, platformStart, platformIndices);
+    bucketByChunk(info, items.transform, collectibleStart, collectibleIndices);
+    
+    const void* columns[LEVEL_SECTIONS] = {
+        platformList.transform.x.data(), platformList.transform.y.data(), platformList.transform.z.data(),
+        platformList.size.data(), platformList.color.data(), platformList.animationType.data(),
+        items.transform.x.data(), items.transform.y.data(), items.transform.z.data(), items.platform.data(),
+        platformStart.data(), platformIndices.data(), collectibleStart.data(), collectibleIndices.data()
+    };
+    
+    LevelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LEVEL_MAGIC, sizeof(header.magic));
+    header.version = LEVEL_VERSION;
+    header.byteOrder = LEVEL_BYTE_ORDER;
+    header.platformCount = (uint32_t)platformList.count();
+    header.collectibleCount = (uint32_t)items.count();
+    header.worldHalfSize = info.worldHalfSize;
+    header.chunkSize = info.chunkSize;
+    header.chunksPerSide = (uint32_t)info.chunksPerSide();
+    
+    uint64_t offset = sizeof(header);
+    for (int s = 0; s < LEVEL_SECTIONS; s++) {
+        offset = (offset + LEVEL_ALIGN - 1) / LEVEL_ALIGN * LEVEL_ALIGN;
+        header.sections[s].offset = offset;
+        header.sections[s].bytes = levelSectionCount(header, s) * LEVEL_ELEMENT_SIZE[s];
+        offset += header.sections[s].bytes;
+    }
+    header.fileSize = offset;
+    
+    out.assign((offset + LEVEL_ALIGN - 1) / LEVEL_ALIGN, LevelBlock());
+    unsigned char* base = out[0].bytes;
+    memcpy(base, &header, sizeof(header));
+    for (int s = 0; s < LEVEL_SECTIONS; s++) {
+        if (header.sections[s].bytes) memcpy(base + header.sections[s].offset, columns[s], header.sections[s].bytes);
+    }
+}
+
+bool writeLevel(const std::string& path, const std::vector<LevelBlock>& blob) {
+    const LevelHeader* header = (const LevelHeader*)blob[0].bytes;
+    std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    out.write((const char*)blob[0].bytes, header->fileSize);
+    return (bool)out;
+}
+
+// A loaded level: a memory-mapped binary file or a text level compiled in
+// memory. The tables it is applied to point into it, so it has to outlive them.
+class LevelFile {
+private:
+    static unsigned loads;
+    unsigned serial;    // changes with every load, even into the same object
+    void* mapping;
+    size_t mappedBytes;
+    std::vector<LevelBlock> compiled;
+    const unsigned char* base;
+    std::string name;
+    
+    const LevelHeader& header() const { return *(const LevelHeader*)base; }
+    
+    template <typename T>
+    const T* section(int s) const { return (const T*)(base + header().sections[s].offset); }
+    
+    // Checks the header against the file before anything is read through it
+    bool check(const unsigned char* data, size_t size, std::string& error) const {
+        const LevelHeader* h = (const LevelHeader*)data;
+        if (size < sizeof(LEVEL_MAGIC) || memcmp(h->magic, LEVEL_MAGIC, sizeof(LEVEL_MAGIC)) != 0) {
+            error = name + ": not a level file";
+            return false;
+        }
+        if (size >= sizeof(LevelHeader) && (h->byteOrder != LEVEL_BYTE_ORDER || h->version != LEVEL_VERSION)) {
+            error = name + ": level version " + std::to_string(h->version) + " or byte order not supported";
+            return false;
+        }
+        if (size < sizeof(LevelHeader) || h->fileSize != size) {
+            error = name + ": truncated level file";
+            return false;
+        }
+        if (!(h->worldHalfSize > 0) || !(h->chunkSize > 0) || h->chunksPerSide == 0 || h->chunksPerSide > 65536) {
+            error = name + ": bad world or chunk size";
+            return false;
+        }
+        // Chunks are looked up by position with LevelInfo::chunkAt(), so the
+        // stored side has to be the one it works out
+        LevelInfo info;
+        info.worldHalfSize = h->worldHalfSize;
+        info.chunkSize = h->chunkSize;
+        if (!(2 * info.worldHalfSize / info.chunkSize <= 65536) || info.chunksPerSide() != (int)h->chunksPerSide) {
+            error = name + ": chunk count does not match the world and chunk size";
+            return false;
+        }
+        for (int s = 0; s < LEVEL_SECTIONS; s++) {
+            const LevelSection& sec = h->sections[s];
+            if (sec.offset % LEVEL_ALIGN != 0 || sec.offset > size || sec.bytes > size - sec.offset ||
+                sec.bytes != levelSectionCount(*h, s) * LEVEL_ELEMENT_SIZE[s]) {
+                error = name + ": corrupt level section " + std::to_string(s);
+                return false;
+            }
+        }
+        // The chunk lists are read without bounds checks later
+        const uint32_t* starts[2] = { (const uint32_t*)(data + h->sections[SECTION_CHUNK_PLATFORM_START].offset),
+                                      (const uint32_t*)(data + h->sections[SECTION_CHUNK_COLLECTIBLE_START].offset) };
+        const int32_t* lists[2] = { (const int32_t*)(data + h->sections[SECTION_CHUNK_PLATFORMS].offset),
+                                    (const int32_t*)(data + h->sections[SECTION_CHUNK_COLLECTIBLES].offset) };
+        uint32_t counts[2] = { h->platformCount, h->collectibleCount };
+        uint64_t chunks = (uint64_t)h->chunksPerSide * h->chunksPerSide;
+        for (int k = 0; k < 2; k++) {
+            bool ok = starts[k][0] == 0 && starts[k][chunks] == counts[k];
+            for (uint64_t c = 0; ok && c < chunks; c++) ok = starts[k][c] <= starts[k][c + 1];
+            for (uint32_t i = 0; ok && i < counts[k]; i++) ok = lists[k][i] >= 0 && (uint32_t)lists[k][i] < counts[k];
+            if (!ok) {
+                error = name + ": corrupt chunk lists";
+                return false;
+            }
+        }
+        return true;
+    }
+    
+public:
+    LevelFile() : serial(0), mapping(NULL), mappedBytes(0), base(NULL) {}
+    ~LevelFile() { close(); }
+    LevelFile(const LevelFile&) = delete;
+    LevelFile& operator=(const LevelFile&) = delete;
+    
+    void close() {
+        if (mapping) munmap(mapping, mappedBytes);
+        mapping = NULL;
+        mappedBytes = 0;
+        compiled.clear();
+        base = NULL;
+    }
+    
+    // Maps a binary level, or reads and compiles a text one
+    bool load(const std::string& path, std::string& error) {
+        close();
+        name = path;
+        int fd = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0) {
+            if (fd >= 0) ::close(fd);
+            error = path + ": " + strerror(errno);
+            return false;
+        }
+        
+        char magic[sizeof(LEVEL_MAGIC)] = { 0 };
+        bool binary = pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+                      memcmp(magic, LEVEL_MAGIC, sizeof(magic)) == 0;
+        if (!binary) {
+            std::string text((size_t)info.st_size, '\0');
+            bool read = info.st_size == 0 || pread(fd, &text[0], text.size(), 0) == (ssize_t)text.size();
+            ::close(fd);
+            if (!read) {
+                error = path + ": read failed";
+                return false;
+            }
+            return loadText(text, path, error);
+        }
+        
+        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            error = path + ": " + strerror(errno);
+            return false;
+        }
+        if (!check((const unsigned char*)data, (size_t)info.st_size, error)) {
+            munmap(data, (size_t)info.st_size);
+            return false;
+        }
+        mapping = data;
+        mappedBytes = (size_t)info.st_size;
+        base = (const unsigned char*)data;
+        serial = ++loads;
+        return true;
+    }
+    
+    bool loadText(const std::string& text, const std::string& sourceName, std::string& error) {
+        close();
+        name = sourceName;
+        PlatformTable platformList;
+        CollectibleTable items;
+        LevelInfo info;
+        if (!parseLevel(text, sourceName, platformList, items, info, error)) return false;
+        compileLevel(platformList, items, info, compiled);
+        base = compiled[0].bytes;
+        serial = ++loads;
+        return true;
+    }
+    
+    // Points the tables' static columns at the level and resets their state
+    void apply(PlatformTable& platformList, CollectibleTable& items) const {
+        size_t platformCount = header().platformCount, collectibleCount = header().collectibleCount;
+        platformList.clear();
+        platformList.transform.x.borrow(section<float>(SECTION_PLATFORM_X), platformCount);
+        platformList.transform.y.borrow(section<float>(SECTION_PLATFORM_Y), platformCount);
+        platformList.transform.z.borrow(section<float>(SECTION_PLATFORM_Z), platformCount);
+        platformList.size.borrow(section<Vector3>(SECTION_PLATFORM_SIZE), platformCount);
+        platformList.color.borrow(section<Color>(SECTION_PLATFORM_COLOR), platformCount);
+        platformList.animationType.borrow(section<int>(SECTION_PLATFORM_OBJECT), platformCount);
+        platformList.resetState();
+        
+        items.clear();
+        items.transform.x.borrow(section<float>(SECTION_COLLECTIBLE_X), collectibleCount);
+        items.transform.y.borrow(section<float>(SECTION_COLLECTIBLE_Y), collectibleCount);
+        items.transform.z.borrow(section<float>(SECTION_COLLECTIBLE_Z), collectibleCount);
+        items.platform.borrow(section<int>(SECTION_COLLECTIBLE_PLATFORM), collectibleCount);
+        items.resetState();
+    }
+    
+    // Platform and collectible indices of chunk c (row by row, chunksPerSide() to a row)
+    const int* chunkPlatforms(int c, int& count) const {
+        const uint32_t* start = section<uint32_t>(SECTION_CHUNK_PLATFORM_START);
+        count = (int)(start[c + 1] - start[c]);
+        return section<int>(SECTION_CHUNK_PLATFORMS) + start[c];
+    }
+    const int* chunkCollectibles(int c, int& count) const {
+        const uint32_t* start = section<uint32_t>(SECTION_CHUNK_COLLECTIBLE_START);
+        count = (int)(start[c + 1] - start[c]);
+        return section<int>(SECTION_CHUNK_COLLECTIBLES) + start[c];
+    }
+    
+    LevelInfo info() const {
+        LevelInfo i;
+        i.worldHalfSize = header().worldHalfSize;
+        i.chunkSize = header().chunkSize;
+        return i;
+    }
+    Vector3 platformPosition(int i) const {
+        return Vector3(section<float>(SECTION_PLATFORM_X)[i], section<float>(SECTION_PLATFORM_Y)[i],
+                       section<float>(SECTION_PLATFORM_Z)[i]);
+    }
+    const Vector3& platformSize(int i) const { return section<Vector3>(SECTION_PLATFORM_SIZE)[i]; }
+    const Color& platformColor(int i) const { return section<Color>(SECTION_PLATFORM_COLOR)[i]; }
+    
+    int chunksPerSide() const { return (int)header().chunksPerSide; }
+    int chunkCount() const { return chunksPerSide() * chunksPerSide(); }
+    
+    bool loaded() const { return base != NULL; }
+    unsigned loadSerial() const { return serial; }
+    bool mapped() const { return mapping != NULL; }
+    const std::string& sourceName() const { return name; }
+    int platformCount() const { return (int)header().platformCount; }
+    int collectibleCount() const { return (int)header().collectibleCount; }
+    size_t bytes() const { return header().fileSize; }
+    // The same for a text level and its compiled file; recordings use it to
+    // check they are replayed on their own level
+    uint64_t checksum() const { return fnv1a(base, bytes()); }
+};
+
+unsigned LevelFile::loads = 0;
+
+// Copy of levels/arena.level, used when no --level is given
+const char* const DEFAULT_LEVEL =
+    "world 50\n"
+    "chunk 100\n"
+    "platform -15 0.5 -15   5 1 5   0.8 0.2 0.2   lantern\n"
+    "ring 3 0\n"
+    "platform  15 0.5 -15   5 1 5   0.2 0.8 0.2   pagoda\n"
+    "ring 3 60\n"
+    "platform -15 0.5  15   5 1 5   0.2 0.2 0.8   statue\n"
+    "ring 3 120\n"
+    "platform  15 0.5  15   5 1 5   0.8 0.8 0.2   weapon-rack\n"
+    "ring 3 180\n";
+
+LevelFile level;
+std::string levelPath; // --level
+
+const float MIN_COLLECTIBLE_SPACING = 1.0f;
+
+// Checks a level: every collectible belongs to an existing platform or none,
+// and no two collectibles of a platform are closer than MIN_COLLECTIBLE_SPACING.
+// Neighbours come from a grid over the same items, so this is linear in the
+// number of collectibles. Logs each problem and returns how many it found.
+int validateLevel(const PlatformTable& platformList, const CollectibleTable& items, const CollectibleGrid& grid) {
+    int problems = 0;
+    std::vector<int> nearby;
+    const Transforms& t = items.transform;
+    for (int i = 0; i < items.count(); i++) {
+        int owner = items.platform[i];
+        if (owner < -1 || owner >= platformList.count()) {
+            gameLogger.log(LOG_WARN, LOG_OVERLAP, "WARNING: Collectible %d is on missing platform %d", i, owner);
+            problems++;
+            continue;
+        }
+        if (owner < 0) continue;
+        Vector3 pos = t.position(i);
+        grid.queryRadius(pos, MIN_COLLECTIBLE_SPACING, nearby);
+        for (int j : nearby) {
+            if (j <= i || items.platform[j] != owner) continue;
+            gameLogger.log(LOG_WARN, LOG_OVERLAP, "WARNING: Collectibles %d and %d are too close! Distance: %.2f",
+                           i, j, distance(pos, t.position(j)));
+            problems++;
+        }
+    }
+    return problems;
+}
+
+// --compile-level: writes the binary form of a text level
+int compileLevelFile(const char* in, const char* out) {
+    std::ifstream file(in, std::ios::in | std::ios::binary);
+    if (!file) {
+        std::cerr << in << ": cannot open" << std::endl;
+        return 1;
+    }
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    
+    double t0 = nowMs();
+    PlatformTable platformList;
+    CollectibleTable items;
+    LevelInfo info;
+    std::string error;
+    if (!parseLevel(text, in, platformList, items, info, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    std::vector<LevelBlock> blob;
+    compileLevel(platformList, items, info, blob);
+    if (!writeLevel(out, blob)) {
+        std::cerr << out << ": write failed" << std::endl;
+        return 1;
+    }
+    std::cout << out << ": " << platformList.count() << " platforms, " << items.count() << " collectibles, "
+              << ((const LevelHeader*)blob[0].bytes)->fileSize << " bytes in " << std::fixed
+              << std::setprecision(1) << nowMs() - t0 << " ms" << std::endl;
+    return 0;
+}
+
+// --validate-level: prints the problems validateLevel() finds in a level
+int validateLevelFile(const char* path) {
+    gameLogger.setLevel(LOG_WARN);
+    LevelFile file;
+    std::string error;
+    if (!file.load(path, error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
+    PlatformTable platformList;
+    CollectibleTable items;
+    file.apply(platformList, items);
+    CollectibleGrid grid;
+    grid.build(items, GRID_CELL_SIZE);
+    int problems = validateLevel(platformList, items, grid);
+    gameLogger.flush();
+    std::cout << path << ": " << platformList.count() << " platforms, " << items.count() << " collectibles, "
+              << problems << " problems" << std::endl;
+    return problems ? 1 : 0;
+}
+
+// ==================== WORLD STREAMING ====================
+// Only the chunks near the player are resident. A loader thread reads a
+// chunk's lists from the level and builds its ground, wall and platform base
+// geometry; the simulation then adds its collectibles to the pickup grid, and
+// the renderer uploads the geometry a few chunks per frame. Chunks furthest
+// from the player are evicted when the resident ones exceed the budget. The
+// level file itself stays mapped, so its pages are left to the OS.
+
+const float STREAM_DISTANCE = 120.0f;                    // chunks closer than this are loaded
+const size_t DEFAULT_STREAM_BUDGET = 64u * 1024 * 1024;  // bytes of resident chunk data
+const int STREAM_LOCKSTEP_STEPS = 3;                     // request to install in lockstep mode
+const int STREAM_FILL_PER_STEP = 512;                    // collectibles of new chunks put in the pickup grid per step
+const size_t GRID_ENTRY_BYTES = 32;                      // pickup grid cost per collectible, roughly
+
+// Static world vertices: interleaved position, normal, colour
+const int WORLD_VERTEX_STRIDE = 9;
+
+void worldVertex(std::vector<float>& out, float x, float y, float z, float nx, float ny, float nz, const Color& c) {
+    float v[WORLD_VERTEX_STRIDE] = { x, y, z, nx, ny, nz, c.r, c.g, c.b };
+    out.insert(out.end(), v, v + WORLD_VERTEX_STRIDE);
+}
+
+void worldQuad(std::vector<float>& out, const float corners[4][3], const float n[3], const Color& c) {
+    const int order[6] = { 0, 1, 2, 0, 2, 3 };
+    for (int i : order) worldVertex(out, corners[i][0], corners[i][1], corners[i][2], n[0], n[1], n[2], c);
+}
+
+// Axis-aligned box, same as a glutSolidCube(1) scaled to size
+void worldBox(std::vector<float>& out, Vector3 center, Vector3 size, const Color& c) {
+    float hx = size.x / 2, hy = size.y / 2, hz = size.z / 2;
+    const float normals[6][3] = { {1,0,0}, {-1,0,0}, {0,1,0}, {0,-1,0}, {0,0,1}, {0,0,-1} };
+    for (const auto& n : normals) {
+        // Pick the two axes spanning this face and walk its corners
+        int axis = n[0] != 0 ? 0 : (n[1] != 0 ? 1 : 2);
+        int a = (axis + 1) % 3, b = (axis + 2) % 3;
+        float half[3] = { hx, hy, hz };
+        float base[3] = { center.x, center.y, center.z };
+        float corners[4][3];
+        const float su[4] = { -1, 1, 1, -1 }, sv[4] = { -1, -1, 1, 1 };
+        for (int k = 0; k < 4; k++) {
+            corners[k][axis] = base[axis] + n[axis] * half[axis];
+            corners[k][a] = base[a] + su[k] * half[a];
+            corners[k][b] = base[b] + sv[k] * half[b];
+        }
+        worldQuad(out, corners, n, c);
+    }
+}
+
+// One chunk's resident data. Built on the loader thread and read-only after
+// that, so the simulation and render threads share it.
+struct ChunkData {
+    int id;
+    float minX, minZ, maxX, maxZ;
+    std::vector<int> platforms;      // indices into the level's tables
+    std::vector<int> collectibles;
+    std::vector<float> triangles;    // ground, walls and platform bases (WORLD_VERTEX_STRIDE floats a vertex)
+    std::vector<float> lines;        // grid lines
+    Vector3 center;                  // bounding sphere of the geometry
+    float radius;
+    
+    size_t bytes() const {
+        return sizeof(ChunkData) + (platforms.size() + collectibles.size()) * sizeof(int) +
+               (triangles.size() + lines.size()) * sizeof(float) + collectibles.size() * GRID_ENTRY_BYTES;
+    }
+};
+typedef std::shared_ptr<const ChunkData> ChunkRef;
+
+// Loads chunk c: copies its entity lists and builds the geometry that
+// drawGround(), drawWalls() and drawPlatform() would draw for it
+ChunkData* buildChunk(const LevelFile& file, int c) {
+    LevelInfo info = file.info();
+    int side = file.chunksPerSide();
+    float half = info.worldHalfSize;
+    ChunkData* chunk = new ChunkData();
+    chunk->id = c;
+    chunk->minX = -half + (c % side) * info.chunkSize;
+    chunk->minZ = -half + (c / side) * info.chunkSize;
+    chunk->maxX = std::min(chunk->minX + info.chunkSize, half);
+    chunk->maxZ = std::min(chunk->minZ + info.chunkSize, half);
+    
+    int count;
+    const int* list = file.chunkPlatforms(c, count);
+    chunk->platforms.assign(list, list + count);
+    list = file.chunkCollectibles(c, count);
+    chunk->collectibles.assign(list, list + count);
+    
+    float x0 = chunk->minX, x1 = chunk->maxX, z0 = chunk->minZ, z1 = chunk->maxZ;
+    const float up[3] = { 0, 1, 0 };
+    const float ground[4][3] = { {x0, 0, z0}, {x0, 0, z1}, {x1, 0, z1}, {x1, 0, z0} };
+    worldQuad(chunk->triangles, ground, up, Color(0.2f, 0.3f, 0.2f));
+    
+    // Grid lines every 5 units from the world's corner; a chunk owns the
+    // lines on its low edges, and the world's far edges
+    Color gridColor(0.3f, 0.4f, 0.3f);
+    for (int k = (int)ceil((x0 + half) / 5); -half + k * 5 <= x1; k++) {
+        float x = -half + k * 5;
+        if (x == x1 && x1 < half) break;
+        worldVertex(chunk->lines, x, 0.01f, z0, 0, 1, 0, gridColor);
+        worldVertex(chunk->lines, x, 0.01f, z1, 0, 1, 0, gridColor);
+    }
+    for (int k = (int)ceil((z0 + half) / 5); -half + k * 5 <= z1; k++) {
+        float z = -half + k * 5;
+        if (z == z1 && z1 < half) break;
+        worldVertex(chunk->lines, x0, 0.01f, z, 0, 1, 0, gridColor);
+        worldVertex(chunk->lines, x1, 0.01f, z, 0, 1, 0, gridColor);
+    }
+    
+    // The three walls, split along the chunks at the world's edge
+    Color wallColor(0.8f, 0.2f, 0.2f);
+    if (z0 == -half) worldBox(chunk->triangles, Vector3((x0 + x1) / 2, WALL_HEIGHT/2, -half), Vector3(x1 - x0, WALL_HEIGHT, 0.5f), wallColor);
+    if (x0 == -half) worldBox(chunk->triangles, Vector3(-half, WALL_HEIGHT/2, (z0 + z1) / 2), Vector3(0.5f, WALL_HEIGHT, z1 - z0), wallColor);
+    if (x1 == half) worldBox(chunk->triangles, Vector3(half, WALL_HEIGHT/2, (z0 + z1) / 2), Vector3(0.5f, WALL_HEIGHT, z1 - z0), wallColor);
+    
+    const float heightScale = 0.5f;
+    for (int p : chunk->platforms) {
+        Vector3 position = file.platformPosition(p);
+        const Vector3& size = file.platformSize(p);
+        const Color& color = file.platformColor(p);
+        float reducedHeight = size.y * heightScale;
+        worldBox(chunk->triangles, position, Vector3(size.x, reducedHeight, size.z), color);
+        Vector3 top(position.x, position.y + reducedHeight / 2 + 0.1f, position.z);
+        worldBox(chunk->triangles, top, Vector3(size.x, 0.2f, size.z),
+                 Color(color.r * 0.8f, color.g * 0.8f, color.b * 0.8f));
+    }
+    
+    float lo[3] = { x0, 0, z0 }, hi[3] = { x1, 0, z1 };
+    for (const std::vector<float>* vertices : { &chunk->triangles, &chunk->lines }) {
+        for (size_t v = 0; v < vertices->size(); v += WORLD_VERTEX_STRIDE) {
+            for (int k = 0; k < 3; k++) {
+                lo[k] = std::min(lo[k], (*vertices)[v + k]);
+                hi[k] = std::max(hi[k], (*vertices)[v + k]);
+            }
+        }
+    }
+    chunk->center = Vector3((lo[0] + hi[0]) / 2, (lo[1] + hi[1]) / 2, (lo[2] + hi[2]) / 2);
+    chunk->radius = 0.5f * sqrt((hi[0] - lo[0]) * (hi[0] - lo[0]) + (hi[1] - lo[1]) * (hi[1] - lo[1]) +
+                                (hi[2] - lo[2]) * (hi[2] - lo[2]));
+    return chunk;
+}
+
+// Streaming counters, kept by the simulation thread and published with every snapshot
+struct StreamStats {
+    long loads;
+    long evictions;
+    long stepsUnloaded;     // steps the player spent on a chunk that wasn't resident yet
+    double latencySumMs;    // request to resident
+    float worstLatencyMs;
+    int residentChunks;
+    size_t residentBytes, peakBytes, budgetBytes;
+    
+    StreamStats() : loads(0), evictions(0), stepsUnloaded(0), latencySumMs(0), worstLatencyMs(0),
+                    residentChunks(0), residentBytes(0), peakBytes(0), budgetBytes(DEFAULT_STREAM_BUDGET) {}
+};
+
+// Decides which chunks are resident. update() and restart() run on the
+// simulation thread and never wait for a load: finished chunks are picked up
+// on a later step. Until start() is called (and in headless runs) chunks are
+// loaded inline instead, which keeps those runs deterministic.
+//
+// In lockstep mode (recording and replaying input) every chunk is installed
+// exactly STREAM_LOCKSTEP_STEPS steps after it was requested, waiting for the
+// loader if it is behind, so the pickups of a run don't depend on how fast
+// chunks happened to load.
+//
+// A chunk is drawn as soon as it is installed, but its collectibles go into the
+// pickup grid STREAM_FILL_PER_STEP per step (all at once for the player's
+// own chunk), and it only holds() them once they all are. Evictions take the
+// chunk out of range for the longest, from a list kept in that order.
+class WorldStreamer {
+private:
+    enum ChunkState : uint8_t { UNLOADED, QUEUED, FILLING, RESIDENT };
+    
+    const LevelFile* file;
+    unsigned fileSerial;
+    LevelInfo info;
+    int side;
+    std::vector<uint8_t> state;          // by chunk id
+    std::vector<double> requestedMs;
+    std::vector<ChunkRef> resident;      // by chunk id, null unless resident
+    std::vector<int> residentIds;
+    int residentVersion;                 // bumped whenever residentIds changes
+    int centerChunk;                     // player chunk at the last request pass
+    StreamStats stats;
+    
+    std::deque<int> filling;             // installed chunks still filling the pickup grid, oldest first
+    std::vector<int> filled;             // by chunk id: collectibles put in the grid while FILLING
+    
+    // Loaded chunks from the one last in range of the player (head) to the
+    // one out of range for longest (tail), linked by chunk id
+    std::vector<int> newer, older;
+    int newest, oldest;
+    
+    // Loader thread; requests and finished are shared with it under mutex
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool running;
+    std::vector<int> requests;
+    std::vector<ChunkData*> finished;
+    std::atomic<int> focus;              // player chunk; the loader serves the nearest request first
+    std::condition_variable built;       // the loader finished a chunk
+    
+    bool lockstep;
+    long step;                           // update() calls
+    std::deque<std::pair<long, int>> due; // lockstep: step each queued chunk is installed on
+    
+    float distanceTo(int c, float x, float z) const {
+        float x0 = -info.worldHalfSize + (c % side) * info.chunkSize, z0 = -info.worldHalfSize + (c / side) * info.chunkSize;
+        float dx = std::max(std::max(x0 - x, x - (x0 + info.chunkSize)), 0.0f);
+        float dz = std::max(std::max(z0 - z, z - (z0 + info.chunkSize)), 0.0f);
+        return sqrt(dx*dx + dz*dz);
+    }
+    
+    bool loaded(int c) const { return state[c] >= FILLING; }
+    
+    void unlink(int c) {
+        if (newer[c] >= 0) older[newer[c]] = older[c];
+        else newest = older[c];
+        if (older[c] >= 0) newer[older[c]] = newer[c];
+        else oldest = newer[c];
+    }
+    // Moves a loaded chunk to the head of the list
+    void touch(int c, bool linked = true) {
+        if (linked) {
+            if (newest == c) return;
+            unlink(c);
+        }
+        newer[c] = -1;
+        older[c] = newest;
+        if (newest >= 0) newer[newest] = c;
+        newest = c;
+        if (oldest < 0) oldest = c;
+    }
+    
+    // Puts up to `count` more of chunk c's collectibles in the pickup grid
+    void fill(int c, int count) {
+        const std::vector<int>& items = resident[c]->collectibles;
+        int end = (int)std::min(items.size(), (size_t)filled[c] + count);
+        for (int k = filled[c]; k < end; k++) {
+            int i = items[k];
+            if (!collectibles.collected[i]) collectibleGrid.insert(i, collectibles.transform.position(i));
+        }
+        filled[c] = end;
+        if (end == (int)items.size()) state[c] = RESIDENT;
+    }
+    void fillSome(int budget) {
+        while (budget > 0 && !filling.empty()) {
+            int c = filling.front();
+            if (state[c] == FILLING) {
+                int before = filled[c];
+                fill(c, budget);
+                budget -= filled[c] - before;
+            }
+            if (state[c] != FILLING) filling.pop_front(); // done, or evicted meanwhile
+        }
+    }
+    
+    void install(ChunkData* data) {
+        ChunkRef chunk(data);
+        int c = chunk->id;
+        if (loaded(c)) return; // loaded twice after a cancelled request
+        state[c] = FILLING;
+        filled[c] = 0;
+        filling.push_back(c);
+        resident[c] = chunk;
+        residentIds.push_back(c);
+        touch(c, false);
+        residentVersion++;
+        float latency = (float)(nowMs() - requestedMs[c]);
+        stats.loads++;
+        stats.latencySumMs += latency;
+        stats.worstLatencyMs = std::max(stats.worstLatencyMs, latency);
+        stats.residentBytes += chunk->bytes();
+        stats.peakBytes = std::max(stats.peakBytes, stats.residentBytes);
+    }
+    
+    void evict(int c) {
+        const ChunkData& chunk = *resident[c];
+        int inGrid = state[c] == FILLING ? filled[c] : (int)chunk.collectibles.size();
+        for (int k = 0; k < inGrid; k++) {
+            int i = chunk.collectibles[k];
+            if (!collectibles.collected[i]) collectibleGrid.remove(i, collectibles.transform.position(i));
+        }
+        unlink(c);
+        stats.residentBytes -= chunk.bytes();
+        stats.evictions++;
+        resident[c].reset();
+        state[c] = UNLOADED;
+        residentIds.erase(std::find(residentIds.begin(), residentIds.end(), c));
+        residentVersion++;
+    }
+    
+    // Evicts the chunks out of range for longest until the rest fit the budget
+    void enforceBudget(float x, float z) {
+        while (stats.residentBytes > stats.budgetBytes && oldest >= 0) {
+            if (distanceTo(oldest, x, z) < STREAM_DISTANCE) break; // everything left is needed
+            evict(oldest);
+        }
+    }
+    
+    // Requests the chunks within STREAM_DISTANCE and drops requests that
+    // are out of range now
+    void request(float x, float z) {
+        int reach = (int)ceil(STREAM_DISTANCE / info.chunkSize);
+        int cx = centerChunk % side, cz = centerChunk / side;
+        std::vector<int> wanted;
+        for (int rz = std::max(cz - reach, 0); rz <= std::min(cz + reach, side - 1); rz++) {
+            for (int rx = std::max(cx - reach, 0); rx <= std::min(cx + reach, side - 1); rx++) {
+                int c = rz * side + rx;
+                if (distanceTo(c, x, z) >= STREAM_DISTANCE) continue;
+                if (state[c] == UNLOADED) wanted.push_back(c);
+                else if (loaded(c)) touch(c);
+            }
+        }
+        double now = nowMs();
+        if (lockstep) {
+            // Decided by the player's path alone, whether or not a loader runs
+            for (auto it = due.begin(); it != due.end();) {
+                if (distanceTo(it->second, x, z) >= STREAM_DISTANCE) {
+                    state[it->second] = UNLOADED;
+                    it = due.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            for (int c : wanted) {
+                requestedMs[c] = now;
+                state[c] = QUEUED;
+                due.push_back(std::make_pair(step + STREAM_LOCKSTEP_STEPS, c));
+            }
+            if (!thread.joinable()) return;
+        } else if (!thread.joinable()) {
+            for (int c : wanted) {
+                requestedMs[c] = now;
+                state[c] = QUEUED;
+                install(buildChunk(*file, c));
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < requests.size();) {
+            if (distanceTo(requests[i], x, z) >= STREAM_DISTANCE) {
+                if (state[requests[i]] == QUEUED) state[requests[i]] = UNLOADED;
+                requests[i] = requests.back();
+                requests.pop_back();
+            } else {
+                i++;
+            }
+        }
+        for (int c : wanted) {
+            requestedMs[c] = now;
+            state[c] = QUEUED;
+            requests.push_back(c);
+        }
+        if (!wanted.empty()) wake.notify_one();
+    }
+    
+    void loaderLoop() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this] { return !running || !requests.empty(); });
+            if (!running) return;
+            // Nearest to the player first
+            int center = focus.load(std::memory_order_relaxed);
+            size_t best = 0;
+            int bestDistance = INT_MAX;
+            for (size_t i = 0; i < requests.size(); i++) {
+                int c = requests[i];
+                int d = std::max(std::abs(c % side - center % side), std::abs(c / side - center / side));
+                if (d < bestDistance) {
+                    best = i;
+                    bestDistance = d;
+                }
+            }
+            int c = requests[best];
+            requests[best] = requests.back();
+            requests.pop_back();
+            lock.unlock();
+            ChunkData* chunk = buildChunk(*file, c);
+            lock.lock();
+            finished.push_back(chunk);
+            built.notify_one();
+        }
+    }
+    
+    // Lockstep: installs the chunks due by this step, in request order
+    void installDue() {
+        while (!due.empty() && due.front().first <= step) {
+            int c = due.front().second;
+            due.pop_front();
+            if (state[c] != QUEUED) continue;
+            install(thread.joinable() ? waitForChunk(c) : buildChunk(*file, c));
+        }
+    }
+    
+    // Lockstep: takes chunk c from the loader, waiting for it if need be.
+    // Chunks built for cancelled requests are dropped on the way.
+    ChunkData* waitForChunk(int c) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            for (size_t i = 0; i < finished.size();) {
+                ChunkData* chunk = finished[i];
+                if (chunk->id == c) {
+                    finished.erase(finished.begin() + i);
+                    return chunk;
+                }
+                if (state[chunk->id] != QUEUED) {
+                    delete chunk;
+                    finished.erase(finished.begin() + i);
+                } else {
+                    i++;
+                }
+            }
+            built.wait(lock);
+        }
+    }
+    
+public:
+    WorldStreamer() : file(NULL), fileSerial(0), side(0), residentVersion(0), centerChunk(-1), newest(-1), oldest(-1),
+                      running(false), focus(0), lockstep(false), step(0) {}
+    ~WorldStreamer() { stop(); }
+    
+    // Starts loading on a background thread; until then loads happen inline
+    void start() {
+        if (thread.joinable()) return;
+        running = true;
+        // Lockstep requests made before the loader existed
+        for (const auto& d : due) requests.push_back(d.second);
+        thread = std::thread([this] { loaderLoop(); });
+    }
+    
+    void stop() {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wake.notify_one();
+        thread.join();
+        for (ChunkData* chunk : finished) delete chunk;
+        finished.clear();
+        requests.clear();
+        due.clear();
+        for (uint8_t& s : state) {
+            if (s == QUEUED) s = UNLOADED;
+        }
+    }
+    
+    void setBudget(size_t bytes) { stats.budgetBytes = bytes; }
+    void setLockstep(bool on) { lockstep = on; }
+    
+    // Called by initGame() after the level is applied to the tables: keeps
+    // the resident chunks of the same level (their collectibles go back in
+    // the now empty pickup grid) and loads what is missing around the player
+    void restart(const LevelFile& level, const Vector3& player) {
+        if (file != &level || fileSerial != level.loadSerial()) {
+            bool threaded = thread.joinable();
+            stop();
+            file = &level;
+            fileSerial = level.loadSerial();
+            info = level.info();
+            side = level.chunksPerSide();
+            state.assign(level.chunkCount(), UNLOADED);
+            requestedMs.assign(level.chunkCount(), 0);
+            resident.assign(level.chunkCount(), ChunkRef());
+            residentIds.clear();
+            filled.assign(level.chunkCount(), 0);
+            newer.assign(level.chunkCount(), -1);
+            older.assign(level.chunkCount(), -1);
+            newest = oldest = -1;
+            due.clear();
+            stats.residentBytes = 0;
+            residentVersion++;
+            if (threaded) start();
+        }
+        collectibleGrid.clear(GRID_CELL_SIZE);
+        filling.clear();
+        for (int c : residentIds) {
+            filled[c] = 0;
+            fill(c, INT_MAX);
+        }
+        recenter(player);
+    }
+    
+    // After the player jumped (restart, rewind): loads the chunk under the
+    // player at once and requests the rest around it
+    void recenter(const Vector3& player) {
+        if (!file) return;
+        int center = info.chunkAt(player.x, player.z);
+        if (!loaded(center)) {
+            requestedMs[center] = nowMs();
+            install(buildChunk(*file, center));
+        }
+        centerChunk = -1;
+        update(player);
+    }
+    
+    // Whether the collectibles at pos are in the pickup grid's chunks
+    bool holds(float x, float z) const { return file && state[info.chunkAt(x, z)] == RESIDENT; }
+    
+    // Every loaded chunk's collectibles into the pickup grid now, so holds()
+    // speaks for all of them (before a snapshot restore edits the grid)
+    void fillAll() {
+        for (int c : filling) {
+            if (state[c] == FILLING) fill(c, INT_MAX);
+        }
+        filling.clear();
+    }
+    
+    // Once per simulation step
+    void update(const Vector3& player) {
+        if (!file) return;
+        step++;
+        if (lockstep) {
+            installDue();
+        } else if (thread.joinable()) {
+            std::vector<ChunkData*> done;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.swap(finished);
+            }
+            for (ChunkData* chunk : done) install(chunk);
+        }
+        int center = info.chunkAt(player.x, player.z);
+        if (center != centerChunk) {
+            centerChunk = center;
+            focus.store(center, std::memory_order_relaxed);
+            request(player.x, player.z);
+        }
+        // The player's own chunk can't wait for its pickups
+        if (state[center] == FILLING) fill(center, INT_MAX);
+        fillSome(STREAM_FILL_PER_STEP);
+        if (!loaded(center)) stats.stepsUnloaded++;
+        enforceBudget(player.x, player.z);
+        stats.residentChunks = (int)residentIds.size();
+    }
+    
+    // The resident chunks, for a render snapshot
+    void residentChunks(std::vector<ChunkRef>& out) const {
+        out.clear();
+        for (int c : residentIds) out.push_back(resident[c]);
+    }
+    int version() const { return residentVersion; }
+    const StreamStats& statistics() const { return stats; }
+};
+
+WorldStreamer streamer;
+
+// ==================== GAME EVENTS ====================
+// State changes are published once, when they happen. Listeners (HUD, log,
+// audio) react to events instead of rescanning the collectibles every frame.
+enum GameEventType {
+    EVENT_PICKUP, EVENT_PLATFORM_COMPLETE, EVENT_WIN, EVENT_TIME_UP, EVENT_RIVAL_PICKUP, EVENT_RIVAL_WIN
+};
+
+struct GameEvent {
+    GameEventType type;
+    int index;      // collectible (pickup) or platform (platform complete), else -1
+    float distance; // pickup distance
+    int rival;      // agent of a rival pickup or win, else -1
+    GameEvent(GameEventType t, int i = -1, float d = 0, int r = -1) : type(t), index(i), distance(d), rival(r) {}
+};
+
+class GameEventBus {
+private:
+    std::vector<std::function<void(const GameEvent&)>> listeners;
+    
+public:
+    void subscribe(const std::function<void(const GameEvent&)>& listener) {
+        listeners.push_back(listener);
+    }
+    
+    void publish(const GameEvent& event) {
+        for (const auto& listener : listeners) listener(event);
+    }
+};
+
+GameEventBus eventBus;
+
+// Progress counters, updated on each pickup instead of being recounted
+struct GameCounters {
+    int collected;
+    int total;
+    int platformsComplete;
+    std::vector<int> platformCollected;
+    std::vector<int> platformTotal;
+    GameCounters() : collected(0), total(0), platformsComplete(0) {}
+};
+
+GameCounters counters;
+
+// ==================== CROWD ====================
+// Rival ninjas and samurai racing the player for the collectibles. Each one
+// follows the collectible flow field to the nearest uncollected item, keeps
+// its distance from the others and turns along platforms and props before it
+// walks into them; whatever it still runs into it slides along like the
+// player does.
+//
+// Agent state is one array per field. A step sorts the agents into a grid by
+// position and then steers them in blocks on the job system. An agent reads
+// only positions from before the step, the level, the pickup grid and the
+// static colliders (none of which change meanwhile) and writes only its own
+// entries, so the result is the same for any number of workers. Pickups are
+// resolved after the step, one agent at a time in index order (see
+// checkRivalPickups()), and only then update the flow field.
+//
+// Agents are not in the collision world: reinserting thousands of boxes into
+// the tree would cost more than the rest of the step, so they only push each
+// other apart and walk through the player.
+const float NPC_SPEED = 0.2f;               // per step, slower than the player
+const float NPC_SEPARATION = 1.2f;          // agents closer than this push each other apart
+const float NPC_SEPARATION_WEIGHT = 1.5f;
+const int NPC_MAX_NEIGHBOURS = 12;          // pushes counted per agent and step
+const float NPC_LOOKAHEAD = 2.0f;           // obstacles this close ahead are steered around
+const int NPC_RETARGET_PERIOD = 8;          // an agent the flow field can't give a target searches every 8th step
+const int NPC_STUCK_STEPS = 45;             // steps without headway before it gives up on a target
+const int NPC_GRAIN = 1024;                 // agents per steering job
+const int DEFAULT_NPCS = 4;
+
+struct AgentTable {
+    // Position (like playerPos, PLAYER_FOOT_OFFSET above the feet), and before the last step
+    std::vector<float> x, y, z;
+    std::vector<float> prevX, prevY, prevZ;
+    std::vector<float> heading;     // degrees, like playerRotation
+    // Steering state
+    std::vector<int> target;        // collectible, -1 for none
+    std::vector<int> skip;          // the last target it gave up on
+    std::vector<int> stuck;         // steps without headway towards the target
+    std::vector<int> score;         // collectibles picked up
+    
+    int count() const { return (int)x.size(); }
+    Vector3 position(int i) const { return Vector3(x[i], y[i], z[i]); }
+    
+    void resize(int n) {
+        x.assign(n, 0); y.assign(n, 0); z.assign(n, 0);
+        prevX.assign(n, 0); prevY.assign(n, 0); prevZ.assign(n, 0);
+        heading.assign(n, 0);
+        target.assign(n, -1);
+        skip.assign(n, -1);
+        stuck.assign(n, 0);
+        score.assign(n, 0);
+    }
+};
+
+// Running totals, like CollisionStats
+struct CrowdStats {
+    long steps;
+    long agentSteps;
+    long retargets;      // nearest-collectible searches, when the flow field did not do
+    long neighbours;     // separation pushes
+    long avoided;        // agent steps turned by an obstacle ahead
+    long pickups;
+    double stepMs;       // steering, summed over the steps
+    float worstMs;
+    CollisionStats collision;   // of the agents' obstacle queries and sweeps
+    
+    CrowdStats() : steps(0), agentSteps(0), retargets(0), neighbours(0), avoided(0), pickups(0), stepMs(0), worstMs(0) {}
+    
+    void add(const CrowdStats& o) {
+        retargets += o.retargets;
+        neighbours += o.neighbours;
+        avoided += o.avoided;
+        collision.add(o.collision);
+    }
+};
+
+class Crowd {
+private:
+    // The agents sorted by grid cell: cell c holds order[cellStart[c]] up to
+    // order[cellStart[c + 1]], with their positions alongside
+    float cellSize, originX, originZ;
+    int columns, rows;
+    std::vector<int> cellStart, cursor, cellOf, order;
+    std::vector<float> sortedX, sortedZ;
+    std::vector<CrowdStats> blockStats;  // one per steering job, merged in block order
+    
+    // The static colliders by cell of a fixed grid over the level: cell c
+    // lists obstacles[obstacleStart[c]] up to obstacleStart[c + 1], every
+    // collider an agent anywhere in the cell could look ahead at or walk into
+    // this step. Most cells are empty, so an agent in the open costs one lookup.
+    float obstacleCell, obstacleOrigin;
+    int obstacleColumns;
+    std::vector<int> obstacleStart, obstacles;
+    
+    int obstacleCellOf(float v) const {
+        return std::max(0, std::min(obstacleColumns - 1, (int)((v - obstacleOrigin) / obstacleCell)));
+    }
+    
+    void buildObstacles(float half) {
+        const float reach = NPC_LOOKAHEAD + PLAYER_HALF_WIDTH + NPC_SPEED;
+        obstacleCell = 4.0f;
+        obstacleOrigin = -half - 1;
+        while ((2 * half + 2) / obstacleCell > 2048) obstacleCell *= 2;
+        obstacleColumns = (int)((2 * half + 2) / obstacleCell) + 1;
+        obstacleStart.assign(obstacleColumns * obstacleColumns + 1, 0);
+        obstacles.clear();
+        // Counted first, then filled in collider order
+        for (int pass = 0; pass < 2; pass++) {
+            if (pass == 1) {
+                for (int c = 0; c < obstacleColumns * obstacleColumns; c++) obstacleStart[c + 1] += obstacleStart[c];
+                obstacles.resize(obstacleStart.back());
+                cursor.assign(obstacleStart.begin(), obstacleStart.end() - 1);
+            }
+            for (int c = 0; c < collision.staticColliders(); c++) {
+                const AABB& box = collision.collider(c).box;
+                int x0 = obstacleCellOf(box.min.x - reach), x1 = obstacleCellOf(box.max.x + reach);
+                int z0 = obstacleCellOf(box.min.z - reach), z1 = obstacleCellOf(box.max.z + reach);
+                for (int z = z0; z <= z1; z++) {
+                    for (int x = x0; x <= x1; x++) {
+                        if (pass == 0) obstacleStart[z * obstacleColumns + x + 1]++;
+                        else obstacles[cursor[z * obstacleColumns + x]++] = c;
+                    }
+                }
+            }
+        }
+    }
+    
+    int cellIndex(float x, float z) const {
+        int cx = std::min(columns - 1, (int)((x - originX) / cellSize));
+        int cz = std::min(rows - 1, (int)((z - originZ) / cellSize));
+        return cz * columns + cx;
+    }
+    
+    // Counting sort of the positions before the step. Cells are at least
+    // NPC_SEPARATION wide, so every neighbour is in the 3 x 3 cells around an
+    // agent; a crowd spread thin gets wider cells, so the grid stays within a
+    // few cells per agent.
+    void buildGrid() {
+        int n = agents.count();
+        float minX = 1e30f, maxX = -1e30f, minZ = 1e30f, maxZ = -1e30f;
+        for (int i = 0; i < n; i++) {
+            minX = std::min(minX, agents.prevX[i]); maxX = std::max(maxX, agents.prevX[i]);
+            minZ = std::min(minZ, agents.prevZ[i]); maxZ = std::max(maxZ, agents.prevZ[i]);
+        }
+        cellSize = NPC_SEPARATION;
+        const double maxCells = 4.0 * n + 1024;
+        while (((maxX - minX) / cellSize + 1) * (double)((maxZ - minZ) / cellSize + 1) > maxCells) cellSize *= 2;
+        originX = minX;
+        originZ = minZ;
+        columns = (int)((maxX - minX) / cellSize) + 1;
+        rows = (int)((maxZ - minZ) / cellSize) + 1;
+        
+        cellStart.assign(columns * rows + 1, 0);
+        cellOf.resize(n);
+        for (int i = 0; i < n; i++) {
+            cellOf[i] = cellIndex(agents.prevX[i], agents.prevZ[i]);
+            cellStart[cellOf[i] + 1]++;
+        }
+        for (int c = 0; c < columns * rows; c++) cellStart[c + 1] += cellStart[c];
+        cursor.assign(cellStart.begin(), cellStart.end() - 1);
+        order.resize(n);
+        sortedX.resize(n);
+        sortedZ.resize(n);
+        for (int i = 0; i < n; i++) {
+            int k = cursor[cellOf[i]]++;
+            order[k] = i;
+            sortedX[k] = agents.prevX[i];
+            sortedZ[k] = agents.prevZ[i];
+        }
+    }
+    
+    // Whether the flow field speaks for cell. Where it does, no source there
+    // means no collectible can be walked to, and a search would find none.
+    static bool fieldCovers(int cell) { return collectibleField.ready() && navGrid.open(cell); }
+    
+    void retarget(int i, const Vector3& pos, std::vector<int>& nearest, std::vector<std::pair<float, int>>& scratch) {
+        collectibleGrid.nearest(pos, agents.skip[i] >= 0 ? 2 : 1, nearest, scratch);
+        agents.target[i] = -1;
+        for (int item : nearest) {
+            if (item != agents.skip[i]) {
+                agents.target[i] = item;
+                break;
+            }
+        }
+        if (agents.target[i] < 0 && !nearest.empty()) agents.target[i] = nearest[0];
+        agents.stuck[i] = 0;
+    }
+    
+    // Steers and moves agents [begin, end) one step
+    void steer(int begin, int end, CrowdStats& counts) {
+        static thread_local std::vector<int> near, nearest;
+        static thread_local std::vector<std::pair<float, int>> scratch;
+        AgentTable& a = agents;
+        const float r2 = NPC_SEPARATION * NPC_SEPARATION;
+        const int slot = (int)(ticks % NPC_RETARGET_PERIOD);
+        for (int i = begin; i < end; i++) {
+            Vector3 pos(a.prevX[i], a.prevY[i], a.prevZ[i]);
+            
+            // A target someone else took (or whose chunk was evicted) is
+            // replaced by the one the flow field leads to from here. If that
+            // is the one it gave up on, or it stands where the field does not
+            // reach, it searches in its slot of every NPC_RETARGET_PERIOD
+            // steps, which spreads out the searches. An open cell the field
+            // gives no source (rather than one it is refilling) has nothing
+            // left to search for.
+            int target = a.target[i];
+            int navCell = navGrid.cellAt(pos.x, pos.z);
+            int fieldTarget = collectibleField.sourceAt(navCell);
+            if (!offered(target)) {
+                if (fieldTarget != a.skip[i] && offered(fieldTarget)) {
+                    a.target[i] = fieldTarget;
+                    a.stuck[i] = 0;
+                } else if ((slot + i) % NPC_RETARGET_PERIOD == 0 && (fieldTarget != -1 || !fieldCovers(navCell))) {
+                    counts.retargets++;
+                    retarget(i, pos, nearest, scratch);
+                }
+                target = a.target[i];
+            }
+            
+            // Seek: towards the next cell of the flow field while it leads to
+            // the target, otherwise (and in the target's cell) straight at it
+            float seekX = 0, seekZ = 0, goalDistance = 0;
+            int fieldDistance = NAV_UNREACHED;
+            if (target >= 0) {
+                int next = fieldTarget == target ? collectibleField.next(navCell) : -1;
+                if (next >= 0) fieldDistance = collectibleField.distanceAt(navCell);
+                float gx = collectibles.transform.x[target] - pos.x, gz = collectibles.transform.z[target] - pos.z;
+                goalDistance = sqrtf(gx * gx + gz * gz);
+                Vector3 waypoint = next >= 0 ? navGrid.center(next) : collectibles.transform.position(target);
+                seekX = waypoint.x - pos.x;
+                seekZ = waypoint.z - pos.z;
+                float seekDistance = sqrtf(seekX * seekX + seekZ * seekZ);
+                if (seekDistance > 1e-4f) {
+                    seekX /= seekDistance;
+                    seekZ /= seekDistance;
+                } else {
+                    seekX = seekZ = 0;
+                }
+            }
+            
+            // Separation: each neighbour pushes by how far it is inside NPC_SEPARATION
+            float pushX = 0, pushZ = 0;
+            int pushes = 0;
+            int cx = cellOf[i] % columns, cz = cellOf[i] / columns;
+            for (int gz = std::max(cz - 1, 0); gz <= std::min(cz + 1, rows - 1) && pushes < NPC_MAX_NEIGHBOURS; gz++) {
+                for (int gx = std::max(cx - 1, 0); gx <= std::min(cx + 1, columns - 1) && pushes < NPC_MAX_NEIGHBOURS; gx++) {
+                    int c = gz * columns + gx;
+                    for (int k = cellStart[c]; k < cellStart[c + 1] && pushes < NPC_MAX_NEIGHBOURS; k++) {
+                        float dx = pos.x - sortedX[k], dz = pos.z - sortedZ[k];
+                        float d2 = dx * dx + dz * dz;
+                        if (d2 >= r2 || order[k] == i) continue;
+                        pushes++;
+                        if (d2 < 1e-8f) {
+                            pushX += order[k] < i ? 1.0f : -1.0f; // on the same spot: part by index
+                            continue;
+                        }
+                        float d = sqrtf(d2);
+                        float w = (NPC_SEPARATION - d) / (NPC_SEPARATION * d);
+                        pushX += dx * w;
+                        pushZ += dz * w;
+                    }
+                }
+            }
+            counts.neighbours += pushes;
+            
+            float steerX = seekX + pushX * NPC_SEPARATION_WEIGHT;
+            float steerZ = seekZ + pushZ * NPC_SEPARATION_WEIGHT;
+            float length = sqrtf(steerX * steerX + steerZ * steerZ);
+            a.x[i] = pos.x;
+            a.y[i] = pos.y;
+            a.z[i] = pos.z;
+            if (length < 1e-4f) {
+                a.stuck[i] = 0;
+                continue;
+            }
+            steerX /= length;
+            steerZ /= length;
+            float speed = std::min(length, 1.0f) * NPC_SPEED;
+            
+            // The agent's obstacle cell answers both the look-ahead and the move
+            AABB box = playerBox(pos);
+            int cell = obstacleCellOf(pos.z) * obstacleColumns + obstacleCellOf(pos.x);
+            near.assign(obstacles.begin() + obstacleStart[cell], obstacles.begin() + obstacleStart[cell + 1]);
+            
+            // Obstacle avoidance: the closer the first box ahead that is too
+            // tall to step onto, the more the agent turns along its face, the
+            // way it is already heading along it (or round the nearer end)
+            float first = 1;
+            int axis = -1;
+            const AABB* obstacle = NULL;
+            Vector3 ahead(steerX * NPC_LOOKAHEAD, 0, steerZ * NPC_LOOKAHEAD);
+            for (int c : near) {
+                const AABB& other = collision.collider(c).box;
+                if (other.max.y <= box.min.y + STEP_HEIGHT) continue;
+                float t;
+                int hit;
+                if (sweepBox(box, ahead, other, t, hit) && t < first) {
+                    first = t;
+                    axis = hit;
+                    obstacle = &other;
+                }
+            }
+            if (axis == 0 || axis == 2) {
+                counts.avoided++;
+                float along = axis == 0 ? steerZ : steerX;
+                if (fabsf(along) < 1e-3f) {
+                    along = axis == 0 ? pos.z - (obstacle->min.z + obstacle->max.z) * 0.5f
+                                      : pos.x - (obstacle->min.x + obstacle->max.x) * 0.5f;
+                }
+                float turn = (along >= 0 ? 1.0f : -1.0f) * (1 - first);
+                if (axis == 0) {
+                    steerX *= first;
+                    steerZ = steerZ * first + turn;
+                } else {
+                    steerZ *= first;
+                    steerX = steerX * first + turn;
+                }
+                length = sqrtf(steerX * steerX + steerZ * steerZ);
+                if (length > 1e-4f) {
+                    steerX /= length;
+                    steerZ /= length;
+                }
+            }
+            
+            Vector3 delta(steerX * speed, 0, steerZ * speed);
+            AABB moved = collision.sweepAmong(box, delta, STEP_HEIGHT, near, counts.collision);
+            float movedX = moved.min.x - box.min.x, movedZ = moved.min.z - box.min.z;
+            a.x[i] = pos.x + movedX;
+            a.y[i] = pos.y + (moved.min.y - box.min.y);
+            a.z[i] = pos.z + movedZ;
+            if (movedX != 0 || movedZ != 0) a.heading[i] = atan2f(-movedX, movedZ) * (float)(180.0 / M_PI);
+            
+            // Give up on a target it makes no headway towards, by straight
+            // line or along the flow field
+            if (target >= 0) {
+                float gx = collectibles.transform.x[target] - a.x[i], gz = collectibles.transform.z[target] - a.z[i];
+                bool headway = sqrtf(gx * gx + gz * gz) < goalDistance - NPC_SPEED * 0.25f ||
+                               collectibleField.distanceAt(navGrid.cellAt(a.x[i], a.z[i])) < fieldDistance;
+                if (headway) {
+                    a.stuck[i] = 0;
+                } else if (++a.stuck[i] >= NPC_STUCK_STEPS) {
+                    a.skip[i] = target;
+                    a.target[i] = -1;
+                    a.stuck[i] = 0;
+                }
+            }
+        }
+    }
+    
+public:
+    AgentTable agents;
+    long ticks;         // steps since spawn(); picks the agents that retarget
+    CrowdStats stats;
+    
+    // Whether an agent may go for item: rivals only see the collectibles in
+    // resident chunks, like the player's pickup grid
+    static bool offered(int item) {
+        if (item < 0 || collectibles.collected[item]) return false;
+        return streamer.holds(collectibles.transform.x[item], collectibles.transform.z[item]);
+    }
+    
+    Crowd() : cellSize(NPC_SEPARATION), originX(0), originZ(0), columns(1), rows(1), obstacleCell(4.0f),
+              obstacleOrigin(0), obstacleColumns(0), ticks(0) {}
+    
+    // n agents at random open spots around the middle of the level, each with
+    // a target already. Needs the colliders, the navigation grid and the
+    // pickup grid.
+    void spawn(int n, uint32_t seed, float half) {
+        agents.resize(n);
+        ticks = 0;
+        if (n > 0) buildObstacles(half);
+        std::mt19937 rng(seed);
+        auto unit = [&rng]() { return (rng() >> 8) * (1.0f / 16777216.0f); };
+        float extent = std::max(1.0f, std::min(half - 2, std::max(20.0f, 2 * sqrtf((float)n))));
+        std::vector<int> near, nearest;
+        std::vector<std::pair<float, int>> scratch;
+        CollisionStats counts;
+        for (int i = 0; i < n; i++) {
+            Vector3 pos;
+            for (int attempt = 0; attempt < 16; attempt++) {
+                pos = Vector3((unit() * 2 - 1) * extent, PLAYER_FOOT_OFFSET, (unit() * 2 - 1) * extent);
+                collision.staticNear(playerBox(pos), near, counts);
+                if (near.empty()) break;
+            }
+            agents.x[i] = agents.prevX[i] = pos.x;
+            agents.y[i] = agents.prevY[i] = pos.y;
+            agents.z[i] = agents.prevZ[i] = pos.z;
+            int target = collectibleField.sourceAt(navGrid.cellAt(pos.x, pos.z));
+            agents.target[i] = offered(target) ? target : -1;
+            if (agents.target[i] < 0) retarget(i, pos, nearest, scratch);
+        }
+    }
+    
+    // Steers and moves every agent one step
+    void step() {
+        int n = agents.count();
+        if (n == 0) return;
+        PROFILE_SCOPE("crowd");
+        double start = nowMs();
+        agents.prevX = agents.x;
+        agents.prevY = agents.y;
+        agents.prevZ = agents.z;
+        buildGrid();
+        
+        int blocks = (n + NPC_GRAIN - 1) / NPC_GRAIN;
+        blockStats.assign(blocks, CrowdStats());
+        auto steerBlock = [this](int begin, int end) { steer(begin, end, blockStats[begin / NPC_GRAIN]); };
+        if (blocks == 1) steerBlock(0, n);
+        else jobs.run(jobs.parallelFor(n, NPC_GRAIN, steerBlock));
+        for (const CrowdStats& block : blockStats) stats.add(block);
+        ticks++;
+        
+        float ms = (float)(nowMs() - start);
+        stats.steps++;
+        stats.agentSteps += n;
+        stats.stepMs += ms;
+        stats.worstMs = std::max(stats.worstMs, ms);
+    }
+    
+    // Highest score and the agent with it (the lowest index on a tie), -1 without agents
+    int leader() const {
+        int best = -1;
+        for (int i = 0; i < agents.count(); i++) {
+            if (best < 0 || agents.score[i] > agents.score[best]) best = i;
+        }
+        return best;
+    }
+    int bestScore() const {
+        int i = leader();
+        return i < 0 ? 0 : agents.score[i];
+    }
+};
+
+Crowd crowd;
+int npcCount = DEFAULT_NPCS;   // --npcs
+
+// One line of per-step averages, after the caller's label
+void printCrowdStats(const CrowdStats& stats, int agents) {
+    double perStep = 1.0 / std::max(1L, stats.steps);
+    double perAgent = 1.0 / std::max(1L, stats.agentSteps);
+    std::cout << agents << " agents, " << std::fixed << std::setprecision(3) << stats.stepMs * perStep
+              << " ms per step (worst " << stats.worstMs << " ms), " << std::setprecision(2)
+              << stats.retargets * perStep << " retargets, " << stats.neighbours * perAgent << " pushes and "
+              << stats.collision.pairsTested * perAgent << " pairs tested per agent; "
+              << stats.avoided << " turns, " << stats.pickups << " pickups" << std::endl;
+}
+
+// ==================== RENDER SNAPSHOTS ====================
+// The simulation runs on its own thread (see SimulationThread) and hands the
+// renderer copies of the state it draws. The renderer reads nothing else the
+// simulation writes, so neither side ever waits for the other.
+
+// Simulation-side stall counters, published with every snapshot
+struct SimStats {
+    long steps;
+    long lateSteps;     // started more than a step behind schedule
+    long droppedSteps;  // skipped after a stall longer than MAX_FRAME_MS
+    long unseen;        // snapshots replaced before the renderer took them
+    float worstLateMs;
+    float publishMs;    // copying the last snapshot
+    SimStats() : steps(0), lateSteps(0), droppedSteps(0), unseen(0), worstLateMs(0), publishMs(0) {}
+};
+
+// The rival columns drawRivals() reads: where each one is, was a step ago
+// and faces. Kept per snapshot slot and overwritten in place.
+struct RivalView {
+    std::vector<float> x, y, z;
+    std::vector<float> prevX, prevY, prevZ;
+    std::vector<float> heading;
+    
+    int count() const { return (int)x.size(); }
+    Vector3 position(int i) const { return Vector3(x[i], y[i], z[i]); }
+};
+
+// Everything the renderer reads about the game after the last step. The
+// renderer only writes renderAnimationValue, which the simulation never reads.
+struct RenderSnapshot {
+    long tick;
+    double stepTimeMs;  // when the last step was due; rendering interpolates from here
+    int levelVersion;   // the tables' layout is only copied again when this changes
+    GameState gameState;
+    int timeRemaining;
+    int collected, total;
+    Vector3 playerPos, prevPlayerPos;
+    float playerRotation;
+    float globalRotation, prevGlobalRotation;
+    bool debugMode;
+    int cameraMode;
+    float cameraAngleX, cameraAngleY, cameraDistance;
+    PlatformTable platforms;
+    CollectibleTable collectibles;
+    size_t pickedSeen;  // entries of pickedSinceLevel already in collectibles.collected
+    float worldHalfSize;
+    int chunkVersion;               // chunks is only copied again when this changes
+    std::vector<ChunkRef> chunks;   // resident; only these are drawn
+    SimStats stats;
+    StreamStats stream;
+    CollisionStats collision;
+    int colliders;
+    RivalView rivals;
+    int rivalCollected, rivalBest;
+    CrowdStats crowd;
+    NavStats paths, field;
+    
+    RenderSnapshot() : tick(-1), stepTimeMs(0), levelVersion(-1), gameState(PLAYING), timeRemaining(0),
+                       collected(0), total(0), playerRotation(0), globalRotation(0), prevGlobalRotation(0),
+                       debugMode(false), cameraMode(0), cameraAngleX(0), cameraAngleY(0), cameraDistance(0),
+                       pickedSeen(0), worldHalfSize(GROUND_SIZE), chunkVersion(-1), colliders(0), rivalCollected(0), rivalBest(0) {}
+};
+
+// Three snapshots: the one being written, the one being drawn and the newest
+// finished one. Each side swaps its slot with the newest one in a single
+// atomic exchange, so publishing and acquiring never block.
+class SnapshotBuffer {
+private:
+    static const int FRESH = 4; // set on `latest` until the renderer takes it
+    RenderSnapshot slots[3];
+    std::atomic<int> latest;
+    int writing;    // simulation thread only
+    int reading;    // render thread only
+    
+public:
+    SnapshotBuffer() : latest(1), writing(0), reading(2) {}
+    
+    // Simulation side. The slot may hold an older snapshot to update.
+    RenderSnapshot& back() { return slots[writing]; }
+    
+    // Makes back() the newest snapshot. False if the one it replaced was never drawn.
+    bool publish() {
+        int previous = latest.exchange(writing | FRESH, std::memory_order_acq_rel);
+        writing = previous & 3;
+        return !(previous & FRESH);
+    }
+    
+    // Render side: moves to the newest snapshot; false if there is none since the last call
+    bool acquire() {
+        if (!(latest.load(std::memory_order_relaxed) & FRESH)) return false;
+        reading = latest.exchange(reading, std::memory_order_acq_rel) & 3;
+        return true;
+    }
+    RenderSnapshot& front() { return slots[reading]; }
+};
+
+// Render-side stall counters: frames that found no new snapshot, and how
+// far behind the clock the snapshots they drew were
+struct RenderStallStats {
+    long frames;
+    long staleFrames;
+    double ageSumMs;
+    float worstAgeMs;
+    
+    RenderStallStats() : frames(0), staleFrames(0), ageSumMs(0), worstAgeMs(0) {}
+    
+    void frame(bool fresh, float ageMs) {
+        frames++;
+        if (!fresh) staleFrames++;
+        ageSumMs += ageMs;
+        worstAgeMs = std::max(worstAgeMs, ageMs);
+    }
+};
+
+RenderStallStats renderStalls;
+
+int levelVersion = 0;           // bumped by initGame() and snapshot restores
+std::vector<int> pickedSinceLevel;  // collectibles picked up since levelVersion changed, in order
+RenderSnapshot* scene = NULL;   // what the render thread draws this frame
+
+// Copies the simulation state into s. Positions, sizes and colours only change
+// with the level, so they are copied once per level and slot; after that the
+// collected flags only take the pickups the slot has not seen.
+void captureSnapshot(RenderSnapshot& s) {
+    if (s.levelVersion != levelVersion) {
+        s.platforms = platforms;
+        s.collectibles = collectibles;
+        s.pickedSeen = pickedSinceLevel.size();
+        s.worldHalfSize = worldHalfSize;
+        s.levelVersion = levelVersion;
+    } else {
+        s.platforms.animationActive = platforms.animationActive;
+        s.platforms.animationValue = platforms.animationValue;
+        s.platforms.prevAnimationValue = platforms.prevAnimationValue;
+        s.platforms.allCollected = platforms.allCollected;
+        for (; s.pickedSeen < pickedSinceLevel.size(); s.pickedSeen++) {
+            s.collectibles.collected[pickedSinceLevel[s.pickedSeen]] = 1;
+        }
+    }
+    s.gameState = gameState;
+    s.timeRemaining = gameTimeRemaining;
+    s.collected = counters.collected;
+    s.total = counters.total;
+    s.playerPos = playerPos;
+    s.prevPlayerPos = prevPlayerPos;
+    s.playerRotation = playerRotation;
+    s.globalRotation = globalRotation;
+    s.prevGlobalRotation = prevGlobalRotation;
+    s.debugMode = debugMode;
+    s.cameraMode = cameraMode;
+    s.cameraAngleX = cameraAngleX;
+    s.cameraAngleY = cameraAngleY;
+    s.cameraDistance = cameraDistance;
+    if (s.chunkVersion != streamer.version()) {
+        streamer.residentChunks(s.chunks);
+        s.chunkVersion = streamer.version();
+    }
+    s.stream = streamer.statistics();
+    s.collision = collision.stats;
+    s.colliders = collision.count();
+    const AgentTable& agents = crowd.agents;
+    RivalView& rivals = s.rivals;
+    rivals.x.assign(agents.x.begin(), agents.x.end());
+    rivals.y.assign(agents.y.begin(), agents.y.end());
+    rivals.z.assign(agents.z.begin(), agents.z.end());
+    rivals.prevX.assign(agents.prevX.begin(), agents.prevX.end());
+    rivals.prevY.assign(agents.prevY.begin(), agents.prevY.end());
+    rivals.prevZ.assign(agents.prevZ.begin(), agents.prevZ.end());
+    rivals.heading.assign(agents.heading.begin(), agents.heading.end());
+    s.rivalCollected = 0;
+    for (int score : crowd.agents.score) s.rivalCollected += score;
+    s.rivalBest = crowd.bestScore();
+    s.crowd = crowd.stats;
+    s.paths = pathFinder.stats;
+    s.field = collectibleField.stats;
+}
+
+// ==================== GL STATE CACHE ====================
+// Shadows the GL state the renderer changes (capabilities, client arrays,
+// buffer bindings, program) so redundant calls never reach the driver.
+// Everything that touches this state should go through glState.
+class GLStateCache {
+private:
+    std::vector<std::pair<GLenum, bool>> caps;
+    std::vector<std::pair<GLenum, bool>> clientArrays;
+    GLuint arrayBuffer, elementBuffer, currentProgram;
+    
+    bool* lookup(std::vector<std::pair<GLenum, bool>>& list, GLenum cap) {
+        for (auto& entry : list) {
+            if (entry.first == cap) return &entry.second;
+        }
+        list.push_back(std::make_pair(cap, (bool)glIsEnabled(cap)));
+        return &list.back().second;
+    }
+    
+public:
+    int issued;  // calls passed on to GL since resetCounters()
+    int skipped; // redundant calls dropped
+    
+    GLStateCache() : arrayBuffer(0), elementBuffer(0), currentProgram(0), issued(0), skipped(0) {}
+    
+    // Forget everything; the next change of each piece of state is issued
+    void invalidate() {
+        caps.clear();
+        clientArrays.clear();
+        glBindBuffer(GL_ARRAY_BUFFER, arrayBuffer = 0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer = 0);
+        glUseProgram(currentProgram = 0);
+    }
+    
+    void resetCounters() { issued = skipped = 0; }
+    
+    void set(GLenum cap, bool on) {
+        bool* state = lookup(caps, cap);
+        if (*state == on) { skipped++; return; }
+        if (on) glEnable(cap); else glDisable(cap);
+        *state = on;
+        issued++;
+    }
+    void enable(GLenum cap) { set(cap, true); }
+    void disable(GLenum cap) { set(cap, false); }
+    
+    void clientArray(GLenum array, bool on) {
+        bool* state = lookup(clientArrays, array);
+        if (*state == on) { skipped++; return; }
+        if (on) glEnableClientState(array); else glDisableClientState(array);
+        *state = on;
+        issued++;
+    }
+    
+    void bindBuffer(GLenum target, GLuint buffer) {
+        GLuint& bound = target == GL_ELEMENT_ARRAY_BUFFER ? elementBuffer : arrayBuffer;
+        if (bound == buffer) { skipped++; return; }
+        glBindBuffer(target, buffer);
+        bound = buffer;
+        issued++;
+    }
+    
+    void useProgram(GLuint program) {
+        if (currentProgram == program) { skipped++; return; }
+        glUseProgram(program);
+        currentProgram = program;
+        issued++;
+    }
+    
+    // GLUT's shapes draw from client memory and switch off the client arrays
+    // they use, so unbind our buffers and expect the arrays to be off after
+    void prepareForGLUT() {
+        bindBuffer(GL_ARRAY_BUFFER, 0);
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        clientArray(GL_VERTEX_ARRAY, false);
+        clientArray(GL_NORMAL_ARRAY, false);
+        clientArray(GL_COLOR_ARRAY, false);
+    }
+    
+    GLuint boundArrayBuffer() const { return arrayBuffer; }
+    GLuint boundElementBuffer() const { return elementBuffer; }
+    GLuint program() const { return currentProgram; }
+};
+
+GLStateCache glState;
+
+// ==================== MESH CACHE ====================
+// Per-frame counters for comparing the retained and immediate-mode paths
+struct RenderStats {
+    int drawCalls;
+    int tessellations;      // primitives re-tessellated by GLU/GLUT this frame
+    long verticesSubmitted; // vertices sent from the CPU in immediate mode
+    int objectsDrawn;       // drawables that passed frustum culling
+    int objectsCulled;
+    RenderStats() { reset(); }
+    void reset() {
+        drawCalls = 0; tessellations = 0; verticesSubmitted = 0;
+        objectsDrawn = 0; objectsCulled = 0;
+    }
+    void immediate(int vertices) { drawCalls++; tessellations++; verticesSubmitted += vertices; }
+};
+
+RenderStats renderStats;
+bool useMeshCache = true;
+bool useInstancing = true;
+
+// Tessellation per level of detail, finest first; level 0 is what GLU/GLUT
+// were always asked for
+const int LOD_LEVELS = 4;
+const int LOD_SLICES[LOD_LEVELS] = { 20, 12, 8, 5 };      // spheres, cylinders, cones
+const int LOD_STACKS[LOD_LEVELS] = { 20, 10, 6, 4 };
+const int LOD_TORUS_SIDES[LOD_LEVELS] = { 16, 10, 6, 4 };
+const int LOD_TORUS_RINGS[LOD_LEVELS] = { 16, 12, 8, 6 };
+
+struct Mesh {
+    GLuint vertexBuffer, indexBuffer;
+    GLsizei indexCount;
+    Mesh() : vertexBuffer(0), indexBuffer(0), indexCount(0) {}
+};
+
+// Unit primitives tessellated once into vertex/index buffers and drawn by
+// handle; callers scale them to size with the matrix stack.
+class MeshCache {
+private:
+    // Interleaved position + normal vertices and triangle indices
+    struct Builder {
+        std::vector<float> vertices;
+        std::vector<GLushort> indices;
+        
+        void vertex(float px, float py, float pz, float nx, float ny, float nz) {
+            float v[6] = { px, py, pz, nx, ny, nz };
+            vertices.insert(vertices.end(), v, v + 6);
+        }
+        
+        // Triangulates a (rows+1) x (cols+1) vertex grid added from index base
+        void grid(int rows, int cols, int base) {
+            for (int i = 0; i < rows; i++) {
+                for (int j = 0; j < cols; j++) {
+                    GLushort a = base + i * (cols + 1) + j, b = a + cols + 1;
+                    GLushort tri[6] = { a, b, (GLushort)(a + 1), (GLushort)(a + 1), b, (GLushort)(b + 1) };
+                    indices.insert(indices.end(), tri, tri + 6);
+                }
+            }
+        }
+    };
+    
+    struct TorusSet {
+        float ratio; // tube/ring radius
+        int handles[LOD_LEVELS];
+    };
+    
+    std::vector<Mesh> meshes;
+    std::vector<TorusSet> tori;
+    
+    int upload(const Builder& b) {
+        Mesh m;
+        glGenBuffers(1, &m.vertexBuffer);
+        glState.bindBuffer(GL_ARRAY_BUFFER, m.vertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, b.vertices.size() * sizeof(float), &b.vertices[0], GL_STATIC_DRAW);
+        glGenBuffers(1, &m.indexBuffer);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, b.indices.size() * sizeof(GLushort), &b.indices[0], GL_STATIC_DRAW);
+        // Unbind so the next draw() of this mesh sets its vertex pointers
+        glState.bindBuffer(GL_ARRAY_BUFFER, 0);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        m.indexCount = (GLsizei)b.indices.size();
+        meshes.push_back(m);
+        return (int)meshes.size() - 1;
+    }
+    
+public:
+    int cube;
+    int sphere[LOD_LEVELS], cylinder[LOD_LEVELS], cone[LOD_LEVELS];
+    
+    MeshCache() : cube(-1) {}
+    
+    // Side of a unit cone/cylinder along +y, like gluCylinder rotated -90 about x
+    int buildTube(float topRadius, int slices) {
+        Builder b;
+        float ny = 1.0f - topRadius; // slope of the side for a unit height
+        float len = sqrt(1.0f + ny * ny);
+        for (int i = 0; i <= 1; i++) {
+            float r = i == 0 ? 1.0f : topRadius;
+            for (int j = 0; j <= slices; j++) {
+                float a = 2.0f * M_PI * j / slices;
+                b.vertex(r * sin(a), (float)i, r * cos(a), sin(a) / len, ny / len, cos(a) / len);
+            }
+        }
+        b.grid(1, slices, 0);
+        return upload(b);
+    }
+    
+    // Unit sphere with its poles on the z axis, like glutSolidSphere
+    int buildSphere(int slices, int stacks) {
+        Builder b;
+        for (int i = 0; i <= stacks; i++) {
+            float phi = M_PI * i / stacks;
+            for (int j = 0; j <= slices; j++) {
+                float theta = 2.0f * M_PI * j / slices;
+                float x = sin(phi) * cos(theta), y = sin(phi) * sin(theta), z = cos(phi);
+                b.vertex(x, y, z, x, y, z);
+            }
+        }
+        b.grid(stacks, slices, 0);
+        return upload(b);
+    }
+    
+    // Torus with a ring radius of 1 in the XY plane, like glutSolidTorus
+    int buildTorus(float ratio, int sides, int rings) {
+        Builder b;
+        for (int i = 0; i <= rings; i++) {
+            float theta = 2.0f * M_PI * i / rings;
+            for (int j = 0; j <= sides; j++) {
+                float phi = 2.0f * M_PI * j / sides;
+                float nx = cos(phi) * cos(theta), ny = cos(phi) * sin(theta), nz = sin(phi);
+                float ring = 1.0f + ratio * cos(phi);
+                b.vertex(ring * cos(theta), ring * sin(theta), ratio * nz, nx, ny, nz);
+            }
+        }
+        b.grid(rings, sides, 0);
+        return upload(b);
+    }
+    
+    // Needs a current GL context
+    void init() {
+        Builder b;
+        const float faces[6][3] = { {1,0,0}, {-1,0,0}, {0,1,0}, {0,-1,0}, {0,0,1}, {0,0,-1} };
+        for (int f = 0; f < 6; f++) {
+            const float* n = faces[f];
+            // Two axes spanning the face
+            float u[3] = { n[1] != 0 || n[2] != 0 ? 1.0f : 0.0f, 0, n[0] != 0 ? 1.0f : 0.0f };
+            float v[3] = { n[1]*u[2] - n[2]*u[1], n[2]*u[0] - n[0]*u[2], n[0]*u[1] - n[1]*u[0] };
+            for (int i = 0; i <= 1; i++) {
+                for (int j = 0; j <= 1; j++) {
+                    float su = j - 0.5f, sv = i - 0.5f;
+                    b.vertex(n[0]*0.5f + u[0]*su + v[0]*sv, n[1]*0.5f + u[1]*su + v[1]*sv,
+                             n[2]*0.5f + u[2]*su + v[2]*sv, n[0], n[1], n[2]);
+                }
+            }
+            b.grid(1, 1, f * 4);
+        }
+        cube = upload(b);
+        
+        for (int lod = 0; lod < LOD_LEVELS; lod++) {
+            sphere[lod] = buildSphere(LOD_SLICES[lod], LOD_STACKS[lod]);
+            // Side normals don't vary along the height, so one stack looks the same as 20
+            cylinder[lod] = buildTube(1.0f, LOD_SLICES[lod]);
+            cone[lod] = buildTube(0.0f, LOD_SLICES[lod]);
+        }
+    }
+    
+    // All detail levels of a torus are built the first time its tube/ring
+    // ratio is asked for
+    int torus(float ratio, int lod = 0) {
+        for (const auto& t : tori) {
+            if (fabs(t.ratio - ratio) < 1e-4f) return t.handles[lod];
+        }
+        TorusSet set;
+        set.ratio = ratio;
+        for (int i = 0; i < LOD_LEVELS; i++) {
+            set.handles[i] = buildTorus(ratio, LOD_TORUS_SIDES[i], LOD_TORUS_RINGS[i]);
+        }
+        tori.push_back(set);
+        return set.handles[lod];
+    }
+    
+    // Draws instanceCount copies when > 0; the caller sets up the instance
+    // attributes (see CollectibleRenderer)
+    void draw(int handle, int instanceCount = 0) {
+        const Mesh& m = meshes[handle];
+        // Pointers only need setting when another buffer was bound in between
+        if (glState.boundArrayBuffer() != m.vertexBuffer || glState.boundElementBuffer() != m.indexBuffer) {
+            glState.bindBuffer(GL_ARRAY_BUFFER, m.vertexBuffer);
+            glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.indexBuffer);
+            glVertexPointer(3, GL_FLOAT, 6 * sizeof(float), (const GLvoid*)0);
+            glNormalPointer(GL_FLOAT, 6 * sizeof(float), (const GLvoid*)(3 * sizeof(float)));
+        }
+        glState.clientArray(GL_VERTEX_ARRAY, true);
+        glState.clientArray(GL_NORMAL_ARRAY, true);
+        glState.clientArray(GL_COLOR_ARRAY, false);
+        if (instanceCount > 0) {
+            glDrawElementsInstancedARB(GL_TRIANGLES, m.indexCount, GL_UNSIGNED_SHORT, (const GLvoid*)0, instanceCount);
+        } else {
+            glDrawElements(GL_TRIANGLES, m.indexCount, GL_UNSIGNED_SHORT, (const GLvoid*)0);
+        }
+        renderStats.drawCalls++;
+    }
+};
+
+MeshCache meshCache;
+
+// ==================== SHADER PIPELINE ====================
+GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    GLint ok = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char info[1024];
+        glGetShaderInfoLog(shader, sizeof(info), NULL, info);
+        gameLogger.log(LOG_ERROR, LOG_SHADER, "Compile failed: %s", info);
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+// Links a vertex + fragment program; attributes are bound to fixed locations
+// before linking. Returns 0 on failure.
+GLuint linkProgram(const char* vertexSource, const char* fragmentSource,
+                   const std::vector<std::pair<GLuint, const char*>>& attributes) {
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    if (!vs || !fs) return 0;
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    for (const auto& a : attributes) glBindAttribLocation(program, a.first, a.second);
+    glLinkProgram(program);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint ok = 0;
+    glGetProgramiv(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char info[1024];
+        glGetProgramInfoLog(program, sizeof(info), NULL, info);
+        gameLogger.log(LOG_ERROR, LOG_SHADER, "Link failed: %s", info);
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+bool hasExtension(const char* name) {
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    return extensions && strstr(extensions, name) != NULL;
+}
+
+// Lighting shared by the shaders: the fixed-function model the game was
+// tuned with (LIGHT0 at its eye-space position, colour material for ambient
+// and diffuse, no specular), evaluated per pixel
+const char* LIGHTING_GLSL =
+    "vec3 shade(vec3 base, vec3 eyePos, vec3 eyeNormal) {\n"
+    "    vec3 n = normalize(eyeNormal);\n"
+    "    vec3 l = normalize(gl_LightSource[0].position.xyz - eyePos);\n"
+    "    vec3 light = gl_LightModel.ambient.rgb + gl_LightSource[0].ambient.rgb\n"
+    "               + gl_LightSource[0].diffuse.rgb * max(dot(n, l), 0.0);\n"
+    "    return min(base * light, 1.0);\n"
+    "}\n";
+
+// Per-pixel lit program for everything drawn through the draw helpers. The
+// material colour is a uniform that is only re-sent when it changes; baked
+// geometry can take its colour from the vertices instead.
+class LitShader {
+private:
+    GLint colorLoc, vertexColorLoc;
+    Color color;
+    float vertexColorWeight;
+    
+public:
+    GLuint program;
+    
+    LitShader() : colorLoc(-1), vertexColorLoc(-1), color(-1, -1, -1), vertexColorWeight(-1), program(0) {}
+    
+    bool init() {
+        const char* vertexSource =
+            "#version 120\n"
+            "varying vec3 eyePos;\n"
+            "varying vec3 eyeNormal;\n"
+            "varying vec3 vertexColor;\n"
+            "void main() {\n"
+            "    vec4 eye = gl_ModelViewMatrix * gl_Vertex;\n"
+            "    eyePos = eye.xyz;\n"
+            "    eyeNormal = gl_NormalMatrix * gl_Normal;\n"
+            "    vertexColor = gl_Color.rgb;\n"
+            "    gl_Position = gl_ProjectionMatrix * eye;\n"
+            "}\n";
+        std::string fragmentSource = std::string("#version 120\n") + LIGHTING_GLSL +
+            "uniform vec3 materialColor;\n"
+            "uniform float vertexColorWeight;\n"
+            "varying vec3 eyePos;\n"
+            "varying vec3 eyeNormal;\n"
+            "varying vec3 vertexColor;\n"
+            "void main() {\n"
+            "    vec3 base = materialColor * mix(vec3(1.0), vertexColor, vertexColorWeight);\n"
+            "    gl_FragColor = vec4(shade(base, eyePos, eyeNormal), 1.0);\n"
+            "}\n";
+        program = linkProgram(vertexSource, fragmentSource.c_str(), std::vector<std::pair<GLuint, const char*>>());
+        if (!program) return false;
+        colorLoc = glGetUniformLocation(program, "materialColor");
+        vertexColorLoc = glGetUniformLocation(program, "vertexColorWeight");
+        glState.useProgram(program);
+        setColor(Color(1, 1, 1));
+        setVertexColors(false);
+        glState.useProgram(0);
+        return true;
+    }
+    
+    // Both setters expect the program to be current
+    void setColor(const Color& c) {
+        if (c.r == color.r && c.g == color.g && c.b == color.b) { glState.skipped++; return; }
+        glUniform3f(colorLoc, c.r, c.g, c.b);
+        color = c;
+        glState.issued++;
+    }
+    
+    void setVertexColors(bool on) {
+        float weight = on ? 1.0f : 0.0f;
+        if (weight == vertexColorWeight) { glState.skipped++; return; }
+        glUniform1f(vertexColorLoc, weight);
+        vertexColorWeight = weight;
+        glState.issued++;
+    }
+};
+
+LitShader litShader;
+bool useShaderLighting = true; // Cleared by --fixed-function or when the shaders don't build
+
+bool shaderLightingActive() {
+    return useShaderLighting && litShader.program && glState.program() == litShader.program;
+}
+
+// Colour for the next lit primitive: a uniform on the shader path,
+// glColor (through GL_COLOR_MATERIAL) on the fixed-function path
+void setMaterial(const Color& color) {
+    if (shaderLightingActive()) litShader.setColor(color);
+    else glColor3f(color.r, color.g, color.b);
+}
+
+// ==================== VISIBILITY ====================
+// View-frustum culling and level-of-detail selection. Each drawable passes a
+// world-space bounding sphere that covers it through its whole animation;
+// the detail level comes from how many pixels that sphere's radius spans.
+class Visibility {
+private:
+    float planes[6][4];   // inward-facing, normalised
+    float view[16];       // camera modelview
+    float pixelsPerUnit;  // projected size of one unit at eye distance 1
+    
+public:
+    bool enabled;
+    int lod; // detail level for the primitives being drawn
+    
+    Visibility() : pixelsPerUnit(0), enabled(true), lod(0) {}
+    
+    // Call right after the camera transform is loaded
+    void setCamera() {
+        float projection[16], modelview[16];
+        GLint viewport[4];
+        glGetFloatv(GL_PROJECTION_MATRIX, projection);
+        glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        setCamera(projection, modelview, viewport[3]);
+    }
+    
+    // Column-major matrices, as GL returns them
+    void setCamera(const float* projection, const float* modelview, int viewportHeight) {
+        memcpy(view, modelview, sizeof(view));
+        pixelsPerUnit = projection[5] * viewportHeight * 0.5f;
+        
+        // Rows of projection * view, then the planes from their sums and differences
+        float rows[4][4];
+        for (int r = 0; r < 4; r++) {
+            for (int c = 0; c < 4; c++) {
+                rows[r][c] = projection[r] * view[c * 4] + projection[4 + r] * view[c * 4 + 1] +
+                             projection[8 + r] * view[c * 4 + 2] + projection[12 + r] * view[c * 4 + 3];
+            }
+        }
+        for (int i = 0; i < 6; i++) {
+            const float* axis = rows[i / 2];
+            float sign = i % 2 == 0 ? 1.0f : -1.0f;
+            float length = 0;
+            for (int c = 0; c < 4; c++) {
+                planes[i][c] = rows[3][c] + sign * axis[c];
+                if (c < 3) length += planes[i][c] * planes[i][c];
+            }
+            length = sqrt(length);
+            for (int c = 0; c < 4; c++) planes[i][c] /= length;
+        }
+    }
+    
+    bool sphereVisible(const Vector3& center, float radius) const {
+        for (int i = 0; i < 6; i++) {
+            const float* p = planes[i];
+            if (p[0] * center.x + p[1] * center.y + p[2] * center.z + p[3] < -radius) return false;
+        }
+        return true;
+    }
+    
+    int lodFor(const Vector3& center, float radius) const {
+        static const float MIN_PIXELS[LOD_LEVELS - 1] = { 64.0f, 24.0f, 8.0f };
+        float depth = -(view[2] * center.x + view[6] * center.y + view[10] * center.z + view[14]);
+        if (depth <= radius) return 0;
+        float pixels = radius * pixelsPerUnit / depth;
+        int level = 0;
+        while (level < LOD_LEVELS - 1 && pixels < MIN_PIXELS[level]) level++;
+        return level;
+    }
+    
+    // Detail level to draw a drawable at, or -1 if it is off screen. Safe to
+    // call from jobs while the camera stays put.
+    int cull(const Vector3& center, float radius) const {
+        if (!enabled) return 0;
+        if (!sphereVisible(center, radius)) return -1;
+        return lodFor(center, radius);
+    }
+    
+    // cull() that also counts the object in renderStats
+    int classify(const Vector3& center, float radius) const {
+        int level = cull(center, radius);
+        if (level < 0) renderStats.objectsCulled++;
+        else renderStats.objectsDrawn++;
+        return level;
+    }
+    
+    // Brackets the drawing of one object; false means skip it
+    bool begin(const Vector3& center, float radius) {
+        int level = classify(center, radius);
+        if (level < 0) return false;
+        lod = level;
+        return true;
+    }
+    void end() { lod = 0; }
+};
+
+Visibility visibility;
+
+// ==================== DRAWING PRIMITIVES ====================
+void drawCube(float size, Color color) {
+    setMaterial(color);
+    if (useMeshCache) {
+        glPushMatrix();
+        glScalef(size, size, size);
+        meshCache.draw(meshCache.cube);
+        glPopMatrix();
+        return;
+    }
+    glState.prepareForGLUT();
+    glutSolidCube(size);
+    renderStats.immediate(24);
+}
+
+void drawSphere(float radius, Color color) {
+    setMaterial(color);
+    if (useMeshCache) {
+        glPushMatrix();
+        glScalef(radius, radius, radius);
+        meshCache.draw(meshCache.sphere[visibility.lod]);
+        glPopMatrix();
+        return;
+    }
+    int slices = LOD_SLICES[visibility.lod], stacks = LOD_STACKS[visibility.lod];
+    glState.prepareForGLUT();
+    glutSolidSphere(radius, slices, stacks);
+    renderStats.immediate(slices * (stacks + 1) * 2);
+}
+
+void drawCylinder(float radius, float height, Color color) {
+    setMaterial(color);
+    if (useMeshCache) {
+        glPushMatrix();
+        glScalef(radius, height, radius);
+        meshCache.draw(meshCache.cylinder[visibility.lod]);
+        glPopMatrix();
+        return;
+    }
+    int slices = LOD_SLICES[visibility.lod], stacks = LOD_STACKS[visibility.lod];
+    glState.prepareForGLUT();
+    GLUquadric* quad = gluNewQuadric();
+    glPushMatrix();
+    glRotatef(-90, 1, 0, 0);
+    gluCylinder(quad, radius, radius, height, slices, stacks);
+    glPopMatrix();
+    gluDeleteQuadric(quad);
+    renderStats.immediate(slices * (stacks + 1) * 2);
+}
+
+void drawCone(float radius, float height, Color color) {
+    setMaterial(color);
+    if (useMeshCache) {
+        glPushMatrix();
+        glScalef(radius, height, radius);
+        meshCache.draw(meshCache.cone[visibility.lod]);
+        glPopMatrix();
+        return;
+    }
+    int slices = LOD_SLICES[visibility.lod], stacks = LOD_STACKS[visibility.lod];
+    glState.prepareForGLUT();
+    GLUquadric* quad = gluNewQuadric();
+    glPushMatrix();
+    glRotatef(-90, 1, 0, 0);
+    gluCylinder(quad, radius, 0, height, slices, stacks);
+    glPopMatrix();
+    gluDeleteQuadric(quad);
+    renderStats.immediate(slices * (stacks + 1) * 2);
+}
+
+void drawTorus(float innerRadius, float outerRadius, Color color) {
+    setMaterial(color);
+    if (useMeshCache) {
+        glPushMatrix();
+        glScalef(outerRadius, outerRadius, outerRadius);
+        meshCache.draw(meshCache.torus(innerRadius / outerRadius, visibility.lod));
+        glPopMatrix();
+        return;
+    }
+    int sides = LOD_TORUS_SIDES[visibility.lod], rings = LOD_TORUS_RINGS[visibility.lod];
+    glState.prepareForGLUT();
+    glutSolidTorus(innerRadius, outerRadius, sides, rings);
+    renderStats.immediate(rings * (sides + 1) * 2);
+}
+
+// ==================== DEBUG DRAWING ====================
+void drawDebugSphere(Vector3 pos, float radius, Color color) {
+    glPushMatrix();
+    glState.useProgram(0);
+    glState.disable(GL_LIGHTING);
+    glState.prepareForGLUT();
+    glColor3f(color.r, color.g, color.b);
+    glTranslatef(pos.x, pos.y, pos.z);
+    glutWireSphere(radius, 12, 12);
+    glState.enable(GL_LIGHTING);
+    glPopMatrix();
+}
+
+void drawDebugLine(Vector3 from, Vector3 to, Color color) {
+    glState.useProgram(0);
+    glState.disable(GL_LIGHTING);
+    glColor3f(color.r, color.g, color.b);
+    glLineWidth(2.0f);
+    glBegin(GL_LINES);
+    glVertex3f(from.x, from.y, from.z);
+    glVertex3f(to.x, to.y, to.z);
+    glEnd();
+    glLineWidth(1.0f);
+    glState.enable(GL_LIGHTING);
+}
+
+// ==================== GAME OBJECTS ====================
+
+// Ground (1 primitive)
+void drawGround() {
+    PROFILE_SCOPE("drawGround");
+    glPushMatrix();
+    glNormal3f(0, 1, 0);
+    setMaterial(Color(0.2f, 0.3f, 0.2f));
+    glBegin(GL_QUADS);
+    glVertex3f(-scene->worldHalfSize, 0, -scene->worldHalfSize);
+    glVertex3f(scene->worldHalfSize, 0, -scene->worldHalfSize);
+    glVertex3f(scene->worldHalfSize, 0, scene->worldHalfSize);
+    glVertex3f(-scene->worldHalfSize, 0, scene->worldHalfSize);
+    glEnd();
+    
+    setMaterial(Color(0.3f, 0.4f, 0.3f));
+    glBegin(GL_LINES);
+    int lineVertices = 0;
+    for (float i = -scene->worldHalfSize; i <= scene->worldHalfSize; i += 5) {
+        glVertex3f(i, 0.01f, -scene->worldHalfSize);
+        glVertex3f(i, 0.01f, scene->worldHalfSize);
+        glVertex3f(-scene->worldHalfSize, 0.01f, i);
+        glVertex3f(scene->worldHalfSize, 0.01f, i);
+        lineVertices += 4;
+    }
+    glEnd();
+    glPopMatrix();
+    renderStats.drawCalls += 2;
+    renderStats.verticesSubmitted += 4 + lineVertices;
+}
+
+// Walls (3 primitives - 1 each)
+void drawWalls() {
+    PROFILE_SCOPE("drawWalls");
+    // Front wall
+    glPushMatrix();
+    glTranslatef(0, WALL_HEIGHT/2, -scene->worldHalfSize);
+    glScalef(scene->worldHalfSize * 2, WALL_HEIGHT, 0.5f);
+    drawCube(1, Color(0.8f, 0.2f, 0.2f));
+    glPopMatrix();
+    
+    // Left wall
+    glPushMatrix();
+    glTranslatef(-scene->worldHalfSize, WALL_HEIGHT/2, 0);
+    glScalef(0.5f, WALL_HEIGHT, scene->worldHalfSize * 2);
+    drawCube(1, Color(0.8f, 0.2f, 0.2f));
+    glPopMatrix();
+    
+    // Right wall
+    glPushMatrix();
+    glTranslatef(scene->worldHalfSize, WALL_HEIGHT/2, 0);
+    glScalef(0.5f, WALL_HEIGHT, scene->worldHalfSize * 2);
+    drawCube(1, Color(0.8f, 0.2f, 0.2f));
+    glPopMatrix();
+}
+
+// A warrior: legs to hat, and the sword reaching out to the left (8 primitives)
+void drawWarrior(const Vector3& pos, float rotation, const Color& body, const Color& dark) {
+    glPushMatrix();
+    glTranslatef(pos.x, pos.y, pos.z);
+    glRotatef(rotation, 0, 1, 0);
+    
+    // Legs (2 cylinders)
+    glPushMatrix();
+    glTranslatef(-0.2f, -0.3f, 0);
+    drawCylinder(0.15f, 0.6f, dark);
+    glPopMatrix();
+    
+    glPushMatrix();
+    glTranslatef(0.2f, -0.3f, 0);
+    drawCylinder(0.15f, 0.6f, dark);
+    glPopMatrix();
+    
+    // Torso (cube)
+    glPushMatrix();
+    glTranslatef(0, 0.4f, 0);
+    glScalef(0.8f, 1.0f, 0.5f);
+    drawCube(1, body);
+    glPopMatrix();
+    
+    // Arms (2 cylinders)
+    glPushMatrix();
+    glTranslatef(-0.5f, 0.4f, 0);
+    glRotatef(90, 0, 0, 1);
+    drawCylinder(0.1f, 0.4f, body);
+    glPopMatrix();
+    
+    glPushMatrix();
+    glTranslatef(0.5f, 0.4f, 0);
+    glRotatef(-90, 0, 0, 1);
+    drawCylinder(0.1f, 0.4f, body);
+    glPopMatrix();
+    
+    // Head (sphere)
+    glPushMatrix();
+    glTranslatef(0, 1.1f, 0);
+    drawSphere(0.3f, Color(0.9f, 0.8f, 0.7f));
+    glPopMatrix();
+    
+    // Hat (cone)
+    glPushMatrix();
+    glTranslatef(0, 1.4f, 0);
+    drawCone(0.4f, 0.5f, dark);
+    glPopMatrix();
+    
+    // Sword (cylinder)
+    glPushMatrix();
+    glTranslatef(-0.7f, 0.6f, 0);
+    glRotatef(45, 0, 0, 1);
+    drawCylinder(0.05f, 1.2f, Color(0.7f, 0.7f, 0.8f));
+    glPopMatrix();
+    
+    glPopMatrix();
+}
+
+// Player Character
+void drawPlayer() {
+    PROFILE_SCOPE("drawPlayer");
+    Vector3 center(renderPlayerPos.x, renderPlayerPos.y + 0.8f, renderPlayerPos.z);
+    if (!visibility.begin(center, 2.0f)) return;
+    drawWarrior(renderPlayerPos, scene->playerRotation, Color(0.8f, 0.0f, 0.0f), Color(0.1f, 0.1f, 0.1f));
+    visibility.end();
+}
+
+// Rivals: ninjas in black and samurai in blue, taking turns by index. Far
+// away, where the figure would be a few pixels tall, a rival is one box.
+void drawRivals() {
+    PROFILE_SCOPE("drawRivals");
+    const RivalView& agents = scene->rivals;
+    const Color ninja(0.15f, 0.15f, 0.2f), samurai(0.2f, 0.3f, 0.7f), dark(0.05f, 0.05f, 0.05f);
+    for (int i = 0; i < agents.count(); i++) {
+        Vector3 pos = lerp(Vector3(agents.prevX[i], agents.prevY[i], agents.prevZ[i]), agents.position(i), renderAlpha);
+        if (!visibility.begin(Vector3(pos.x, pos.y + 0.8f, pos.z), 2.0f)) continue;
+        const Color& body = i % 2 == 0 ? ninja : samurai;
+        if (visibility.lod < LOD_LEVELS - 1) {
+            drawWarrior(pos, agents.heading[i], body, dark);
+        } else {
+            glPushMatrix();
+            glTranslatef(pos.x, pos.y + 0.5f, pos.z);
+            glScalef(0.8f, 2.0f, 0.5f);
+            drawCube(1, body);
+            glPopMatrix();
+        }
+        visibility.end();
+    }
+}
+
+// Platform (2 primitives each)
+void drawPlatform(int p) {
+    PROFILE_SCOPE("drawPlatform");
+    Vector3 position = scene->platforms.transform.position(p);
+    const Vector3& size = scene->platforms.size[p];
+    const Color& color = scene->platforms.color[p];
+    const float heightScale = 0.5f;
+    float reducedHeight = size.y * heightScale;
+    float radius = 0.5f * sqrt(size.x * size.x + size.y * size.y +
+                               size.z * size.z);
+    if (!visibility.begin(position, radius)) return;
+
+    glPushMatrix();
+    glTranslatef(position.x, position.y, position.z);
+
+    // Base
+    glPushMatrix();
+    glScalef(size.x, reducedHeight, size.z);
+    drawCube(1, color);
+    glPopMatrix();
+
+    // Top section
+    glPushMatrix();
+    glTranslatef(0, reducedHeight / 2 + 0.1f, 0);
+    glScalef(size.x, 0.2f, size.z);
+    Color topColor(
+        color.r * 0.8f,
+        color.g * 0.8f,
+        color.b * 0.8f
+    );
+    drawCube(1, topColor);
+    glPopMatrix();
+
+    glPopMatrix();
+    visibility.end();
+}
+
+// Collectible (3 primitives)
+// Bounding sphere around the ring and cone, relative to the position
+const float COLLECTIBLE_BOUNDS_OFFSET = 0.15f;
+const float COLLECTIBLE_BOUNDS_RADIUS = 0.4f;
+
+void drawCollectible(Vector3 pos) {
+    PROFILE_SCOPE("drawCollectible");
+    if (!visibility.begin(Vector3(pos.x, pos.y + COLLECTIBLE_BOUNDS_OFFSET, pos.z), COLLECTIBLE_BOUNDS_RADIUS)) return;
+    
+    glPushMatrix();
+    glTranslatef(pos.x, pos.y, pos.z);
+    glRotatef(renderGlobalRotation * 2, 0, 1, 0);
+    
+    // Center sphere
+    drawSphere(0.2f, Color(1.0f, 0.84f, 0.0f));
+    
+    // Ring
+    glPushMatrix();
+    glRotatef(90, 1, 0, 0);
+    drawTorus(0.05f, 0.3f, Color(0.9f, 0.7f, 0.0f));
+    glPopMatrix();
+    
+    // Top cone
+    glPushMatrix();
+    glTranslatef(0, 0.3f, 0);
+    drawCone(0.15f, 0.2f, Color(1.0f, 0.84f, 0.0f));
+    glPopMatrix();
+    
+    glPopMatrix();
+    visibility.end();
+}
+
+// ==================== STATIC WORLD BATCH ====================
+// Ground, grid lines, walls and platform bases never move. Each resident
+// chunk's geometry (see buildChunk) goes into two vertex buffers drawn with
+// one call each, and chunks off screen are skipped. Uploads are capped per
+// frame, so when many chunks arrive at once some appear a frame later
+// instead of the frame taking longer.
+class StaticWorldBatch {
+private:
+    static const size_t UPLOAD_BUDGET = 512 * 1024; // bytes per frame
+    
+    struct Batch {
+        GLuint triangleBuffer, lineBuffer;
+        GLsizei triangleVertices, lineVertices;
+        size_t bytes;
+        int version;    // of the last chunk list that held it
+    };
+    std::unordered_map<int, Batch> batches;
+    int syncedVersion;
+    bool pending;       // chunks in the list still waiting for an upload
+    
+    static GLuint upload(const std::vector<float>& data) {
+        GLuint buffer = 0;
+        glGenBuffers(1, &buffer);
+        glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(float), data.empty() ? NULL : &data[0], GL_STATIC_DRAW);
+        return buffer;
+    }
+    
+    static void drawBuffer(GLuint buffer, GLenum mode, GLsizei count) {
+        if (count == 0) return;
+        const GLsizei stride = WORLD_VERTEX_STRIDE * sizeof(float);
+        glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+        glState.clientArray(GL_VERTEX_ARRAY, true);
+        glState.clientArray(GL_NORMAL_ARRAY, true);
+        glState.clientArray(GL_COLOR_ARRAY, true);
+        glVertexPointer(3, GL_FLOAT, stride, (const GLvoid*)0);
+        glNormalPointer(GL_FLOAT, stride, (const GLvoid*)(3 * sizeof(float)));
+        glColorPointer(3, GL_FLOAT, stride, (const GLvoid*)(6 * sizeof(float)));
+        glDrawArrays(mode, 0, count);
+        renderStats.drawCalls++;
+    }
+    
+    void release(const Batch& b) {
+        GLuint buffers[2] = { b.triangleBuffer, b.lineBuffer };
+        glState.bindBuffer(GL_ARRAY_BUFFER, 0);
+        glDeleteBuffers(2, buffers);
+        gpuBytes -= b.bytes;
+    }
+    
+public:
+    size_t gpuBytes;
+    long uploads;
+    float worstUploadMs;    // one frame's uploads
+    
+    StaticWorldBatch() : syncedVersion(-1), pending(false), gpuBytes(0), uploads(0), worstUploadMs(0) {}
+    
+    // Frees the buffers of chunks that left the list and uploads new ones,
+    // up to UPLOAD_BUDGET bytes. Needs a current GL context.
+    void sync(const std::vector<ChunkRef>& chunks, int version) {
+        if (version == syncedVersion && !pending) return;
+        PROFILE_SCOPE("staticWorld.upload");
+        if (version != syncedVersion) {
+            for (const ChunkRef& chunk : chunks) {
+                auto it = batches.find(chunk->id);
+                if (it != batches.end()) it->second.version = version;
+            }
+            for (auto it = batches.begin(); it != batches.end();) {
+                if (it->second.version != version) {
+                    release(it->second);
+                    it = batches.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            syncedVersion = version;
+        }
+        
+        double t0 = nowMs();
+        size_t uploaded = 0;
+        pending = false;
+        for (const ChunkRef& chunk : chunks) {
+            if (batches.count(chunk->id)) continue;
+            if (uploaded >= UPLOAD_BUDGET) {
+                pending = true;
+                break;
+            }
+            Batch b;
+            b.triangleBuffer = upload(chunk->triangles);
+            b.lineBuffer = upload(chunk->lines);
+            b.triangleVertices = (GLsizei)(chunk->triangles.size() / WORLD_VERTEX_STRIDE);
+            b.lineVertices = (GLsizei)(chunk->lines.size() / WORLD_VERTEX_STRIDE);
+            b.bytes = (chunk->triangles.size() + chunk->lines.size()) * sizeof(float);
+            b.version = version;
+            batches[chunk->id] = b;
+            uploaded += b.bytes;
+            gpuBytes += b.bytes;
+            uploads++;
+        }
+        if (uploaded) worstUploadMs = std::max(worstUploadMs, (float)(nowMs() - t0));
+    }
+    
+    bool empty() const { return batches.empty(); }
+    
+    void draw(const std::vector<ChunkRef>& chunks) {
+        PROFILE_SCOPE("staticWorld.draw");
+        if (shaderLightingActive()) {
+            litShader.setColor(Color(1, 1, 1));
+            litShader.setVertexColors(true);
+        }
+        for (const ChunkRef& chunk : chunks) {
+            auto it = batches.find(chunk->id);
+            if (it == batches.end() || visibility.cull(chunk->center, chunk->radius) < 0) continue;
+            drawBuffer(it->second.triangleBuffer, GL_TRIANGLES, it->second.triangleVertices);
+            drawBuffer(it->second.lineBuffer, GL_LINES, it->second.lineVertices);
+        }
+        if (shaderLightingActive()) litShader.setVertexColors(false);
+    }
+};
+
+StaticWorldBatch staticWorld;
+
+// ==================== INSTANCED COLLECTIBLES ====================
+// Render extraction: the positions of the uncollected items, in index order.
+// Every position is written and the flag decides whether it is kept, so the
+// loop has no branch to mispredict.
+void extractUncollected(const CollectibleTable& items, int begin, int end, std::vector<Vector3>& out) {
+    out.resize(end - begin);
+    const float* x = items.transform.x.data();
+    const float* y = items.transform.y.data();
+    const float* z = items.transform.z.data();
+    const uint8_t* collected = items.collected.data();
+    Vector3* dst = out.data();
+    size_t count = 0;
+    for (int i = begin; i < end; i++) {
+        dst[count].x = x[i];
+        dst[count].y = y[i];
+        dst[count].z = z[i];
+        count += !collected[i];
+    }
+    out.resize(count);
+}
+
+void extractUncollected(const CollectibleTable& items, std::vector<Vector3>& out) {
+    extractUncollected(items, 0, items.count(), out);
+}
+
+// The same for an index list, such as a chunk's collectibles
+void extractUncollected(const CollectibleTable& items, const int* indices, int count, std::vector<Vector3>& out) {
+    out.resize(count);
+    const float* x = items.transform.x.data();
+    const float* y = items.transform.y.data();
+    const float* z = items.transform.z.data();
+    const uint8_t* collected = items.collected.data();
+    Vector3* dst = out.data();
+    size_t kept = 0;
+    for (int k = 0; k < count; k++) {
+        int i = indices[k];
+        dst[kept].x = x[i];
+        dst[kept].y = y[i];
+        dst[kept].z = z[i];
+        kept += !collected[i];
+    }
+    out.resize(kept);
+}
+
+// Per-frame CPU work for the instanced collectibles: extraction (only after a
+// pickup) and culling into detail-level buckets. Both run as jobs over blocks
+// of at most BLOCK items, either slices of the table or of each resident
+// chunk's list, and the buckets are joined block by block, so the instance
+// stream has the same order as a single-threaded pass.
+class CollectibleDrawList {
+public:
+    static const int BLOCK = 4096;
+    
+private:
+    struct Block {
+        const int* indices;                       // NULL: table rows begin..end
+        int begin, end;
+        std::vector<Vector3> positions;           // uncollected
+        std::vector<Vector3> buckets[LOD_LEVELS]; // visible this frame, by detail level
+        int culled;
+    };
+    std::vector<Block> blocks;
+    Job* pending;
+    
+    void addBlocks(const int* indices, int count) {
+        for (int begin = 0; begin < count; begin += BLOCK) {
+            blocks.emplace_back();
+            Block& block = blocks.back();
+            block.indices = indices;
+            block.begin = begin;
+            block.end = std::min(begin + BLOCK, count);
+        }
+    }
+    
+public:
+    std::vector<Vector3> streamed;    // the buckets back to back
+    int bucketSize[LOD_LEVELS];
+    
+    CollectibleDrawList() : pending(NULL) {
+        for (int lod = 0; lod < LOD_LEVELS; lod++) bucketSize[lod] = 0;
+    }
+    
+    // Queues the jobs. The table and the camera must stay unchanged until
+    // finish() returns.
+    void build(const CollectibleTable& items, bool extract, const Visibility& view) {
+        if (extract) {
+            blocks.clear();
+            addBlocks(NULL, items.count());
+        }
+        queue(items, extract, view);
+    }
+    
+    // Only the collectibles of the given chunks
+    void build(const CollectibleTable& items, const std::vector<ChunkRef>& chunks, bool extract,
+               const Visibility& view) {
+        if (extract) {
+            blocks.clear();
+            for (const ChunkRef& chunk : chunks) {
+                addBlocks(chunk->collectibles.data(), (int)chunk->collectibles.size());
+            }
+        }
+        queue(items, extract, view);
+    }
+    
+private:
+    void queue(const CollectibleTable& items, bool extract, const Visibility& view) {
+        Job* culling = jobs.parallelFor((int)blocks.size(), 1, [this, &view](int begin, int end) {
+            for (int b = begin; b < end; b++) {
+                Block& block = blocks[b];
+                for (auto& bucket : block.buckets) bucket.clear();
+                block.culled = 0;
+                for (const Vector3& p : block.positions) {
+                    int lod = view.cull(Vector3(p.x, p.y + COLLECTIBLE_BOUNDS_OFFSET, p.z), COLLECTIBLE_BOUNDS_RADIUS);
+                    if (lod < 0) block.culled++;
+                    else block.buckets[lod].push_back(p);
+                }
+            }
+        });
+        if (extract) {
+            Job* extraction = jobs.parallelFor((int)blocks.size(), 1, [this, &items](int begin, int end) {
+                for (int b = begin; b < end; b++) {
+                    Block& block = blocks[b];
+                    if (block.indices) {
+                        extractUncollected(items, block.indices + block.begin, block.end - block.begin,
+                                           block.positions);
+                    } else {
+                        extractUncollected(items, block.begin, block.end, block.positions);
+                    }
+                }
+            });
+            jobs.depend(culling, extraction);
+            jobs.submit(extraction);
+        }
+        jobs.submit(culling);
+        pending = culling;
+    }
+    
+public:
+    // Waits for the jobs and joins their output into streamed
+    void finish() {
+        if (!pending) return;
+        jobs.wait(pending);
+        pending = NULL;
+        streamed.clear();
+        for (int lod = 0; lod < LOD_LEVELS; lod++) {
+            bucketSize[lod] = 0;
+            for (const Block& block : blocks) {
+                streamed.insert(streamed.end(), block.buckets[lod].begin(), block.buckets[lod].end());
+                bucketSize[lod] += (int)block.buckets[lod].size();
+            }
+        }
+        for (const Block& block : blocks) {
+            renderStats.objectsCulled += block.culled;
+            renderStats.objectsDrawn += (int)block.positions.size() - block.culled;
+        }
+    }
+};
+
+// Draws the visible collectibles with one instanced call per part (sphere,
+// ring, cone) and detail level. Each frame the uncollected positions are
+// culled and sorted into level-of-detail buckets; only the stretches that
+// differ from last frame's are written to the instance buffer, which keeps
+// its storage. The shared spin is applied in the vertex shader. Falls back to
+// drawCollectible() when instancing is missing.
+class CollectibleRenderer {
+private:
+    static constexpr GLuint INSTANCE_ATTRIBUTE = 1;
+    static constexpr size_t UPLOAD_GAP = 256;  // unchanged instances that split two uploads
+    
+    struct Part {
+        int mesh[LOD_LEVELS];
+        float matrix[16];      // unit mesh -> collectible space (column-major)
+        float normalMatrix[9]; // inverse transpose of the upper 3x3
+        Color color;
+    };
+    
+    GLuint program;
+    GLuint instanceBuffer;
+    GLint partMatrixLoc, partNormalLoc, spinLoc, colorLoc;
+    Part parts[3];
+    CollectibleDrawList drawList;
+    std::vector<Vector3> uploaded;  // what the instance buffer holds
+    size_t capacity;                // instances the buffer has storage for
+    int instanceCount;
+    bool dirty;     // extract the positions again
+    bool prepared;  // drawList jobs queued for this frame
+    bool supported;
+    
+    // Scale then translate, optionally after a 90 degree turn about x
+    static void makePart(Part& p, const int* mesh, float sx, float sy, float sz, float ty,
+                         bool rotateX, Color color) {
+        for (int i = 0; i < 16; i++) p.matrix[i] = 0;
+        for (int i = 0; i < 9; i++) p.normalMatrix[i] = 0;
+        if (rotateX) {
+            // glRotatef(90, 1, 0, 0): y -> z, z -> -y
+            p.matrix[0] = sx; p.matrix[6] = sy; p.matrix[9] = -sz;
+            p.normalMatrix[0] = 1 / sx; p.normalMatrix[5] = 1 / sy; p.normalMatrix[7] = -1 / sz;
+        } else {
+            p.matrix[0] = sx; p.matrix[5] = sy; p.matrix[10] = sz;
+            p.normalMatrix[0] = 1 / sx; p.normalMatrix[4] = 1 / sy; p.normalMatrix[8] = 1 / sz;
+        }
+        p.matrix[13] = ty;
+        p.matrix[15] = 1;
+        for (int lod = 0; lod < LOD_LEVELS; lod++) p.mesh[lod] = mesh[lod];
+        p.color = color;
+    }
+    
+    // Writes the instances that differ from the buffer's, a range at a time
+    void upload(const std::vector<Vector3>& streamed) {
+        size_t n = streamed.size();
+        glState.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        if (n > capacity) {
+            capacity = std::max(n, capacity * 2);
+            glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(Vector3), NULL, GL_DYNAMIC_DRAW);
+            uploaded.clear();
+        }
+        size_t kept = std::min(n, uploaded.size());
+        auto same = [&](size_t k) { return k < kept && memcmp(&streamed[k], &uploaded[k], sizeof(Vector3)) == 0; };
+        for (size_t k = 0; k < n;) {
+            if (same(k)) {
+                k++;
+                continue;
+            }
+            size_t begin = k, end = k + 1;
+            for (k = end; k < n && k < end + UPLOAD_GAP; k++) {
+                if (!same(k)) end = k + 1;
+            }
+            glBufferSubData(GL_ARRAY_BUFFER, begin * sizeof(Vector3), (end - begin) * sizeof(Vector3), &streamed[begin]);
+        }
+        uploaded.assign(streamed.begin(), streamed.end());
+    }
+    
+public:
+    CollectibleRenderer() : program(0), instanceBuffer(0), capacity(0), instanceCount(0), dirty(true), prepared(false),
+                            supported(false) {}
+    
+    // Needs a current GL context and an initialised meshCache
+    void init() {
+        supported = hasExtension("GL_ARB_instanced_arrays") && hasExtension("GL_ARB_draw_instanced");
+        if (!supported) {
+            gameLogger.log(LOG_WARN, LOG_RENDER, "Instancing not supported, drawing collectibles one by one");
+            return;
+        }
+        
+        const char* vertexSource =
+            "#version 120\n"
+            "attribute vec3 instancePosition;\n"
+            "uniform mat4 partMatrix;\n"
+            "uniform mat3 partNormalMatrix;\n"
+            "uniform vec2 spin;\n" // cos, sin
+            "varying vec3 eyePos;\n"
+            "varying vec3 eyeNormal;\n"
+            "vec3 rotateY(vec3 v) { return vec3(spin.x * v.x + spin.y * v.z, v.y, -spin.y * v.x + spin.x * v.z); }\n"
+            "void main() {\n"
+            "    vec3 local = rotateY((partMatrix * gl_Vertex).xyz) + instancePosition;\n"
+            "    vec4 eye = gl_ModelViewMatrix * vec4(local, 1.0);\n"
+            "    eyePos = eye.xyz;\n"
+            "    eyeNormal = gl_NormalMatrix * rotateY(partNormalMatrix * gl_Normal);\n"
+            "    gl_Position = gl_ProjectionMatrix * eye;\n"
+            "}\n";
+        std::string fragmentSource = std::string("#version 120\n") + LIGHTING_GLSL +
+            "uniform vec3 color;\n"
+            "varying vec3 eyePos;\n"
+            "varying vec3 eyeNormal;\n"
+            "void main() { gl_FragColor = vec4(shade(color, eyePos, eyeNormal), 1.0); }\n";
+        
+        std::vector<std::pair<GLuint, const char*>> attributes;
+        attributes.push_back(std::make_pair(INSTANCE_ATTRIBUTE, "instancePosition"));
+        program = linkProgram(vertexSource, fragmentSource.c_str(), attributes);
+        if (!program) {
+            supported = false;
+            return;
+        }
+        partMatrixLoc = glGetUniformLocation(program, "partMatrix");
+        partNormalLoc = glGetUniformLocation(program, "partNormalMatrix");
+        spinLoc = glGetUniformLocation(program, "spin");
+        colorLoc = glGetUniformLocation(program, "color");
+        glGenBuffers(1, &instanceBuffer);
+        uploaded.clear();
+        capacity = 0;
+        
+        int rings[LOD_LEVELS];
+        for (int lod = 0; lod < LOD_LEVELS; lod++) rings[lod] = meshCache.torus(0.05f / 0.3f, lod);
+        makePart(parts[0], meshCache.sphere, 0.2f, 0.2f, 0.2f, 0, false, Color(1.0f, 0.84f, 0.0f));
+        makePart(parts[1], rings, 0.3f, 0.3f, 0.3f, 0, true, Color(0.9f, 0.7f, 0.0f));
+        makePart(parts[2], meshCache.cone, 0.15f, 0.2f, 0.15f, 0.3f, false, Color(1.0f, 0.84f, 0.0f));
+        dirty = true;
+    }
+    
+    bool available() const { return supported; }
+    void markDirty() { dirty = true; }
+    int count() const { return instanceCount; }
+    
+    // Starts extraction and culling on the job system, so they overlap with
+    // whatever is drawn before draw(). Call after the camera is set.
+    void prepare() {
+        if (!supported || prepared) return;
+        drawList.build(scene->collectibles, scene->chunks, dirty, visibility);
+        dirty = false;
+        prepared = true;
+    }
+    
+    void draw(float spinDegrees) {
+        PROFILE_SCOPE("collectibleRenderer.draw");
+        prepare();
+        drawList.finish();
+        prepared = false;
+        const std::vector<Vector3>& streamed = drawList.streamed;
+        instanceCount = (int)streamed.size();
+        if (instanceCount == 0) return;
+        
+        upload(streamed);
+        
+        float angle = spinDegrees * M_PI / 180.0f;
+        GLuint previousProgram = glState.program();
+        glState.useProgram(program);
+        glUniform2f(spinLoc, cos(angle), sin(angle));
+        glEnableVertexAttribArray(INSTANCE_ATTRIBUTE);
+        glVertexAttribDivisorARB(INSTANCE_ATTRIBUTE, 1);
+        size_t first = 0;
+        for (int lod = 0; lod < LOD_LEVELS; lod++) {
+            int count = drawList.bucketSize[lod];
+            if (count == 0) continue;
+            // The pointer is latched from the instance buffer, whatever is bound later
+            glState.bindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            glVertexAttribPointer(INSTANCE_ATTRIBUTE, 3, GL_FLOAT, GL_FALSE, sizeof(Vector3),
+                                  (const GLvoid*)(first * sizeof(Vector3)));
+            for (const Part& part : parts) {
+                glUniformMatrix4fv(partMatrixLoc, 1, GL_FALSE, part.matrix);
+                glUniformMatrix3fv(partNormalLoc, 1, GL_FALSE, part.normalMatrix);
+                glUniform3f(colorLoc, part.color.r, part.color.g, part.color.b);
+                meshCache.draw(part.mesh[lod], count);
+            }
+            first += count;
+        }
+        glVertexAttribDivisorARB(INSTANCE_ATTRIBUTE, 0);
+        glDisableVertexAttribArray(INSTANCE_ATTRIBUTE);
+        glState.useProgram(previousProgram);
+    }
+};
+
+CollectibleRenderer collectibleRenderer;
+
+// Platform 1: Lantern (5 primitives) - Rotation
+void drawLantern(int p) {
+    PROFILE_SCOPE("drawLantern");
+    Vector3 position = scene->platforms.transform.position(p);
+    bool animating = scene->platforms.animationActive[p];
+    float animationValue = scene->platforms.renderAnimationValue[p];
+    // Chain to ring, plus the bob
+    Vector3 center(position.x, position.y + 3.9f, position.z);
+    if (!visibility.begin(center, 1.8f)) return;
+    
+    glPushMatrix();
+    glTranslatef(position.x, position.y + 3, position.z);
+
+    float rot = 0.0f;
+    float bob = 0.0f;
+    const float fixedGlow = 0.84f;
+    if (animating) {
+        rot = animationValue * 3.0f;
+        bob = 0.25f * sin(animationValue * 0.05f);
+    }
+    glTranslatef(0, bob, 0);
+    glRotatef(rot, 0, 1, 0);
+
+    // Top
+    drawCylinder(0.3f, 0.5f, Color(0.6f, 0.3f, 0.0f));
+
+    // Middle sphere
+    glPushMatrix();
+    glTranslatef(0, 0.8f, 0);
+    drawSphere(0.6f, Color(1.0f, fixedGlow, 0.0f));
+    glPopMatrix();
+
+    // Bottom cone
+    glPushMatrix();
+    glTranslatef(0, 1.5f, 0);
+    drawCone(0.4f, 0.5f, Color(0.6f, 0.3f, 0.0f));
+    glPopMatrix();
+
+    // Chain
+    glPushMatrix();
+    glTranslatef(0, -0.5f, 0);
+    drawCylinder(0.05f, 0.5f, Color(0.5f, 0.5f, 0.5f));
+    glPopMatrix();
+
+    // Ring
+    glPushMatrix();
+    glTranslatef(0, 2.2f, 0);
+    glRotatef(90, 1, 0, 0);
+    drawTorus(0.1f, 0.5f, Color(0.8f, 0.6f, 0.0f));
+    glPopMatrix();
+
+    glPopMatrix();
+    visibility.end();
+}
+
+// Platform 2: Pagoda (6 primitives) - Scaling
+void drawPagoda(int p) {
+    PROFILE_SCOPE("drawPagoda");
+    Vector3 position = scene->platforms.transform.position(p);
+    bool animating = scene->platforms.animationActive[p];
+    float animationValue = scene->platforms.renderAnimationValue[p];
+    // Base to top sphere at the largest scale and tilt
+    Vector3 center(position.x, position.y + 3.75f, position.z);
+    if (!visibility.begin(center, 2.6f)) return;
+    
+    glPushMatrix();
+    glTranslatef(position.x, position.y + 2, position.z);
+
+    if (animating) {
+        float s1 = 1.0f + 0.35f * sin(animationValue * 0.035f);
+        float s2 = 1.0f + 0.15f * sin(animationValue * 0.04f + 1.0f);
+        float s3 = 1.0f + 0.25f * sin(animationValue * 0.03f + 2.0f);
+        glScalef(s1, s2, s3);
+        glRotatef(sin(animationValue * 0.015f) * 6.0f, 0, 0, 1);
+    }
+
+    // Base
+    glPushMatrix();
+    glScalef(1.5f, 0.3f, 1.5f);
+    drawCube(1, Color(0.5f, 0.0f, 0.0f));
+    glPopMatrix();
+    
+    // Level 1
+    glPushMatrix();
+    glTranslatef(0, 0.5f, 0);
+    glScalef(1.2f, 0.8f, 1.2f);
+    drawCube(1, Color(0.8f, 0.1f, 0.1f));
+    glPopMatrix();
+    
+    // Level 2
+    glPushMatrix();
+    glTranslatef(0, 1.2f, 0);
+    glScalef(0.9f, 0.6f, 0.9f);
+    drawCube(1, Color(0.8f, 0.1f, 0.1f));
+    glPopMatrix();
+    
+    // Level 3
+    glPushMatrix();
+    glTranslatef(0, 1.7f, 0);
+    glScalef(0.6f, 0.4f, 0.6f);
+    drawCube(1, Color(0.8f, 0.1f, 0.1f));
+    glPopMatrix();
+    
+    // Roof
+    glPushMatrix();
+    glTranslatef(0, 2.2f, 0);
+    drawCone(0.8f, 0.7f, Color(0.3f, 0.2f, 0.1f));
+    glPopMatrix();
+    
+    // Top sphere
+    glPushMatrix();
+    glTranslatef(0, 3.0f, 0);
+    drawSphere(0.2f, Color(1.0f, 0.84f, 0.0f));
+    glPopMatrix();
+    
+    glPopMatrix();
+    visibility.end();
+}
+
+// Platform 3: Statue (7 primitives) - Translation
+void drawStatue(int p) {
+    PROFILE_SCOPE("drawStatue");
+    Vector3 position = scene->platforms.transform.position(p);
+    bool animating = scene->platforms.animationActive[p];
+    float animationValue = scene->platforms.renderAnimationValue[p];
+    // Base to crown, anywhere along the orbit
+    Vector3 center(position.x, position.y + 3.5f, position.z);
+    if (!visibility.begin(center, 2.8f)) return;
+    
+    glPushMatrix();
+    float orbitX = 0.0f;
+    float orbitZ = 0.0f;
+    float offsetY = 0.0f;
+    float rotY = 0.0f;
+    if (animating) {
+        float ang = animationValue * 3.14159f / 180.0f;
+        float radius = 0.6f;
+        orbitX = radius * cos(ang * 0.6f);
+        orbitZ = radius * sin(ang * 0.6f);
+        offsetY = 0.6f * sin(ang * 1.2f);
+        rotY = fmod(animationValue * 0.2f, 360.0f);
+    }
+    glTranslatef(position.x + orbitX, position.y + 2 + offsetY, position.z + orbitZ);
+    glRotatef(rotY, 0, 1, 0);
+    
+    // Base
+    glPushMatrix();
+    glScalef(1.0f, 0.5f, 1.0f);
+    drawCube(1, Color(0.4f, 0.4f, 0.4f));
+    glPopMatrix();
+    
+    // Lower body
+    glPushMatrix();
+    glTranslatef(0, 1.0f, 0);
+    drawCylinder(0.4f, 1.0f, Color(0.6f, 0.5f, 0.4f));
+    glPopMatrix();
+    
+    // Upper body
+    glPushMatrix();
+    glTranslatef(0, 2.0f, 0);
+    glScalef(0.8f, 0.6f, 0.5f);
+    drawCube(1, Color(0.6f, 0.5f, 0.4f));
+    glPopMatrix();
+    
+    // Head
+    glPushMatrix();
+    glTranslatef(0, 2.8f, 0);
+    drawSphere(0.35f, Color(0.6f, 0.5f, 0.4f));
+    glPopMatrix();
+    
+    // Left arm
+    glPushMatrix();
+    glTranslatef(-0.5f, 1.8f, 0);
+    drawCylinder(0.15f, 0.7f, Color(0.6f, 0.5f, 0.4f));
+    glPopMatrix();
+    
+    // Right arm
+    glPushMatrix();
+    glTranslatef(0.5f, 1.8f, 0);
+    drawCylinder(0.15f, 0.7f, Color(0.6f, 0.5f, 0.4f));
     glPopMatrix();
     
-    // Hat (cone)
+    // Crown
+    glPushMatrix();
+    glTranslatef(0, 3.2f, 0);
+    glRotatef(90, 1, 0, 0);
+    drawTorus(0.1f, 0.4f, Color(1.0f, 0.84f, 0.0f));
+    glPopMatrix();
+    
+    glPopMatrix();
+    visibility.end();
+}
+
+// Platform 4: Weapon Rack (5 primitives) - Color Change
+void drawWeaponRack(int p) {
+    PROFILE_SCOPE("drawWeaponRack");
+    Vector3 position = scene->platforms.transform.position(p);
+    bool animating = scene->platforms.animationActive[p];
+    float animationValue = scene->platforms.renderAnimationValue[p];
+    // Stand to ornament, swords at full swing
+    Vector3 center(position.x, position.y + 3.3f, position.z);
+    if (!visibility.begin(center, 2.2f)) return;
+    
+    glPushMatrix();
+    glTranslatef(position.x, position.y + 2, position.z);
+
+    float swing = 0.0f;
+    Color weaponColor(0.7f, 0.7f, 0.8f);
+    if (animating) {
+        swing = sin(animationValue * 0.06f) * 25.0f;
+        float r = 0.4f + 0.6f * fabs(sin(animationValue * 0.03f));
+        float g = 0.4f + 0.6f * fabs(sin(animationValue * 0.03f + 2.0f));
+        float b = 0.4f + 0.6f * fabs(sin(animationValue * 0.03f + 4.0f));
+        weaponColor = Color(r, g, b);
+    }
+
+    // Stand base
+    glPushMatrix();
+    glScalef(1.0f, 0.2f, 0.5f);
+    drawCube(1, Color(0.3f, 0.2f, 0.1f));
+    glPopMatrix();
+
+    // Vertical support
+    glPushMatrix();
+    glTranslatef(0, 0.8f, 0);
+    drawCylinder(0.1f, 1.5f, Color(0.3f, 0.2f, 0.1f));
+    glPopMatrix();
+
+    // Sword 1 (left)
+    glPushMatrix();
+    glTranslatef(-0.3f, 1.2f, 0);
+    glRotatef(30 + swing, 0, 0, 1);
+    drawCylinder(0.05f, 1.5f, weaponColor);
+    glPopMatrix();
+
+    // Sword 2 (right)
+    glPushMatrix();
+    glTranslatef(0.3f, 1.2f, 0);
+    glRotatef(-30 - swing, 0, 0, 1);
+    drawCylinder(0.05f, 1.5f, weaponColor);
+    glPopMatrix();
+
+    // Top ornament
+    glPushMatrix();
+    glTranslatef(0, 2.5f, 0);
+    drawSphere(0.2f, Color(1.0f, 0.84f, 0.0f));
+    glPopMatrix();
+
+    glPopMatrix();
+    visibility.end();
+}
+
+// Draws whatever the level put on platform p
+void drawPlatformObject(int p) {
+    switch (scene->platforms.animationType[p]) {
+        case OBJECT_LANTERN: drawLantern(p); break;
+        case OBJECT_PAGODA: drawPagoda(p); break;
+        case OBJECT_STATUE: drawStatue(p); break;
+        case OBJECT_WEAPON_RACK: drawWeaponRack(p); break;
+        default: break;
+    }
+}
+
+// ==================== TEXT RENDERING ====================
+// The two GLUT bitmap fonts are rasterised once into a texture atlas; text is
+// then drawn as textured quads, whole blocks of strings in one draw call
+class GlyphAtlas {
+private:
+    static const int SIZE = 512;
+    static const int PAD = 2;   // room for glyphs that overhang their advance
+    
+    struct Glyph {
+        short x, y;     // pen origin in the atlas
+        short advance;
+    };
+    struct Face {
+        void* font;
+        int cellHeight; // fixed metrics, Apple's GLUT has no glutBitmapHeight
+        int descent;
+        Glyph glyphs[256];
+    };
+    
+    Face faces[2];
+    GLuint texture;
+    bool ready;
+    
+    Face* face(void* font) {
+        return font == GLUT_BITMAP_TIMES_ROMAN_24 ? &faces[1] : &faces[0];
+    }
+    
+public:
+    GlyphAtlas() : texture(0), ready(false) {
+        faces[0].font = GLUT_BITMAP_HELVETICA_18;
+        faces[0].cellHeight = 26;
+        faces[0].descent = 6;
+        faces[1].font = GLUT_BITMAP_TIMES_ROMAN_24;
+        faces[1].cellHeight = 32;
+        faces[1].descent = 8;
+    }
+    
+    // Needs a current context; renders the glyphs through an FBO
+    bool init() {
+        if (!hasExtension("GL_EXT_framebuffer_object")) return false;
+        
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SIZE, SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        
+        GLuint fbo;
+        glGenFramebuffersEXT(1, &fbo);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbo);
+        glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_TEXTURE_2D, texture, 0);
+        if (glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) != GL_FRAMEBUFFER_COMPLETE_EXT) {
+            glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+            glDeleteFramebuffersEXT(1, &fbo);
+            glDeleteTextures(1, &texture);
+            texture = 0;
+            return false;
+        }
+        
+        glPushAttrib(GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
+        glViewport(0, 0, SIZE, SIZE);
+        glClearColor(0, 0, 0, 0);
+        glClear(GL_COLOR_BUFFER_BIT);
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        gluOrtho2D(0, SIZE, 0, SIZE);
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+        
+        glState.useProgram(0);
+        glState.disable(GL_LIGHTING);
+        glState.disable(GL_DEPTH_TEST);
+        glState.disable(GL_TEXTURE_2D);
+        glColor4f(1, 1, 1, 1);
+        
+        // Shelf packing: glyphs left to right, a new row when one is full.
+        // Bytes above 127 are kept so UTF-8 text renders as it always has.
+        int x = 0, y = 0;
+        bool fits = true;
+        for (Face& f : faces) {
+            for (int c = 0; c < 256; c++) {
+                Glyph& g = f.glyphs[c];
+                g.advance = c < 32 ? 0 : glutBitmapWidth(f.font, c);
+                int width = g.advance + 2 * PAD;
+                if (x + width > SIZE) {
+                    x = 0;
+                    y += f.cellHeight;
+                }
+                if (y + f.cellHeight > SIZE) fits = false;
+                g.x = x + PAD;
+                g.y = y + f.descent;
+                if (g.advance > 0 && fits) {
+                    glRasterPos2i(g.x, g.y);
+                    glutBitmapCharacter(f.font, c);
+                }
+                x += width;
+            }
+            x = 0;
+            y += f.cellHeight;
+        }
+        
+        glPopMatrix();
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+        glPopAttrib();
+        glState.enable(GL_LIGHTING);
+        glState.enable(GL_DEPTH_TEST);
+        
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+        glDeleteFramebuffersEXT(1, &fbo);
+        
+        ready = fits;
+        return ready;
+    }
+    
+    bool available() const { return ready; }
+    GLuint textureId() const { return texture; }
+    
+    // Append one quad per glyph: x, y, u, v, r, g, b for each corner
+    float append(std::vector<float>& out, float x, float y, const char* text, void* font, Color color) {
+        Face* f = face(font);
+        const float texel = 1.0f / SIZE;
+        for (const unsigned char* c = (const unsigned char*)text; *c != '\0'; c++) {
+            const Glyph& g = f->glyphs[*c];
+            if (g.advance == 0) continue;
+            
+            float x0 = x - PAD, y0 = y - f->descent;
+            float x1 = x0 + g.advance + 2 * PAD, y1 = y0 + f->cellHeight;
+            float u0 = (g.x - PAD) * texel, v0 = (g.y - f->descent) * texel;
+            float u1 = u0 + (g.advance + 2 * PAD) * texel, v1 = v0 + f->cellHeight * texel;
+            
+            const float quad[4][4] = {{x0, y0, u0, v0}, {x1, y0, u1, v0},
+                                      {x1, y1, u1, v1}, {x0, y1, u0, v1}};
+            for (const auto& corner : quad) {
+                out.insert(out.end(), corner, corner + 4);
+                out.push_back(color.r);
+                out.push_back(color.g);
+                out.push_back(color.b);
+            }
+            x += g.advance;
+        }
+        return x;
+    }
+};
+
+GlyphAtlas glyphAtlas;
+
+// Screen-space text kept in a VBO; re-uploaded only after it was rebuilt
+class TextBatch {
+private:
+    std::vector<float> vertices;
+    GLuint buffer;
+    GLsizei vertexCount;
+    bool dirty;
+    
+public:
+    TextBatch() : buffer(0), vertexCount(0), dirty(true) {}
+    
+    void clear() {
+        vertices.clear();
+        dirty = true;
+    }
+    
+    void add(float x, float y, const char* text, void* font = GLUT_BITMAP_HELVETICA_18,
+             Color color = Color(1, 1, 1)) {
+        glyphAtlas.append(vertices, x, y, text, font, color);
+        dirty = true;
+    }
+    
+    // Expects the 2D projection to be set up
+    void draw() {
+        if (dirty) {
+            if (buffer == 0) glGenBuffers(1, &buffer);
+            glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
+                         vertices.empty() ? NULL : &vertices[0], GL_DYNAMIC_DRAW);
+            vertexCount = (GLsizei)(vertices.size() / 7);
+            dirty = false;
+        }
+        if (vertexCount == 0) return;
+        
+        const GLsizei stride = 7 * sizeof(float);
+        glState.bindBuffer(GL_ARRAY_BUFFER, buffer);
+        glState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        glState.clientArray(GL_VERTEX_ARRAY, true);
+        glState.clientArray(GL_NORMAL_ARRAY, false);
+        glState.clientArray(GL_COLOR_ARRAY, true);
+        glState.clientArray(GL_TEXTURE_COORD_ARRAY, true);
+        glVertexPointer(2, GL_FLOAT, stride, (const GLvoid*)0);
+        glTexCoordPointer(2, GL_FLOAT, stride, (const GLvoid*)(2 * sizeof(float)));
+        glColorPointer(3, GL_FLOAT, stride, (const GLvoid*)(4 * sizeof(float)));
+        
+        // Like glBitmap, only the set texels produce fragments, so the padding
+        // around each glyph never covers its neighbours
+        glState.enable(GL_TEXTURE_2D);
+        glState.enable(GL_ALPHA_TEST);
+        glAlphaFunc(GL_GREATER, 0.5f);
+        glBindTexture(GL_TEXTURE_2D, glyphAtlas.textureId());
+        glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+        
+        glDrawArrays(GL_QUADS, 0, vertexCount);
+        renderStats.drawCalls++;
+        
+        glState.disable(GL_TEXTURE_2D);
+        glState.disable(GL_ALPHA_TEST);
+        // Mesh draws don't set a texture coordinate pointer, so don't leave one live
+        glState.clientArray(GL_TEXTURE_COORD_ARRAY, false);
+    }
+};
+
+TextBatch hudBatch;
+TextBatch textScratch;
+
+void renderText(float x, float y, const char* text, void* font = GLUT_BITMAP_HELVETICA_18) {
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
+    
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    
+    glState.disable(GL_LIGHTING);
+    if (glyphAtlas.available()) {
+        textScratch.clear();
+        textScratch.add(x, y, text, font);
+        textScratch.draw();
+    } else {
+        glColor3f(1.0f, 1.0f, 1.0f);
+        glRasterPos2f(x, y);
+        
+        for (const char* c = text; *c != '\0'; c++) {
+            glutBitmapCharacter(font, *c);
+        }
+    }
+    
+    glState.enable(GL_LIGHTING);
+    glPopMatrix();
+    
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+}
+
+// Everything the HUD shows; its text is only rebuilt when this changes
+struct HUDState {
+    int timeRemaining;
+    int collected, total;
+    int rivals, rivalBest;
+    unsigned platformFlags;
+    bool debug;
+    char stats[2][128];
+    
+    bool operator==(const HUDState& o) const {
+        return timeRemaining == o.timeRemaining && collected == o.collected && total == o.total &&
+               rivals == o.rivals && rivalBest == o.rivalBest && platformFlags == o.platformFlags && debug == o.debug &&
+               (!debug || memcmp(stats, o.stats, sizeof(stats)) == 0);
+    }
+};
+
+HUDState hudShown;
+bool hudValid = false;
+
+// With a batch, queue the text; without one, draw it straight away
+void hudText(TextBatch* batch, float x, float y, const char* text, void* font = GLUT_BITMAP_HELVETICA_18,
+             Color color = Color(1, 1, 1)) {
+    if (batch) batch->add(x, y, text, font, color);
+    else renderText(x, y, text, font);
+}
+
+void buildHUD(const HUDState& hud, TextBatch* batch) {
+    char buffer[100];
+    
+    // Timer
+    sprintf(buffer, "Time: %d:%02d", hud.timeRemaining / 60, hud.timeRemaining % 60);
+    hudText(batch, 10, WINDOW_HEIGHT - 30, buffer, GLUT_BITMAP_TIMES_ROMAN_24);
+    
+    // Collectibles
+    sprintf(buffer, "Collected: %d/%d", hud.collected, hud.total);
+    hudText(batch, 10, WINDOW_HEIGHT - 60, buffer);
+    if (hud.rivals > 0) {
+        sprintf(buffer, "Best of %d rivals: %d", hud.rivals, hud.rivalBest);
+        hudText(batch, 200, WINDOW_HEIGHT - 60, buffer, GLUT_BITMAP_HELVETICA_18,
+                hud.rivalBest > hud.collected ? Color(1, 0.4f, 0.4f) : Color(1, 1, 1));
+    }
+    
+    // Platform status
+    hudText(batch, 10, WINDOW_HEIGHT - 90, "Platforms:");
+    for (int i = 0; i < scene->platforms.count(); i++) {
+        sprintf(buffer, "P%d: %s %s", i+1, 
+                scene->platforms.allCollected[i] ? "✓" : "✗",
+                scene->platforms.animationActive[i] ? "[ON]" : "[OFF]");
+        hudText(batch, 10, WINDOW_HEIGHT - 110 - i*20, buffer);
+    }
+    
+    // Controls
+    hudText(batch, 10, 70, "WASD: Move | 1/2/3: Views | Z/X/C/V: Animations");
+    hudText(batch, 10, 50, "Mouse: Camera | B: Debug | P: Profiler | R: Restart | Q: Rewind | ESC: Exit");
+    
+    // Debug mode indicator
+    if (hud.debug) {
+        hudText(batch, 10, 30, "DEBUG MODE ON - Check game_debug.log", GLUT_BITMAP_HELVETICA_18);
+        hudText(batch, WINDOW_WIDTH - 760, WINDOW_HEIGHT - 30, hud.stats[0]);
+        hudText(batch, WINDOW_WIDTH - 760, WINDOW_HEIGHT - 55, hud.stats[1]);
+    }
+}
+
+void renderHUD() {
+    PROFILE_SCOPE("renderHUD");
+    glState.disable(GL_DEPTH_TEST);
+    glState.disable(GL_LIGHTING);
+    
+    HUDState hud;
+    memset(&hud, 0, sizeof(hud));
+    hud.timeRemaining = scene->timeRemaining;
+    hud.collected = scene->collected;
+    hud.total = scene->total;
+    hud.rivals = scene->rivals.count();
+    hud.rivalBest = scene->rivalBest;
+    for (int i = 0; i < scene->platforms.count() && i < 16; i++) {
+        if (scene->platforms.allCollected[i]) hud.platformFlags |= 1u << (2 * i);
+        if (scene->platforms.animationActive[i]) hud.platformFlags |= 2u << (2 * i);
+    }
+    hud.debug = scene->debugMode;
+    if (hud.debug) {
+        sprintf(hud.stats[0], "%s%s%s | Draws: %d | Tessellations: %d | Verts sent: %ld",
+                useShaderLighting ? "Shaders, " : "Fixed function, ",
+                useMeshCache ? "mesh cache" : "GLU/GLUT",
+                useInstancing && collectibleRenderer.available() ? " + instancing" : "",
+                renderStats.drawCalls,
+                renderStats.tessellations, renderStats.verticesSubmitted);
+        // Counted up to this point of the frame
+        sprintf(hud.stats[1], "GL state calls: %d issued, %d skipped | Objects: %d drawn, %d culled%s",
+                glState.issued, glState.skipped, renderStats.objectsDrawn, renderStats.objectsCulled,
+                visibility.enabled ? "" : " (culling off)");
+    }
+    
+    if (glyphAtlas.available()) {
+        if (!hudValid || !(hud == hudShown)) {
+            hudBatch.clear();
+            buildHUD(hud, &hudBatch);
+            hudShown = hud;
+            hudValid = true;
+        }
+        
+        glMatrixMode(GL_PROJECTION);
+        glPushMatrix();
+        glLoadIdentity();
+        gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+        glLoadIdentity();
+        
+        hudBatch.draw();
+        
+        glPopMatrix();
+        glMatrixMode(GL_PROJECTION);
+        glPopMatrix();
+        glMatrixMode(GL_MODELVIEW);
+    } else {
+        buildHUD(hud, NULL);
+    }
+    
+    glState.enable(GL_DEPTH_TEST);
+    glState.enable(GL_LIGHTING);
+}
+
+void renderWinScreen() {
+    PROFILE_SCOPE("renderWinScreen");
+    glState.disable(GL_DEPTH_TEST);
+    glState.disable(GL_LIGHTING);
+    
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
+    
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    
+    // Semi-transparent overlay
+    glState.enable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glColor4f(0, 0, 0, 0.5f);
+    glBegin(GL_QUADS);
+    glVertex2f(0, 0);
+    glVertex2f(WINDOW_WIDTH, 0);
+    glVertex2f(WINDOW_WIDTH, WINDOW_HEIGHT);
+    glVertex2f(0, WINDOW_HEIGHT);
+    glEnd();
+    glState.disable(GL_BLEND);
+    
+    // Win message
+    glColor3f(1, 1, 0);
+    renderText(WINDOW_WIDTH/2 - 150, WINDOW_HEIGHT/2 + 50, "CONGRATULATIONS!", GLUT_BITMAP_TIMES_ROMAN_24);
+    glColor3f(1, 1, 1);
+    renderText(WINDOW_WIDTH/2 - 100, WINDOW_HEIGHT/2, "YOU WIN!");
+    renderText(WINDOW_WIDTH/2 - 120, WINDOW_HEIGHT/2 - 40, "Press R to restart");
+    
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    
+    glState.enable(GL_DEPTH_TEST);
+    glState.enable(GL_LIGHTING);
+}
+
+void renderGameOverScreen() {
+    PROFILE_SCOPE("renderGameOverScreen");
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glLoadIdentity();
+    
+    glState.disable(GL_LIGHTING);
+    glColor3f(0.1f, 0, 0);
+    glBegin(GL_QUADS);
+    glVertex2f(-1, -1);
+    glVertex2f(1, -1);
+    glVertex2f(1, 1);
+    glVertex2f(-1, 1);
+    glEnd();
+    
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
+    
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
+    
+    glColor3f(1, 0, 0);
+    renderText(WINDOW_WIDTH/2 - 100, WINDOW_HEIGHT/2 + 50, "GAME OVER", GLUT_BITMAP_TIMES_ROMAN_24);
+    glColor3f(1, 1, 1);
+    if (scene->timeRemaining > 0) renderText(WINDOW_WIDTH/2 - 130, WINDOW_HEIGHT/2, "A rival collected more!");
+    else renderText(WINDOW_WIDTH/2 - 80, WINDOW_HEIGHT/2, "Time's Up!");
+    renderText(WINDOW_WIDTH/2 - 120, WINDOW_HEIGHT/2 - 40, "Press R to restart");
+    renderText(WINDOW_WIDTH/2 - 100, WINDOW_HEIGHT/2 - 70, "Press ESC to exit");
+    
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    
+    glState.enable(GL_LIGHTING);
+}
+
+// ==================== PROFILER OVERLAY ====================
+bool showProfiler = false;
+TextBatch profilerBatch;
+double profilerTextTime = 0;
+
+const float PROFILER_PANEL_X = WINDOW_WIDTH - 450;
+const float PROFILER_PANEL_Y = 90;
+const float PROFILER_PANEL_W = 440;
+const float PROFILER_GRAPH_H = 100;
+const float PROFILER_GRAPH_MS = 50.0f;  // frame time at the top of the graph
+const int PROFILER_PHASE_ROWS = 10;
+const float PROFILER_PANEL_H = PROFILER_GRAPH_H + 20 + (PROFILER_PHASE_ROWS + 7) * 20;
+
+// Percentiles and the slowest phases, refreshed a few times a second so the
+// numbers stay readable
+void buildProfilerText(TextBatch* batch) {
+    char buffer[128];
+    float x = PROFILER_PANEL_X + 10;
+    float y = PROFILER_PANEL_Y + PROFILER_PANEL_H - 22;
+    int frames = profiler.frameCount();
+    const FrameProfiler::Frame* last = frames > 0 ? &profiler.frame(0) : NULL;
+    
+    double draws = 0;
+    for (int i = 0; i < frames; i++) draws += profiler.frame(i).drawCalls;
+    sprintf(buffer, "Frame %.2f ms | p50 %.2f | p99 %.2f",
+            last ? last->durationMs : 0.0f, profiler.percentile(0.5f), profiler.percentile(0.99f));
+    hudText(batch, x, y, buffer);
+    sprintf(buffer, "Draw calls %d (avg %.0f) over %d frames",
+            last ? last->drawCalls : 0, frames > 0 ? draws / frames : 0.0, frames);
+    hudText(batch, x, y - 20, buffer);
+    const SimStats& sim = scene->stats;
+    sprintf(buffer, "Sim late %ld/%ld steps | stale frames %ld", sim.lateSteps, sim.steps, renderStalls.staleFrames);
+    hudText(batch, x, y - 40, buffer);
+    const StreamStats& stream = scene->stream;
+    sprintf(buffer, "Chunks %d, %.1f/%.0f MB | load avg %.1f / %.1f ms | GPU %.1f MB",
+            stream.residentChunks, stream.residentBytes / 1048576.0, stream.budgetBytes / 1048576.0,
+            stream.latencySumMs / std::max(1L, stream.loads), stream.worstLatencyMs,
+            staticWorld.gpuBytes / 1048576.0);
+    hudText(batch, x, y - 60, buffer);
+    const CollisionStats& hits = scene->collision;
+    double perStep = 1.0 / std::max(1L, hits.steps);
+    sprintf(buffer, "Colliders %d | %.1f pairs, %.2f queries/step | %ld reinserts",
+            scene->colliders, hits.pairsTested * perStep, hits.queries * perStep, hits.reinserts);
+    hudText(batch, x, y - 80, buffer);
+    const CrowdStats& crowdStats = scene->crowd;
+    sprintf(buffer, "Rivals %d | %.3f ms/step, worst %.2f | %.1f retargets/step",
+            scene->rivals.count(), crowdStats.stepMs / std::max(1L, crowdStats.steps), crowdStats.worstMs,
+            crowdStats.retargets / (double)std::max(1L, crowdStats.steps));
+    hudText(batch, x, y - 100, buffer);
+    y -= 80;
+    
+#if ENABLE_PROFILER
+    hudText(batch, x, y - 45, "Phase", GLUT_BITMAP_HELVETICA_18, Color(1, 1, 0));
+    hudText(batch, x + 250, y - 45, "avg ms", GLUT_BITMAP_HELVETICA_18, Color(1, 1, 0));
+    hudText(batch, x + 340, y - 45, "last", GLUT_BITMAP_HELVETICA_18, Color(1, 1, 0));
+    
+    int order[FrameProfiler::MAX_PHASES];
+    float average[FrameProfiler::MAX_PHASES];
+    int count = profiler.phases();
+    for (int p = 0; p < count; p++) {
+        order[p] = p;
+        average[p] = profiler.averagePhaseMs(p);
+    }
+    std::sort(order, order + count, [&](int a, int b) { return average[a] > average[b]; });
+    for (int row = 0; row < count && row < PROFILER_PHASE_ROWS; row++) {
+        int p = order[row];
+        float rowY = y - 65 - row * 20;
+        hudText(batch, x, rowY, profiler.phaseName(p));
+        sprintf(buffer, "%.3f", average[p]);
+        hudText(batch, x + 250, rowY, buffer);
+        sprintf(buffer, "%.3f", last ? last->phaseMs[p] : 0.0f);
+        hudText(batch, x + 340, rowY, buffer);
+    }
+#else
+    hudText(batch, x, y - 45, "Phase timers are compiled out (NDEBUG)");
+#endif
+}
+
+// Frame-time bars, oldest on the left, against 60 and 30 fps reference lines
+void drawProfilerGraph() {
+    float left = PROFILER_PANEL_X + 10;
+    float bottom = PROFILER_PANEL_Y + 10;
+    float width = PROFILER_PANEL_W - 20;
+    float barWidth = width / (FrameProfiler::HISTORY - 1);
+    float scale = PROFILER_GRAPH_H / PROFILER_GRAPH_MS;
+    
+    glBegin(GL_QUADS);
+    for (int age = 0; age < profiler.frameCount(); age++) {
+        float ms = profiler.frame(age).durationMs;
+        if (ms < 1000.0f / 59.0f) glColor3f(0.3f, 0.9f, 0.3f);
+        else if (ms < 1000.0f / 29.0f) glColor3f(0.95f, 0.8f, 0.2f);
+        else glColor3f(0.95f, 0.3f, 0.25f);
+        float x = left + width - (age + 1) * barWidth;
+        float h = std::min(ms, PROFILER_GRAPH_MS) * scale;
+        glVertex2f(x, bottom);
+        glVertex2f(x + barWidth, bottom);
+        glVertex2f(x + barWidth, bottom + h);
+        glVertex2f(x, bottom + h);
+    }
+    glEnd();
+    
+    glColor3f(0.6f, 0.6f, 0.6f);
+    glBegin(GL_LINES);
+    for (float ms : {1000.0f / 60.0f, 1000.0f / 30.0f}) {
+        glVertex2f(left, bottom + ms * scale);
+        glVertex2f(left + width, bottom + ms * scale);
+    }
+    glEnd();
+}
+
+void renderProfilerOverlay() {
+    PROFILE_SCOPE("renderProfilerOverlay");
+    glState.disable(GL_DEPTH_TEST);
+    glState.disable(GL_LIGHTING);
+    
+    glMatrixMode(GL_PROJECTION);
     glPushMatrix();
-    glTranslatef(0, 1.4f, 0);
-    drawCone(0.4f, 0.5f, Color(0.1f, 0.1f, 0.1f));
-    glPopMatrix();
-    
-    // Sword (cylinder)
+    glLoadIdentity();
+    gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
+    glMatrixMode(GL_MODELVIEW);
     glPushMatrix();
-    glTranslatef(-0.7f, 0.6f, 0);
-    glRotatef(45, 0, 0, 1);
-    drawCylinder(0.05f, 1.2f, Color(0.7f, 0.7f, 0.8f));
-    glPopMatrix();
+    glLoadIdentity();
+    
+    // Backing panel
+    glState.enable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glColor4f(0, 0, 0, 0.6f);
+    glBegin(GL_QUADS);
+    glVertex2f(PROFILER_PANEL_X, PROFILER_PANEL_Y);
+    glVertex2f(PROFILER_PANEL_X + PROFILER_PANEL_W, PROFILER_PANEL_Y);
+    glVertex2f(PROFILER_PANEL_X + PROFILER_PANEL_W, PROFILER_PANEL_Y + PROFILER_PANEL_H);
+    glVertex2f(PROFILER_PANEL_X, PROFILER_PANEL_Y + PROFILER_PANEL_H);
+    glEnd();
+    glState.disable(GL_BLEND);
+    
+    drawProfilerGraph();
+    
+    if (glyphAtlas.available()) {
+        double now = nowMs();
+        if (now - profilerTextTime >= 250.0) {
+            profilerBatch.clear();
+            buildProfilerText(&profilerBatch);
+            profilerTextTime = now;
+        }
+        profilerBatch.draw();
+    } else {
+        buildProfilerText(NULL);
+    }
     
     glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    
+    glState.enable(GL_DEPTH_TEST);
+    glState.enable(GL_LIGHTING);
 }
 
-// Platform (2 primitives each)
-void drawPlatform(Platform& platform) {
-    const float heightScale = 0.5f;
-    float reducedHeight = platform.size.y * heightScale;
+// ==================== STATE SNAPSHOTS ====================
+// Everything a step can change, in one flat buffer: a POD header with the
+// scalars, then the platform, collectible and agent state arrays back to back.
+// Positions, sizes and colours belong to the level and are not copied, so a
+// snapshot is a few bytes per entity and capture and restore are a handful
+// of memcpys. Restoring also patches the pickup grid, but only for the
+// collectibles whose state changed.
+struct GameStateHeader {
+    uint32_t platformCount, collectibleCount, agentCount;
+    GameState gameState;
+    int timeRemaining, timerTicks;
+    Vector3 playerPos, prevPlayerPos;
+    float playerRotation;
+    float globalRotation, prevGlobalRotation;
+    int cameraMode;
+    float cameraAngleX, cameraAngleY, cameraDistance;
+    int collected, platformsComplete;
+    long crowdTicks;
+};
+static_assert(std::is_trivially_copyable<GameStateHeader>::value, "GameStateHeader is copied with memcpy");
 
-    glPushMatrix();
-    glTranslatef(platform.position.x, platform.position.y, platform.position.z);
+class GameSnapshot {
+private:
+    std::vector<uint8_t> data;  // keeps its capacity, so capturing again doesn't allocate
+    
+    template <typename T>
+    static void put(uint8_t*& p, const T* values, size_t count) {
+        memcpy(p, values, count * sizeof(T));
+        p += count * sizeof(T);
+    }
+    
+    template <typename T>
+    static void get(const uint8_t*& p, T* values, size_t count) {
+        memcpy(values, p, count * sizeof(T));
+        p += count * sizeof(T);
+    }
+    
+public:
+    bool empty() const { return data.empty(); }
+    size_t bytes() const { return data.size(); }
+    void clear() { data.clear(); }
+    
+    const GameStateHeader& header() const { return *(const GameStateHeader*)data.data(); }
+    
+    void capture() {
+        size_t p = platforms.count(), n = collectibles.count(), a = crowd.agents.count();
+        data.resize(sizeof(GameStateHeader) + p * (2 * sizeof(float) + sizeof(int) + 2) + n +
+                    a * (7 * sizeof(float) + 4 * sizeof(int)));
+        GameStateHeader h;
+        h.platformCount = (uint32_t)p;
+        h.collectibleCount = (uint32_t)n;
+        h.agentCount = (uint32_t)a;
+        h.gameState = gameState;
+        h.timeRemaining = gameTimeRemaining;
+        h.timerTicks = timerTicks;
+        h.playerPos = playerPos;
+        h.prevPlayerPos = prevPlayerPos;
+        h.playerRotation = playerRotation;
+        h.globalRotation = globalRotation;
+        h.prevGlobalRotation = prevGlobalRotation;
+        h.cameraMode = cameraMode;
+        h.cameraAngleX = cameraAngleX;
+        h.cameraAngleY = cameraAngleY;
+        h.cameraDistance = cameraDistance;
+        h.collected = counters.collected;
+        h.platformsComplete = counters.platformsComplete;
+        h.crowdTicks = crowd.ticks;
+        
+        uint8_t* out = data.data();
+        put(out, &h, 1);
+        put(out, platforms.animationValue.data(), p);
+        put(out, platforms.prevAnimationValue.data(), p);
+        put(out, counters.platformCollected.data(), p);
+        put(out, platforms.animationActive.data(), p);
+        put(out, platforms.allCollected.data(), p);
+        put(out, collectibles.collected.data(), n);
+        const AgentTable& agents = crowd.agents;
+        put(out, agents.x.data(), a);
+        put(out, agents.y.data(), a);
+        put(out, agents.z.data(), a);
+        put(out, agents.prevX.data(), a);
+        put(out, agents.prevY.data(), a);
+        put(out, agents.prevZ.data(), a);
+        put(out, agents.heading.data(), a);
+        put(out, agents.target.data(), a);
+        put(out, agents.skip.data(), a);
+        put(out, agents.stuck.data(), a);
+        put(out, agents.score.data(), a);
+    }
+    
+    // Puts the game back in the captured state. The camera and the
+    // collectibles' spin are only restored when asked, so restart and rewind
+    // leave the view alone. Fails if the tables changed size since (another
+    // level or crowd).
+    bool restore(bool view) {
+        if (data.empty()) return false;
+        GameStateHeader h;
+        const uint8_t* in = data.data();
+        get(in, &h, 1);
+        size_t p = h.platformCount, n = h.collectibleCount, a = h.agentCount;
+        if ((int)p != platforms.count() || (int)n != collectibles.count() || (int)a != crowd.agents.count()) {
+            return false;
+        }
+        
+        gameState = h.gameState;
+        gameTimeRemaining = h.timeRemaining;
+        timerTicks = h.timerTicks;
+        playerPos = h.playerPos;
+        prevPlayerPos = h.prevPlayerPos;
+        playerRotation = h.playerRotation;
+        if (view) {
+            globalRotation = h.globalRotation;
+            prevGlobalRotation = h.prevGlobalRotation;
+            cameraMode = h.cameraMode;
+            cameraAngleX = h.cameraAngleX;
+            cameraAngleY = h.cameraAngleY;
+            cameraDistance = h.cameraDistance;
+        }
+        counters.collected = h.collected;
+        counters.platformsComplete = h.platformsComplete;
+        crowd.ticks = h.crowdTicks;
+        
+        get(in, platforms.animationValue.data(), p);
+        get(in, platforms.prevAnimationValue.data(), p);
+        get(in, counters.platformCollected.data(), p);
+        get(in, platforms.animationActive.data(), p);
+        get(in, platforms.allCollected.data(), p);
+        
+        // Only the pickups that differ touch the grid and the flow field;
+        // equal stretches are skipped a block at a time
+        static std::vector<int> picked, restored;
+        picked.clear();
+        restored.clear();
+        streamer.fillAll(); // no half-filled chunks for holds() to miss
+        const uint8_t* saved = in;
+        uint8_t* current = collectibles.collected.data();
+        const size_t BLOCK = 64;
+        for (size_t begin = 0; begin < n; begin += BLOCK) {
+            size_t end = std::min(begin + BLOCK, n);
+            if (memcmp(current + begin, saved + begin, end - begin) == 0) continue;
+            for (size_t i = begin; i < end; i++) {
+                if (current[i] == saved[i]) continue;
+                current[i] = saved[i];
+                if (saved[i]) picked.push_back((int)i);
+                else restored.push_back((int)i);
+                Vector3 pos = collectibles.transform.position((int)i);
+                if (!streamer.holds(pos.x, pos.z)) continue;
+                if (saved[i]) collectibleGrid.remove((int)i, pos);
+                else collectibleGrid.insert((int)i, pos);
+            }
+        }
+        in += n;
+        if (!picked.empty()) collectibleField.remove(picked);
+        if (!restored.empty()) collectibleField.add(restored);
+        
+        AgentTable& agents = crowd.agents;
+        get(in, agents.x.data(), a);
+        get(in, agents.y.data(), a);
+        get(in, agents.z.data(), a);
+        get(in, agents.prevX.data(), a);
+        get(in, agents.prevY.data(), a);
+        get(in, agents.prevZ.data(), a);
+        get(in, agents.heading.data(), a);
+        get(in, agents.target.data(), a);
+        get(in, agents.skip.data(), a);
+        get(in, agents.stuck.data(), a);
+        get(in, agents.score.data(), a);
+        
+        streamer.recenter(playerPos);
+        levelVersion++;
+        pickedSinceLevel.clear();
+        return true;
+    }
+};
 
-    // Base
-    glPushMatrix();
-    glScalef(platform.size.x, reducedHeight, platform.size.z);
-    drawCube(1, platform.color);
-    glPopMatrix();
+// Recent states for rewinding, captured every REWIND_INTERVAL steps into a
+// ring sized to REWIND_BUDGET bytes (at most REWIND_SLOTS snapshots)
+const int REWIND_INTERVAL = SIM_HZ / 4;
+const int REWIND_SLOTS = 120;                       // 30 s on the built-in arena
+const size_t REWIND_BUDGET = 32u * 1024 * 1024;
+const int REWIND_STEP_SLOTS = SIM_HZ / REWIND_INTERVAL; // one second per rewind
 
-    // Top section
-    glPushMatrix();
-    glTranslatef(0, reducedHeight / 2 + 0.1f, 0);
-    glScalef(platform.size.x, 0.2f, platform.size.z);
-    Color topColor(
-        platform.color.r * 0.8f,
-        platform.color.g * 0.8f,
-        platform.color.b * 0.8f
-    );
-    drawCube(1, topColor);
-    glPopMatrix();
+class RewindBuffer {
+private:
+    std::vector<GameSnapshot> slots;
+    int newest;
+    int count;
+    int stepsSinceCapture;
+    
+public:
+    bool enabled;
+    
+    RewindBuffer() : newest(-1), count(0), stepsSinceCapture(0), enabled(true) {}
+    
+    // After a restart or a new level: drops the history and sizes the ring
+    // for the current tables
+    void reset(size_t snapshotBytes) {
+        size_t fit = REWIND_BUDGET / std::max(snapshotBytes, (size_t)1);
+        slots.resize(std::max(2, (int)std::min(fit, (size_t)REWIND_SLOTS)));
+        newest = -1;
+        count = 0;
+        stepsSinceCapture = 0;
+    }
+    
+    // Once per simulation step
+    void step() {
+        if (!enabled || slots.empty() || ++stepsSinceCapture < REWIND_INTERVAL) return;
+        stepsSinceCapture = 0;
+        newest = (newest + 1) % (int)slots.size();
+        slots[newest].capture();
+        count = std::min(count + 1, (int)slots.size());
+    }
+    
+    // Restores the state of about a second ago (or the oldest one kept) and
+    // forgets everything after it
+    bool rewind() {
+        if (count == 0) return false;
+        int back = std::min(REWIND_STEP_SLOTS, count - 1);
+        newest = (newest - back + (int)slots.size()) % (int)slots.size();
+        count -= back;
+        stepsSinceCapture = 0;
+        return slots[newest].restore(false);
+    }
+    
+    int size() const { return count; }
+    int capacity() const { return (int)slots.size(); }
+};
 
-    glPopMatrix();
+GameSnapshot startState;    // taken by initGame(); R restores it
+RewindBuffer rewindBuffer;
+
+// ==================== GAME LOGIC ====================
+// Whether collectible i counts towards the score: the ones on a platform,
+// which finish the level, not the lattice of --stress-collectibles
+bool scores(int i) {
+    int owner = collectibles.platform[i];
+    return owner >= 0 && owner < platforms.count();
 }
 
-// Collectible (3 primitives)
-void drawCollectible(Vector3 pos) {
-    glPushMatrix();
-    glTranslatef(pos.x, pos.y, pos.z);
-    glRotatef(globalRotation * 2, 0, 1, 0);
+void resetCounters() {
+    counters = GameCounters();
+    counters.platformCollected.assign(platforms.count(), 0);
+    counters.platformTotal.assign(platforms.count(), 0);
+    for (int i = 0; i < collectibles.count(); i++) {
+        if (!scores(i)) continue;
+        counters.total++;
+        counters.platformTotal[collectibles.platform[i]]++;
+    }
+    // A platform without collectibles has nothing left to collect
+    for (int i = 0; i < platforms.count(); i++) {
+        if (counters.platformTotal[i] == 0) {
+            platforms.allCollected[i] = 1;
+            counters.platformsComplete++;
+        }
+    }
+}
+
+// Hooks the log and audio up to the game events. Called once at startup.
+// The HUD and renderer follow the counters in the render snapshots.
+void subscribeEventListeners() {
+    eventBus.subscribe([](const GameEvent& e) {
+        switch (e.type) {
+            case EVENT_PICKUP:
+                gameLogger.log(LOG_INFO, LOG_SUCCESS, "Collectible #%d picked up! Distance: %.2f",
+                               e.index, e.distance);
+                break;
+            case EVENT_PLATFORM_COMPLETE:
+                gameLogger.log(LOG_INFO, LOG_PLATFORM, "Platform %d completed! (%d/%d items)", e.index + 1,
+                               counters.platformCollected[e.index], counters.platformTotal[e.index]);
+                if (!headlessMode) {
+                    std::cout << "Platform " << (e.index+1) << " completed. Animation auto-enabled." << std::endl;
+                }
+                break;
+            case EVENT_WIN:
+                gameLogger.log(LOG_INFO, LOG_GAME, "PLAYER WON!");
+                if (!headlessMode) std::cout << "YOU WIN!" << std::endl;
+                break;
+            case EVENT_TIME_UP:
+                gameLogger.log(LOG_INFO, LOG_GAME, "TIME UP - GAME OVER");
+                break;
+            case EVENT_RIVAL_PICKUP:
+                gameLogger.log(LOG_DEBUG, LOG_COLLECT, "Rival %d picked up collectible #%d (%d so far)",
+                               e.rival, e.index, crowd.agents.score[e.rival]);
+                break;
+            case EVENT_RIVAL_WIN:
+                gameLogger.log(LOG_INFO, LOG_GAME, "RIVAL %d WON with %d to the player's %d - GAME OVER", e.rival,
+                               crowd.agents.score[e.rival], counters.collected);
+                if (!headlessMode) std::cout << "A rival collected more. GAME OVER" << std::endl;
+                break;
+        }
+    });
     
-    // Center sphere
-    drawSphere(0.2f, Color(1.0f, 0.84f, 0.0f));
+    eventBus.subscribe([](const GameEvent& e) {
+        switch (e.type) {
+            case EVENT_PICKUP: audio.play(SOUND_PICKUP); break;
+            case EVENT_WIN: audio.play(SOUND_WIN); break;
+            case EVENT_TIME_UP: audio.play(SOUND_TIME_UP); break;
+            case EVENT_RIVAL_WIN: audio.play(SOUND_TIME_UP); break;
+            default: break;
+        }
+    });
+}
+
+// The built-in arena, unless --level loaded another level
+void loadDefaultLevel() {
+    if (level.loaded()) return;
+    // --stress-collectibles adds a lattice to the built-in arena
+    std::string text = DEFAULT_LEVEL;
+    if (stressCollectibleCount > 0) text += "lattice " + std::to_string(stressCollectibleCount) + "\n";
+    std::string error;
+    if (!level.loadText(text, "built-in arena", error)) gameLogger.log(LOG_ERROR, LOG_INIT, "%s", error.c_str());
+}
+
+void initGame() {
+    srand(gameSeed);
+    audio.stopAll(); // Stop any previous music
+    audio.play(SOUND_MUSIC, true);
     
-    // Ring
-    glPushMatrix();
-    glRotatef(90, 1, 0, 0);
-    drawTorus(0.05f, 0.3f, Color(0.9f, 0.7f, 0.0f));
-    glPopMatrix();
+    gameLogger.log(LOG_INFO, LOG_GAME, "===== GAME INITIALIZATION =====");
     
-    // Top cone
-    glPushMatrix();
-    glTranslatef(0, 0.3f, 0);
-    drawCone(0.15f, 0.2f, Color(1.0f, 0.84f, 0.0f));
-    glPopMatrix();
+    static bool levelChecked = false;
+    loadDefaultLevel();
+    level.apply(platforms, collectibles);
+    worldHalfSize = level.info().worldHalfSize;
+    buildColliders(platforms, worldHalfSize);
+    buildNavigation(worldHalfSize, npcCount > 0);
     
-    glPopMatrix();
+    // Log and check the level once, not on every restart
+    if (!levelChecked) {
+        levelChecked = true;
+        gameLogger.logCollectiblePositions(collectibles);
+        if (gameLogger.wants(LOG_WARN, LOG_OVERLAP)) {
+            CollectibleGrid grid;
+            grid.build(collectibles, GRID_CELL_SIZE);
+            validateLevel(platforms, collectibles, grid);
+        }
+    }
+    
+    gameState = PLAYING;
+    gameTimeRemaining = GAME_TIME;
+    timerTicks = 0;
+    playerPos = Vector3(0, 0.5, 0);
+    prevPlayerPos = playerPos;
+    playerRotation = 0;
+    
+    // Fills the pickup grid from the chunks around the player
+    streamer.restart(level, playerPos);
+    resetCounters();
+    crowd.spawn(npcCount, gameSeed, worldHalfSize);
+    levelVersion++;
+    pickedSinceLevel.clear();
+    startState.capture();
+    rewindBuffer.reset(startState.bytes());
+    
+    gameLogger.log(LOG_INFO, LOG_GAME, "Initialization complete");
 }
 
-// Platform 1: Lantern (5 primitives) - Rotation
-void drawLantern(Platform& platform) {
-    glPushMatrix();
-    glTranslatef(platform.position.x, platform.position.y + 3, platform.position.z);
+// R: back to the state initGame() left, without reloading anything
+void restartGame() {
+    srand(gameSeed);
+    if (!startState.restore(false)) {
+        initGame();
+        return;
+    }
+    audio.stopAll();
+    audio.play(SOUND_MUSIC, true);
+    rewindBuffer.reset(startState.bytes());
+    gameLogger.log(LOG_INFO, LOG_GAME, "===== GAME RESTART =====");
+}
 
-    float rot = 0.0f;
-    float bob = 0.0f;
-    const float fixedGlow = 0.84f;
-    if (platform.animationActive) {
-        rot = platform.animationValue * 3.0f;
-        bob = 0.25f * sin(platform.animationValue * 0.05f);
+// Marks collectible i picked up, publishes `pickup` and completes the
+// collectible's platform if it was the last one there. Platforms completed
+// here start animating at once, or are added to `completed` when an
+// animation pass may still be reading the flags.
+void collectItem(int i, const GameEvent& pickup, std::vector<int>* completed) {
+    collectibles.collected[i] = 1;
+    pickedSinceLevel.push_back(i);
+    collectibleGrid.remove(i, collectibles.transform.position(i));
+    collectibleField.remove(i);
+    eventBus.publish(pickup);
+    
+    // Check platform completion
+    int p = collectibles.platform[i];
+    if (p >= 0 && p < platforms.count() &&
+        ++counters.platformCollected[p] == counters.platformTotal[p]) {
+        platforms.allCollected[p] = 1;
+        if (completed) completed->push_back(p);
+        else platforms.animationActive[p] = 1;
+        counters.platformsComplete++;
+        eventBus.publish(GameEvent(EVENT_PLATFORM_COMPLETE, p));
     }
-    glTranslatef(0, bob, 0);
-    glRotatef(rot, 0, 1, 0);
+}
 
-    // Top
-    drawCylinder(0.3f, 0.5f, Color(0.6f, 0.3f, 0.0f));
+// The player's pickups; see collectItem() for `completed`
+void checkCollectibles(std::vector<int>* completed = NULL) {
+    PROFILE_SCOPE("checkCollectibles");
+    static std::vector<int> nearby;
+    float searchRadius = debugMode ? COLLECTION_RADIUS * 1.5f : COLLECTION_RADIUS;
+    collectibleGrid.queryRadius(playerPos, searchRadius, nearby);
+    
+    // Grid cells hold a couple of items at most, too few to batch; the test
+    // is still the kernel's, so it agrees with the batch paths at the boundary
+    ProximityQuery pickup(playerPos, COLLECTION_RADIUS);
+    for (int i : nearby) {
+        Vector3 position = collectibles.transform.position(i);
+        
+        // The distance only goes into the event and the debug log
+        if (proximityHit(position.x, position.y, position.z, pickup)) {
+            if (scores(i)) counters.collected++;
+            collectItem(i, GameEvent(EVENT_PICKUP, i, distance(playerPos, position)), completed);
+        } else if (debugMode) {
+            float dist = distance(playerPos, position);
+            if (dist < COLLECTION_RADIUS * 1.5f) gameLogger.logCollectionAttempt(i, dist);
+        }
+    }
+}
 
-    // Middle sphere
-    glPushMatrix();
-    glTranslatef(0, 0.8f, 0);
-    drawSphere(0.6f, Color(1.0f, fixedGlow, 0.0f));
-    glPopMatrix();
+// Each rival picks up its own target once it is in reach, in agent order
+// and after the player, so a tie goes to the player and then the lower index
+void checkRivalPickups(std::vector<int>* completed = NULL) {
+    AgentTable& agents = crowd.agents;
+    for (int a = 0; a < agents.count(); a++) {
+        int i = agents.target[a];
+        if (!Crowd::offered(i)) continue;
+        Vector3 position = collectibles.transform.position(i);
+        if (!proximityHit(position.x, position.y, position.z, ProximityQuery(agents.position(a), COLLECTION_RADIUS))) {
+            continue;
+        }
+        if (scores(i)) agents.score[a]++;
+        crowd.stats.pickups++;
+        collectItem(i, GameEvent(EVENT_RIVAL_PICKUP, i, distance(agents.position(a), position), a), completed);
+    }
+}
 
-    // Bottom cone
-    glPushMatrix();
-    glTranslatef(0, 1.5f, 0);
-    drawCone(0.4f, 0.5f, Color(0.6f, 0.3f, 0.0f));
-    glPopMatrix();
+// Once every platform is complete the player wins, unless a rival picked up more
+void checkMatchEnd() {
+    if (counters.platformsComplete != platforms.count() || gameState != PLAYING) return;
+    int leader = crowd.leader();
+    if (leader >= 0 && crowd.agents.score[leader] > counters.collected) {
+        gameState = GAME_OVER;
+        eventBus.publish(GameEvent(EVENT_RIVAL_WIN, -1, 0, leader));
+    } else {
+        gameState = WIN;
+        eventBus.publish(GameEvent(EVENT_WIN));
+    }
+}
 
-    // Chain
-    glPushMatrix();
-    glTranslatef(0, -0.5f, 0);
-    drawCylinder(0.05f, 0.5f, Color(0.5f, 0.5f, 0.5f));
-    glPopMatrix();
+// Moves the player by delta, sliding along walls and props and stepping
+// onto platforms; returns where it ends up
+Vector3 movePlayer(const Vector3& from, const Vector3& delta) {
+    collision.place(playerCollider, playerBox(from));
+    Vector3 moved = collision.move(playerCollider, delta, STEP_HEIGHT);
+    return Vector3(from.x + moved.x, from.y + moved.y, from.z + moved.z);
+}
 
-    // Ring
-    glPushMatrix();
-    glTranslatef(0, 2.2f, 0);
-    glRotatef(90, 1, 0, 0);
-    drawTorus(0.1f, 0.5f, Color(0.8f, 0.6f, 0.0f));
-    glPopMatrix();
+// ==================== SIMULATION CORE ====================
+// Everything below runs without GLUT or a GL context. The caller supplies the
+// elapsed time and the input for the tick, so the same code drives the
+// windowed game, headless runs and benchmarks.
+struct SimInput {
+    bool up, down, left, right;
+    SimInput() : up(false), down(false), left(false), right(false) {}
+};
 
-    glPopMatrix();
-}
+// Degrees per step for each platform animation type
+const float ANIMATION_SPEEDS[] = { 4.0f, 2.5f, 3.5f, 2.0f };
+const int ANIMATION_TYPES = sizeof(ANIMATION_SPEEDS) / sizeof(ANIMATION_SPEEDS[0]);
+const float DEFAULT_ANIMATION_SPEED = 2.0f;
 
-// Platform 2: Pagoda (6 primitives) - Scaling
-void drawPagoda(Platform& platform) {
-    glPushMatrix();
-    glTranslatef(platform.position.x, platform.position.y + 2, platform.position.z);
+const int ANIMATION_GRAIN = 16384; // platforms per animation job
 
-    if (platform.animationActive) {
-        float s1 = 1.0f + 0.35f * sin(platform.animationValue * 0.035f);
-        float s2 = 1.0f + 0.15f * sin(platform.animationValue * 0.04f + 1.0f);
-        float s3 = 1.0f + 0.25f * sin(platform.animationValue * 0.03f + 2.0f);
-        glScalef(s1, s2, s3);
-        glRotatef(sin(platform.animationValue * 0.015f) * 6.0f, 0, 0, 1);
+// Animation system: advances the active platform animations in [begin, end) by one step
+void animatePlatformRange(PlatformTable& table, int begin, int end) {
+    const uint8_t* active = table.animationActive.data();
+    const int* type = table.animationType.data();
+    float* value = table.animationValue.data();
+    for (int i = begin; i < end; i++) {
+        if (!active[i]) continue;
+        int t = type[i];
+        value[i] += (t >= 0 && t < ANIMATION_TYPES) ? ANIMATION_SPEEDS[t] : DEFAULT_ANIMATION_SPEED;
+        if (value[i] > 360) value[i] -= 360;
     }
+}
 
-    // Base
-    glPushMatrix();
-    glScalef(1.5f, 0.3f, 1.5f);
-    drawCube(1, Color(0.5f, 0.0f, 0.0f));
-    glPopMatrix();
+void animatePlatforms(PlatformTable& table) {
+    animatePlatformRange(table, 0, table.count());
+}
+
+// The same pass as a job over blocks of ANIMATION_GRAIN platforms
+Job* animatePlatformsJob(PlatformTable& table) {
+    return jobs.parallelFor(table.count(), ANIMATION_GRAIN, [&table](int begin, int end) {
+        animatePlatformRange(table, begin, end);
+    });
+}
+
+// Advances the game by exactly one SIM_STEP_MS step
+void stepSimulation(const SimInput& input) {
+    PROFILE_SCOPE("sim step");
+    // Keep the previous state around for render interpolation
+    prevPlayerPos = playerPos;
+    prevGlobalRotation = globalRotation;
+    platforms.prevAnimationValue = platforms.animationValue;
     
-    // Level 1
-    glPushMatrix();
-    glTranslatef(0, 0.5f, 0);
-    glScalef(1.2f, 0.8f, 1.2f);
-    drawCube(1, Color(0.8f, 0.1f, 0.1f));
-    glPopMatrix();
+    collision.stats.steps++;
     
-    // Level 2
-    glPushMatrix();
-    glTranslatef(0, 1.2f, 0);
-    glScalef(0.9f, 0.6f, 0.9f);
-    drawCube(1, Color(0.8f, 0.1f, 0.1f));
-    glPopMatrix();
+    // Update timer
+    if (gameState == PLAYING) {
+        if (++timerTicks >= SIM_HZ) {
+            gameTimeRemaining--;
+            timerTicks = 0;
+            if (gameTimeRemaining <= 0) {
+                gameState = GAME_OVER;
+                eventBus.publish(GameEvent(EVENT_TIME_UP));
+            }
+        }
+    }
     
-    // Level 3
-    glPushMatrix();
-    glTranslatef(0, 1.7f, 0);
-    glScalef(0.6f, 0.4f, 0.6f);
-    drawCube(1, Color(0.8f, 0.1f, 0.1f));
-    glPopMatrix();
+    // Update animations
+    globalRotation += 1.0f;
+    if (globalRotation > 360) globalRotation -= 360;
     
-    // Roof
-    glPushMatrix();
-    glTranslatef(0, 2.2f, 0);
-    drawCone(0.8f, 0.7f, Color(0.3f, 0.2f, 0.1f));
-    glPopMatrix();
+    // Large levels animate on the job system while the player moves; platforms
+    // completed meanwhile start animating once that pass is done, as they would
+    // have after a serial one
+    static std::vector<int> completedPlatforms;
+    Job* animation = NULL;
+    if (platforms.count() > ANIMATION_GRAIN && jobs.workerCount() > 0) {
+        animation = animatePlatformsJob(platforms);
+        jobs.submit(animation);
+    } else {
+        animatePlatforms(platforms);
+    }
     
-    // Top sphere
-    glPushMatrix();
-    glTranslatef(0, 3.0f, 0);
-    drawSphere(0.2f, Color(1.0f, 0.84f, 0.0f));
-    glPopMatrix();
+    // Update player movement
+    if (gameState == PLAYING || gameState == WIN) {
+        Vector3 newPos = playerPos;
+        bool moved = false;
+        
+        if (input.up) {
+            newPos.z -= PLAYER_SPEED;
+            playerRotation = 180;
+            moved = true;
+        }
+        if (input.down) {
+            newPos.z += PLAYER_SPEED;
+            playerRotation = 0;
+            moved = true;
+        }
+        if (input.left) {
+            newPos.x -= PLAYER_SPEED;
+            playerRotation = 90;
+            moved = true;
+        }
+        if (input.right) {
+            newPos.x += PLAYER_SPEED;
+            playerRotation = 270;
+            moved = true;
+        }
+        
+        if (moved) {
+            playerPos = movePlayer(playerPos, Vector3(newPos.x - playerPos.x, 0, newPos.z - playerPos.z));
+            if (debugMode) {
+                gameLogger.logPlayerMovement(playerPos);
+            }
+        }
+        
+        // Picks up chunks the loader finished and requests the ones coming into range
+        streamer.update(playerPos);
+        checkCollectibles(animation ? &completedPlatforms : NULL);
+        
+        // The flow field catches up with the last pickups a slice at a time
+        collectibleField.update(NAV_FIELD_STEP_CELLS);
+        crowd.step();
+        checkRivalPickups(animation ? &completedPlatforms : NULL);
+        checkMatchEnd();
+    }
     
-    glPopMatrix();
+    if (animation) {
+        jobs.wait(animation);
+        for (int p : completedPlatforms) platforms.animationActive[p] = 1;
+        completedPlatforms.clear();
+    }
+    rewindBuffer.step();
+}
+
+// ==================== INPUT ====================
+// Window input reaches the game only as InputEvents, applied on the
+// simulation thread before the step they belong to, so the events and their
+// step numbers are all a recording needs to repeat a run.
+enum InputEventType {
+    INPUT_KEY_DOWN, INPUT_KEY_UP, INPUT_SPECIAL_DOWN, INPUT_SPECIAL_UP, INPUT_MOUSE_BUTTON, INPUT_MOUSE_MOVE
+};
+
+struct InputEvent {
+    InputEventType type;
+    int key;        // character, GLUT special key or mouse button
+    int state;      // GLUT_DOWN / GLUT_UP for mouse buttons
+    int x, y;
+};
+
+SimInput sampleInput() {
+    SimInput input;
+    input.up = keys['w'] || keys['W'] || specialKeys[GLUT_KEY_UP];
+    input.down = keys['s'] || keys['S'] || specialKeys[GLUT_KEY_DOWN];
+    input.left = keys['a'] || keys['A'] || specialKeys[GLUT_KEY_LEFT];
+    input.right = keys['d'] || keys['D'] || specialKeys[GLUT_KEY_RIGHT];
+    return input;
 }
 
-// Platform 3: Statue (7 primitives) - Translation
-void drawStatue(Platform& platform) {
-    glPushMatrix();
-    float orbitX = 0.0f;
-    float orbitZ = 0.0f;
-    float offsetY = 0.0f;
-    float rotY = 0.0f;
-    if (platform.animationActive) {
-        float ang = platform.animationValue * 3.14159f / 180.0f;
-        float radius = 0.6f;
-        orbitX = radius * cos(ang * 0.6f);
-        orbitZ = radius * sin(ang * 0.6f);
-        offsetY = 0.6f * sin(ang * 1.2f);
-        rotY = fmod(platform.animationValue * 0.2f, 360.0f);
+// Keys that act on the game (the renderer's own keys are handled in
+// keyboard()). Returns true when the game was restarted.
+bool applyGameKey(unsigned char key) {
+    bool restarted = false;
+    if (key == 'r' || key == 'R') {
+        restartGame();
+        restarted = true;
     }
-    glTranslatef(platform.position.x + orbitX, platform.position.y + 2 + offsetY, platform.position.z + orbitZ);
-    glRotatef(rotY, 0, 1, 0);
-    
-    // Base
-    glPushMatrix();
-    glScalef(1.0f, 0.5f, 1.0f);
-    drawCube(1, Color(0.4f, 0.4f, 0.4f));
-    glPopMatrix();
-    
-    // Lower body
-    glPushMatrix();
-    glTranslatef(0, 1.0f, 0);
-    drawCylinder(0.4f, 1.0f, Color(0.6f, 0.5f, 0.4f));
-    glPopMatrix();
-    
-    // Upper body
-    glPushMatrix();
-    glTranslatef(0, 2.0f, 0);
-    glScalef(0.8f, 0.6f, 0.5f);
-    drawCube(1, Color(0.6f, 0.5f, 0.4f));
-    glPopMatrix();
-    
-    // Head
-    glPushMatrix();
-    glTranslatef(0, 2.8f, 0);
-    drawSphere(0.35f, Color(0.6f, 0.5f, 0.4f));
-    glPopMatrix();
     
-    // Left arm
-    glPushMatrix();
-    glTranslatef(-0.5f, 1.8f, 0);
-    drawCylinder(0.15f, 0.7f, Color(0.6f, 0.5f, 0.4f));
-    glPopMatrix();
+    // Rewind about a second
+    if ((key == 'q' || key == 'Q') && rewindBuffer.rewind()) {
+        gameLogger.log(LOG_INFO, LOG_GAME, "Rewound (%d snapshots left)", rewindBuffer.size());
+    }
     
-    // Right arm
-    glPushMatrix();
-    glTranslatef(0.5f, 1.8f, 0);
-    drawCylinder(0.15f, 0.7f, Color(0.6f, 0.5f, 0.4f));
-    glPopMatrix();
+    // Debug mode toggle
+    if (key == 'b' || key == 'B') {
+        debugMode = !debugMode;
+        gameLogger.log(LOG_INFO, LOG_DEBUG_MODE, debugMode ? "Debug mode ENABLED" : "Debug mode DISABLED");
+        if (!headlessMode) std::cout << "Debug mode " << (debugMode ? "ON" : "OFF") << std::endl;
+    }
     
-    // Crown
-    glPushMatrix();
-    glTranslatef(0, 3.2f, 0);
-    glRotatef(90, 1, 0, 0);
-    drawTorus(0.1f, 0.4f, Color(1.0f, 0.84f, 0.0f));
-    glPopMatrix();
+    // Camera modes
+    if (key == '0') cameraMode = 0; // Free
+    if (key == '1') cameraMode = 1; // Top
+    if (key == '2') cameraMode = 2; // Side
+    if (key == '3') cameraMode = 3; // Front
     
-    glPopMatrix();
+    // Animation toggles (only if platform complete)
+    static const char toggleKeys[] = { 'z', 'x', 'c', 'v' };
+    for (int p = 0; p < 4; p++) {
+        if (tolower(key) != toggleKeys[p]) continue;
+        if (platforms.count() > p && platforms.allCollected[p]) {
+            platforms.animationActive[p] = !platforms.animationActive[p];
+            if (!headlessMode) {
+                std::cout << "P" << (p + 1) << " animation toggled to "
+                          << (platforms.animationActive[p] ? "ON" : "OFF") << std::endl;
+            }
+        } else if (!headlessMode) {
+            std::cout << "P" << (p + 1) << " not complete yet. Collect all items to enable animation." << std::endl;
+        }
+    }
+    return restarted;
 }
 
-// Platform 4: Weapon Rack (5 primitives) - Color Change
-void drawWeaponRack(Platform& platform) {
-    glPushMatrix();
-    glTranslatef(platform.position.x, platform.position.y + 2, platform.position.z);
-
-    float swing = 0.0f;
-    Color weaponColor(0.7f, 0.7f, 0.8f);
-    if (platform.animationActive) {
-        swing = sin(platform.animationValue * 0.06f) * 25.0f;
-        float r = 0.4f + 0.6f * fabs(sin(platform.animationValue * 0.03f));
-        float g = 0.4f + 0.6f * fabs(sin(platform.animationValue * 0.03f + 2.0f));
-        float b = 0.4f + 0.6f * fabs(sin(platform.animationValue * 0.03f + 4.0f));
-        weaponColor = Color(r, g, b);
+// Applies one event to the key, mouse and camera state. Returns true when it
+// restarted the game.
+bool applyInputEvent(const InputEvent& e) {
+    switch (e.type) {
+        case INPUT_KEY_DOWN:
+            keys[e.key & 255] = true;
+            return applyGameKey((unsigned char)e.key);
+        case INPUT_KEY_UP: keys[e.key & 255] = false; break;
+        case INPUT_SPECIAL_DOWN: specialKeys[e.key & 255] = true; break;
+        case INPUT_SPECIAL_UP: specialKeys[e.key & 255] = false; break;
+        case INPUT_MOUSE_BUTTON:
+            if (e.key == GLUT_LEFT_BUTTON) {
+                mouseDown = e.state == GLUT_DOWN;
+                mouseX = e.x;
+                mouseY = e.y;
+            }
+            // Mouse wheel for zoom
+            if (e.key == 3) cameraDistance = std::max(cameraDistance - 2.0f, 5.0f);
+            if (e.key == 4) cameraDistance = std::min(cameraDistance + 2.0f, 60.0f);
+            break;
+        case INPUT_MOUSE_MOVE:
+            if (mouseDown && cameraMode == 0) {
+                cameraAngleY += (e.x - mouseX) * 0.5f;
+                cameraAngleX += (e.y - mouseY) * 0.5f;
+                cameraAngleX = std::max(-89.0f, std::min(cameraAngleX, 89.0f));
+                mouseX = e.x;
+                mouseY = e.y;
+            }
+            break;
     }
+    return false;
+}
 
-    // Stand base
-    glPushMatrix();
-    glScalef(1.0f, 0.2f, 0.5f);
-    drawCube(1, Color(0.3f, 0.2f, 0.1f));
-    glPopMatrix();
+// ==================== INPUT RECORDING ====================
+// A recording holds the game seed, the level's checksum, the number of
+// rivals and every input event with the step it was applied before. Replaying the events through
+// applyInputEvent() repeats the run step for step (world streaming runs in
+// lockstep for both), and the state checksum stored at the end catches a
+// replay that went its own way.
+//
+// After the header every event is a record of varints: steps since the
+// previous event, type, key, button state, and for mouse events x and y as
+// zigzag deltas from the previous mouse event. A final INPUT_END record
+// holds the steps from the last event to the end and the state checksum.
+const char INPUT_MAGIC[8] = { 'P', '1', '6', 'I', 'N', 'P', 'U', 'T' };
+const uint32_t INPUT_VERSION = 4; // 2: solid platforms and props, 3: rivals, 4: rivals follow the flow field
+const uint64_t INPUT_END = 0xFF;
 
-    // Vertical support
-    glPushMatrix();
-    glTranslatef(0, 0.8f, 0);
-    drawCylinder(0.1f, 1.5f, Color(0.3f, 0.2f, 0.1f));
-    glPopMatrix();
+struct InputHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t seed;
+    uint64_t levelChecksum;
+    uint32_t npcs;
+    uint32_t reserved;
+};
 
-    // Sword 1 (left)
-    glPushMatrix();
-    glTranslatef(-0.3f, 1.2f, 0);
-    glRotatef(30 + swing, 0, 0, 1);
-    drawCylinder(0.05f, 1.5f, weaponColor);
-    glPopMatrix();
+void putVarint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t)(v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t)v);
+}
 
-    // Sword 2 (right)
-    glPushMatrix();
-    glTranslatef(0.3f, 1.2f, 0);
-    glRotatef(-30 - swing, 0, 0, 1);
-    drawCylinder(0.05f, 1.5f, weaponColor);
-    glPopMatrix();
+bool getVarint(const uint8_t*& p, const uint8_t* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t byte = *p++;
+        v |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
 
-    // Top ornament
-    glPushMatrix();
-    glTranslatef(0, 2.5f, 0);
-    drawSphere(0.2f, Color(1.0f, 0.84f, 0.0f));
-    glPopMatrix();
+uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+int64_t unzigzag(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
 
-    glPopMatrix();
+// Everything a step can change. Runs that agree on it after the same steps
+// went the same way.
+uint64_t simulationChecksum() {
+    int ints[] = { gameState, gameTimeRemaining, timerTicks, cameraMode, debugMode, counters.collected,
+                   counters.platformsComplete };
+    float floats[] = { playerPos.x, playerPos.y, playerPos.z, playerRotation, globalRotation,
+                       cameraAngleX, cameraAngleY, cameraDistance };
+    uint64_t hash = fnv1a(ints, sizeof(ints));
+    hash = fnv1a(floats, sizeof(floats), hash);
+    hash = fnv1a(collectibles.collected.data(), collectibles.collected.size(), hash);
+    hash = fnv1a(platforms.animationActive.data(), platforms.animationActive.size(), hash);
+    hash = fnv1a(platforms.animationValue.data(), platforms.animationValue.size() * sizeof(float), hash);
+    hash = fnv1a(platforms.allCollected.data(), platforms.allCollected.size(), hash);
+    const AgentTable& agents = crowd.agents;
+    hash = fnv1a(agents.x.data(), agents.x.size() * sizeof(float), hash);
+    hash = fnv1a(agents.y.data(), agents.y.size() * sizeof(float), hash);
+    hash = fnv1a(agents.z.data(), agents.z.size() * sizeof(float), hash);
+    hash = fnv1a(agents.target.data(), agents.target.size() * sizeof(int), hash);
+    return fnv1a(agents.score.data(), agents.score.size() * sizeof(int), hash);
 }
 
-// ==================== TEXT RENDERING ====================
-void renderText(float x, float y, const char* text, void* font = GLUT_BITMAP_HELVETICA_18) {
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
+// Written by the simulation thread as it applies events; the file is only
+// written at the end of the run (a long session is a few hundred KB)
+class InputRecorder {
+private:
+    std::string path;
+    std::vector<uint8_t> data;
+    long lastStep;
+    int lastX, lastY;
+    bool open;
     
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
+public:
+    long events;
     
-    glDisable(GL_LIGHTING);
-    glColor3f(1.0f, 1.0f, 1.0f);
-    glRasterPos2f(x, y);
+    InputRecorder() : lastStep(0), lastX(0), lastY(0), open(false), events(0) {}
     
-    for (const char* c = text; *c != '\0'; c++) {
-        glutBitmapCharacter(font, *c);
+    void start(const std::string& file, uint32_t seed, uint64_t levelChecksum, uint32_t npcs) {
+        path = file;
+        InputHeader header;
+        memcpy(header.magic, INPUT_MAGIC, sizeof(INPUT_MAGIC));
+        header.version = INPUT_VERSION;
+        header.seed = seed;
+        header.levelChecksum = levelChecksum;
+        header.npcs = npcs;
+        header.reserved = 0;
+        data.assign((const uint8_t*)&header, (const uint8_t*)(&header + 1));
+        lastStep = 0;
+        lastX = lastY = 0;
+        events = 0;
+        open = true;
     }
     
-    glEnable(GL_LIGHTING);
-    glPopMatrix();
+    bool active() const { return open; }
     
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
-}
-
-void renderHUD() {
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_LIGHTING);
+    // `step` is the number of steps run before the event
+    void record(long step, const InputEvent& e) {
+        if (!open) return;
+        putVarint(data, step - lastStep);
+        putVarint(data, e.type);
+        putVarint(data, zigzag(e.key));
+        putVarint(data, zigzag(e.state));
+        if (e.type == INPUT_MOUSE_BUTTON || e.type == INPUT_MOUSE_MOVE) {
+            putVarint(data, zigzag(e.x - lastX));
+            putVarint(data, zigzag(e.y - lastY));
+            lastX = e.x;
+            lastY = e.y;
+        }
+        lastStep = step;
+        events++;
+    }
     
-    char buffer[100];
+    // Ends the recording after `steps` steps in the state `checksum`
+    bool finish(long steps, uint64_t checksum, std::string& error) {
+        if (!open) return true;
+        open = false;
+        putVarint(data, steps - lastStep);
+        putVarint(data, INPUT_END);
+        for (int i = 0; i < 8; i++) data.push_back((uint8_t)(checksum >> (8 * i)));
+        std::ofstream out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        out.write((const char*)data.data(), data.size());
+        if (!out) {
+            error = path + ": write failed";
+            return false;
+        }
+        return true;
+    }
     
-    // Timer
-    sprintf(buffer, "Time: %d:%02d", gameTimeRemaining / 60, gameTimeRemaining % 60);
-    renderText(10, WINDOW_HEIGHT - 30, buffer, GLUT_BITMAP_TIMES_ROMAN_24);
+    size_t bytes() const { return data.size(); }
+};
+
+struct RecordedEvent {
+    long step;
+    InputEvent event;
+};
+
+// A loaded recording. apply() is called before each step and applies the
+// events recorded for it.
+class InputReplay {
+private:
+    std::vector<RecordedEvent> events;
+    size_t next;
     
-    // Collectibles
-    int collected = 0;
-    for (const auto& c : collectibles) if (c.collected) collected++;
-    sprintf(buffer, "Collected: %d/%d", collected, (int)collectibles.size());
-    renderText(10, WINDOW_HEIGHT - 60, buffer);
+public:
+    uint32_t seed;
+    uint64_t levelChecksum;
+    uint32_t npcs;
+    long steps;             // length of the recorded run
+    uint64_t checksum;      // state at the end of it
     
-    // Platform status
-    renderText(10, WINDOW_HEIGHT - 90, "Platforms:");
-    for (size_t i = 0; i < platforms.size(); i++) {
-        sprintf(buffer, "P%d: %s %s", (int)i+1, 
-                platforms[i].allCollected ? "✓" : "✗",
-                platforms[i].animationActive ? "[ON]" : "[OFF]");
-        renderText(10, WINDOW_HEIGHT - 110 - i*20, buffer);
-    }
+    InputReplay() : next(0), seed(0), levelChecksum(0), npcs(0), steps(0), checksum(0) {}
     
-    // Controls
-    renderText(10, 70, "WASD: Move | 1/2/3: Views | Z/X/C/V: Animations");
-    renderText(10, 50, "Mouse: Camera | B: Debug | R: Restart | ESC: Exit");
+    bool load(const std::string& path, std::string& error) {
+        std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        InputHeader header;
+        if (!in || data.size() < sizeof(header)) {
+            error = path + ": cannot read recording";
+            return false;
+        }
+        memcpy(&header, data.data(), sizeof(header));
+        if (memcmp(header.magic, INPUT_MAGIC, sizeof(INPUT_MAGIC)) != 0 || header.version != INPUT_VERSION) {
+            error = path + ": not an input recording of this version";
+            return false;
+        }
+        seed = header.seed;
+        levelChecksum = header.levelChecksum;
+        npcs = header.npcs;
+        
+        events.clear();
+        next = 0;
+        const uint8_t* p = data.data() + sizeof(header);
+        const uint8_t* end = data.data() + data.size();
+        long step = 0;
+        int lastX = 0, lastY = 0;
+        while (true) {
+            uint64_t delta, type, key, state;
+            if (!getVarint(p, end, delta) || !getVarint(p, end, type)) break;
+            step += (long)delta;
+            if (type == INPUT_END) {
+                if (end - p != 8) break;
+                steps = step;
+                checksum = 0;
+                for (int i = 0; i < 8; i++) checksum |= (uint64_t)p[i] << (8 * i);
+                return true;
+            }
+            if (type > INPUT_MOUSE_MOVE || !getVarint(p, end, key) || !getVarint(p, end, state)) break;
+            RecordedEvent r;
+            r.step = step;
+            r.event.type = (InputEventType)type;
+            r.event.key = (int)unzigzag(key);
+            r.event.state = (int)unzigzag(state);
+            r.event.x = r.event.y = 0;
+            if (type == INPUT_MOUSE_BUTTON || type == INPUT_MOUSE_MOVE) {
+                uint64_t dx, dy;
+                if (!getVarint(p, end, dx) || !getVarint(p, end, dy)) break;
+                lastX += (int)unzigzag(dx);
+                lastY += (int)unzigzag(dy);
+                r.event.x = lastX;
+                r.event.y = lastY;
+            }
+            events.push_back(r);
+        }
+        error = path + ": truncated or corrupt recording";
+        return false;
+    }
     
-    // Debug mode indicator
-    if (debugMode) {
-        glColor3f(0, 1, 0);
-        renderText(10, 30, "DEBUG MODE ON - Check game_debug.log", GLUT_BITMAP_HELVETICA_18);
+    // Applies the events recorded before step `step`. Returns true when one
+    // of them restarted the game.
+    bool apply(long step) {
+        bool restarted = false;
+        while (next < events.size() && events[next].step <= step) {
+            restarted = applyInputEvent(events[next++].event) || restarted;
+        }
+        return restarted;
     }
     
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
+    size_t eventCount() const { return events.size(); }
+};
+
+InputRecorder recorder;   // --record
+std::string recordPath;
+InputReplay replay;       // --replay
+bool replaying = false;
+
+// Records the run from the next initGame() on
+void startRecording(const std::string& path) {
+    loadDefaultLevel();
+    recorder.start(path, gameSeed, level.checksum(), (uint32_t)npcCount);
+    streamer.setLockstep(true);
+    std::cout << "Recording input to " << path << std::endl;
 }
 
-void renderWinScreen() {
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_LIGHTING);
-    
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
-    
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
-    
-    // Semi-transparent overlay
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glColor4f(0, 0, 0, 0.5f);
-    glBegin(GL_QUADS);
-    glVertex2f(0, 0);
-    glVertex2f(WINDOW_WIDTH, 0);
-    glVertex2f(WINDOW_WIDTH, WINDOW_HEIGHT);
-    glVertex2f(0, WINDOW_HEIGHT);
-    glEnd();
-    glDisable(GL_BLEND);
+// Writes the recording after `steps` steps
+void finishRecording(long steps) {
+    if (!recorder.active()) return;
+    std::string error;
+    long events = recorder.events;
+    if (recorder.finish(steps, simulationChecksum(), error)) {
+        std::cout << "Recorded " << events << " input events over " << steps << " steps to " << recordPath
+                  << " (" << recorder.bytes() << " bytes)" << std::endl;
+    } else {
+        std::cerr << error << std::endl;
+    }
+}
+
+// Checks a recording against the current level and seeds the game and the
+// crowd with it
+bool prepareReplay(const std::string& path) {
+    std::string error;
+    if (!replay.load(path, error)) {
+        std::cerr << error << std::endl;
+        return false;
+    }
+    if (replay.levelChecksum != level.checksum()) {
+        std::cerr << path << " was recorded on a different level (pass the same --level or "
+                  << "--stress-collectibles as the recording)" << std::endl;
+        return false;
+    }
+    gameSeed = replay.seed;
+    npcCount = (int)replay.npcs;
+    streamer.setLockstep(true);
+    return true;
+}
+
+// Compares the state at the end of a replay with the recording's and hands
+// control back to live input. Returns true when they match.
+bool finishReplay(long steps) {
+    replaying = false;
+    uint64_t checksum = simulationChecksum();
+    bool match = steps == replay.steps && checksum == replay.checksum;
+    std::cout << "Replay of " << replay.eventCount() << " events over " << steps << " steps: state " << std::hex
+              << checksum;
+    if (match) std::cout << " matches the recording";
+    else std::cout << " DIFFERS from the recording's " << replay.checksum;
+    std::cout << std::dec << std::endl;
+    return match;
+}
+
+// The box that stopped a move in the pressed directions, if any
+bool findObstacle(const SimInput& pressed, AABB& obstacle) {
+    static std::vector<int> hits;
+    const float reach = 0.05f;
+    Vector3 probe(pressed.right ? reach : pressed.left ? -reach : 0, 0, pressed.down ? reach : pressed.up ? -reach : 0);
+    AABB me = playerBox(playerPos);
+    collision.overlapping(me.moved(probe), playerCollider, hits);
+    for (int c : hits) {
+        const Collider& other = collision.collider(c);
+        if (other.kind != COLLIDER_DYNAMIC && other.box.max.y > me.min.y + STEP_HEIGHT) {
+            obstacle = other.box;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Scripted driver for headless runs: walk the A* path to the nearest
+// collectible, picking a new one only once the current target has been
+// collected (or follow the flow field where A* finds no path). When something still stops it, it sidesteps along the obstacle
+// on the waypoint's side until clear of it, then walks on past it.
+SimInput autopilotInput() {
+    static std::vector<int> nearest;
+    static int target = -1;
+    static std::vector<Vector3> path;
+    static size_t waypoint = 0;
+    static int pathTarget = -1;
+    static bool found = false;
+    static Vector3 lastPos;
+    static SimInput last;
+    static int detour = 0;          // 0 none, 1 sidestepping, 2 walking past
+    static int detourTarget = -1;
+    static bool alongX = false;     // the sidestep axis
+    static bool positive = false;   // and direction
+    static bool onward = false;     // direction of the blocked move
+    static AABB obstacle;
+    SimInput input;
+    if (target < 0 || target >= collectibles.count() || collectibles.collected[target]) {
+        collectibleGrid.nearest(playerPos, 1, nearest);
+        if (nearest.empty()) return input;
+        target = nearest[0];
+    }
     
-    // Win message
-    glColor3f(1, 1, 0);
-    renderText(WINDOW_WIDTH/2 - 150, WINDOW_HEIGHT/2 + 50, "CONGRATULATIONS!", GLUT_BITMAP_TIMES_ROMAN_24);
-    glColor3f(1, 1, 1);
-    renderText(WINDOW_WIDTH/2 - 100, WINDOW_HEIGHT/2, "YOU WIN!");
-    renderText(WINDOW_WIDTH/2 - 120, WINDOW_HEIGHT/2 - 40, "Press R to restart");
+    // A new path for a new target, or after a restart moved the player
+    Vector3 goal = collectibles.transform.position(target);
+    if (pathTarget != target || distance(playerPos, lastPos) > PLAYER_SPEED * 2) {
+        found = pathFinder.findPath(playerPos, goal, path);
+        waypoint = 0;
+        pathTarget = target;
+    }
+    lastPos = playerPos;
+    while (waypoint + 1 < path.size() && fabsf(path[waypoint].x - playerPos.x) <= PLAYER_SPEED &&
+           fabsf(path[waypoint].z - playerPos.z) <= PLAYER_SPEED) {
+        waypoint++;
+    }
+    if (waypoint < path.size()) goal = path[waypoint];
     
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
+    // Without a path (A* gave up, or there is none) the flow field, where
+    // there is one, leads to whichever collectible is nearest on foot
+    int cell = navGrid.cellAt(playerPos.x, playerPos.z);
+    if (!found && collectibleField.ready() && collectibleField.sourceAt(cell) >= 0 &&
+        !collectibles.collected[collectibleField.sourceAt(cell)]) {
+        target = pathTarget = collectibleField.sourceAt(cell);
+        int next = collectibleField.next(cell);
+        goal = next >= 0 ? navGrid.center(next) : collectibles.transform.position(target);
+    }
+    const float deadZone = PLAYER_SPEED * 0.5f;
+    input.left = goal.x < playerPos.x - deadZone;
+    input.right = goal.x > playerPos.x + deadZone;
+    input.up = goal.z < playerPos.z - deadZone;
+    input.down = goal.z > playerPos.z + deadZone;
     
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
+    if (detourTarget != target) detour = 0;
+    bool pressed = last.up || last.down || last.left || last.right;
+    bool stuck = pressed && playerPos.x == prevPlayerPos.x && playerPos.z == prevPlayerPos.z;
+    if (stuck && detour == 1) {
+        positive = !positive; // blocked sideways too, try the other way round
+    } else if (stuck && findObstacle(last, obstacle)) {
+        detour = 1;
+        detourTarget = target;
+        alongX = last.up || last.down;
+        onward = alongX ? last.down : last.right;
+        positive = alongX ? goal.x > (obstacle.min.x + obstacle.max.x) * 0.5f
+                          : goal.z > (obstacle.min.z + obstacle.max.z) * 0.5f;
+    }
+    if (detour > 0) {
+        AABB me = playerBox(playerPos);
+        if (detour == 1 && (alongX ? me.max.x <= obstacle.min.x || me.min.x >= obstacle.max.x
+                                   : me.max.z <= obstacle.min.z || me.min.z >= obstacle.max.z)) {
+            detour = 2;
+        }
+        // Done once lined up with the target or past the obstacle
+        bool lined = alongX ? !(input.up || input.down) : !(input.left || input.right);
+        bool past = alongX ? (onward ? me.min.z >= obstacle.max.z : me.max.z <= obstacle.min.z)
+                           : (onward ? me.min.x >= obstacle.max.x : me.max.x <= obstacle.min.x);
+        if (detour == 2 && (lined || past)) detour = 0;
+    }
+    if (detour > 0) {
+        bool forward = detour == 1;
+        if (alongX) {
+            input.right = forward && positive;
+            input.left = forward && !positive;
+        } else {
+            input.down = forward && positive;
+            input.up = forward && !positive;
+        }
+    }
+    last = input;
+    return input;
 }
 
-void renderGameOverScreen() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glLoadIdentity();
-    
-    glDisable(GL_LIGHTING);
-    glColor3f(0.1f, 0, 0);
-    glBegin(GL_QUADS);
-    glVertex2f(-1, -1);
-    glVertex2f(1, -1);
-    glVertex2f(1, 1);
-    glVertex2f(-1, 1);
-    glEnd();
-    
-    glMatrixMode(GL_PROJECTION);
-    glPushMatrix();
-    glLoadIdentity();
-    gluOrtho2D(0, WINDOW_WIDTH, 0, WINDOW_HEIGHT);
+// Plays matches back to back on the autopilot for a fixed number of ticks
+// and reports simulation throughput. With rivals it plays the same ticks
+// again without them, so the crowd's share of the step shows and the
+// player's simulation alone compares with older runs. Returns the process
+// exit code.
+int runHeadless(long ticks) {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    subscribeEventListeners();
+    if (!recordPath.empty()) startRecording(recordPath);
+    rewindBuffer.enabled = false; // the autopilot never rewinds
+    initGame();
     
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
-    glLoadIdentity();
+    // When recording, the autopilot presses WASD and R like a player would
+    auto send = [](long step, InputEventType type, int key) {
+        InputEvent e = { type, key, 0, 0, 0 };
+        recorder.record(step, e);
+        applyInputEvent(e);
+    };
+    auto press = [&send](long step, char key, bool down) {
+        if (keys[(int)key] != down) send(step, down ? INPUT_KEY_DOWN : INPUT_KEY_UP, key);
+    };
     
-    glColor3f(1, 0, 0);
-    renderText(WINDOW_WIDTH/2 - 100, WINDOW_HEIGHT/2 + 50, "GAME OVER", GLUT_BITMAP_TIMES_ROMAN_24);
-    glColor3f(1, 1, 1);
-    renderText(WINDOW_WIDTH/2 - 80, WINDOW_HEIGHT/2, "Time's Up!");
-    renderText(WINDOW_WIDTH/2 - 120, WINDOW_HEIGHT/2 - 40, "Press R to restart");
-    renderText(WINDOW_WIDTH/2 - 100, WINDOW_HEIGHT/2 - 70, "Press ESC to exit");
+    // Seconds taken for the ticks
+    int wins = 0, losses = 0, rivalWins = 0;
+    auto play = [&]() {
+        auto start = std::chrono::steady_clock::now();
+        for (long t = 0; t < ticks; t++) {
+            SimInput input = autopilotInput();
+            if (recorder.active()) {
+                press(t, 'w', input.up);
+                press(t, 's', input.down);
+                press(t, 'a', input.left);
+                press(t, 'd', input.right);
+                input = sampleInput();
+            }
+            stepSimulation(input);
+            jobs.endFrame();
+            if (gameState != PLAYING) {
+                if (gameState == WIN) wins++;
+                else losses++;
+                if (gameState == GAME_OVER && gameTimeRemaining > 0) rivalWins++;
+                if (recorder.active()) {
+                    send(t + 1, INPUT_KEY_DOWN, 'r');
+                    send(t + 1, INPUT_KEY_UP, 'r');
+                } else {
+                    restartGame();
+                }
+            }
+        }
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
     
-    glPopMatrix();
-    glMatrixMode(GL_PROJECTION);
-    glPopMatrix();
-    glMatrixMode(GL_MODELVIEW);
+    double seconds = play();
+    double ticksPerSec = seconds > 0 ? ticks / seconds : 0;
+    std::cout << "=== Headless Simulation ===" << std::endl;
+    std::cout << "Ticks:        " << ticks << " (" << std::fixed << std::setprecision(2) << SIM_STEP_MS
+              << " ms each, " << std::setprecision(1) << ticks * SIM_STEP_MS / 1000.0 << " s simulated)" << std::endl;
+    std::cout << "Matches:      " << wins << " won, " << losses << " lost (" << rivalWins << " to a rival)" << std::endl;
+    std::cout << "Wall time:    " << std::setprecision(3) << seconds * 1000.0 << " ms" << std::endl;
+    std::cout << "Throughput:   " << std::setprecision(0) << ticksPerSec << " ticks/sec ("
+              << std::setprecision(1) << ticksPerSec / 1000.0 << " ticks/ms)" << std::endl;
+    std::cout << "Collision:    ";
+    printCollisionStats(collision.stats, collision.count());
+    std::cout << "Crowd:        ";
+    printCrowdStats(crowd.stats, crowd.agents.count());
+    std::cout << "Navigation:   ";
+    printNavStats(pathFinder.stats, collectibleField.stats);
+    finishRecording(ticks);
     
-    glEnable(GL_LIGHTING);
+    if (npcCount > 0) {
+        int rivals = npcCount;
+        npcCount = 0;
+        initGame();
+        wins = losses = 0;
+        double alone = play();
+        npcCount = rivals;
+        std::cout << "No rivals:    " << std::setprecision(0) << (alone > 0 ? ticks / alone : 0) << " ticks/sec ("
+                  << wins + losses << " matches); the " << rivals << " rivals cost " << std::setprecision(2)
+                  << (seconds - alone) * 1e6 / ticks << " us per tick" << std::endl;
+    }
+    return 0;
 }
 
-// ==================== GAME LOGIC ====================
-void initGame() {
-    srand(time(NULL));
-    system("killall afplay 2>/dev/null"); // Stop any previous music
-    system("afplay /System/Library/Sounds/Funk.aiff --loop &");
+// Replays a recording as fast as the simulation runs, without a window, and
+// reports the step times. Exits with 2 if the run diverged from the recording.
+int runReplay(const std::string& path) {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    subscribeEventListeners();
+    loadDefaultLevel();
+    if (!prepareReplay(path)) return 1;
+    initGame();
     
-    gameLogger.log("GAME", "===== GAME INITIALIZATION =====");
+    std::vector<float> stepUs;
+    stepUs.reserve(replay.steps);
+    auto start = std::chrono::steady_clock::now();
+    for (long t = 0; t < replay.steps; t++) {
+        replay.apply(t);
+        double t0 = nowMs();
+        stepSimulation(sampleInput());
+        jobs.endFrame();
+        stepUs.push_back((float)((nowMs() - t0) * 1000));
+    }
+    replay.apply(replay.steps);
+    auto end = std::chrono::steady_clock::now();
     
-    platforms.clear();
-    platforms.push_back(Platform(Vector3(-15, 0.5, -15), Vector3(5, 1, 5), Color(0.8f, 0.2f, 0.2f), 0));
-    platforms.push_back(Platform(Vector3(15, 0.5, -15), Vector3(5, 1, 5), Color(0.2f, 0.8f, 0.2f), 1));
-    platforms.push_back(Platform(Vector3(-15, 0.5, 15), Vector3(5, 1, 5), Color(0.2f, 0.2f, 0.8f), 2));
-    platforms.push_back(Platform(Vector3(15, 0.5, 15), Vector3(5, 1, 5), Color(0.8f, 0.8f, 0.2f), 3));
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::sort(stepUs.begin(), stepUs.end());
+    auto percentile = [&stepUs](float p) { return stepUs.empty() ? 0.0f : stepUs[(size_t)(p * (stepUs.size() - 1))]; };
+    std::cout << "=== Replay " << path << " ===" << std::endl;
+    std::cout << "Steps:        " << replay.steps << " (" << std::fixed << std::setprecision(1)
+              << replay.steps * SIM_STEP_MS / 1000.0 << " s of play), " << replay.eventCount() << " input events"
+              << std::endl;
+    std::cout << "Wall time:    " << std::setprecision(3) << seconds * 1000.0 << " ms ("
+              << std::setprecision(0) << (seconds > 0 ? replay.steps / seconds : 0) << " steps/sec)" << std::endl;
+    std::cout << "Step time:    p50 " << std::setprecision(2) << percentile(0.5f) << " us, p99 "
+              << percentile(0.99f) << " us, max " << percentile(1.0f) << " us" << std::endl;
+    return finishReplay(replay.steps) ? 0 : 2;
+}
+
+// ==================== SIMULATION THREAD ====================
+// In the windowed game the fixed steps run here instead of in the GLUT
+// callbacks. Input arrives through a lock-free queue, and after its steps
+// the thread publishes a RenderSnapshot, so a slow frame never delays a step
+// and a slow step never delays a frame.
+class SimulationThread {
+private:
+    std::thread thread;
+    std::atomic<bool> running;
+    SpscRing<InputEvent, 1024> input; // render thread -> simulation
+    SimStats stats;
+    double nextStepMs;
     
-    collectibles.clear();
+    void publish() {
+        double start = nowMs();
+        RenderSnapshot& snapshot = snapshots.back();
+        captureSnapshot(snapshot);
+        snapshot.tick = stats.steps;
+        snapshot.stepTimeMs = nextStepMs - SIM_STEP_MS;
+        stats.publishMs = (float)(nowMs() - start);
+        snapshot.stats = stats;
+        if (!snapshots.publish()) stats.unseen++;
+    }
     
-    // FIXED: Proper spacing using equilateral triangle vertices (guaranteed no overlap)
-    for (size_t i = 0; i < platforms.size(); i++) {
-        Platform& p = platforms[i];
-        float platformRadius = (p.size.x / 2.0f) * 0.7f; // Stay within platform
-        float collectY = p.position.y + p.size.y * 0.5f * 0.5f + 1.5f; // Higher above platform
-        
-        // Place 3 collectibles at vertices of equilateral triangle
-        float angleOffset = (M_PI / 3.0f) * i; // Different rotation per platform
-        
-        for (int j = 0; j < 3; j++) {
-            float angle = (2.0f * M_PI * j / 3.0f) + angleOffset;
-            float offsetX = cos(angle) * platformRadius;
-            float offsetZ = sin(angle) * platformRadius;
+    // Runs the steps that are due, publishes, and sleeps until the next one
+    void loop() {
+        jobs.attach(JobSystem::SIMULATION_CLIENT);
+        profileThisThread = false;
+        while (running.load()) {
+            // Live input is ignored while a replay runs
+            uint32_t first;
+            uint32_t events = input.readable(first);
+            for (uint32_t i = 0; i < events && !replaying; i++) {
+                const InputEvent& e = input.at(first + i);
+                recorder.record(stats.steps, e);
+                if (applyInputEvent(e)) nextStepMs = nowMs();
+            }
+            input.release(events);
+            
+            // After a long stall (e.g. a breakpoint) skip ahead instead of fast-forwarding
+            double now = nowMs();
+            if (now - nextStepMs > MAX_FRAME_MS) {
+                stats.droppedSteps += (long)((now - nextStepMs - MAX_FRAME_MS) / SIM_STEP_MS);
+                nextStepMs = now - MAX_FRAME_MS;
+            }
+            
+            int steps = 0;
+            SimInput controls = sampleInput();
+            while (nextStepMs <= now) {
+                if (replaying) {
+                    replay.apply(stats.steps);
+                    if (stats.steps >= replay.steps) finishReplay(stats.steps);
+                    controls = sampleInput();
+                }
+                float late = (float)(now - nextStepMs);
+                if (late > SIM_STEP_MS) stats.lateSteps++;
+                stats.worstLateMs = std::max(stats.worstLateMs, late);
+                stepSimulation(controls);
+                nextStepMs += SIM_STEP_MS;
+                stats.steps++;
+                steps++;
+            }
+            if (steps > 0 || events > 0) publish();
+            jobs.endFrame();
             
-            Vector3 pos(p.position.x + offsetX, collectY, p.position.z + offsetZ);
-            collectibles.push_back(Collectible(pos, i));
+            double wait = nextStepMs - nowMs();
+            if (wait > 0) std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(wait));
         }
     }
     
-    gameLogger.logCollectiblePositions(collectibles);
+public:
+    SnapshotBuffer snapshots;
     
-    gameState = PLAYING;
-    gameTimeRemaining = GAME_TIME;
-    playerPos = Vector3(0, 0.5, 0);
-    playerRotation = 0;
+    SimulationThread() : running(false), nextStepMs(0) {}
+    ~SimulationThread() { stop(); }
+    
+    // Publishes the current state, so the renderer has a snapshot straight away
+    void start() {
+        nextStepMs = nowMs();
+        publish();
+        running = true;
+        thread = std::thread(&SimulationThread::loop, this);
+    }
+    
+    void stop() {
+        running = false;
+        if (thread.joinable()) thread.join();
+    }
     
-    gameLogger.log("GAME", "Initialization complete");
+    // Render thread side. Events that don't fit are dropped (and counted).
+    void post(InputEventType type, int key, int state = 0, int x = 0, int y = 0) {
+        InputEvent e = { type, key, state, x, y };
+        input.push(e);
+    }
+    uint64_t droppedInput() const { return input.dropped.load(); }
+    long steps() const { return stats.steps; }
+};
+
+SimulationThread simulation;
+
+// Replaces the level with n collectibles at the default arena's density and
+// returns the half-extent of the area they cover
+float scatterCollectibles(int n, unsigned seed) {
+    float half = GROUND_SIZE * sqrt(n / 12.0f);
+    srand(seed);
+    collectibles.clear();
+    collectibles.reserve(n);
+    for (int i = 0; i < n; i++) {
+        float x = (rand() / (float)RAND_MAX * 2 - 1) * half;
+        float z = (rand() / (float)RAND_MAX * 2 - 1) * half;
+        collectibles.add(Vector3(x, 2.25f, z), 0);
+    }
+    collectibleGrid.build(collectibles, GRID_CELL_SIZE);
+    resetCounters();
+    return half;
 }
 
-void checkCollectibles() {
-    for (size_t i = 0; i < collectibles.size(); i++) {
-        auto& c = collectibles[i];
-        if (!c.collected) {
-            float dist = distance(playerPos, c.position);
-            
-            if (dist < COLLECTION_RADIUS) {
-                c.collected = true;
-                system("afplay /System/Library/Sounds/Pop.aiff &");
-                
-                std::stringstream ss;
-                ss << "Collectible #" << i << " picked up! Distance: " 
-                   << std::fixed << std::setprecision(2) << dist;
-                gameLogger.log("SUCCESS", ss.str());
-            } else if (dist < COLLECTION_RADIUS * 1.5f && debugMode) {
-                gameLogger.logCollectionAttempt(i, dist);
+// Times checkCollectibles() against the old full scan for growing levels.
+// Collectibles keep the same density as the default arena, so a level with
+// more items is also a larger one, like the real levels would be.
+int runPickupBenchmark() {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    const int sizes[] = { 12, 1000, 10000, 100000 };
+    const int QUERIES = 20000;
+    
+    std::cout << "=== Pickup Check Benchmark (" << QUERIES << " queries per size) ===" << std::endl;
+    std::cout << std::setw(12) << "collectibles" << std::setw(16) << "grid ns/check"
+              << std::setw(16) << "scan ns/check" << std::setw(16) << "simd ns/check"
+              << std::setw(10) << "pickups" << std::endl;
+    for (int n : sizes) {
+        float half = scatterCollectibles(n, 1234);
+        
+        std::vector<Vector3> probes;
+        for (int q = 0; q < QUERIES; q++) {
+            float x = (rand() / (float)RAND_MAX * 2 - 1) * half;
+            float z = (rand() / (float)RAND_MAX * 2 - 1) * half;
+            probes.push_back(Vector3(x, 0.5f, z));
+        }
+        
+        // Full scan as checkCollectibles() used to do it
+        volatile int scanHits = 0;
+        double t0 = nowMs();
+        for (const Vector3& probe : probes) {
+            for (int i = 0; i < n; i++) {
+                if (!collectibles.collected[i] &&
+                    distance(probe, collectibles.transform.position(i)) < COLLECTION_RADIUS) scanHits++;
             }
         }
-    }
-    
-    // Check platform completion
-    for (size_t i = 0; i < platforms.size(); i++) {
-        bool allCollected = true;
-        int collectedCount = 0;
-        for (const auto& c : collectibles) {
-            if (c.platform == (int)i) {
-                if (c.collected) collectedCount++;
-                else allCollected = false;
+        double scanMs = nowMs() - t0;
+        
+        // The same scan through the batch kernel, straight over the table
+        const CollectibleTable& items = collectibles;
+        std::vector<uint64_t> masks(std::max(proximityMaskWords(n), 1));
+        volatile int simdHits = 0;
+        t0 = nowMs();
+        for (const Vector3& probe : probes) {
+            ProximityQuery query(probe, COLLECTION_RADIUS);
+            proximity.test(items.transform.x.data(), items.transform.y.data(), items.transform.z.data(),
+                           n, &query, 1, masks.data());
+            for (int w = 0; w < proximityMaskWords(n); w++) {
+                for (uint64_t bits = masks[w]; bits; bits &= bits - 1) {
+                    if (!items.collected[w * 64 + __builtin_ctzll(bits)]) simdHits++;
+                }
             }
         }
+        double simdMs = nowMs() - t0;
         
-        if (!platforms[i].allCollected && allCollected) {
-            platforms[i].allCollected = true;
-            platforms[i].animationActive = true;
-            
-            std::stringstream ss;
-            ss << "Platform " << (i+1) << " completed! (" << collectedCount << "/3 items)";
-            gameLogger.log("PLATFORM", ss.str());
-            std::cout << "Platform " << (i+1) << " completed. Animation auto-enabled." << std::endl;
+        size_t before = collectibleGrid.size();
+        t0 = nowMs();
+        for (const Vector3& probe : probes) {
+            playerPos = probe;
+            checkCollectibles();
         }
+        double gridMs = nowMs() - t0;
+        
+        std::cout << std::setw(12) << n << std::fixed << std::setprecision(1)
+                  << std::setw(16) << gridMs * 1e6 / QUERIES
+                  << std::setw(16) << scanMs * 1e6 / QUERIES
+                  << std::setw(16) << simdMs * 1e6 / QUERIES
+                  << std::setw(10) << (before - collectibleGrid.size()) << std::endl;
+    }
+    return 0;
+}
+
+// Game-thread cost of a log call. Calls are timed in bursts smaller than a
+// ring, with the writer catching up in between, so none are dropped.
+template <typename Fn>
+double timeLogCalls(GameLogger& logger, int calls, Fn fn) {
+    const int BURST = 2048;
+    double total = 0;
+    for (int done = 0; done < calls; done += BURST) {
+        double t0 = nowMs();
+        for (int i = done; i < done + BURST; i++) fn(i);
+        total += nowMs() - t0;
+        logger.flush();
+    }
+    return total * 1e6 / calls;
+}
+
+int runLoggerBenchmark() {
+    const int CALLS = 200000;
+    std::cout << "=== Logger Benchmark (" << CALLS << " calls each, game thread ns/call) ===" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    
+    {
+        GameLogger logger("logger_bench.log");
+        logger.setConsoleEcho(false);
+        logger.setLevel(LOG_INFO);
+        Vector3 p(1.5f, 0.5f, -3.25f);
+        
+        double filtered = timeLogCalls(logger, CALLS, [&](int i) {
+            logger.log(LOG_DEBUG, LOG_PLAYER, "Player at (%.2f, %.2f, %.2f)", p.x + i, p.y, p.z);
+        });
+        double numbers = timeLogCalls(logger, CALLS, [&](int i) {
+            logger.log(LOG_INFO, LOG_PLAYER, "Player at (%.2f, %.2f, %.2f)", p.x + i, p.y, p.z);
+        });
+        double text = timeLogCalls(logger, CALLS, [&](int i) {
+            logger.log(LOG_INFO, LOG_RENDER, "Pass %d: %s", i, "instanced collectibles, 3 parts");
+        });
+        std::cout << "Filtered out (below level):        " << std::setw(8) << filtered << std::endl;
+        std::cout << "Queued, 3 floats:                  " << std::setw(8) << numbers << std::endl;
+        std::cout << "Queued, int + string:              " << std::setw(8) << text << std::endl;
+        std::cout << "Dropped records:                   " << std::setw(8) << logger.dropped() << std::endl;
     }
     
-    // Check win condition
-    bool allComplete = true;
-    for (const auto& p : platforms) {
-        if (!p.allCollected) {
-            allComplete = false;
-            break;
+    // The same message formatted, written and flushed on the calling thread,
+    // as GameLogger did before (without the console echo)
+    {
+        std::ofstream file("logger_bench.log", std::ios::out | std::ios::trunc);
+        double t0 = nowMs();
+        for (int i = 0; i < CALLS; i++) {
+            std::stringstream ss;
+            ss << "Player at (" << std::fixed << std::setprecision(2) << 1.5f + i << ", " << 0.5f << ", " << -3.25f << ")";
+            file << "[PLAYER] " << ss.str() << std::endl;
+            file.flush();
         }
+        std::cout << "Synchronous stream + flush:        " << std::setw(8) << (nowMs() - t0) * 1e6 / CALLS << std::endl;
     }
-    if (allComplete && gameState == PLAYING) {
-        gameState = WIN;
-        system("afplay /System/Library/Sounds/Glass.aiff &");
-        gameLogger.log("GAME", "PLAYER WON!");
-        std::cout << "YOU WIN!" << std::endl;
+    
+    // Writer thread throughput, text against binary records
+    for (int binary = 0; binary < 2; binary++) {
+        GameLogger logger("logger_bench.log");
+        logger.setConsoleEcho(false);
+        logger.setBinary(binary == 1);
+        double t0 = nowMs();
+        timeLogCalls(logger, CALLS, [&](int i) {
+            logger.log(LOG_INFO, LOG_SUCCESS, "Collectible #%d picked up! Distance: %.2f", i, 1.25f);
+        });
+        double ms = nowMs() - t0;
+        std::cout << (binary ? "Writer, binary records:           " : "Writer, text records:             ")
+                  << std::setw(8) << CALLS / ms / 1000.0 << " M records/s" << std::endl;
     }
+    std::remove("logger_bench.log");
+    return 0;
 }
 
-bool checkCollision(Vector3 newPos) {
-    if (newPos.x < -GROUND_SIZE + 1 || newPos.x > GROUND_SIZE - 1) return true;
-    if (newPos.z < -GROUND_SIZE + 1 || newPos.z > GROUND_SIZE - 1) return true;
-    return false;
+// Mixer on the null backend: cost of a play() on the game thread, the delay
+// until the mixer starts the voice, and mixing cost with every voice busy
+int runAudioBenchmark() {
+    const int COMMANDS = 400;
+    gameLogger.setEnabled(false);
+    audio.loadSamples();
+    if (!audio.start(new NullAudioBackend())) return 1;
+    
+    std::cout << "=== Audio Mixer Benchmark (null backend, " << AUDIO_RATE << " Hz, "
+              << AUDIO_BLOCK_FRAMES << "-frame blocks) ===" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    
+    // Pickup-like one-shots at irregular intervals
+    srand(1234);
+    double pushMs = 0;
+    for (int i = 0; i < COMMANDS; i++) {
+        std::this_thread::sleep_for(std::chrono::microseconds(1000 + rand() % 9000));
+        double t0 = nowMs();
+        audio.play((SoundId)(i % SOUND_MUSIC));
+        pushMs += nowMs() - t0;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    
+    // Every voice busy with a looping sound
+    const double LOADED_SECONDS = 1.0;
+    for (int i = 0; i < 64; i++) audio.play(SOUND_MUSIC, true, 0.05f);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    AudioMixer::Stats before = audio.stats();
+    int voices = audio.activeVoices();
+    std::this_thread::sleep_for(std::chrono::milliseconds((long)(LOADED_SECONDS * 1000)));
+    AudioMixer::Stats after = audio.stats();
+    long loadedBlocks = after.blocks - before.blocks;
+    double loadedMixMs = after.mixMs - before.mixMs;
+    
+    int outputFrames = audio.outputLatencyFrames();
+    uint64_t dropped = audio.droppedCommands();
+    audio.shutdown();
+    AudioMixer::Stats st = audio.stats();
+    double blockMs = 1000.0 * AUDIO_BLOCK_FRAMES / AUDIO_RATE;
+    
+    std::cout << "play() on the game thread:     " << std::setw(8) << pushMs * 1e6 / COMMANDS << " ns" << std::endl;
+    std::cout << std::setprecision(2);
+    std::cout << "Command -> voice started:      " << std::setw(8) << st.latencySumMs / std::max(1L, st.commands)
+              << " ms avg, " << st.latencyMaxMs << " ms max (" << st.commands << " commands)" << std::endl;
+    std::cout << "Output buffering:              " << std::setw(8) << 1000.0 * outputFrames / AUDIO_RATE << " ms" << std::endl;
+    std::cout << "Mix cost, " << std::setw(2) << voices << " voices:          " << std::setw(8)
+              << loadedMixMs * 1000.0 / std::max(1L, loadedBlocks) << " us/block ("
+              << std::setprecision(1) << 100.0 * loadedMixMs / std::max(1L, loadedBlocks) / blockMs
+              << "% of real time)" << std::endl;
+    std::cout << "Blocks mixed / underruns:      " << std::setw(8) << st.blocks << " / " << st.underruns << std::endl;
+    std::cout << "Dropped commands:              " << std::setw(8) << dropped << std::endl;
+    return 0;
 }
 
 // ==================== OPENGL CALLBACKS ====================
-void display() {
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    glLoadIdentity();
+// Frame-time summary printed every couple of seconds in stress runs
+struct FrameTimeReport {
+    double windowStart, lastFrame;
+    double total, best, worst;
+    int frames;
     
-    if (gameState == GAME_OVER) {
-        renderGameOverScreen();
-        glutSwapBuffers();
-        return;
+    FrameTimeReport() : windowStart(0), lastFrame(0) { reset(); }
+    void reset() { total = 0; best = 1e9; worst = 0; frames = 0; }
+    
+    void frame(double now) {
+        if (lastFrame > 0) {
+            double ms = now - lastFrame;
+            total += ms;
+            best = std::min(best, ms);
+            worst = std::max(worst, ms);
+            frames++;
+        } else {
+            windowStart = now;
+        }
+        lastFrame = now;
+        
+        if (now - windowStart >= 2000.0 && frames > 0) {
+            double avg = total / frames;
+            std::cout << std::fixed << std::setprecision(2)
+                      << "[FRAME] " << frames << " frames | avg " << avg << " ms ("
+                      << std::setprecision(1) << 1000.0 / avg << " fps) | min "
+                      << std::setprecision(2) << best << " | max " << worst
+                      << " | collectibles " << (scene->total - scene->collected)
+                      << " | draws " << renderStats.drawCalls
+                      << " | culled " << renderStats.objectsCulled << std::endl;
+            reset();
+            windowStart = now;
+        }
     }
+};
+
+FrameTimeReport frameReport;
+
+int sceneLevelVersion = -1;
+int sceneChunkVersion = -1;
+int sceneCollected = -1;
+
+// Takes the newest snapshot, if any, and sets renderAlpha from how long ago
+// its last step was due. Rebuilds what depends on the level or the pickups.
+void acquireScene() {
+    bool fresh = simulation.snapshots.acquire();
+    scene = &simulation.snapshots.front();
+    double age = nowMs() - scene->stepTimeMs;
+    renderStalls.frame(fresh, (float)age);
+    renderAlpha = (float)std::max(0.0, std::min(age / SIM_STEP_MS, 1.0));
     
-    // Set camera
+    if (scene->levelVersion != sceneLevelVersion) {
+        sceneLevelVersion = scene->levelVersion;
+        sceneCollected = -1;
+    }
+    if (scene->chunkVersion != sceneChunkVersion) {
+        sceneChunkVersion = scene->chunkVersion;
+        sceneCollected = -1;
+    }
+    if (useMeshCache) staticWorld.sync(scene->chunks, scene->chunkVersion);
+    if (scene->collected + scene->rivalCollected != sceneCollected) {
+        collectibleRenderer.markDirty();
+        sceneCollected = scene->collected + scene->rivalCollected;
+    }
+}
+
+void printStallStats() {
+    const SimStats& sim = scene ? scene->stats : SimStats();
+    std::cout << "Simulation: " << sim.steps << " steps, " << sim.lateSteps << " late (worst "
+              << std::fixed << std::setprecision(1) << sim.worstLateMs << " ms), " << sim.droppedSteps
+              << " dropped, " << sim.unseen << " snapshots never drawn" << std::endl;
+    std::cout << "Rendering:  " << renderStalls.frames << " frames, " << renderStalls.staleFrames
+              << " without a new snapshot, snapshot age avg "
+              << renderStalls.ageSumMs / std::max(1L, renderStalls.frames) << " ms / worst "
+              << renderStalls.worstAgeMs << " ms" << std::endl;
+    const StreamStats& stream = scene ? scene->stream : StreamStats();
+    std::cout << "Streaming:  " << stream.loads << " chunk loads, " << stream.evictions << " evictions, latency avg "
+              << stream.latencySumMs / std::max(1L, stream.loads) << " ms / worst " << stream.worstLatencyMs
+              << " ms, peak " << stream.peakBytes / 1048576.0 << " of " << stream.budgetBytes / 1048576.0
+              << " MB, " << stream.stepsUnloaded << " steps on unloaded chunks" << std::endl;
+    std::cout << "Collision:  ";
+    printCollisionStats(scene ? scene->collision : CollisionStats(), scene ? scene->colliders : 0);
+    std::cout << "Crowd:      ";
+    printCrowdStats(scene ? scene->crowd : CrowdStats(), scene ? scene->rivals.count() : 0);
+    std::cout << "Navigation: ";
+    printNavStats(scene ? scene->paths : NavStats(), scene ? scene->field : NavStats());
+}
+
+// Blends the snapshot's last two simulation states by renderAlpha for drawing
+void interpolateRenderState() {
+    renderPlayerPos = lerp(scene->prevPlayerPos, scene->playerPos, renderAlpha);
+    renderGlobalRotation = lerpWrapped(scene->prevGlobalRotation, scene->globalRotation, renderAlpha);
+    PlatformTable& table = scene->platforms;
+    for (int i = 0; i < table.count(); i++) {
+        table.renderAnimationValue[i] = lerpWrapped(table.prevAnimationValue[i], table.animationValue[i], renderAlpha);
+    }
+}
+
+void applyCamera() {
+    PROFILE_SCOPE("camera");
+    int cameraMode = scene->cameraMode;
+    float cameraAngleX = scene->cameraAngleX, cameraAngleY = scene->cameraAngleY;
+    float cameraDistance = scene->cameraDistance;
     if (cameraMode == 1) { // Top view
-        gluLookAt(playerPos.x, 40, playerPos.z, 
-                 playerPos.x, 0, playerPos.z, 
+        gluLookAt(renderPlayerPos.x, 40, renderPlayerPos.z, 
+                 renderPlayerPos.x, 0, renderPlayerPos.z, 
                  0, 0, -1);
     } else if (cameraMode == 2) { // Side view
-        gluLookAt(40, 10, playerPos.z, 
-                 0, 10, playerPos.z, 
+        gluLookAt(40, 10, renderPlayerPos.z, 
+                 0, 10, renderPlayerPos.z, 
                  0, 1, 0);
     } else if (cameraMode == 3) { // Front view
-        gluLookAt(playerPos.x, 10, 40, 
-                 playerPos.x, 10, 0, 
+        gluLookAt(renderPlayerPos.x, 10, 40, 
+                 renderPlayerPos.x, 10, 0, 
                  0, 1, 0);
     } else { // Free camera
         float camX = cameraDistance * sin(cameraAngleY * M_PI / 180.0) * cos(cameraAngleX * M_PI / 180.0);
         float camY = cameraDistance * sin(cameraAngleX * M_PI / 180.0);
         float camZ = cameraDistance * cos(cameraAngleY * M_PI / 180.0) * cos(cameraAngleX * M_PI / 180.0);
-        gluLookAt(playerPos.x + camX, playerPos.y + camY, playerPos.z + camZ,
-                 playerPos.x, playerPos.y, playerPos.z,
+        gluLookAt(renderPlayerPos.x + camX, renderPlayerPos.y + camY, renderPlayerPos.z + camZ,
+                 renderPlayerPos.x, renderPlayerPos.y, renderPlayerPos.z,
                  0, 1, 0);
     }
+    visibility.setCamera();
+}
+
+// Presents the frame and closes it in the profiler
+void swapBuffers() {
+    {
+        PROFILE_SCOPE("glutSwapBuffers");
+        glutSwapBuffers();
+    }
+    if (stressCollectibleCount > 0) frameReport.frame(nowMs());
+    profiler.endFrame(renderStats.drawCalls);
+    jobs.endFrame();
+}
+
+void display() {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glLoadIdentity();
+    acquireScene();
+    interpolateRenderState();
+    renderStats.reset();
+    glState.resetCounters();
+    
+    if (scene->gameState == GAME_OVER) {
+        renderGameOverScreen();
+        swapBuffers();
+        return;
+    }
+    
+    // Set camera
+    applyCamera();
+    if (useInstancing) collectibleRenderer.prepare();
     
     // Draw scene
-    drawGround();
-    drawWalls();
+    if (useShaderLighting) glState.useProgram(litShader.program);
+    if (useMeshCache) {
+        staticWorld.draw(scene->chunks); // ground, walls and platform bases
+    } else {
+        drawGround();
+        drawWalls();
+        for (const ChunkRef& chunk : scene->chunks) {
+            for (int i : chunk->platforms) drawPlatform(i);
+        }
+    }
     drawPlayer();
+    drawRivals();
+    
+    // Draw platform objects
+    for (const ChunkRef& chunk : scene->chunks) {
+        for (int i : chunk->platforms) drawPlatformObject(i);
+    }
+    
+    // Draw collectibles
+    if (useInstancing && collectibleRenderer.available()) {
+        collectibleRenderer.draw(renderGlobalRotation * 2);
+    } else {
+        const CollectibleTable& items = scene->collectibles;
+        for (const ChunkRef& chunk : scene->chunks) {
+            for (int i : chunk->collectibles) {
+                if (!items.collected[i]) drawCollectible(items.transform.position(i));
+            }
+        }
+    }
+    
+    glState.useProgram(0);
+    
+    // DEBUG VISUALIZATION
+    if (scene->debugMode) {
+        PROFILE_SCOPE("debug draw");
+        Vector3 playerPos = scene->playerPos;
+        
+        // Show collection radius around player
+        drawDebugSphere(playerPos, COLLECTION_RADIUS, Color(0, 1, 0));
+        
+        // Draw lines to nearby collectibles. The grid belongs to the
+        // simulation, so the snapshot's positions go through the batch kernel.
+        const CollectibleTable& items = scene->collectibles;
+        ProximityQuery queries[2] = { ProximityQuery(playerPos, 5.0f), ProximityQuery(playerPos, COLLECTION_RADIUS) };
+        static std::vector<uint64_t> masks;
+        int words = proximityMaskWords(items.count());
+        masks.resize(std::max(2 * words, 1));
+        proximity.test(items.transform.x.data(), items.transform.y.data(), items.transform.z.data(),
+                       items.count(), queries, 2, masks.data());
+        for (int i = 0; i < items.count(); i++) {
+            if (items.collected[i] || !((masks[i >> 6] >> (i & 63)) & 1)) continue;
+            Vector3 position = items.transform.position(i);
+            bool inReach = (masks[words + (i >> 6)] >> (i & 63)) & 1;
+            Color lineColor = inReach ? Color(0, 1, 0) : Color(1, 1, 0);
+            drawDebugLine(playerPos, position, lineColor);
+            
+            // Draw sphere around each collectible
+            drawDebugSphere(position, 0.5f, Color(1, 0.5f, 0));
+        }
+    }
+    
+    // Draw HUD
+    renderHUD();
+    
+    // Draw win screen overlay
+    if (scene->gameState == WIN) {
+        renderWinScreen();
+    }
+    
+    // Profiler overlay
+    if (showProfiler) {
+        renderProfilerOverlay();
+    }
+    
+    swapBuffers();
+}
+
+void reshape(int w, int h) {
+    glViewport(0, 0, w, h);
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(45.0, (double)w / (double)h, 0.1, 200.0);
+    glMatrixMode(GL_MODELVIEW);
+}
+
+// The simulation paces itself; these only schedule frames
+void update(int value) {
+    glutPostRedisplay();
+    glutTimerFunc(16, update, 0);
+}
+
+// Uncapped / vsynced pacing: render as fast as swaps allow
+void idle() {
+    glutPostRedisplay();
+}
+
+void setSwapInterval(int interval) {
+#ifdef __APPLE__
+    GLint value = interval;
+    CGLSetParameter(CGLGetCurrentContext(), kCGLCPSwapInterval, &value);
+#else
+    typedef int (*SwapIntervalProc)(int);
+    SwapIntervalProc swapInterval = (SwapIntervalProc)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalMESA");
+    if (!swapInterval) swapInterval = (SwapIntervalProc)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalSGI");
+    if (swapInterval) swapInterval(interval);
+#endif
+}
+
+// Input callbacks run on the render thread. The renderer's own toggles are
+// applied here; every event also goes to the simulation, which owns the
+// game, camera and key state.
+void keyboard(unsigned char key, int x, int y) {
+    if (key == 27) { // ESC
+        simulation.stop();
+        streamer.stop();
+        finishRecording(simulation.steps());
+        printStallStats();
+        exit(0);
+    }
+    
+    // Frame profiler overlay and trace export
+    if (key == 'p' || key == 'P') {
+        showProfiler = !showProfiler;
+        profilerTextTime = 0;
+        std::cout << "Profiler overlay " << (showProfiler ? "ON" : "OFF") << std::endl;
+    }
+    if (key == 't' || key == 'T') {
+        if (profiler.exportChromeTrace("frame_trace.json")) {
+            std::cout << "Wrote the last " << profiler.frameCount() << " frames to frame_trace.json" << std::endl;
+        } else {
+            std::cout << "Could not write frame_trace.json" << std::endl;
+        }
+    }
+    
+    // Instanced collectibles toggle
+    if (key == 'i' || key == 'I') {
+        useInstancing = !useInstancing;
+        std::cout << "Instanced collectibles " << (useInstancing ? "ON" : "OFF") << std::endl;
+    }
+    
+    // Shader / fixed-function lighting toggle
+    if ((key == 'l' || key == 'L') && litShader.program) {
+        useShaderLighting = !useShaderLighting;
+        std::cout << "Shader lighting " << (useShaderLighting ? "ON" : "OFF") << std::endl;
+    }
+    
+    // Frustum culling / level of detail toggle
+    if (key == 'f' || key == 'F') {
+        visibility.enabled = !visibility.enabled;
+        std::cout << "Culling and LOD " << (visibility.enabled ? "ON" : "OFF") << std::endl;
+    }
+    
+    // Mesh cache toggle
+    if (key == 'm' || key == 'M') {
+        useMeshCache = !useMeshCache;
+        std::cout << "Mesh cache " << (useMeshCache ? "ON" : "OFF") << std::endl;
+    }
+    
+    simulation.post(INPUT_KEY_DOWN, key);
+}
+
+void keyboardUp(unsigned char key, int x, int y) {
+    simulation.post(INPUT_KEY_UP, key);
+}
+
+void specialKeysCallback(int key, int x, int y) {
+    simulation.post(INPUT_SPECIAL_DOWN, key);
+}
+
+void specialKeysUpCallback(int key, int x, int y) {
+    simulation.post(INPUT_SPECIAL_UP, key);
+}
+
+void mouse(int button, int state, int x, int y) {
+    simulation.post(INPUT_MOUSE_BUTTON, button, state, x, y);
+}
+
+void mouseMotion(int x, int y) {
+    simulation.post(INPUT_MOUSE_MOVE, 0, 0, x, y);
+}
+
+// Without text the GL can be set up without GLUT, which the glyph atlas
+// needs (see benchDrawing)
+void initGL(bool withText = true) {
+    glClearColor(0.1f, 0.1f, 0.15f, 1.0f);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_COLOR_MATERIAL);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+    
+    // Setup lighting
+    GLfloat lightPos[] = { 0.0f, 30.0f, 0.0f, 1.0f };
+    GLfloat lightAmbient[] = { 0.3f, 0.3f, 0.3f, 1.0f };
+    GLfloat lightDiffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
+    GLfloat lightSpecular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    
+    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
+    glLightfv(GL_LIGHT0, GL_AMBIENT, lightAmbient);
+    glLightfv(GL_LIGHT0, GL_DIFFUSE, lightDiffuse);
+    glLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular);
+    
+    glShadeModel(GL_SMOOTH);
+    glEnable(GL_NORMALIZE);
+    
+    glState.invalidate();
+    if (useShaderLighting && !litShader.init()) {
+        gameLogger.log(LOG_WARN, LOG_RENDER, "Lit shader unavailable, using fixed-function lighting");
+        useShaderLighting = false;
+    }
+    meshCache.init();
+    collectibleRenderer.init();
+    if (withText && !glyphAtlas.init()) {
+        gameLogger.log(LOG_WARN, LOG_RENDER, "Glyph atlas unavailable, drawing text with glutBitmapCharacter");
+    }
+}
+
+// ==================== BENCHMARK SUITE ====================
+// --bench times the simulation and drawing hot paths, optionally writes the
+// results as JSON and compares them with an earlier run. Drawing runs in an
+// offscreen software GL context so the numbers don't depend on a window,
+// the compositor or the GPU.
+class OffscreenContext {
+private:
+#ifdef __APPLE__
+    CGLContextObj context;
+    GLuint framebuffer, renderbuffers[2];
+#else
+    EGLDisplay display;
+    EGLSurface surface;
+    EGLContext context;
+#endif
+    
+public:
+#ifdef __APPLE__
+    OffscreenContext() : context(NULL), framebuffer(0) {}
+#else
+    OffscreenContext() : display(EGL_NO_DISPLAY), surface(EGL_NO_SURFACE), context(EGL_NO_CONTEXT) {}
+#endif
+    ~OffscreenContext() { destroy(); }
+    
+    bool create(int width, int height) {
+#ifdef __APPLE__
+        // Apple's software renderer, drawing into a framebuffer object
+        CGLPixelFormatAttribute attributes[] = {
+            kCGLPFARendererID, (CGLPixelFormatAttribute)kCGLRendererGenericFloatID,
+            kCGLPFAColorSize, (CGLPixelFormatAttribute)24,
+            kCGLPFADepthSize, (CGLPixelFormatAttribute)24,
+            (CGLPixelFormatAttribute)0
+        };
+        CGLPixelFormatObj format;
+        GLint formats = 0;
+        if (CGLChoosePixelFormat(attributes, &format, &formats) != kCGLNoError || !format) return false;
+        CGLError error = CGLCreateContext(format, NULL, &context);
+        CGLDestroyPixelFormat(format);
+        if (error != kCGLNoError || CGLSetCurrentContext(context) != kCGLNoError) return false;
+        
+        glGenFramebuffersEXT(1, &framebuffer);
+        glGenRenderbuffersEXT(2, renderbuffers);
+        glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, framebuffer);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffers[0]);
+        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_RGBA8, width, height);
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_COLOR_ATTACHMENT0_EXT, GL_RENDERBUFFER_EXT, renderbuffers[0]);
+        glBindRenderbufferEXT(GL_RENDERBUFFER_EXT, renderbuffers[1]);
+        glRenderbufferStorageEXT(GL_RENDERBUFFER_EXT, GL_DEPTH_COMPONENT24, width, height);
+        glFramebufferRenderbufferEXT(GL_FRAMEBUFFER_EXT, GL_DEPTH_ATTACHMENT_EXT, GL_RENDERBUFFER_EXT, renderbuffers[1]);
+        return glCheckFramebufferStatusEXT(GL_FRAMEBUFFER_EXT) == GL_FRAMEBUFFER_COMPLETE_EXT;
+#else
+        // Mesa's llvmpipe without a window system; a pbuffer stands in for the window
+        setenv("EGL_PLATFORM", "surfaceless", 0);
+        setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) return false;
+        EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_DEPTH_SIZE, 24, EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configs = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configs) || configs == 0) return false;
+        if (!eglBindAPI(EGL_OPENGL_API)) return false;
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+        EGLint surfaceAttributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+        surface = eglCreatePbufferSurface(display, config, surfaceAttributes);
+        if (context == EGL_NO_CONTEXT || surface == EGL_NO_SURFACE) return false;
+        return eglMakeCurrent(display, surface, surface, context);
+#endif
+    }
+    
+    void destroy() {
+#ifdef __APPLE__
+        if (!context) return;
+        glDeleteFramebuffersEXT(1, &framebuffer);
+        glDeleteRenderbuffersEXT(2, renderbuffers);
+        CGLSetCurrentContext(NULL);
+        CGLDestroyContext(context);
+        context = NULL;
+#else
+        if (display == EGL_NO_DISPLAY) return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (surface != EGL_NO_SURFACE) eglDestroySurface(display, surface);
+        if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+        surface = EGL_NO_SURFACE;
+        context = EGL_NO_CONTEXT;
+#endif
+    }
+};
+
+struct BenchResult {
+    std::string name;
+    const char* unit;
+    long iterations;    // per repeat
+    double median, best;
+};
+
+struct BenchOptions {
+    std::string jsonPath;
+    std::string baselinePath;
+    double threshold;   // a slower median than baseline * (1 + threshold) is a regression
+    
+    BenchOptions() : threshold(0.10) {}
+};
+
+const int BENCH_REPEATS = 7;
+volatile float benchSink; // keeps results of otherwise unused calls alive
+
+// Times BENCH_REPEATS batches of `iterations` calls of fn(i) after one warm-up
+// batch. Each batch may run setup() first, outside the timing.
+template <typename Fn, typename Setup>
+BenchResult measure(const std::string& name, const char* unit, long iterations, Fn fn, Setup setup) {
+    double scale = strcmp(unit, "us") == 0 ? 1e3 : 1e6;  // ms per batch to unit per call
+    std::vector<double> times;
+    for (int r = 0; r <= BENCH_REPEATS; r++) {
+        setup();
+        double t0 = nowMs();
+        for (long i = 0; i < iterations; i++) fn(i);
+        double elapsed = nowMs() - t0;
+        if (r > 0) times.push_back(elapsed * scale / iterations);
+    }
+    std::sort(times.begin(), times.end());
+    BenchResult result;
+    result.name = name;
+    result.unit = unit;
+    result.iterations = iterations;
+    result.median = times[times.size() / 2];
+    result.best = times[0];
+    return result;
+}
+
+template <typename Fn>
+BenchResult measure(const std::string& name, const char* unit, long iterations, Fn fn) {
+    return measure(name, unit, iterations, fn, [] {});
+}
+
+void benchSimulation(std::vector<BenchResult>& results) {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
     
-    // Draw platforms
-    for (auto& platform : platforms) {
-        drawPlatform(platform);
+    // distance() over a table of point pairs that stays in L1
+    const int PAIRS = 1024;
+    std::vector<Vector3> points;
+    srand(1234);
+    for (int i = 0; i < PAIRS * 2; i++) {
+        points.push_back(Vector3(rand() % 100 - 50.0f, rand() % 10 - 5.0f, rand() % 100 - 50.0f));
     }
+    results.push_back(measure("distance", "ns", 2000000, [&](long i) {
+        int k = (int)(i & (PAIRS - 1)) * 2;
+        benchSink = benchSink + distance(points[k], points[k + 1]);
+    }));
     
-    // Draw platform objects
-    drawLantern(platforms[0]);
-    drawPagoda(platforms[1]);
-    drawStatue(platforms[2]);
-    drawWeaponRack(platforms[3]);
+    // movePlayer() walking the arena in a new random direction every 64
+    // steps, into the walls, onto the platforms and against the props
+    PlatformTable arena;
+    CollectibleTable arenaItems;
+    LevelInfo arenaInfo;
+    std::string error;
+    parseLevel(DEFAULT_LEVEL, "built-in arena", arena, arenaItems, arenaInfo, error);
+    buildColliders(arena, arenaInfo.worldHalfSize);
+    std::vector<Vector3> steps;
+    for (int i = 0; i < PAIRS; i++) {
+        float angle = rand() / (float)RAND_MAX * 2 * M_PI;
+        steps.push_back(Vector3(cos(angle) * PLAYER_SPEED, 0, sin(angle) * PLAYER_SPEED));
+    }
+    Vector3 walker(0, PLAYER_FOOT_OFFSET, 0);
+    results.push_back(measure("movePlayer", "ns", 1000000, [&](long i) {
+        walker = movePlayer(walker, steps[(i >> 6) & (PAIRS - 1)]);
+        benchSink = benchSink + walker.x;
+    }));
     
-    // Draw collectibles
-    for (const auto& c : collectibles) {
-        if (!c.collected) {
-            drawCollectible(c.position);
+    // checkCollectibles() from random player positions; the level is rebuilt
+    // before each batch so every batch picks up the same items
+    const int sizes[] = { 12, 1000, 100000 };
+    for (int n : sizes) {
+        float half = GROUND_SIZE * sqrt(n / 12.0f);
+        std::vector<Vector3> positions;
+        srand(4321);
+        for (int i = 0; i < 4096; i++) {
+            float x = (rand() / (float)RAND_MAX * 2 - 1) * half;
+            float z = (rand() / (float)RAND_MAX * 2 - 1) * half;
+            positions.push_back(Vector3(x, 0.5f, z));
         }
+        results.push_back(measure("checkCollectibles/" + std::to_string(n), "ns", 20000, [&](long i) {
+            playerPos = positions[i & 4095];
+            checkCollectibles();
+        }, [&] { scatterCollectibles(n, 1234); }));
     }
     
-    // DEBUG VISUALIZATION
-    if (debugMode) {
-        // Show collection radius around player
-        drawDebugSphere(playerPos, COLLECTION_RADIUS, Color(0, 1, 0));
-        
-        // Draw lines to nearby collectibles
-        for (const auto& c : collectibles) {
-            if (!c.collected) {
-                float dist = distance(playerPos, c.position);
-                if (dist < 5.0f) {
-                    Color lineColor = dist < COLLECTION_RADIUS ? Color(0, 1, 0) : Color(1, 1, 0);
-                    drawDebugLine(playerPos, c.position, lineColor);
-                    
-                    // Draw sphere around each collectible
-                    drawDebugSphere(c.position, 0.5f, Color(1, 0.5f, 0));
-                }
-            }
-        }
+    // The batch proximity kernel on the selected path: 1024 positions
+    // against 4 query spheres per call
+    std::vector<float> xs(PAIRS), ys(PAIRS), zs(PAIRS);
+    for (int i = 0; i < PAIRS; i++) {
+        xs[i] = points[i].x;
+        ys[i] = points[i].y;
+        zs[i] = points[i].z;
     }
+    ProximityQuery queries[4];
+    for (int q = 0; q < 4; q++) queries[q] = ProximityQuery(points[PAIRS + q], 20.0f);
+    std::vector<uint64_t> masks(4 * proximityMaskWords(PAIRS));
+    results.push_back(measure("proximity/1024x4", "ns", 200000, [&](long) {
+        proximity.test(xs.data(), ys.data(), zs.data(), PAIRS, queries, 4, masks.data());
+        benchSink = benchSink + (float)masks[0];
+    }));
     
-    // Draw HUD
-    renderHUD();
+    // One full simulation tick of the default level on the autopilot
+    results.push_back(measure("stepSimulation", "ns", 200000, [&](long) {
+        stepSimulation(autopilotInput());
+        if (gameState != PLAYING) initGame();
+    }, [] { initGame(); }));
+}
+
+// Draws each object helper in a software GL context. Returns false if no
+// context could be created; the simulation results stand on their own.
+bool benchDrawing(std::vector<BenchResult>& results, std::string& renderer) {
+    OffscreenContext offscreen;
+    if (!offscreen.create(WINDOW_WIDTH, WINDOW_HEIGHT)) return false;
+    renderer = (const char*)glGetString(GL_RENDERER);
     
-    // Draw win screen overlay
-    if (gameState == WIN) {
-        renderWinScreen();
+    headlessMode = true;
+    initGL(false);
+    initGame();
+    static RenderSnapshot benchScene;
+    captureSnapshot(benchScene);
+    scene = &benchScene;
+    interpolateRenderState();
+    visibility.enabled = false;  // every draw at full detail
+    reshape(WINDOW_WIDTH, WINDOW_HEIGHT);
+    
+    struct DrawCase {
+        const char* name;
+        std::function<void()> draw;
+    };
+    DrawCase cases[] = {
+        { "drawPlayer", [] { drawPlayer(); } },
+        { "drawLantern", [] { drawLantern(0); } },
+        { "drawPagoda", [] { drawPagoda(1); } },
+        { "drawStatue", [] { drawStatue(2); } },
+        { "drawWeaponRack", [] { drawWeaponRack(3); } },
+    };
+    
+    const long CALLS = 100;
+    for (const DrawCase& c : cases) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glLoadIdentity();
+        gluLookAt(0, 25, 45, 0, 0, 0, 0, 1, 0);
+        if (useShaderLighting) glState.useProgram(litShader.program);
+        
+        // The batch ends with glFinish so the GL's queued work is counted
+        BenchResult r = measure(c.name, "us", CALLS, [&](long i) {
+            c.draw();
+            if (i == CALLS - 1) glFinish();
+        }, [] { glFinish(); });
+        results.push_back(r);
+        glState.useProgram(0);
     }
     
-    glutSwapBuffers();
+    glState.invalidate();
+    offscreen.destroy();
+    return true;
 }
 
-void reshape(int w, int h) {
-    glViewport(0, 0, w, h);
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(45.0, (double)w / (double)h, 0.1, 200.0);
-    glMatrixMode(GL_MODELVIEW);
+bool writeBenchJSON(const std::string& path, const std::vector<BenchResult>& results,
+                    const std::string& renderer) {
+    std::ofstream out(path.c_str());
+    if (!out) return false;
+    out << "{\n  \"version\": 1,\n  \"renderer\": \"" << renderer << "\",\n  \"results\": [\n";
+    out << std::setprecision(6);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "    {\"name\": \"" << r.name << "\", \"unit\": \"" << r.unit
+            << "\", \"iterations\": " << r.iterations << ", \"median\": " << r.median
+            << ", \"min\": " << r.best << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return (bool)out;
 }
 
-void update(int value) {
-    int currentTime = glutGet(GLUT_ELAPSED_TIME);
-    int deltaTime = currentTime - lastTime;
-    lastTime = currentTime;
+// Reads the name -> median pairs of a file written by writeBenchJSON
+bool readBenchBaseline(const std::string& path, std::unordered_map<std::string, double>& medians,
+                       std::string& renderer) {
+    std::ifstream in(path.c_str());
+    if (!in) return false;
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string text = buffer.str();
     
-    // Update timer
-    if (gameState == PLAYING) {
-        static int timeAccumulator = 0;
-        timeAccumulator += deltaTime;
-        if (timeAccumulator >= 1000) {
-            gameTimeRemaining--;
-            timeAccumulator = 0;
-            if (gameTimeRemaining <= 0) {
-                gameState = GAME_OVER;
-                gameLogger.log("GAME", "TIME UP - GAME OVER");
-                system("afplay /System/Library/Sounds/Basso.aiff &");
-            }
+    auto quotedAfter = [&](const std::string& key, size_t from, size_t& end) -> std::string {
+        size_t k = text.find("\"" + key + "\"", from);
+        if (k == std::string::npos) { end = std::string::npos; return ""; }
+        size_t open = text.find('"', text.find(':', k) + 1);
+        size_t close = text.find('"', open + 1);
+        end = close;
+        return text.substr(open + 1, close - open - 1);
+    };
+    
+    size_t pos = 0;
+    renderer = quotedAfter("renderer", 0, pos);
+    pos = 0;
+    while (true) {
+        std::string name = quotedAfter("name", pos, pos);
+        if (pos == std::string::npos) break;
+        size_t m = text.find("\"median\"", pos);
+        if (m == std::string::npos) break;
+        medians[name] = strtod(text.c_str() + text.find(':', m) + 1, NULL);
+    }
+    return true;
+}
+
+int runBenchmarkSuite(const BenchOptions& options) {
+    std::vector<BenchResult> results;
+    std::string renderer = "none";
+    
+    std::cout << "=== Benchmark Suite (median of " << BENCH_REPEATS << " runs) ===" << std::endl;
+    benchSimulation(results);
+    if (!benchDrawing(results, renderer)) {
+        std::cout << "No offscreen GL context, skipping the draw benchmarks" << std::endl;
+    }
+    std::cout << "Renderer: " << renderer << std::endl;
+    
+    std::unordered_map<std::string, double> baseline;
+    std::string baselineRenderer;
+    bool compare = !options.baselinePath.empty();
+    if (compare) {
+        if (!readBenchBaseline(options.baselinePath, baseline, baselineRenderer)) {
+            std::cerr << "Cannot read baseline " << options.baselinePath << std::endl;
+            return 1;
+        }
+        if (baselineRenderer != renderer) {
+            std::cout << "Warning: baseline was drawn with " << baselineRenderer << std::endl;
         }
     }
     
-    // Update animations
-    globalRotation += 1.0f;
-    if (globalRotation > 360) globalRotation -= 360;
+    std::cout << std::setw(26) << std::left << "benchmark" << std::right << std::setw(6) << "unit"
+              << std::setw(12) << "median" << std::setw(12) << "min";
+    if (compare) std::cout << std::setw(12) << "baseline" << std::setw(10) << "change";
+    std::cout << std::endl;
     
-    for (auto& platform : platforms) {
-        if (platform.animationActive) {
-            float speed = 2.0f;
-            switch (platform.animationType) {
-                case 0: speed = 4.0f; break;
-                case 1: speed = 2.5f; break;
-                case 2: speed = 3.5f; break;
-                case 3: speed = 2.0f; break;
-                default: speed = 2.0f; break;
+    int regressions = 0;
+    for (const BenchResult& r : results) {
+        std::cout << std::setw(26) << std::left << r.name << std::right << std::setw(6) << r.unit
+                  << std::fixed << std::setprecision(2) << std::setw(12) << r.median << std::setw(12) << r.best;
+        if (compare) {
+            auto it = baseline.find(r.name);
+            if (it == baseline.end() || it->second <= 0) {
+                std::cout << std::setw(12) << "-" << std::setw(10) << "new";
+            } else {
+                double change = r.median / it->second - 1.0;
+                std::cout << std::setw(12) << it->second << std::setw(9) << std::showpos
+                          << std::setprecision(1) << change * 100.0 << "%" << std::noshowpos;
+                if (change > options.threshold) {
+                    std::cout << "  REGRESSION";
+                    regressions++;
+                }
             }
-            platform.animationValue += speed;
-            if (platform.animationValue > 360) platform.animationValue -= 360;
         }
+        std::cout << std::endl;
     }
     
-    // Update player movement
-    if (gameState == PLAYING || gameState == WIN) {
-        Vector3 newPos = playerPos;
-        bool moved = false;
+    if (!options.jsonPath.empty()) {
+        if (!writeBenchJSON(options.jsonPath, results, renderer)) {
+            std::cerr << "Cannot write " << options.jsonPath << std::endl;
+            return 1;
+        }
+        std::cout << "Results written to " << options.jsonPath << std::endl;
+    }
+    if (compare) {
+        std::cout << regressions << " regression(s) beyond " << std::setprecision(0)
+                  << options.threshold * 100.0 << "% of " << options.baselinePath << std::endl;
+    }
+    return regressions > 0 ? 2 : 0;
+}
+
+// The entity layouts the game used before the component tables, kept to
+// compare against: hot and cold fields share each element
+struct AosCollectible {
+    Vector3 position;
+    bool collected;
+    int platform;
+};
+
+struct AosPlatform {
+    Vector3 position;
+    Vector3 size;
+    Color color;
+    bool allCollected;
+    bool animationActive;
+    float animationValue;
+    float prevAnimationValue;
+    float renderAnimationValue;
+    int animationType;
+};
+
+// Runs the pickup, render extraction and animation passes over n entities
+// stored both ways. Every entity is visited, so the difference is how many
+// bytes each pass drags through the cache.
+int runEntityBenchmark() {
+    const int sizes[] = { 1000, 100000, 1000000 };
+    const float r2 = COLLECTION_RADIUS * COLLECTION_RADIUS;
+    
+    std::cout << "=== Entity Storage Benchmark (ns per entity, median of " << BENCH_REPEATS << " runs) ===" << std::endl;
+    std::cout << "Bytes read per entity, AoS / SoA: pickup " << sizeof(AosCollectible) << " / 13, extract "
+              << sizeof(AosCollectible) << " / 13, animate " << sizeof(AosPlatform) << " / 9" << std::endl;
+    std::cout << std::setw(10) << "entities" << std::setw(14) << "pickup AoS" << std::setw(12) << "SoA"
+              << std::setw(14) << "extract AoS" << std::setw(12) << "SoA"
+              << std::setw(14) << "animate AoS" << std::setw(12) << "SoA" << std::endl;
+    
+    for (int n : sizes) {
+        std::vector<AosCollectible> aosItems(n);
+        CollectibleTable soaItems;
+        std::vector<AosPlatform> aosPlatforms(n);
+        PlatformTable soaPlatforms;
+        soaItems.reserve(n);
+        srand(1234);
+        float half = GROUND_SIZE * sqrt(n / 12.0f);
+        for (int i = 0; i < n; i++) {
+            Vector3 pos((rand() / (float)RAND_MAX * 2 - 1) * half, 2.25f,
+                        (rand() / (float)RAND_MAX * 2 - 1) * half);
+            bool collected = rand() % 4 == 0;
+            AosCollectible c = { pos, collected, 0 };
+            aosItems[i] = c;
+            soaItems.add(pos, 0);
+            soaItems.collected[i] = collected;
+            
+            int type = i % ANIMATION_TYPES;
+            AosPlatform p = { pos, Vector3(5, 1, 5), Color(), false, i % 3 != 0, 0, 0, 0, type };
+            aosPlatforms[i] = p;
+            soaPlatforms.add(pos, Vector3(5, 1, 5), Color(), type);
+            soaPlatforms.animationActive[i] = p.animationActive;
+        }
         
-        if (keys['w'] || keys['W'] || specialKeys[GLUT_KEY_UP]) {
-            newPos.z -= PLAYER_SPEED;
-            playerRotation = 180;
-            moved = true;
+        long passes = std::max(1L, 20000000L / n);
+        Vector3 probe(0, 0.5f, 0);
+        std::vector<Vector3> extracted;
+        extracted.reserve(n);
+        
+        // Pickup: distance test against every uncollected item. Both loops
+        // are branch-free, so only the layout differs.
+        BenchResult pickupAos = measure("pickup aos", "ns", passes, [&](long) {
+            int hits = 0;
+            for (const AosCollectible& c : aosItems) {
+                float dx = c.position.x - probe.x, dy = c.position.y - probe.y, dz = c.position.z - probe.z;
+                hits += (!c.collected) & (dx*dx + dy*dy + dz*dz < r2);
+            }
+            benchSink = benchSink + hits;
+        });
+        BenchResult pickupSoa = measure("pickup soa", "ns", passes, [&](long) {
+            const float* x = soaItems.transform.x.data();
+            const float* y = soaItems.transform.y.data();
+            const float* z = soaItems.transform.z.data();
+            const uint8_t* collected = soaItems.collected.data();
+            int hits = 0;
+            for (int i = 0; i < n; i++) {
+                float dx = x[i] - probe.x, dy = y[i] - probe.y, dz = z[i] - probe.z;
+                hits += (!collected[i]) & (dx*dx + dy*dy + dz*dz < r2);
+            }
+            benchSink = benchSink + hits;
+        });
+        
+        // Render extraction: gather the uncollected positions
+        BenchResult extractAos = measure("extract aos", "ns", passes, [&](long) {
+            extracted.resize(n);
+            size_t count = 0;
+            for (const AosCollectible& c : aosItems) {
+                extracted[count] = c.position;
+                count += !c.collected;
+            }
+            extracted.resize(count);
+            benchSink = benchSink + extracted.size();
+        });
+        BenchResult extractSoa = measure("extract soa", "ns", passes, [&](long) {
+            extractUncollected(soaItems, extracted);
+            benchSink = benchSink + extracted.size();
+        });
+        
+        // Animation: one step of every active platform, as stepSimulation() did it before
+        BenchResult animateAos = measure("animate aos", "ns", passes, [&](long) {
+            for (AosPlatform& platform : aosPlatforms) {
+                if (!platform.animationActive) continue;
+                int t = platform.animationType;
+                platform.animationValue += (t >= 0 && t < ANIMATION_TYPES) ? ANIMATION_SPEEDS[t] : DEFAULT_ANIMATION_SPEED;
+                if (platform.animationValue > 360) platform.animationValue -= 360;
+            }
+        });
+        BenchResult animateSoa = measure("animate soa", "ns", passes, [&](long) {
+            animatePlatforms(soaPlatforms);
+        });
+        benchSink = benchSink + aosPlatforms[n - 1].animationValue + soaPlatforms.animationValue[n - 1];
+        
+        std::cout << std::setw(10) << n << std::fixed << std::setprecision(3)
+                  << std::setw(14) << pickupAos.median / n << std::setw(12) << pickupSoa.median / n
+                  << std::setw(14) << extractAos.median / n << std::setw(12) << extractSoa.median / n
+                  << std::setw(14) << animateAos.median / n << std::setw(12) << animateSoa.median / n << std::endl;
+    }
+    return 0;
+}
+
+// Text for a level of n collectibles: platforms 40 apart, each holding up to
+// 1024 collectibles on a jittered lattice, so a few end up too close together
+std::string benchLevelText(int n, unsigned seed) {
+    srand(seed);
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(3);
+    int platformCount = (n + 1023) / 1024;
+    int side = (int)ceil(sqrt((float)platformCount));
+    text << "world " << side * 20 + 10 << "\n";
+    for (int p = 0, left = n; p < platformCount; p++, left -= 1024) {
+        float px = (p % side - (side - 1) * 0.5f) * 40.0f, pz = (p / side - (side - 1) * 0.5f) * 40.0f;
+        text << "platform " << px << " 0.5 " << pz << "  36 1 36  0.5 0.5 0.5  " << OBJECT_NAMES[p % OBJECT_TYPES] << "\n";
+        for (int i = 0; i < std::min(left, 1024); i++) {
+            float x = px - 18.6f + (i % 32) * 1.2f + (rand() / (float)RAND_MAX - 0.5f) * 0.22f;
+            float z = pz - 18.6f + (i / 32) * 1.2f + (rand() / (float)RAND_MAX - 0.5f) * 0.22f;
+            text << "collectible " << x << " 2.25 " << z << "\n";
         }
-        if (keys['s'] || keys['S'] || specialKeys[GLUT_KEY_DOWN]) {
-            newPos.z += PLAYER_SPEED;
-            playerRotation = 0;
-            moved = true;
+    }
+    return text.str();
+}
+
+// Compiling, loading and validating levels of 12 to 1M collectibles. The
+// pairwise column is the overlap check logCollectiblePositions() used to do.
+int runLevelBenchmark() {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    const int sizes[] = { 12, 10000, 100000, 1000000 };
+    const int PAIRWISE_LIMIT = 20000;
+    const char* path = "level_bench.lvl";
+    
+    std::cout << "=== Level Loading Benchmark (load and apply: median of " << BENCH_REPEATS << " runs) ===" << std::endl;
+    std::cout << std::setw(12) << "collectibles" << std::setw(10) << "file MB" << std::setw(12) << "compile ms"
+              << std::setw(10) << "load us" << std::setw(10) << "apply us" << std::setw(13) << "validate ms"
+              << std::setw(13) << "pairwise ms" << std::setw(10) << "problems" << std::endl;
+    for (int n : sizes) {
+        std::string text = n == 12 ? std::string(DEFAULT_LEVEL) : benchLevelText(n, 1234);
+        
+        double t0 = nowMs();
+        PlatformTable platformList;
+        CollectibleTable items;
+        LevelInfo info;
+        std::string error;
+        std::vector<LevelBlock> blob;
+        if (!parseLevel(text, "bench", platformList, items, info, error)) {
+            std::cerr << error << std::endl;
+            return 1;
         }
-        if (keys['a'] || keys['A'] || specialKeys[GLUT_KEY_LEFT]) {
-            newPos.x -= PLAYER_SPEED;
-            playerRotation = 90;
-            moved = true;
+        compileLevel(platformList, items, info, blob);
+        double compileMs = nowMs() - t0;
+        if (!writeLevel(path, blob)) {
+            std::cerr << path << ": write failed" << std::endl;
+            return 1;
         }
-        if (keys['d'] || keys['D'] || specialKeys[GLUT_KEY_RIGHT]) {
-            newPos.x += PLAYER_SPEED;
-            playerRotation = 270;
-            moved = true;
+        
+        LevelFile file;
+        BenchResult load = measure("level load", "us", 1, [&](long) {
+            if (!file.load(path, error)) std::cerr << error << std::endl;
+        });
+        BenchResult apply = measure("level apply", "us", 1, [&](long) {
+            file.apply(platforms, collectibles);
+        });
+        if (!file.mapped() || !collectibles.transform.x.isBorrowed()) {
+            std::cerr << "level columns were copied" << std::endl;
+            return 1;
         }
         
-        if (moved && !checkCollision(newPos)) {
-            playerPos = newPos;
-            if (debugMode) {
-                gameLogger.logPlayerMovement(playerPos);
+        t0 = nowMs();
+        collectibleGrid.build(collectibles, GRID_CELL_SIZE);
+        int problems = validateLevel(platforms, collectibles, collectibleGrid);
+        double validateMs = nowMs() - t0;
+        
+        std::ostringstream pairwise;
+        pairwise << std::fixed << std::setprecision(1);
+        if (n <= PAIRWISE_LIMIT) {
+            const Transforms& t = collectibles.transform;
+            int pairs = 0;
+            t0 = nowMs();
+            for (int i = 0; i < n; i++) {
+                for (int j = i + 1; j < n; j++) {
+                    if (collectibles.platform[i] != collectibles.platform[j]) continue;
+                    float dx = t.x[i] - t.x[j], dy = t.y[i] - t.y[j], dz = t.z[i] - t.z[j];
+                    if (sqrt(dx*dx + dy*dy + dz*dz) < MIN_COLLECTIBLE_SPACING) pairs++;
+                }
+            }
+            pairwise << nowMs() - t0;
+            if (pairs != problems) {
+                std::cerr << "validateLevel found " << problems << " problems, the pairwise check " << pairs << std::endl;
+                return 1;
             }
+        } else {
+            pairwise << "-";
         }
         
-        checkCollectibles();
+        std::cout << std::setw(12) << n << std::fixed << std::setprecision(1)
+                  << std::setw(10) << file.bytes() / 1e6 << std::setw(12) << compileMs
+                  << std::setw(10) << load.median << std::setw(10) << apply.median
+                  << std::setw(13) << validateMs << std::setw(13) << pairwise.str()
+                  << std::setw(10) << problems << std::endl;
+        platforms.clear();
+        collectibles.clear();
     }
-    
-    glutPostRedisplay();
-    glutTimerFunc(16, update, 0);
+    remove(path);
+    return 0;
 }
 
-void keyboard(unsigned char key, int x, int y) {
-    keys[key] = true;
+// Walks the player diagonally across a 2000 x 2000 world at 8 units a step,
+// stepping in real time so the loader thread competes with the simulation
+// the way it does in the game, once with the default budget and once with
+// one too small for the chunks in range.
+int runStreamBenchmark() {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    const float HALF = 1000.0f, SPACING = 50.0f, SPEED = 8.0f;
+    const char* path = "stream_bench.lvl";
     
-    if (key == 27) { // ESC
-        exit(0);
+    std::ostringstream text;
+    text << "world " << HALF << "\nchunk 25\n";
+    int perSide = (int)(2 * HALF / SPACING);
+    for (int p = 0; p < perSide * perSide; p++) {
+        float x = -HALF + SPACING * (p % perSide + 0.5f), z = -HALF + SPACING * (p / perSide + 0.5f);
+        text << "platform " << x << " 0.5 " << z << "  6 1 6  0.5 0.5 0.5  " << OBJECT_NAMES[p % OBJECT_TYPES] << "\n";
+        text << "ring 8\n";
     }
+    text << "lattice 100000\n";
     
-    if (key == 'r' || key == 'R') {
-        initGame();
-        lastTime = glutGet(GLUT_ELAPSED_TIME);
+    PlatformTable platformList;
+    CollectibleTable items;
+    LevelInfo info;
+    std::string error;
+    std::vector<LevelBlock> blob;
+    if (!parseLevel(text.str(), "bench", platformList, items, info, error)) {
+        std::cerr << error << std::endl;
+        return 1;
     }
-    
-    // Debug mode toggle
-    if (key == 'b' || key == 'B') {
-        debugMode = !debugMode;
-        gameLogger.log("DEBUG", debugMode ? "Debug mode ENABLED" : "Debug mode DISABLED");
-        std::cout << "Debug mode " << (debugMode ? "ON" : "OFF") << std::endl;
+    compileLevel(platformList, items, info, blob);
+    LevelFile file;
+    if (!writeLevel(path, blob) || !file.load(path, error)) {
+        std::cerr << path << ": " << (error.empty() ? "write failed" : error) << std::endl;
+        return 1;
     }
+    remove(path);
+    file.apply(platforms, collectibles);
     
-    // Camera modes
-    if (key == '0') cameraMode = 0; // Free
-    if (key == '1') cameraMode = 1; // Top
-    if (key == '2') cameraMode = 2; // Side
-    if (key == '3') cameraMode = 3; // Front
-    
-    // Animation toggles (only if platform complete)
-    if (key == 'z' || key == 'Z') {
-        if (platforms.size() > 0 && platforms[0].allCollected) {
-            platforms[0].animationActive = !platforms[0].animationActive;
-            std::cout << "P1 animation toggled to " << (platforms[0].animationActive ? "ON" : "OFF") << std::endl;
-        } else {
-            std::cout << "P1 not complete yet. Collect all items to enable animation." << std::endl;
+    std::cout << "=== World Streaming Benchmark (" << file.chunkCount() << " chunks, " << file.platformCount()
+              << " platforms, " << file.collectibleCount() << " collectibles, " << SPEED * SIM_HZ
+              << " units/s) ===" << std::endl;
+    std::cout << std::setw(10) << "budget KB" << std::setw(8) << "loads" << std::setw(11) << "evictions"
+              << std::setw(14) << "latency ms" << std::setw(10) << "worst ms" << std::setw(10) << "peak KB"
+              << std::setw(14) << "update us" << std::setw(10) << "worst us" << std::setw(16) << "steps unloaded"
+              << std::endl;
+    const size_t budgets[] = { DEFAULT_STREAM_BUDGET, 256 * 1024 };
+    for (size_t budget : budgets) {
+        WorldStreamer stream;
+        stream.setBudget(budget);
+        Vector3 player(-HALF + 20, 0.5f, -HALF + 20);
+        stream.start();
+        stream.restart(file, player);
+        
+        float worstUpdateUs = 0;
+        double updateSumUs = 0;
+        long steps = 0;
+        double next = nowMs();
+        while (player.x < HALF - 20) {
+            player.x += SPEED / sqrt(2.0f);
+            player.z += SPEED / sqrt(2.0f);
+            double t0 = nowMs();
+            stream.update(player);
+            float us = (float)((nowMs() - t0) * 1000);
+            updateSumUs += us;
+            worstUpdateUs = std::max(worstUpdateUs, us);
+            steps++;
+            next += SIM_STEP_MS;
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(std::max(next - nowMs(), 0.0)));
         }
-    }
-    if (key == 'x' || key == 'X') {
-        if (platforms.size() > 1 && platforms[1].allCollected) {
-            platforms[1].animationActive = !platforms[1].animationActive;
-            std::cout << "P2 animation toggled to " << (platforms[2].animationActive ? "ON" : "OFF") << std::endl;
-        } else {
-            std::cout << "P2 not complete yet. Collect all items to enable animation." << std::endl;
+        stream.stop();
+        stream.fillAll();
+        
+        // The pickup grid must hold exactly the collectibles of the resident chunks
+        std::vector<ChunkRef> chunks;
+        stream.residentChunks(chunks);
+        size_t expected = 0;
+        for (const ChunkRef& chunk : chunks) expected += chunk->collectibles.size();
+        if (collectibleGrid.size() != expected) {
+            std::cerr << "pickup grid holds " << collectibleGrid.size() << " collectibles, the resident chunks "
+                      << expected << std::endl;
+            return 1;
         }
+        
+        const StreamStats& stats = stream.statistics();
+        std::cout << std::fixed << std::setprecision(1) << std::setw(10) << budget / 1024 << std::setw(8) << stats.loads
+                  << std::setw(11) << stats.evictions << std::setw(14) << stats.latencySumMs / std::max(1L, stats.loads)
+                  << std::setw(10) << stats.worstLatencyMs << std::setw(10) << stats.peakBytes / 1024.0
+                  << std::setw(14) << updateSumUs / steps << std::setw(10) << worstUpdateUs
+                  << std::setw(16) << stats.stepsUnloaded << std::endl;
     }
-    if (key == 'c' || key == 'C') {
-        if (platforms.size() > 2 && platforms[2].allCollected) {
-            platforms[2].animationActive = !platforms[2].animationActive;
-            std::cout << "P3 animation toggled to " << (platforms[2].animationActive ? "ON" : "OFF") << std::endl;
-        } else {
-            std::cout << "P3 not complete yet. Collect all items to enable animation." << std::endl;
+    platforms.clear();
+    collectibles.clear();
+    return 0;
+}
+
+// Restart the old way (initGame) against capturing and restoring a state
+// snapshot, at 1k to 1M collectibles (a tenth as many platforms). "restore
+// +10%" restores after a tenth of the collectibles were picked up, which
+// includes putting them back in the pickup grid.
+int runSnapshotBenchmark() {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    const int sizes[] = { 1000, 10000, 100000, 1000000 };
+    
+    std::cout << "=== State Snapshot Benchmark (median of " << BENCH_REPEATS << " runs) ===" << std::endl;
+    std::cout << std::setw(12) << "collectibles" << std::setw(11) << "platforms" << std::setw(13) << "snapshot KB"
+              << std::setw(14) << "initGame us" << std::setw(12) << "capture us" << std::setw(12) << "restore us"
+              << std::setw(16) << "restore+10% us" << std::setw(14) << "rewind slots" << std::endl;
+    for (int n : sizes) {
+        int platformCount = n / 10;
+        int side = (int)ceil(sqrt((float)platformCount));
+        std::ostringstream text;
+        text << "world " << side * 5 + 5 << "\n";
+        for (int p = 0; p < platformCount; p++) {
+            text << "platform " << (p % side - side / 2) * 10 << " 0.5 " << (p / side - side / 2) * 10
+                 << "  6 1 6  0.5 0.5 0.5  " << OBJECT_NAMES[p % OBJECT_TYPES] << "\nring 10\n";
         }
-    }
-    if (key == 'v' || key == 'V') {
-        if (platforms.size() > 3 && platforms[3].allCollected) {
-            platforms[3].animationActive = !platforms[3].animationActive;
-            std::cout << "P4 animation toggled to " << (platforms[3].animationActive ? "ON" : "OFF") << std::endl;
-        } else {
-            std::cout << "P4 not complete yet. Collect all items to enable animation." << std::endl;
+        std::string error;
+        if (!level.loadText(text.str(), "bench", error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        
+        BenchResult init = measure("initGame", "us", 1, [](long) { initGame(); });
+        GameSnapshot snapshot;
+        BenchResult capture = measure("capture", "us", 1, [&](long) { snapshot.capture(); });
+        BenchResult restore = measure("restore", "us", 1, [&](long) { snapshot.restore(true); });
+        BenchResult restorePicked = measure("restore+10%", "us", 1, [&](long) { snapshot.restore(true); }, [&] {
+            for (int i = 0; i < n; i += 10) {
+                if (collectibles.collected[i]) continue;
+                collectibles.collected[i] = 1;
+                collectibleGrid.remove(i, collectibles.transform.position(i));
+            }
+        });
+        
+        // The pickup grid must be back where initGame() left it
+        size_t gridSize = collectibleGrid.size();
+        initGame();
+        if (collectibleGrid.size() != gridSize) {
+            std::cerr << "restore left " << gridSize << " collectibles in the pickup grid, initGame "
+                      << collectibleGrid.size() << std::endl;
+            return 1;
         }
+        
+        std::cout << std::setw(12) << n << std::setw(11) << platformCount << std::fixed << std::setprecision(1)
+                  << std::setw(13) << snapshot.bytes() / 1024.0 << std::setw(14) << init.median
+                  << std::setw(12) << capture.median << std::setw(12) << restore.median
+                  << std::setw(16) << restorePicked.median << std::setw(14) << rewindBuffer.capacity() << std::endl;
     }
+    level.close();
+    return 0;
 }
 
-void keyboardUp(unsigned char key, int x, int y) {
-    keys[key] = false;
-}
-
-void specialKeysCallback(int key, int x, int y) {
-    specialKeys[key] = true;
-}
+// Random static boxes at a constant density with player-sized dynamic boxes
+// walking among them: every dynamic box moves once per tick through the
+// broadphase, and a sample of the same moves is swept against every collider
+// for comparison. Ends with fast boxes thrown at walls thinner than one step.
+float randomIn(float lo, float hi) { return lo + (hi - lo) * (rand() / (float)RAND_MAX); }
 
-void specialKeysUpCallback(int key, int x, int y) {
-    specialKeys[key] = false;
+int runCollisionBenchmark() {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    const int staticCounts[] = { 1000, 10000, 100000 };
+    const int dynamicCounts[] = { 100, 1000, 10000 };
+    const int TICKS = 10;
+    const int BRUTE_MOVES = 1000;
+    
+    std::cout << "=== Collision Benchmark (median of " << BENCH_REPEATS << " runs of " << TICKS << " ticks) ===" << std::endl;
+    std::cout << std::setw(8) << "static" << std::setw(9) << "dynamic" << std::setw(10) << "build ms"
+              << std::setw(8) << "height" << std::setw(11) << "tick us" << std::setw(11) << "move ns"
+              << std::setw(12) << "pairs/move" << std::setw(14) << "queries/move" << std::setw(14) << "reinserts %"
+              << std::setw(15) << "brute move ns" << std::setw(13) << "brute pairs" << std::endl;
+    for (int n : staticCounts) {
+        for (int m : dynamicCounts) {
+            srand(1234);
+            float half = 5.0f * sqrt((float)n);
+            std::vector<Collider> boxes;
+            for (int i = 0; i < n; i++) {
+                Vector3 c(randomIn(-half, half), 0, randomIn(-half, half));
+                Vector3 e(randomIn(0.25f, 2.0f), randomIn(0.25f, 3.0f), randomIn(0.25f, 2.0f));
+                float bottom = rand() % 4 == 0 ? randomIn(1.0f, 3.0f) : 0.0f; // some overhead
+                boxes.push_back(Collider(AABB(Vector3(c.x - e.x, bottom, c.z - e.z), Vector3(c.x + e.x, bottom + e.y, c.z + e.z)),
+                                         COLLIDER_PLATFORM, i));
+            }
+            CollisionWorld world;
+            double t0 = nowMs();
+            world.build(boxes);
+            double buildMs = nowMs() - t0;
+            
+            std::vector<int> ids;
+            std::vector<Vector3> velocity;
+            for (int j = 0; j < m; j++) {
+                ids.push_back(world.addDynamic(playerBox(Vector3(randomIn(-half, half), PLAYER_FOOT_OFFSET, randomIn(-half, half)))));
+                float angle = randomIn(0, 2 * M_PI);
+                velocity.push_back(Vector3(cos(angle) * PLAYER_SPEED, 0, sin(angle) * PLAYER_SPEED));
+            }
+            world.stats = CollisionStats();
+            BenchResult tick = measure("tick", "us", TICKS, [&](long) {
+                for (int j = 0; j < m; j++) {
+                    Vector3 moved = world.move(ids[j], velocity[j], STEP_HEIGHT);
+                    // Turn when stopped or about to leave the area
+                    const AABB& box = world.collider(ids[j]).box;
+                    if ((moved.x == 0 && moved.z == 0) || fabsf(box.min.x) > half || fabsf(box.min.z) > half) {
+                        velocity[j] = Vector3(-velocity[j].z, 0, velocity[j].x);
+                    }
+                }
+                world.stats.steps++;
+            });
+            double moves = (double)world.stats.steps * m;
+            
+            // The same kind of move swept against every other collider
+            double brutePairs = 0;
+            t0 = nowMs();
+            for (int k = 0; k < BRUTE_MOVES; k++) {
+                int j = ids[k % m];
+                const AABB& box = world.collider(j).box;
+                float first = 1;
+                for (int c = 0; c < world.count(); c++) {
+                    if (c == j) continue;
+                    brutePairs++;
+                    float t;
+                    int axis;
+                    if (sweepBox(box, velocity[k % m], world.collider(c).box, t, axis) && t < first) first = t;
+                }
+                benchSink = benchSink + first;
+            }
+            double bruteNs = (nowMs() - t0) * 1e6 / BRUTE_MOVES;
+            
+            std::cout << std::setw(8) << n << std::setw(9) << m << std::fixed << std::setprecision(1)
+                      << std::setw(10) << buildMs << std::setw(8) << world.treeHeight() << std::setw(11) << tick.median
+                      << std::setw(11) << tick.median * 1000 / m << std::setprecision(2)
+                      << std::setw(12) << world.stats.pairsTested / moves << std::setw(14) << world.stats.queries / moves
+                      << std::setw(14) << 100.0 * world.stats.reinserts / moves << std::setprecision(0)
+                      << std::setw(15) << bruteNs << std::setw(13) << brutePairs / BRUTE_MOVES << std::endl;
+        }
+    }
+    
+    // Boxes moving 5 units a step at walls 0.05 thick: a plain overlap test
+    // after each step would let nearly all of them through
+    const int THROWN = 1000;
+    const float SPEED = 5.0f;
+    std::vector<Collider> walls;
+    for (int w = 0; w < 10; w++) {
+        float x = 10.0f + w * 7.3f;
+        walls.push_back(Collider(AABB(Vector3(x, 0, -500), Vector3(x + 0.05f, WALL_HEIGHT, 500)), COLLIDER_WALL, -1));
+    }
+    CollisionWorld world;
+    world.build(walls);
+    std::vector<int> thrown;
+    for (int j = 0; j < THROWN; j++) {
+        thrown.push_back(world.addDynamic(playerBox(Vector3(randomIn(-5.0f, 9.0f), PLAYER_FOOT_OFFSET, randomIn(-400.0f, 400.0f)))));
+    }
+    for (int step = 0; step < 50; step++) {
+        for (int j : thrown) world.move(j, Vector3(SPEED, 0, SPEED * 0.1f), STEP_HEIGHT);
+    }
+    int through = 0;
+    for (int j : thrown) {
+        if (world.collider(j).box.max.x > walls[0].box.min.x) through++;
+    }
+    std::cout << "Thin walls: " << THROWN << " boxes at " << std::setprecision(1) << SPEED
+              << " units/step against walls 0.05 thick, " << through << " got through" << std::endl;
+    return through == 0 ? 0 : 1;
 }
 
-void mouse(int button, int state, int x, int y) {
-    if (button == GLUT_LEFT_BUTTON) {
-        if (state == GLUT_DOWN) {
-            mouseDown = true;
-            mouseX = x;
-            mouseY = y;
-        } else {
-            mouseDown = false;
+// Runs every proximity path this CPU supports over random batches of every
+// length up to past a few vector widths, plus positions exactly on, just
+// inside and just outside the radius, and requires the masks to match the
+// scalar path bit for bit. Also times each path.
+int runSimdVerify() {
+    const int MAX_QUERIES = 4;
+    std::vector<int> counts;
+    for (int n = 0; n <= 70; n++) counts.push_back(n);
+    counts.push_back(127);
+    counts.push_back(128);
+    counts.push_back(129);
+    counts.push_back(1000);
+    counts.push_back(4099);
+    
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> coord(-50.0f, 50.0f);
+    std::uniform_real_distribution<float> radius(0.0f, 40.0f);
+    
+    std::cout << "=== Proximity Kernel Check (selected: " << ProximityKernel::name(proximity.level()) << ") ===" << std::endl;
+    std::vector<float> x, y, z;
+    std::vector<uint64_t> expected, actual;
+    int cases = 0, failures = 0;
+    for (int round = 0; round < 20; round++) {
+        for (int count : counts) {
+            x.resize(count);
+            y.resize(count);
+            z.resize(count);
+            int queryCount = 1 + (int)(rng() % MAX_QUERIES);
+            ProximityQuery queries[MAX_QUERIES];
+            for (int q = 0; q < queryCount; q++) {
+                queries[q] = ProximityQuery(Vector3(coord(rng), coord(rng), coord(rng)), radius(rng));
+            }
+            for (int i = 0; i < count; i++) {
+                const ProximityQuery& q = queries[rng() % queryCount];
+                switch (rng() % 4) {
+                    case 0:
+                        x[i] = coord(rng); y[i] = coord(rng); z[i] = coord(rng);
+                        break;
+                    default: {
+                        // On the sphere along one axis, then nudged by up to one ulp
+                        float r = sqrtf(q.radius2);
+                        float ulps[3] = { -INFINITY, 0, INFINITY };
+                        x[i] = q.x; y[i] = q.y; z[i] = q.z;
+                        float& axis = (i % 3 == 0) ? x[i] : (i % 3 == 1) ? y[i] : z[i];
+                        axis = nextafterf(axis + r, ulps[rng() % 3]);
+                        break;
+                    }
+                }
+            }
+            
+            size_t words = (size_t)queryCount * proximityMaskWords(count);
+            expected.assign(std::max(words, (size_t)1), 0);
+            proximityScalar(x.data(), y.data(), z.data(), count, queries, queryCount, expected.data());
+            for (int path = ProximityKernel::SCALAR + 1; path < ProximityKernel::LEVEL_COUNT; path++) {
+                ProximityFn fn = ProximityKernel::function((ProximityKernel::Level)path);
+                if (!fn) continue;
+                actual.assign(expected.size(), ~0ULL);
+                fn(x.data(), y.data(), z.data(), count, queries, queryCount, actual.data());
+                cases++;
+                if (memcmp(actual.data(), expected.data(), words * sizeof(uint64_t)) != 0) {
+                    if (failures++ < 10) {
+                        std::cout << "MISMATCH " << ProximityKernel::name((ProximityKernel::Level)path)
+                                  << ": " << count << " positions, " << queryCount << " queries" << std::endl;
+                    }
+                }
+            }
         }
     }
     
-    // Mouse wheel for zoom
-    if (button == 3) { // Scroll up
-        cameraDistance -= 2.0f;
-        if (cameraDistance < 5.0f) cameraDistance = 5.0f;
+    const int N = 4096;
+    x.resize(N);
+    y.resize(N);
+    z.resize(N);
+    for (int i = 0; i < N; i++) {
+        x[i] = coord(rng);
+        y[i] = coord(rng);
+        z[i] = coord(rng);
     }
-    if (button == 4) { // Scroll down
-        cameraDistance += 2.0f;
-        if (cameraDistance > 60.0f) cameraDistance = 60.0f;
+    ProximityQuery queries[MAX_QUERIES];
+    for (int q = 0; q < MAX_QUERIES; q++) queries[q] = ProximityQuery(Vector3(coord(rng), 0, coord(rng)), 20.0f);
+    actual.assign((size_t)MAX_QUERIES * proximityMaskWords(N), 0);
+    std::cout << std::setw(10) << "path" << std::setw(18) << "ns/position" << std::endl;
+    for (int path = ProximityKernel::SCALAR; path < ProximityKernel::LEVEL_COUNT; path++) {
+        ProximityFn fn = ProximityKernel::function((ProximityKernel::Level)path);
+        std::cout << std::setw(10) << ProximityKernel::name((ProximityKernel::Level)path);
+        if (!fn) {
+            std::cout << std::setw(18) << "unsupported" << std::endl;
+            continue;
+        }
+        BenchResult result = measure("proximity", "ns", 2000, [&](long) {
+            fn(x.data(), y.data(), z.data(), N, queries, MAX_QUERIES, actual.data());
+            benchSink = benchSink + (float)actual[0];
+        });
+        std::cout << std::fixed << std::setprecision(3) << std::setw(18) << result.median / (N * MAX_QUERIES) << std::endl;
     }
+    
+    std::cout << cases << " batches compared, " << failures << " mismatches" << std::endl;
+    return failures ? 1 : 0;
 }
 
-void mouseMotion(int x, int y) {
-    if (mouseDown && cameraMode == 0) {
-        int deltaX = x - mouseX;
-        int deltaY = y - mouseY;
-        
-        cameraAngleY += deltaX * 0.5f;
-        cameraAngleX += deltaY * 0.5f;
+// Runs a frame's worth of job-system work (platform animation, collectible
+// extraction and culling) over a level with a million platforms and a million
+// collectibles on 1 to maxThreads threads. Every thread count has to produce
+// the same animation values and instance stream.
+int runJobBenchmark(int maxThreads) {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    const int N = 1000000;
+    const int FRAMES = 10;
+    
+    PlatformTable table;
+    CollectibleTable items;
+    items.reserve(N);
+    srand(1234);
+    float half = GROUND_SIZE * sqrt(N / 12.0f);
+    for (int i = 0; i < N; i++) {
+        Vector3 pos((rand() / (float)RAND_MAX * 2 - 1) * half, 0.5f, (rand() / (float)RAND_MAX * 2 - 1) * half);
+        table.add(pos, Vector3(5, 1, 5), Color(), i % ANIMATION_TYPES);
+        table.animationActive[i] = i % 3 != 0;
+        items.add(Vector3(pos.x + 1, 2.25f, pos.z + 1), -1);
+        items.collected[i] = rand() % 4 == 0;
+    }
+    
+    // gluPerspective(45, 4:3, 0.1, 1000) looking down at 45 degrees from 400 units away
+    float f = 1.0f / tan(22.5f * M_PI / 180.0f), zNear = 0.1f, zFar = 1000.0f;
+    float projection[16] = { f * 0.75f, 0, 0, 0,  0, f, 0, 0,
+                             0, 0, (zFar + zNear) / (zNear - zFar), -1,  0, 0, 2 * zFar * zNear / (zNear - zFar), 0 };
+    float c = cos(M_PI / 4), s = sin(M_PI / 4);
+    float view[16] = { 1, 0, 0, 0,  0, c, s, 0,  0, -s, c, 0,  0, 0, -400, 1 };
+    Visibility camera;
+    camera.setCamera(projection, view, WINDOW_HEIGHT);
+    CollectibleDrawList drawList;
+    
+    std::cout << "=== Job System Scaling (" << N << " platforms + " << N << " collectibles, "
+              << FRAMES << " frames per run, median of " << BENCH_REPEATS << ") ===" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "ms/frame" << std::setw(10) << "speedup"
+              << std::setw(12) << "jobs/frame" << std::setw(10) << "stolen" << std::setw(20) << "checksum" << std::endl;
+    double single = 0;
+    uint64_t expected = 0;
+    bool identical = true;
+    for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads ? std::min(threads * 2, maxThreads) : threads + 1) {
+        jobs.start(threads - 1);
+        long executedBefore = jobs.jobsExecuted(), stolenBefore = jobs.jobsStolen();
+        BenchResult result = measure("jobs", "us", FRAMES, [&](long) {
+            Job* animation = animatePlatformsJob(table);
+            jobs.submit(animation);
+            drawList.build(items, true, camera);
+            jobs.wait(animation);
+            drawList.finish();
+            jobs.endFrame();
+        }, [&] { std::fill(table.animationValue.begin(), table.animationValue.end(), 0.0f); });
+        long frames = (long)FRAMES * (BENCH_REPEATS + 1);
         
-        if (cameraAngleX > 89.0f) cameraAngleX = 89.0f;
-        if (cameraAngleX < -89.0f) cameraAngleX = -89.0f;
+        // Over the animation values and the instance stream
+        uint64_t hash = fnv1a(table.animationValue.data(), table.animationValue.size() * sizeof(float));
+        hash = fnv1a(drawList.streamed.data(), drawList.streamed.size() * sizeof(Vector3), hash);
+        hash = fnv1a(drawList.bucketSize, sizeof(drawList.bucketSize), hash);
+        if (threads == 1) {
+            single = result.median;
+            expected = hash;
+        }
+        identical = identical && hash == expected;
         
-        mouseX = x;
-        mouseY = y;
+        std::cout << std::setw(8) << threads << std::fixed << std::setprecision(2)
+                  << std::setw(12) << result.median / 1000.0 << std::setw(9) << single / result.median << "x"
+                  << std::setw(12) << (jobs.jobsExecuted() - executedBefore) / frames
+                  << std::setw(10) << (jobs.jobsStolen() - stolenBefore) / frames
+                  << std::setw(20) << std::hex << hash << std::dec << std::endl;
     }
+    const FrameArena& arena = jobs.frameArena(JobSystem::RENDER_CLIENT);
+    std::cout << "Frame arena peak: " << arena.peakBytes() << " of " << arena.capacity()
+              << " bytes" << std::endl;
+    std::cout << (identical ? "Output identical for every thread count" : "OUTPUT DIFFERS between thread counts")
+              << std::endl;
+    return identical ? 0 : 1;
 }
 
-void initGL() {
-    glClearColor(0.1f, 0.1f, 0.15f, 1.0f);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_COLOR_MATERIAL);
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
+// The crowd on a 200 x 200 level of platforms and a dense lattice of
+// collectibles, at growing agent counts and on 1 to N threads. A tick steers
+// every agent and resolves their pickups, as stepSimulation() does. Every
+// run starts from the same snapshot, and its final state must be the same
+// for every thread count.
+int runCrowdBenchmark(int maxThreads) {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    const int agentCounts[] = { 1000, 10000, 50000 };
+    const int TICKS = 120;
+    const double BUDGET_MS = 2.0;
     
-    // Setup lighting
-    GLfloat lightPos[] = { 0.0f, 30.0f, 0.0f, 1.0f };
-    GLfloat lightAmbient[] = { 0.3f, 0.3f, 0.3f, 1.0f };
-    GLfloat lightDiffuse[] = { 0.8f, 0.8f, 0.8f, 1.0f };
-    GLfloat lightSpecular[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    std::ostringstream text;
+    text << "world 100\nchunk 200\n";
+    for (int p = 0; p < 64; p++) {
+        text << "platform " << (p % 8 - 3.5f) * 25 << " 0.5 " << (p / 8 - 3.5f) * 25 << "  5 1 5  0.5 0.5 0.5  "
+             << OBJECT_NAMES[p % OBJECT_TYPES] << "\nring 6\n";
+    }
+    text << "lattice 20000\n";
+    std::string error;
+    if (!level.loadText(text.str(), "bench", error)) {
+        std::cerr << error << std::endl;
+        return 1;
+    }
     
-    glLightfv(GL_LIGHT0, GL_POSITION, lightPos);
-    glLightfv(GL_LIGHT0, GL_AMBIENT, lightAmbient);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, lightDiffuse);
-    glLightfv(GL_LIGHT0, GL_SPECULAR, lightSpecular);
+    std::cout << "=== Crowd Benchmark (" << TICKS << " ticks per run, " << BENCH_REPEATS << " runs, "
+              << level.collectibleCount() << " collectibles, " << level.platformCount() << " platforms) ===" << std::endl;
+    std::cout << std::setw(8) << "agents" << std::setw(9) << "threads" << std::setw(12) << "ms/tick"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "speedup" << std::setw(13) << "retargets"
+              << std::setw(9) << "pushes" << std::setw(8) << "pairs" << std::setw(10) << "pickups"
+              << std::setw(20) << "checksum" << std::endl;
+    bool identical = true;
+    std::vector<std::pair<int, double>> target; // agents and best median for the budget line
+    for (int n : agentCounts) {
+        npcCount = n;
+        gameSeed = 1234;
+        initGame();
+        GameSnapshot start;
+        start.capture();
+        
+        double single = 0;
+        uint64_t expected = 0;
+        double best = 1e30;
+        for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads ? std::min(threads * 2, maxThreads) : threads + 1) {
+            jobs.start(threads - 1);
+            std::vector<double> tickMs;
+            for (int r = 0; r <= BENCH_REPEATS; r++) {
+                start.restore(true);
+                crowd.stats = CrowdStats();
+                for (int t = 0; t < TICKS; t++) {
+                    double t0 = nowMs();
+                    collectibleField.update(NAV_FIELD_STEP_CELLS);
+                    crowd.step();
+                    checkRivalPickups();
+                    jobs.endFrame();
+                    if (r > 0) tickMs.push_back(nowMs() - t0);
+                }
+            }
+            std::sort(tickMs.begin(), tickMs.end());
+            double median = tickMs[tickMs.size() / 2], p99 = tickMs[(size_t)(0.99 * (tickMs.size() - 1))];
+            uint64_t hash = simulationChecksum();
+            if (threads == 1) {
+                single = median;
+                expected = hash;
+            }
+            identical = identical && hash == expected;
+            best = std::min(best, median);
+            
+            const CrowdStats& stats = crowd.stats;
+            double perAgent = 1.0 / std::max(1L, stats.agentSteps);
+            std::cout << std::setw(8) << n << std::setw(9) << threads << std::fixed << std::setprecision(3)
+                      << std::setw(12) << median << std::setw(10) << p99 << std::setprecision(2)
+                      << std::setw(9) << single / median << "x" << std::setprecision(1)
+                      << std::setw(13) << stats.retargets / (double)TICKS << std::setprecision(2)
+                      << std::setw(9) << stats.neighbours * perAgent << std::setw(8) << stats.collision.pairsTested * perAgent
+                      << std::setprecision(1) << std::setw(10) << stats.pickups / (double)TICKS
+                      << std::setw(20) << std::hex << hash << std::dec << std::endl;
+        }
+        target.push_back(std::make_pair(n, best));
+    }
+    for (const auto& t : target) {
+        std::cout << t.first << " agents: " << std::setprecision(3) << t.second << " ms per tick at best, "
+                  << (t.second <= BUDGET_MS ? "within" : "OVER") << " the " << std::setprecision(1) << BUDGET_MS
+                  << " ms budget" << std::endl;
+    }
+    std::cout << (identical ? "State identical for every thread count" : "STATE DIFFERS between thread counts")
+              << std::endl;
+    level.close();
+    return identical ? 0 : 1;
+}
+
+// Navigation on levels from 128 x 128 to 1024 x 1024 cells, with a platform
+// (and its prop) every 20 units and a ring of collectibles round each. Times
+// building the grid and the flow field, A* between random open cells with an
+// empty and a warm path cache, and flow field updates for single pickups
+// against building it again. The updated field has to match a fresh build.
+int runNavBenchmark() {
+    headlessMode = true;
+    gameLogger.setEnabled(false);
+    const int halves[] = { 64, 128, 256, 512 };
+    const int QUERIES = 1000;
+    const int PICKUPS = 1000;
     
-    glShadeModel(GL_SMOOTH);
-    glEnable(GL_NORMALIZE);
+    std::cout << "=== Navigation Benchmark (median of " << BENCH_REPEATS << " runs, " << QUERIES << " paths, "
+              << PICKUPS << " pickups) ===" << std::endl;
+    std::cout << std::setw(11) << "grid" << std::setw(8) << "open %" << std::setw(9) << "sources"
+              << std::setw(10) << "grid ms" << std::setw(10) << "field ms" << std::setw(11) << "A* us"
+              << std::setw(10) << "p99 us" << std::setw(10) << "expanded" << std::setw(11) << "cached ns"
+              << std::setw(8) << "hit %" << std::setw(12) << "pickup us" << std::setw(10) << "p99 us"
+              << std::setw(8) << "cells" << std::setw(10) << "speedup" << std::setw(12) << "restore ms" << std::endl;
+    bool identical = true;
+    for (int half : halves) {
+        std::ostringstream text;
+        int side = half / 10;
+        text << "world " << half << "\n";
+        for (int p = 0; p < side * side; p++) {
+            text << "platform " << (p % side - side / 2) * 20 + 10 << " 0.5 " << (p / side - side / 2) * 20 + 10
+                 << "  5 1 5  0.5 0.5 0.5  " << OBJECT_NAMES[p % OBJECT_TYPES] << "\nring 6\n";
+        }
+        std::string error;
+        if (!level.loadText(text.str(), "bench", error)) {
+            std::cerr << error << std::endl;
+            return 1;
+        }
+        npcCount = 0;
+        initGame();
+        
+        BenchResult gridBuild = measure("grid", "us", 1, [](long) { navGrid.build(worldHalfSize, collision); });
+        pathFinder.reset();
+        BenchResult fieldBuild = measure("field", "us", 1, [](long) { collectibleField.build(collectibles); });
+        int open = 0;
+        for (int c = 0; c < navGrid.cells(); c++) open += navGrid.open(c);
+        
+        // Random pairs of open cells, first with an empty cache, then again
+        std::mt19937 rng(1234);
+        std::vector<std::pair<Vector3, Vector3>> pairs;
+        while ((int)pairs.size() < QUERIES) {
+            int a = (int)(rng() % navGrid.cells()), b = (int)(rng() % navGrid.cells());
+            if (navGrid.open(a) && navGrid.open(b)) pairs.push_back(std::make_pair(navGrid.center(a), navGrid.center(b)));
+        }
+        std::vector<Vector3> path;
+        std::vector<double> queryUs;
+        pathFinder.reset();
+        pathFinder.stats = NavStats();
+        for (const auto& q : pairs) {
+            double t0 = nowMs();
+            pathFinder.findPath(q.first, q.second, path);
+            queryUs.push_back((nowMs() - t0) * 1000);
+        }
+        double expanded = pathFinder.stats.expanded / (double)std::max(1L, pathFinder.stats.queries - pathFinder.stats.cached);
+        std::sort(queryUs.begin(), queryUs.end());
+        NavStats cold = pathFinder.stats;
+        BenchResult cached = measure("cached", "ns", QUERIES, [&](long i) {
+            pathFinder.findPath(pairs[i].first, pairs[i].second, path);
+            benchSink = benchSink + path.size();
+        });
+        double hits = 100.0 * (pathFinder.stats.cached - cold.cached) / std::max(1L, pathFinder.stats.queries - cold.queries);
+        
+        // Pickups one at a time, then all of them put back by one restore
+        std::vector<int> picked;
+        for (int i = 0; i < collectibles.count() && (int)picked.size() < PICKUPS; i += 1 + (int)(rng() % 8)) {
+            picked.push_back(i);
+        }
+        std::shuffle(picked.begin(), picked.end(), rng);
+        std::vector<double> pickupUs;
+        collectibleField.stats = NavStats();
+        for (int i : picked) {
+            collectibles.collected[i] = 1;
+            double t0 = nowMs();
+            collectibleField.remove(i);
+            collectibleField.finish();
+            pickupUs.push_back((nowMs() - t0) * 1000);
+        }
+        std::sort(pickupUs.begin(), pickupUs.end());
+        double cells = collectibleField.stats.cellsUpdated / (double)std::max(1L, collectibleField.stats.updates);
+        
+        FlowField fresh(navGrid);
+        fresh.build(collectibles);
+        for (int c = 0; c < navGrid.cells(); c++) {
+            identical = identical && fresh.sourceAt(c) == collectibleField.sourceAt(c) &&
+                        fresh.distanceAt(c) == collectibleField.distanceAt(c);
+        }
+        for (int i : picked) collectibles.collected[i] = 0;
+        double t0 = nowMs();
+        collectibleField.add(picked);
+        double restoreMs = nowMs() - t0;
+        fresh.build(collectibles);
+        for (int c = 0; c < navGrid.cells(); c++) {
+            identical = identical && fresh.sourceAt(c) == collectibleField.sourceAt(c) &&
+                        fresh.distanceAt(c) == collectibleField.distanceAt(c);
+        }
+        
+        std::ostringstream grid;
+        grid << navGrid.width << "x" << navGrid.height;
+        std::cout << std::setw(11) << grid.str() << std::fixed << std::setprecision(1)
+                  << std::setw(8) << 100.0 * open / navGrid.cells() << std::setw(9) << collectibles.count()
+                  << std::setprecision(2) << std::setw(10) << gridBuild.median / 1000 << std::setw(10) << fieldBuild.median / 1000
+                  << std::setprecision(1) << std::setw(11) << queryUs[queryUs.size() / 2]
+                  << std::setw(10) << queryUs[(size_t)(0.99 * (queryUs.size() - 1))] << std::setprecision(0)
+                  << std::setw(10) << expanded << std::setw(11) << cached.median << std::setprecision(1)
+                  << std::setw(8) << hits << std::setw(12) << pickupUs[pickupUs.size() / 2]
+                  << std::setw(10) << pickupUs[(size_t)(0.99 * (pickupUs.size() - 1))] << std::setprecision(0)
+                  << std::setw(8) << cells << std::setw(9) << fieldBuild.median / pickupUs[pickupUs.size() / 2] << "x"
+                  << std::setprecision(2) << std::setw(12) << restoreMs << std::endl;
+    }
+    std::cout << (identical ? "Updated flow fields identical to fresh builds" : "UPDATED FLOW FIELD DIFFERS from a fresh build")
+              << std::endl;
+    level.close();
+    return identical ? 0 : 1;
 }
 
 // ==================== MAIN ====================
 int main(int argc, char** argv) {
+    bool nullAudio = false;
+    std::string audioWav;
+    bool runBench = false;
+    BenchOptions benchOptions;
+    // The main thread takes part in every wait, so one worker per other core
+    int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    jobs.start(hardwareThreads - 1);
+    long headlessTicks = 0;
+    std::string replayPath, headlessReplayPath;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--headless") {
+            long ticks = (i + 1 < argc) ? atol(argv[i + 1]) : 0;
+            headlessTicks = ticks > 0 ? ticks : 1000000;
+        }
+        if (arg == "--record" && i + 1 < argc) recordPath = argv[++i];
+        if (arg == "--replay" && i + 1 < argc) replayPath = argv[++i];
+        if (arg == "--replay-headless" && i + 1 < argc) headlessReplayPath = argv[++i];
+        if (arg == "--bench-pickup") return runPickupBenchmark();
+        if (arg == "--bench-logger") return runLoggerBenchmark();
+        if (arg == "--bench-audio") return runAudioBenchmark();
+        if (arg == "--bench-entities") return runEntityBenchmark();
+        if (arg == "--bench-level") return runLevelBenchmark();
+        if (arg == "--bench-stream") return runStreamBenchmark();
+        if (arg == "--bench-snapshot") return runSnapshotBenchmark();
+        if (arg == "--bench-collision") return runCollisionBenchmark();
+        if (arg == "--npcs" && i + 1 < argc) npcCount = std::max(0, atoi(argv[++i]));
+        if (arg == "--bench-nav") return runNavBenchmark();
+        if (arg == "--bench-crowd") {
+            int threads = (i + 1 < argc) ? atoi(argv[i + 1]) : 0;
+            return runCrowdBenchmark(threads > 0 ? threads : hardwareThreads);
+        }
+        if (arg == "--stream-budget" && i + 1 < argc) streamer.setBudget((size_t)(atof(argv[++i]) * 1048576));
+        if (arg == "--compile-level" && i + 2 < argc) return compileLevelFile(argv[i + 1], argv[i + 2]);
+        if (arg == "--validate-level" && i + 1 < argc) return validateLevelFile(argv[i + 1]);
+        if (arg == "--level" && i + 1 < argc) {
+            std::string error;
+            if (!level.load(argv[++i], error)) {
+                std::cerr << error << std::endl;
+                return 1;
+            }
+        }
+        if (arg == "--simd" && i + 1 < argc) {
+            std::string name = argv[++i];
+            int path = 0;
+            while (path < ProximityKernel::LEVEL_COUNT && name != ProximityKernel::name((ProximityKernel::Level)path)) path++;
+            if (path == ProximityKernel::LEVEL_COUNT || !proximity.use((ProximityKernel::Level)path)) {
+                std::cerr << "Proximity path " << name << " is not available here" << std::endl;
+            }
+        }
+        if (arg == "--verify-simd") return runSimdVerify();
+        if (arg == "--jobs" && i + 1 < argc) jobs.start(std::max(0, atoi(argv[++i]) - 1));
+        if (arg == "--bench-jobs") {
+            int threads = (i + 1 < argc) ? atoi(argv[i + 1]) : 0;
+            return runJobBenchmark(threads > 0 ? threads : hardwareThreads);
+        }
+        if (arg == "--bench") runBench = true;
+        if (arg == "--bench-json" && i + 1 < argc) benchOptions.jsonPath = argv[++i];
+        if (arg == "--bench-baseline" && i + 1 < argc) benchOptions.baselinePath = argv[++i];
+        if (arg == "--bench-threshold" && i + 1 < argc) benchOptions.threshold = atof(argv[++i]) / 100.0;
+        if (arg == "--audio-null") nullAudio = true;
+        if (arg == "--audio-wav" && i + 1 < argc) audioWav = argv[++i];
+        if (arg == "--decode-log" && i + 1 < argc) return decodeBinaryLog(argv[i + 1]);
+        if (arg == "--log-binary") gameLogger.setBinary(true);
+        if (arg == "--log-level" && i + 1 < argc) {
+            LogLevel level;
+            if (GameLogger::parseLevel(argv[++i], level)) gameLogger.setLevel(level);
+            else std::cerr << "Unknown log level " << argv[i] << " (debug, info, warn, error)" << std::endl;
+        }
+        if (arg == "--log-categories" && i + 1 < argc) {
+            uint32_t mask = GameLogger::parseCategories(argv[++i]);
+            if (mask) gameLogger.setCategories(mask);
+            else std::cerr << "No known log categories in " << argv[i] << std::endl;
+        }
+        if (arg == "--stress-collectibles" && i + 1 < argc) stressCollectibleCount = atoi(argv[++i]);
+        if (arg == "--fixed-function") useShaderLighting = false;
+        if (arg == "--uncapped") framePacing = PACING_UNCAPPED;
+        if (arg == "--vsync") framePacing = PACING_VSYNC;
+    }
+    if (headlessTicks > 0) return runHeadless(headlessTicks);
+    if (!headlessReplayPath.empty()) return runReplay(headlessReplayPath);
+    if (runBench) return runBenchmarkSuite(benchOptions);
+    
     glutInit(&argc, argv);
     glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
     glutInitWindowSize(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -1200,9 +10617,20 @@ int main(int argc, char** argv) {
     glutCreateWindow("Ancient Warriors - Collectibles Game");
     
     initGL();
+    audio.loadSamples();
+    if (!audio.start(createAudioBackend(nullAudio, audioWav))) audio.start(new NullAudioBackend());
+    subscribeEventListeners();
+    if (!replayPath.empty()) {
+        loadDefaultLevel();
+        if (!prepareReplay(replayPath)) return 1;
+        replaying = true;
+    } else if (!recordPath.empty()) {
+        startRecording(recordPath);
+    }
     initGame();
-    
-    lastTime = glutGet(GLUT_ELAPSED_TIME);
+    streamer.start();
+    simulation.start();
+    profiler.enabled = true;
     
     glutDisplayFunc(display);
     glutReshapeFunc(reshape);
@@ -1212,7 +10640,12 @@ int main(int argc, char** argv) {
     glutSpecialUpFunc(specialKeysUpCallback);
     glutMouseFunc(mouse);
     glutMotionFunc(mouseMotion);
-    glutTimerFunc(16, update, 0);
+    if (framePacing == PACING_TIMER) {
+        glutTimerFunc(16, update, 0);
+    } else {
+        setSwapInterval(framePacing == PACING_VSYNC ? 1 : 0);
+        glutIdleFunc(idle);
+    }
     
     std::cout << "=== Ancient Warriors Game ===" << std::endl;
     std::cout << "Controls:" << std::endl;
@@ -1223,10 +10656,17 @@ int main(int argc, char** argv) {
     std::cout << "  0 - Free Camera (Mouse control)" << std::endl;
     std::cout << "  Z/X/C/V - Toggle animations (after collecting)" << std::endl;
     std::cout << "  B - Toggle DEBUG mode (shows collection radius)" << std::endl;
+    std::cout << "  P - Toggle frame profiler overlay" << std::endl;
+    std::cout << "  T - Export profiled frames to frame_trace.json" << std::endl;
+    std::cout << "  M - Toggle mesh cache" << std::endl;
+    std::cout << "  I - Toggle instanced collectibles" << std::endl;
+    std::cout << "  L - Toggle shader lighting" << std::endl;
+    std::cout << "  F - Toggle frustum culling / LOD" << std::endl;
     std::cout << "  R - Restart game" << std::endl;
+    std::cout << "  Q - Rewind one second" << std::endl;
     std::cout << "  ESC - Exit" << std::endl;
     std::cout << "=============================" << std::endl;
-    std::cout << "Debug log saved to: game_debug.log" << std::endl;
+    std::cout << "Debug log saved to: " << gameLogger.outputPath() << std::endl;
     std::cout << "=============================" << std::endl;
     
     glutMainLoop();